@@ -0,0 +1,132 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#if ! defined(BENCH_DWT)
+#include <time.h>
+#endif
+
+static volatile uint32_t bench_sink;
+static volatile uint32_t alloc_count;
+static volatile uint32_t alloc_bytes;
+
+/****************************************************************************************************
+// allocation counting
+ ****************************************************************************************************/
+#if __cplusplus >= 201103L
+#define BENCH_NEW_THROWS
+#else
+#define BENCH_NEW_THROWS    throw(std::bad_alloc)
+#endif
+
+void* operator new(size_t size) BENCH_NEW_THROWS
+{
+    alloc_count++;
+    alloc_bytes += size;
+    void* p = malloc(size ? size : 1);
+    if (! p)
+        abort();
+    return p;
+}
+
+void* operator new[](size_t size) BENCH_NEW_THROWS
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+    free(p);
+}
+
+/****************************************************************************************************
+// time base
+ ****************************************************************************************************/
+#if defined(BENCH_DWT)
+static uint32_t bench_ticks()
+{
+    return DWT->CYCCNT;
+}
+
+static double ticks_to_ns(uint32_t ticks)
+{
+    return ticks * (1e9 / SystemCoreClock);
+}
+#else
+static uint32_t bench_ticks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000000u + ts.tv_nsec;      // ns, wraps after ~4 s
+}
+
+static double ticks_to_ns(uint32_t ticks)
+{
+    return ticks;
+}
+#endif
+
+void bench_init()
+{
+#if defined(BENCH_DWT)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    printf("core clock %lu Hz\r\n", (unsigned long) SystemCoreClock);
+#endif
+    printf("%-20s %10s %12s %12s %10s %10s\r\n", "kernel", "ops", "ns/op", "cycles/op", "allocs/op", "bytes/op");
+}
+
+void bench_consume(uint32_t value)
+{
+    bench_sink += value;
+}
+
+void bench_consume(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bench_sink += bits;
+}
+
+void bench_run(const char* name, BenchKernel kernel)
+{
+    const double min_ns = BENCH_MIN_TIME_MS * 1e6;
+    uint32_t n = 1;
+    double ns;
+
+    // calibration, also warms up the caches and the heap
+    for (;;) {
+        uint32_t t0 = bench_ticks();
+        kernel(n);
+        ns = ticks_to_ns(bench_ticks() - t0);
+        if (ns >= min_ns / 2 || n >= 0x40000000)
+            break;
+        n *= 2;
+    }
+    if (ns > 0 && ns < min_ns)
+        n = (uint32_t) (n * (min_ns / ns));
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+    uint32_t t0 = bench_ticks();
+    kernel(n);
+    uint32_t ticks = bench_ticks() - t0;
+    uint32_t allocs = alloc_count;
+    uint32_t bytes = alloc_bytes;
+
+    ns = ticks_to_ns(ticks);
+#if defined(BENCH_DWT)
+    printf("%-20s %10lu %12.1f %12.1f %10.2f %10.1f\r\n", name, (unsigned long) n, ns / n, (double) ticks / n,
+           (double) allocs / n, (double) bytes / n);
+#else
+    printf("%-20s %10lu %12.1f %12s %10.2f %10.1f\r\n", name, (unsigned long) n, ns / n, "-",
+           (double) allocs / n, (double) bytes / n);
+#endif
+}
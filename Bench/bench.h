@@ -0,0 +1,37 @@
+/****************************************************************************************************
+ * bench.h
+ *
+ * Small benchmark harness for the hot paths of the sampling cycle, built for the Dragonfly and for
+ * Linux (Host_sim/Makefile, make bench).
+ *
+ * A kernel is a function running its operation n times.  bench_run() doubles n until one run takes
+ * at least BENCH_MIN_TIME_MS, then times a final run and prints ns/op and allocations/op.  On the
+ * target the time comes from the Cortex-M DWT cycle counter (cycles/op is printed too), on the host
+ * from clock_gettime().  Allocations are counted by the replaced global operator new, so they cover
+ * std::string, std::map and everything MbedJSONValue builds.
+ ****************************************************************************************************/
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "mbed.h"
+
+#if defined(__CORTEX_M)
+#define BENCH_DWT                       // cycle counter available
+#define BENCH_MIN_TIME_MS   50          // the 32-bit counter wraps after ~40 s at 100 MHz
+#else
+#define BENCH_MIN_TIME_MS   200
+#endif
+
+typedef void (*BenchKernel)(uint32_t n);
+
+// start the time base, prints the header line
+void bench_init();
+
+// calibrate and time one kernel, prints one result line
+void bench_run(const char* name, BenchKernel kernel);
+
+// keeps a result alive so the compiler cannot drop the work that produced it
+void bench_consume(uint32_t value);
+void bench_consume(float value);
+
+#endif
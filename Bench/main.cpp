@@ -0,0 +1,452 @@
+/****************************************************************************************************
+ * Bench/main.cpp
+ *
+ * Microbenchmarks of one Project_5 sampling cycle: the conversions of the ROHM shield readouts, the
+ * ADC scaling, the telemetry frame / compressed batch encoders and the M2X JSON bodies of the Web
+ * block, each on its own and as a whole cycle.  The inputs are raw register bytes in the ranges the
+ * sensors deliver, several variants per kernel so the lux branches and the encoder deltas vary.
+ *
+ * mbed program: main.cpp, bench.h/.cpp, the Common folder, sensor_sample.h, telemetry_codec.h/.cpp
+ * and ts_compress.h/.cpp of Project_5, and the MbedJSONValue library.  The results go to the debug
+ * port at 115200 baud.
+ *
+ * Linux: cd Host_sim && make bench && ./dragonfly_bench [kernel...]    (only the named kernels)
+ * The JSON kernels need MbedJSONValue, which only exists in the mbed program.
+ ****************************************************************************************************/
+#include "mbed.h"
+#include "bench.h"
+#include "rohm_sensors.h"
+#include "sensor_sample.h"
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <string>
+
+#if defined(BENCH_DWT)
+#define MbedJSON        // JSON kernels
+#endif
+
+#ifdef MbedJSON
+#include "MbedJSONValue.h"
+#endif
+
+#define BENCH_INPUTS    8               // input variants per kernel, power of two
+#define BENCH_BATCH     16              // samples per upload batch, as upload_batch_samples in main.cpp
+
+/****************************************************************************************************
+// inputs
+ ****************************************************************************************************/
+static uint8_t raw_rpr0521[BENCH_INPUTS][Rpr0521::raw_len];
+static uint8_t raw_kmx62[BENCH_INPUTS][Kmx62::raw_len];
+static uint8_t raw_bh1745[BENCH_INPUTS][Bh1745::raw_len];
+static uint8_t raw_kx022[BENCH_INPUTS][Kx022::raw_len];
+static uint8_t raw_bm1383[BENCH_INPUTS][Bm1383::raw_len];
+static uint16_t adc_temp[BENCH_INPUTS];
+static uint16_t adc_uv[BENCH_INPUTS];
+static SensorSample samples[BENCH_INPUTS];
+
+static uint32_t lcg_state = 12345;
+
+static int noise(int amplitude)
+{
+    lcg_state = lcg_state * 1103515245 + 12345;
+    return (int) ((lcg_state >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static void put_le16(uint8_t* p, int value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static void FillSample (SensorSample& sample, int i);
+
+static void make_inputs()
+{
+    for (int i = 0; i < BENCH_INPUTS; i++) {
+        // ALS DATA1/DATA0 ratios across all four branches of the lux formula
+        static const int als1[4] = { 100, 300, 480, 900 };
+        put_le16(raw_rpr0521[i] + 0, 40 + noise(20));
+        put_le16(raw_rpr0521[i] + 2, 400 + noise(10));
+        put_le16(raw_rpr0521[i] + 4, als1[i % 4] + noise(10));
+
+        // at rest, 1 g on z, earth field
+        put_le16(raw_kmx62[i] + 0, noise(200));
+        put_le16(raw_kmx62[i] + 2, noise(200));
+        put_le16(raw_kmx62[i] + 4, 8192 + noise(200));
+        put_le16(raw_kmx62[i] + 6, 600 + noise(40));
+        put_le16(raw_kmx62[i] + 8, -250 + noise(40));
+        put_le16(raw_kmx62[i] + 10, 1100 + noise(40));
+
+        for (int c = 0; c < 3; c++)
+            put_le16(raw_bh1745[i] + 2 * c, 800 + 300 * c + noise(100));
+
+        put_le16(raw_kx022[i] + 0, noise(300));
+        put_le16(raw_kx022[i] + 2, noise(300));
+        put_le16(raw_kx022[i] + 4, 16384 + noise(300));
+
+        int temp = 25 * 32 + noise(16);                             // 1/32 C, big endian
+        uint32_t press = (uint32_t) ((1013.25f + noise(50) * 0.01f) * 2048) << 2;
+        raw_bm1383[i][0] = temp >> 8;
+        raw_bm1383[i][1] = temp & 0xFF;
+        raw_bm1383[i][2] = press >> 16;
+        raw_bm1383[i][3] = press >> 8;
+        raw_bm1383[i][4] = press & 0xFC;
+
+        adc_temp[i] = 33000 + noise(50);
+        adc_uv[i] = 44000 + noise(50);
+    }
+    for (int i = 0; i < BENCH_INPUTS; i++) {
+        FillSample(samples[i], i);
+        samples[i].timestamp = 1500000000 + i;
+        samples[i].millis = 250 + i;
+    }
+}
+
+/****************************************************************************************************
+// conversions, as done by sensor_sampler.cpp after each read
+ ****************************************************************************************************/
+static float adc_temp_c(uint16_t value)
+{
+    float v = (float) value * (float) 0.000050354;
+    return (v - (float) 1.753) / ((float) -0.01068) + (float) 30;
+}
+
+static float adc_uv_index(uint16_t value)
+{
+    float v = (float) value * (float) 0.000050354;
+    return (v - (float) 2.2) / ((float) 0.129) + 10;
+}
+
+// raw inputs i -> record, the channel mapping of FillSample()/SampleChannel in sensor_sampler.cpp
+static void FillSample (SensorSample& sample, int i)
+{
+    RohmReading<Rpr0521> light;
+    RohmReading<Kmx62> motion;
+    RohmReading<Bh1745> color;
+    RohmReading<Kx022> accel;
+    RohmReading<Bm1383> pressure;
+
+    rohm_convert<Rpr0521>(raw_rpr0521[i], light);
+    rohm_convert<Kmx62>(raw_kmx62[i], motion);
+    rohm_convert<Bh1745>(raw_bh1745[i], color);
+    rohm_convert<Kx022>(raw_kx022[i], accel);
+    rohm_convert<Bm1383>(raw_bm1383[i], pressure);
+
+    memset(&sample.temp_c, 0, sizeof(SensorSample) - offsetof(SensorSample, temp_c));
+    sample.flags = SAMPLE_THPM | SAMPLE_MOTION;
+    sample.temp_c = adc_temp_c(adc_temp[i]);
+    sample.uv = adc_uv_index(adc_uv[i]);
+    sample.ambient_light = light.lux;
+    sample.proximity = light.proximity;
+    for (int c = 0; c < 3; c++) {
+        sample.color[c] = color.rgb[c];
+        sample.mems_accel[c] = motion.accel[c];
+        sample.mems_mag[c] = motion.mag[c];
+        sample.kx022_accel[c] = accel.accel[c];
+    }
+    sample.bm1383_temp = pressure.temp_c;
+    sample.pressure_hpa = pressure.pressure_hpa;
+}
+
+/****************************************************************************************************
+// M2X JSON bodies, as post_latest() and JournalUplink::upload() in Project_5
+ ****************************************************************************************************/
+#ifdef MbedJSON
+struct UploadStream {
+    const char* name;
+    uint16_t    group;
+    float       (*value)(const SensorSample& sample);
+};
+static float stream_temp_c (const SensorSample& sample) { return sample.temp_c; }
+static float stream_uv (const SensorSample& sample) { return sample.uv; }
+static float stream_amb_light (const SensorSample& sample) { return sample.ambient_light; }
+static float stream_prox (const SensorSample& sample) { return sample.proximity; }
+static const UploadStream upload_streams[] = {
+    { "temp_c",     SAMPLE_TEMP,    stream_temp_c },
+    { "uv",         SAMPLE_UV,      stream_uv },
+    { "amb_light",  SAMPLE_LIGHT,   stream_amb_light },
+    { "prox",       SAMPLE_LIGHT,   stream_prox },
+};
+static const int upload_stream_count = sizeof(upload_streams) / sizeof(upload_streams[0]);
+
+static uint32_t json_latest(const SensorSample& latest)
+{
+    MbedJSONValue http_json_data;
+    std::string http_json_str;
+
+    for (int i = 0; i < upload_stream_count; i++)
+        http_json_data["values"][upload_streams[i].name] = upload_streams[i].value(latest);
+    http_json_str = http_json_data.serialize();
+    return http_json_str.size();
+}
+
+static uint32_t json_batch(const SensorSample* batch, int n)
+{
+    char timestamp[32];
+    MbedJSONValue http_json_data;
+
+    for (int i = 0; i < upload_stream_count; i++) {
+        const UploadStream& stream = upload_streams[i];
+        int k = 0;
+        for (int j = 0; j < n; j++) {
+            const SensorSample& sample = batch[j];
+            if (! (sample.flags & stream.group))
+                continue;
+            time_t t = sample.timestamp;
+            struct tm* tm = gmtime(&t);
+            snprintf(timestamp, sizeof(timestamp), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+                     tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, sample.millis);
+            http_json_data["values"][stream.name][k]["timestamp"] = timestamp;
+            http_json_data["values"][stream.name][k]["value"] = stream.value(sample);
+            k++;
+        }
+    }
+    std::string http_json_str = http_json_data.serialize();
+    return http_json_str.size();
+}
+#endif
+
+/****************************************************************************************************
+// kernels
+ ****************************************************************************************************/
+static void bench_rpr0521(uint32_t n)
+{
+    RohmReading<Rpr0521> v;
+    float sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        rohm_convert<Rpr0521>(raw_rpr0521[i % BENCH_INPUTS], v);
+        sum += v.lux;
+    }
+    bench_consume(sum);
+}
+
+static void bench_bm1383(uint32_t n)
+{
+    RohmReading<Bm1383> v;
+    float sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        rohm_convert<Bm1383>(raw_bm1383[i % BENCH_INPUTS], v);
+        sum += v.temp_c + v.pressure_hpa;
+    }
+    bench_consume(sum);
+}
+
+static void bench_kmx62(uint32_t n)
+{
+    RohmReading<Kmx62> v;
+    float sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        rohm_convert<Kmx62>(raw_kmx62[i % BENCH_INPUTS], v);
+        sum += v.accel[0] + v.accel[1] + v.accel[2] + v.mag[0] + v.mag[1] + v.mag[2];
+    }
+    bench_consume(sum);
+}
+
+static void bench_kx022(uint32_t n)
+{
+    RohmReading<Kx022> v;
+    float sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        rohm_convert<Kx022>(raw_kx022[i % BENCH_INPUTS], v);
+        sum += v.accel[0] + v.accel[1] + v.accel[2];
+    }
+    bench_consume(sum);
+}
+
+static void bench_bh1745(uint32_t n)
+{
+    RohmReading<Bh1745> v;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        rohm_convert<Bh1745>(raw_bh1745[i % BENCH_INPUTS], v);
+        sum += v.rgb[0] + v.rgb[1] + v.rgb[2];
+    }
+    bench_consume(sum);
+}
+
+static void bench_adc(uint32_t n)
+{
+    float sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+        sum += adc_temp_c(adc_temp[i % BENCH_INPUTS]) + adc_uv_index(adc_uv[i % BENCH_INPUTS]);
+    bench_consume(sum);
+}
+
+static void bench_fill_sample(uint32_t n)
+{
+    SensorSample sample;
+    float sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        FillSample(sample, i % BENCH_INPUTS);
+        sum += sample.ambient_light + sample.pressure_hpa;
+    }
+    bench_consume(sum);
+}
+
+static void bench_frame(uint32_t n)
+{
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+        sum += telemetry_encode(samples[i % BENCH_INPUTS], frame, sizeof(frame)) + frame[TELEMETRY_HEADER_SIZE];
+    bench_consume(sum);
+}
+
+// the SMS text of the BinaryTelemetry build
+static void bench_sms_frame(uint32_t n)
+{
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    char sms_text[(TELEMETRY_MAX_FRAME + 2) / 3 * 4 + 8] = "DF1:";
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        int frame_len = telemetry_encode(samples[i % BENCH_INPUTS], frame, sizeof(frame));
+        sum += telemetry_base64_encode(frame, frame_len, sms_text + 4, sizeof(sms_text) - 4) + sms_text[8];
+    }
+    bench_consume(sum);
+}
+
+// one op is one sample appended to a batch block
+static void bench_compress(uint32_t n)
+{
+    static uint8_t block[BENCH_BATCH * TELEMETRY_MAX_FRAME];
+    TsCompressor compressor;
+    SensorSample sample;
+    uint32_t sum = 0;
+
+    compressor.begin(block, sizeof(block));
+    for (uint32_t i = 0; i < n; i++) {
+        sample = samples[i % BENCH_INPUTS];
+        sample.timestamp += i;
+        if (compressor.count() == BENCH_BATCH || ! compressor.add(sample)) {
+            sum += compressor.finish();
+            compressor.begin(block, sizeof(block));
+            compressor.add(sample);
+        }
+    }
+    bench_consume(sum + compressor.finish());
+}
+
+#ifdef MbedJSON
+static void bench_json_latest(uint32_t n)
+{
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+        sum += json_latest(samples[i % BENCH_INPUTS]);
+    bench_consume(sum);
+}
+
+// one op is one batch of BENCH_BATCH samples
+static void bench_json_batch(uint32_t n)
+{
+    static SensorSample batch[BENCH_BATCH];
+    uint32_t sum = 0;
+    for (int j = 0; j < BENCH_BATCH; j++)
+        batch[j] = samples[j % BENCH_INPUTS];
+    for (uint32_t i = 0; i < n; i++) {
+        batch[0].timestamp = 1500000000 + i;
+        sum += json_batch(batch, BENCH_BATCH);
+    }
+    bench_consume(sum);
+}
+#endif
+
+// whole cycle of the default build: convert every sensor, fill the record, frame and batch it
+static void bench_cycle(uint32_t n)
+{
+    static uint8_t block[BENCH_BATCH * TELEMETRY_MAX_FRAME];
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    TsCompressor compressor;
+    SensorSample sample;
+    uint32_t sum = 0;
+
+    compressor.begin(block, sizeof(block));
+    for (uint32_t i = 0; i < n; i++) {
+        FillSample(sample, i % BENCH_INPUTS);
+        sample.timestamp = 1500000000 + i;
+        sample.millis = 250;
+        sum += telemetry_encode(sample, frame, sizeof(frame));
+        if (compressor.count() == BENCH_BATCH || ! compressor.add(sample)) {
+            sum += compressor.finish();
+            compressor.begin(block, sizeof(block));
+            compressor.add(sample);
+        }
+    }
+    bench_consume(sum + compressor.finish());
+}
+
+#ifdef MbedJSON
+// whole cycle of the JSON build: convert every sensor, fill the record, post body of the Web block
+static void bench_cycle_json(uint32_t n)
+{
+    SensorSample sample;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        FillSample(sample, i % BENCH_INPUTS);
+        sum += json_latest(sample);
+    }
+    bench_consume(sum);
+}
+#endif
+
+struct BenchEntry {
+    const char* name;
+    BenchKernel kernel;
+};
+static const BenchEntry kernels[] = {
+    { "rpr0521_lux",    bench_rpr0521 },
+    { "bm1383_unpack",  bench_bm1383 },
+    { "kmx62_scale",    bench_kmx62 },
+    { "kx022_scale",    bench_kx022 },
+    { "bh1745_unpack",  bench_bh1745 },
+    { "adc_scale",      bench_adc },
+    { "fill_sample",    bench_fill_sample },
+    { "telemetry_frame", bench_frame },
+    { "sms_frame",      bench_sms_frame },
+    { "compress_sample", bench_compress },
+#ifdef MbedJSON
+    { "json_latest",    bench_json_latest },
+    { "json_batch16",   bench_json_batch },
+#endif
+    { "cycle",          bench_cycle },
+#ifdef MbedJSON
+    { "cycle_json",     bench_cycle_json },
+#endif
+};
+static const int kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+
+/****************************************************************************************************
+// main
+ ****************************************************************************************************/
+#if defined(BENCH_DWT)
+static Serial debug(USBTX, USBRX);
+
+int main()
+{
+    debug.baud(115200);
+    make_inputs();
+    bench_init();
+    for (int i = 0; i < kernel_count; i++)
+        bench_run(kernels[i].name, kernels[i].kernel);
+    printf("done\r\n");
+    while (true)
+        wait(1);
+}
+#else
+int main(int argc, char** argv)
+{
+    make_inputs();
+    bench_init();
+    for (int i = 0; i < kernel_count; i++) {
+        bool selected = argc < 2;
+        for (int a = 1; a < argc; a++)
+            selected |= strcmp(argv[a], kernels[i].name) == 0;
+        if (selected)
+            bench_run(kernels[i].name, kernels[i].kernel);
+    }
+    return 0;
+}
+#endif
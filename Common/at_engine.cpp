@@ -0,0 +1,258 @@
+#include "at_engine.h"
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#define AT_CTRL_Z       0x1A
+#define AT_ESC          0x1B
+
+// after a timeout: a query whose answer line cannot be a late answer of the timed-out command, the
+// modem runs commands in order, so whatever that command still sends comes before it
+#define AT_PROBE        "AT+CMEE?"
+#define AT_PROBE_ANSWER "+CMEE:"
+#define AT_PROBE_MS     1000
+
+static bool starts_with(const char* line, int len, const char* prefix)
+{
+    int n = strlen(prefix);
+    return len >= n && strncmp(line, prefix, n) == 0;
+}
+
+AtEngine::AtEngine(MTSBufferedIO* io)
+    : commands(0), timeouts(0), errors(0), urcs(0), unhandled(0), overlong(0), io(io), head(0), count(0),
+      running(false), prompt(false), sms_text(false), resync(false), probe_answered(false), urc_count(0),
+      urc_active(NULL), urc_lines(0), line_len(0), line_overlong(false)
+{
+    timer.start();
+}
+
+bool AtEngine::submit(const char* command, AtDoneHandler done, AtLineHandler line, void* arg, int timeout_ms,
+                      const char* payload)
+{
+    if (count == AT_QUEUE_DEPTH || strlen(command) >= AT_MAX_COMMAND)
+        return false;
+    Command& cmd = queue[(head + count) % AT_QUEUE_DEPTH];
+    strcpy(cmd.text, command);
+    cmd.payload = payload;
+    cmd.timeout_ms = timeout_ms;
+    cmd.done = done;
+    cmd.line = line;
+    cmd.arg = arg;
+    count++;
+    if (! running && ! resync)
+        sendNext();
+    return true;
+}
+
+bool AtEngine::onUrc(const char* prefix, AtLineHandler handler, void* arg, int extra_lines)
+{
+    if (urc_count == AT_MAX_URCS)
+        return false;
+    Urc& urc = urc_table[urc_count++];
+    urc.prefix = prefix;
+    urc.prefix_len = strlen(prefix);
+    urc.extra_lines = extra_lines;
+    urc.handler = handler;
+    urc.arg = arg;
+    return true;
+}
+
+int AtEngine::pending()
+{
+    return count;
+}
+
+void AtEngine::poll()
+{
+    char c;
+    while (io->readable() && io->read(c) == 1)
+        feed(c);
+    if (running && timer.read_ms() > queue[head].timeout_ms) {
+        timeouts++;
+        // a modem left waiting for the SMS text would take the next command as that text
+        if (prompt)
+            io->write((char) AT_ESC);
+        // its answer may still come, the next command only goes out once the probe is answered
+        sendProbe();
+        complete(AT_TIMEOUT, -1);
+    } else if (resync && timer.read_ms() > AT_PROBE_MS) {
+        sendProbe();
+    }
+}
+
+/****************************************************************************************************
+// response parser
+ ****************************************************************************************************/
+void AtEngine::feed(char c)
+{
+    if (c == '\r' || c == '\n') {
+        if (line_overlong)
+            overlong++;
+        else if (line_len)
+            dispatch();
+        else if (c == '\r')
+            sms_text = false;               // empty message text
+        line_len = 0;
+        line_overlong = false;
+        return;
+    }
+    if (line_len == AT_MAX_LINE) {
+        line_overlong = true;
+        return;
+    }
+    line[line_len++] = c;
+
+    // the SMS prompt has no line end
+    if (prompt && line_len == 2 && line[0] == '>' && line[1] == ' ') {
+        const Command& cmd = queue[head];
+        io->write(cmd.payload, strlen(cmd.payload));
+        io->write((char) AT_CTRL_Z);
+        prompt = false;
+        line_len = 0;
+    }
+}
+
+void AtEngine::dispatch()
+{
+    line[line_len] = '\0';
+
+    if (urc_active) {
+        const Urc* urc = urc_active;
+        if (--urc_lines == 0)
+            urc_active = NULL;
+        urc->handler(line, line_len, urc->arg);
+        return;
+    }
+
+    if (running) {
+        const Command& cmd = queue[head];
+        AtResult result;
+        int error;
+        if (sms_text) {
+            // the line after a +CMGR:/+CMGL: header is the message, even one that reads "OK"
+            sms_text = false;
+            if (cmd.line)
+                cmd.line(line, line_len, cmd.arg);
+            return;
+        }
+        if (finalResult(result, error)) {
+            complete(result, error);
+            return;
+        }
+        if (strcasecmp(line, cmd.text) == 0)
+            return;                         // echo, when ATE0 was not given
+        if (answers(cmd)) {
+            sms_text = starts_with(line, line_len, "+CMGR:") || starts_with(line, line_len, "+CMGL:");
+            if (cmd.line)
+                cmd.line(line, line_len, cmd.arg);
+            return;
+        }
+    }
+
+    for (int i = 0; i < urc_count; i++) {
+        const Urc& urc = urc_table[i];
+        if (line_len >= urc.prefix_len && strncmp(line, urc.prefix, urc.prefix_len) == 0) {
+            urcs++;
+            if (urc.extra_lines) {
+                urc_active = &urc;
+                urc_lines = urc.extra_lines;
+            }
+            urc.handler(line, line_len, urc.arg);
+            return;
+        }
+    }
+
+    // late lines of a timed-out command are dropped up to the final result of the probe
+    if (resync) {
+        AtResult result;
+        int error;
+        if (starts_with(line, line_len, AT_PROBE_ANSWER)) {
+            probe_answered = true;
+        } else if (probe_answered && finalResult(result, error)) {
+            resync = false;
+            if (count)
+                sendNext();
+        }
+        return;
+    }
+
+    // lines without a known prefix while a command runs are its response (+CMGR text, ATI)
+    if (running && queue[head].line) {
+        queue[head].line(line, line_len, queue[head].arg);
+        return;
+    }
+    unhandled++;
+}
+
+bool AtEngine::finalResult(AtResult& result, int& error)
+{
+    error = -1;
+    if (strcmp(line, "OK") == 0) {
+        result = AT_OK;
+    } else if (strcmp(line, "ERROR") == 0) {
+        result = AT_ERROR;
+    } else if (starts_with(line, line_len, "+CME ERROR:") || starts_with(line, line_len, "+CMS ERROR:")) {
+        result = AT_ERROR;
+        error = atoi(line + 11);
+    } else if (starts_with(line, line_len, "CONNECT")) {
+        result = AT_CONNECT;
+    } else if (strcmp(line, "NO CARRIER") == 0 || strcmp(line, "BUSY") == 0 || strcmp(line, "NO ANSWER") == 0 ||
+               strcmp(line, "NO DIALTONE") == 0) {
+        result = AT_NO_CARRIER;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// "+CSQ: 17,99" answers "AT+CSQ", "+CMGR: ..." answers "AT+CMGR=3": same name up to '=' or '?'
+bool AtEngine::answers(const Command& cmd)
+{
+    const char* name = cmd.text + 2;
+    int n = strcspn(name, "=?");
+    if (n == 0 || (name[0] != '+' && name[0] != '#'))
+        return false;
+    return line_len > n && strncmp(line, name, n) == 0 && line[n] == ':';
+}
+
+/****************************************************************************************************
+// queue
+ ****************************************************************************************************/
+void AtEngine::complete(AtResult result, int error)
+{
+    Command& cmd = queue[head];
+    AtDoneHandler done = cmd.done;
+    void* arg = cmd.arg;
+    head = (head + 1) % AT_QUEUE_DEPTH;
+    count--;
+    running = false;
+    prompt = false;
+    sms_text = false;
+    if (result == AT_ERROR)
+        errors++;
+
+    // the handler may submit the next command itself
+    if (done)
+        done(result, error, arg);
+    if (! running && ! resync && count)
+        sendNext();
+}
+
+void AtEngine::sendNext()
+{
+    Command& cmd = queue[head];
+    io->write(cmd.text, strlen(cmd.text));
+    io->write('\r');
+    commands++;
+    running = true;
+    prompt = cmd.payload != NULL;
+    timer.reset();
+}
+
+void AtEngine::sendProbe()
+{
+    io->write(AT_PROBE "\r", sizeof(AT_PROBE));
+    resync = true;
+    probe_answered = false;
+    timer.reset();
+}
@@ -0,0 +1,124 @@
+/****************************************************************************************************
+ * at_engine.h
+ *
+ * Non-blocking AT command layer for the Dragonfly's Telit radio, shared by Project_3 and Project_5
+ * (add this folder to the program).
+ *
+ * The mtsas Cellular calls (sendSMS, getReceivedSms, setApn, sendCommand) write a command and spin
+ * on the serial buffer until the modem answers, so the calling thread is stuck for as long as the
+ * modem takes, and an unsolicited result code (+CMTI, +CREG, ...) is only seen when a later
+ * command happens to read it.  AtEngine queues commands instead: submit() returns at once, and
+ * poll(), called from the owner's loop, reads whatever arrived, hands response lines to the
+ * command's handlers and sends the next command as soon as the previous one has its final result.
+ * Every command has its own timeout.  Lines that do not belong to the running command are matched
+ * against the registered URC prefixes and dispatched to their handlers.
+ *
+ * The parser works byte by byte on one line buffer: handlers get a pointer into it, valid until
+ * they return, and nothing is allocated.  A command with a payload (AT+CMGS) sends it with Ctrl-Z
+ * when the modem's "> " prompt arrives, or cancels it with ESC when it times out first.  The line
+ * after a +CMGR:/+CMGL: header goes to the command as message text without being taken for a
+ * final result code or a URC.  After a timeout the engine sends AT+CMEE? and drops everything but
+ * URCs until its answer, so a late OK or +CMGS: of the timed-out command cannot complete the next
+ * one.
+ *
+ * The engine owns its serial link: it must not share it with a Cellular object (use a CMUX
+ * channel, see Project_5's cmux.h).  submit(), onUrc() and poll() belong to one thread.
+ ****************************************************************************************************/
+#ifndef AT_ENGINE_H
+#define AT_ENGINE_H
+
+#include "mbed.h"
+#include "mtsas.h"
+
+#define AT_QUEUE_DEPTH          8
+#define AT_MAX_COMMAND          64
+#define AT_MAX_LINE             200
+#define AT_MAX_URCS             8
+
+enum AtResult {
+    AT_OK,
+    AT_ERROR,                   // ERROR, or +CME/+CMS ERROR with the code in error
+    AT_CONNECT,                 // the link is in data mode now
+    AT_NO_CARRIER,              // NO CARRIER, BUSY, NO ANSWER, NO DIALTONE
+    AT_TIMEOUT
+};
+
+// a response or URC line, without its line end; valid until the handler returns
+typedef void (*AtLineHandler)(const char* line, int len, void* arg);
+// final result of a command; error is the +CME/+CMS ERROR code, -1 otherwise
+typedef void (*AtDoneHandler)(AtResult result, int error, void* arg);
+
+class AtEngine
+{
+public:
+    AtEngine(MTSBufferedIO* io);
+
+    // queue a command line ("AT+CSQ"), the payload (not copied) follows the "> " prompt;
+    // false when the queue is full or the command too long
+    bool submit(const char* command, AtDoneHandler done = NULL, AtLineHandler line = NULL, void* arg = NULL,
+                int timeout_ms = 1000, const char* payload = NULL);
+
+    // lines starting with prefix ("+CMTI:") outside a command's response, and the extra_lines after them
+    bool onUrc(const char* prefix, AtLineHandler handler, void* arg = NULL, int extra_lines = 0);
+
+    // read what arrived, dispatch, time out and send; never waits
+    void poll();
+
+    // commands queued or running
+    int pending();
+
+    uint32_t    commands;
+    uint32_t    timeouts;
+    uint32_t    errors;
+    uint32_t    urcs;
+    uint32_t    unhandled;      // lines nobody claimed
+    uint32_t    overlong;       // lines longer than AT_MAX_LINE, dropped
+
+private:
+    struct Command {
+        char            text[AT_MAX_COMMAND];
+        const char*     payload;
+        int             timeout_ms;
+        AtDoneHandler   done;
+        AtLineHandler   line;
+        void*           arg;
+    };
+
+    struct Urc {
+        const char*     prefix;
+        int             prefix_len;
+        int             extra_lines;
+        AtLineHandler   handler;
+        void*           arg;
+    };
+
+    void feed(char c);
+    void dispatch();
+    bool finalResult(AtResult& result, int& error);
+    bool answers(const Command& cmd);
+    void complete(AtResult result, int error);
+    void sendNext();
+    void sendProbe();
+
+    MTSBufferedIO*  io;
+    Command         queue[AT_QUEUE_DEPTH];
+    int             head;           // next to run
+    int             count;
+    bool            running;        // queue[head] is on the wire
+    bool            prompt;         // queue[head] waits for "> "
+    bool            sms_text;       // the next line is the text of a +CMGR/+CMGL message
+    bool            resync;         // a command timed out, waiting for the probe's answer
+    bool            probe_answered; // its +CMEE: line came, the next final result is its own
+    Timer           timer;          // since queue[head] or the probe was sent
+
+    Urc             urc_table[AT_MAX_URCS];
+    int             urc_count;
+    const Urc*      urc_active;     // collecting extra lines
+    int             urc_lines;
+
+    char            line[AT_MAX_LINE + 1];
+    int             line_len;
+    bool            line_overlong;
+};
+
+#endif
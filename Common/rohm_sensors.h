@@ -0,0 +1,337 @@
+/****************************************************************************************************
+ * rohm_sensors.h
+ *
+ * Header-only drivers for the I2C chips of the ROHM Multi-sensor Shield, shared by Project_4 and
+ * Project_5 (add this folder to the program, the projects include the header by name).
+ *
+ * Every chip is a type: its bus address, init register sequence and readout register blocks are
+ * constant tables (static const data, kept in flash), and the conversion from the raw readout
+ * bytes to engineering units is a specialization of rohm_convert<Chip>().  RohmSensor<Chip> is the
+ * generic driver, and a program lists the chips it uses in a SensorSet type:
+ *
+ *      typedef SensorSet<Rpr0521, SensorSet<Kx022, SensorSet<Bm1383> > > Shield;
+ *      Shield shield;
+ *      shield.initAll(i2c);
+ *      shield.readAll(i2c);
+ *      float g = rohm_sensor<Kx022>(shield).value.accel[2];
+ *
+ * Only the drivers named in the set are instantiated, so a chip left out costs no flash or RAM.
+ * The code stays within C++03 for the mbed online compiler: the tables are static const arrays
+ * returned by inline functions instead of constexpr members.
+ ****************************************************************************************************/
+#ifndef ROHM_SENSORS_H
+#define ROHM_SENSORS_H
+
+#include "mbed.h"
+#include <string.h>
+
+struct RegWrite {
+    uint8_t     reg;
+    uint8_t     value;
+};
+
+struct RegBlock {
+    uint8_t     reg;                // first register, read with auto-increment
+    uint8_t     len;
+};
+
+// engineering values of a chip, specialised per chip
+template<typename Chip> struct RohmReading;
+
+// raw readout bytes (all blocks back to back) -> engineering values, specialised per chip
+template<typename Chip> void rohm_convert(const uint8_t* raw, RohmReading<Chip>& value);
+
+static inline int16_t rohm_le16(const uint8_t* p)
+{
+    return (int16_t) (p[0] | (p[1] << 8));
+}
+
+/****************************************************************************************************
+// chips
+ ****************************************************************************************************/
+
+// RPR-0521RS ambient light / proximity
+struct Rpr0521 {
+    enum { address = 0x38 << 1, init_count = 3, block_count = 1, raw_len = 6 };
+    static const char* name() { return "RPR0521"; }
+    static const RegWrite* init()
+    {
+        static const RegWrite seq[init_count] = {
+            { 0x41, 0xE6 },             // MODE_CONTROL: ALS and PS on, 100 ms
+            { 0x42, 0x03 },             // ALS_PS_CONTROL: LED 100 mA
+            { 0x43, 0x20 },             // PERSIST
+        };
+        return seq;
+    }
+    static const RegBlock* blocks()
+    {
+        static const RegBlock b[block_count] = { { 0x44, 6 } };    // PS, ALS DATA0, ALS DATA1
+        return b;
+    }
+};
+
+template<> struct RohmReading<Rpr0521> {
+    float       lux;
+    uint16_t    proximity;          // ADC counts
+    uint16_t    als_data0;
+    uint16_t    als_data1;
+};
+
+template<> inline void rohm_convert<Rpr0521>(const uint8_t* raw, RohmReading<Rpr0521>& v)
+{
+    v.proximity = raw[0] | (raw[1] << 8);
+    v.als_data0 = raw[2] | (raw[3] << 8);
+    v.als_data1 = raw[4] | (raw[5] << 8);
+
+    float d0 = v.als_data0;
+    float d1 = v.als_data1;
+    float ratio = d1 / d0;
+    if (ratio < 0.595f)
+        v.lux = 1.682f * d0 - 1.877f * d1;
+    else if (ratio < 1.015f)
+        v.lux = 0.644f * d0 - 0.132f * d1;
+    else if (ratio < 1.352f)
+        v.lux = 0.756f * d0 - 0.243f * d1;
+    else if (ratio < 3.053f)
+        v.lux = 0.766f * d0 - 0.25f * d1;
+    else
+        v.lux = 0;
+}
+
+// KMX62 accelerometer / magnetometer
+// The accel and mag outputs are adjacent, so one 12 byte burst reads a coherent pair.  Define
+// KMX62_SPLIT_READOUT for the old separate accel and mag reads (to compare the bus time).
+struct Kmx62 {
+#ifdef KMX62_SPLIT_READOUT
+    enum { address = 0x0E << 1, init_count = 1, block_count = 2, raw_len = 12 };
+#else
+    enum { address = 0x0E << 1, init_count = 1, block_count = 1, raw_len = 12 };
+#endif
+    static const char* name() { return "KMX62"; }
+    static const RegWrite* init()
+    {
+        static const RegWrite seq[init_count] = {
+            { 0x3A, 0x5F },             // CNTL2: accel and mag on, +-2 g
+        };
+        return seq;
+    }
+    static const RegBlock* blocks()
+    {
+#ifdef KMX62_SPLIT_READOUT
+        static const RegBlock b[block_count] = {
+            { 0x0A, 6 },                // ACCEL_XOUT_L..ACCEL_ZOUT_H
+            { 0x10, 6 },                // MAG_XOUT_L..MAG_ZOUT_H
+        };
+#else
+        static const RegBlock b[block_count] = { { 0x0A, 12 } };   // ACCEL_XOUT_L..MAG_ZOUT_H
+#endif
+        return b;
+    }
+};
+
+template<> struct RohmReading<Kmx62> {
+    float       accel[3];           // g
+    float       mag[3];             // uT
+};
+
+template<> inline void rohm_convert<Kmx62>(const uint8_t* raw, RohmReading<Kmx62>& v)
+{
+    // 14 bit values left aligned in 16 bits, so the full word is scaled and the LSBs cancel out
+    for (int i = 0; i < 3; i++) {
+        v.accel[i] = (float) rohm_le16(raw + 2 * i) / 8192;
+        v.mag[i] = (float) rohm_le16(raw + 6 + 2 * i) / 4096 * 0.146f;
+    }
+}
+
+// BH1745NUC color
+struct Bh1745 {
+    enum { address = 0x39 << 1, init_count = 4, block_count = 1, raw_len = 6 };
+    static const char* name() { return "BH1745"; }
+    static const RegWrite* init()
+    {
+        static const RegWrite seq[init_count] = {
+            { 0x61, 0x03 },             // PERSISTENCE
+            { 0x41, 0x00 },             // MODE_CONTROL1: 160 ms
+            { 0x42, 0x92 },             // MODE_CONTROL2: RGBC on, gain x1
+            { 0x43, 0x02 },             // MODE_CONTROL3
+        };
+        return seq;
+    }
+    static const RegBlock* blocks()
+    {
+        static const RegBlock b[block_count] = { { 0x50, 6 } };    // RED, GREEN, BLUE
+        return b;
+    }
+};
+
+template<> struct RohmReading<Bh1745> {
+    uint16_t    rgb[3];             // ADC counts
+};
+
+template<> inline void rohm_convert<Bh1745>(const uint8_t* raw, RohmReading<Bh1745>& v)
+{
+    for (int i = 0; i < 3; i++)
+        v.rgb[i] = raw[2 * i] | (raw[2 * i + 1] << 8);
+}
+
+// KX022-1020 accelerometer
+struct Kx022 {
+    enum { address = 0x1E << 1, init_count = 5, block_count = 1, raw_len = 6 };
+    static const char* name() { return "KX022"; }
+    static const RegWrite* init()
+    {
+        static const RegWrite seq[init_count] = {
+            { 0x18, 0x41 },             // CNTL1: stand-by, high resolution, tilt on
+            { 0x1B, 0x02 },             // ODCNTL: 50 Hz
+            { 0x1A, 0xD8 },             // CNTL3
+            { 0x22, 0x01 },             // TILT_TIMER
+            { 0x18, 0xC1 },             // CNTL1: operating
+        };
+        return seq;
+    }
+    static const RegBlock* blocks()
+    {
+        static const RegBlock b[block_count] = { { 0x06, 6 } };    // XOUT_L..ZOUT_H
+        return b;
+    }
+};
+
+template<> struct RohmReading<Kx022> {
+    float       accel[3];           // g
+};
+
+template<> inline void rohm_convert<Kx022>(const uint8_t* raw, RohmReading<Kx022>& v)
+{
+    for (int i = 0; i < 3; i++)
+        v.accel[i] = (float) rohm_le16(raw + 2 * i) / 16384;
+}
+
+// BM1383GLV pressure
+struct Bm1383 {
+    enum { address = 0x5D << 1, init_count = 3, block_count = 1, raw_len = 5 };
+    static const char* name() { return "BM1383"; }
+    static const RegWrite* init()
+    {
+        static const RegWrite seq[init_count] = {
+            { 0x12, 0x01 },             // POWER_DOWN: power up
+            { 0x13, 0x01 },             // SLEEP: active
+            { 0x14, 0xC4 },             // MODE_CONTROL: 64 times average, continuous
+        };
+        return seq;
+    }
+    static const RegBlock* blocks()
+    {
+        static const RegBlock b[block_count] = { { 0x1A, 5 } };    // TEMPS_OUT (big endian), PRESS_OUT
+        return b;
+    }
+};
+
+template<> struct RohmReading<Bm1383> {
+    float       temp_c;
+    float       pressure_hpa;
+};
+
+template<> inline void rohm_convert<Bm1383>(const uint8_t* raw, RohmReading<Bm1383>& v)
+{
+    v.temp_c = (float) (int16_t) ((raw[0] << 8) | raw[1]) / 32;
+    // PRESS_OUT is 22 bits of hPa in 11.11 fixed point
+    uint32_t press = ((uint32_t) raw[2] << 14) | (raw[3] << 6) | (raw[4] >> 2);
+    v.pressure_hpa = (float) press / 2048;
+}
+
+/****************************************************************************************************
+// generic driver
+ ****************************************************************************************************/
+template<typename Chip>
+class RohmSensor
+{
+public:
+    RohmReading<Chip>   value;              // last successful reading
+    uint8_t             raw[Chip::raw_len]; // its raw readout bytes
+
+    RohmSensor()
+    {
+        memset(&value, 0, sizeof(value));
+        memset(raw, 0, sizeof(raw));
+    }
+
+    // write the init sequence, returns false if the chip did not acknowledge
+    bool init(I2C& i2c)
+    {
+        const RegWrite* seq = Chip::init();
+        for (int i = 0; i < Chip::init_count; i++) {
+            char cmd[2] = { (char) seq[i].reg, (char) seq[i].value };
+            if (i2c.write(Chip::address, cmd, 2) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // read all readout blocks and convert them, value is left alone on a bus error
+    bool read(I2C& i2c)
+    {
+        uint8_t buf[Chip::raw_len];
+        uint8_t* p = buf;
+        const RegBlock* blocks = Chip::blocks();
+        for (int i = 0; i < Chip::block_count; i++) {
+            char reg = blocks[i].reg;
+            if (i2c.write(Chip::address, &reg, 1, true) != 0 ||
+                i2c.read(Chip::address | 1, (char*) p, blocks[i].len) != 0)
+                return false;
+            p += blocks[i].len;
+        }
+        memcpy(raw, buf, sizeof(raw));
+        convert();
+        return true;
+    }
+
+    // convert raw into value, for callers that fill raw themselves (e.g. an asynchronous read)
+    void convert()
+    {
+        rohm_convert<Chip>(raw, value);
+    }
+};
+
+/****************************************************************************************************
+// sensor sets
+ ****************************************************************************************************/
+struct SensorSetEnd {
+    bool initAll(I2C&) { return true; }
+    int readAll(I2C&) { return 0; }
+    template<typename F> void each(F&) {}
+};
+
+// compile-time list of drivers, each one is a base of the set
+template<typename Chip, typename Next = SensorSetEnd>
+class SensorSet : public RohmSensor<Chip>, public Next
+{
+public:
+    // init every chip, returns false if any of them failed
+    bool initAll(I2C& i2c)
+    {
+        bool ok = RohmSensor<Chip>::init(i2c);
+        return Next::initAll(i2c) && ok;
+    }
+
+    // read every chip, returns the number of failed reads
+    int readAll(I2C& i2c)
+    {
+        int failed = RohmSensor<Chip>::read(i2c) ? 0 : 1;
+        return failed + Next::readAll(i2c);
+    }
+
+    // call f(RohmSensor<Chip>&) for every chip in list order
+    template<typename F> void each(F& f)
+    {
+        f(static_cast<RohmSensor<Chip>&>(*this));
+        Next::each(f);
+    }
+};
+
+// the driver of Chip in a set, a compile error if the set does not contain Chip
+template<typename Chip, typename Set> RohmSensor<Chip>& rohm_sensor(Set& set)
+{
+    return set;
+}
+
+#endif
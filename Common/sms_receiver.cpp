@@ -0,0 +1,155 @@
+#include "sms_receiver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+SmsReceiver::SmsReceiver(AtEngine& at)
+    : received(0), errors(0), overflows(0), at(at), handler(NULL), handler_arg(NULL), head(0), count(0),
+      reading(false), header_seen(false)
+{
+}
+
+bool SmsReceiver::start(SmsHandler handler, void* arg)
+{
+    this->handler = handler;
+    handler_arg = arg;
+    if (! at.onUrc("+CMTI:", onIndication, this))
+        return false;
+    bool ok = at.submit("AT+CMGF=1");
+    ok = ok && at.submit("AT+CNMI=2,1,0,0,0");
+    ok = ok && at.submit("AT+CMGL=\"ALL\"", NULL, onListLine, this, SMS_LIST_TIMEOUT_MS);
+    return ok;
+}
+
+void SmsReceiver::poll()
+{
+    fetch();
+}
+
+/****************************************************************************************************
+// indications
+ ****************************************************************************************************/
+// +CMTI: "SM",3
+void SmsReceiver::onIndication(const char* line, int len, void* arg)
+{
+    const char* comma = strrchr(line, ',');
+    if (comma)
+        ((SmsReceiver*) arg)->push(atoi(comma + 1));
+}
+
+// +CMGL: 3,"REC UNREAD","+15551230000",,"26/10/17,09:30:00+00" and the text lines after it;
+// sent and unsent messages stay
+void SmsReceiver::onListLine(const char* line, int len, void* arg)
+{
+    if (strncmp(line, "+CMGL:", 6) == 0 && strstr(line, "\"REC "))
+        ((SmsReceiver*) arg)->push(atoi(line + 6));
+}
+
+void SmsReceiver::push(int index)
+{
+    for (int i = 0; i < count; i++) {
+        if (pending[(head + i) % SMS_PENDING] == index)
+            return;                     // listed and indicated
+    }
+    if (count == SMS_PENDING) {
+        overflows++;
+        return;
+    }
+    pending[(head + count) % SMS_PENDING] = index;
+    count++;
+    fetch();
+}
+
+/****************************************************************************************************
+// read and delete
+ ****************************************************************************************************/
+void SmsReceiver::fetch()
+{
+    if (reading || ! count)
+        return;
+    char command[24];
+    snprintf(command, sizeof(command), "AT+CMGR=%d", pending[head]);
+    memset(&message, 0, sizeof(message));
+    message.index = pending[head];
+    header_seen = false;
+    reading = at.submit(command, readDone, onReadLine, this, SMS_READ_TIMEOUT_MS);
+}
+
+void SmsReceiver::onReadLine(const char* line, int len, void* arg)
+{
+    SmsReceiver* self = (SmsReceiver*) arg;
+    SmsMessage& msg = self->message;
+    if (! self->header_seen && strncmp(line, "+CMGR:", 6) == 0) {
+        self->parseHeader(line);
+        self->header_seen = true;
+        return;
+    }
+    if (msg.text_len && msg.text_len < SMS_MAX_TEXT)
+        msg.text[msg.text_len++] = '\n';
+    int n = len;
+    if (n > SMS_MAX_TEXT - msg.text_len) {
+        n = SMS_MAX_TEXT - msg.text_len;
+        msg.truncated = true;
+    }
+    memcpy(msg.text + msg.text_len, line, n);
+    msg.text_len += n;
+    msg.text[msg.text_len] = '\0';
+}
+
+// +CMGR: "REC UNREAD","+15551230000","","26/10/17,09:30:00+00": number second, timestamp last
+void SmsReceiver::parseHeader(const char* line)
+{
+    int field = 0;
+    const char* p = line;
+    while ((p = strchr(p, '"')) != NULL) {
+        const char* end = strchr(p + 1, '"');
+        if (! end)
+            break;
+        int n = end - p - 1;
+        char* dest = NULL;
+        int size = 0;
+        if (field == 1) {
+            dest = message.number;
+            size = sizeof(message.number);
+        } else if (field >= 2 && memchr(p + 1, '/', n)) {
+            dest = message.timestamp;
+            size = sizeof(message.timestamp);
+        }
+        if (dest) {
+            if (n >= size)
+                n = size - 1;
+            memcpy(dest, p + 1, n);
+            dest[n] = '\0';
+        }
+        field++;
+        p = end + 1;
+    }
+}
+
+void SmsReceiver::readDone(AtResult result, int error, void* arg)
+{
+    SmsReceiver* self = (SmsReceiver*) arg;
+    int index = self->pending[self->head];
+    self->head = (self->head + 1) % SMS_PENDING;
+    self->count--;
+    self->reading = false;
+
+    if (result == AT_OK && self->header_seen) {
+        self->received++;
+        if (self->handler)
+            self->handler(self->message, self->handler_arg);
+        char command[24];
+        snprintf(command, sizeof(command), "AT+CMGD=%d", index);
+        if (! self->at.submit(command, deleteDone, NULL, self))
+            self->errors++;             // stays on the SIM, listed again at the next start()
+    } else {
+        self->errors++;                 // +CMS ERROR 321: the index was empty already
+    }
+    self->fetch();
+}
+
+void SmsReceiver::deleteDone(AtResult result, int error, void* arg)
+{
+    if (result != AT_OK)
+        ((SmsReceiver*) arg)->errors++;
+}
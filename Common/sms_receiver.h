@@ -0,0 +1,77 @@
+/****************************************************************************************************
+ * sms_receiver.h
+ *
+ * Incoming SMS on an AtEngine (at_engine.h), driven by the modem's new-message indications instead
+ * of polling the message store.
+ *
+ * start() switches to text mode and asks for "+CMTI: <mem>,<index>" on every new message
+ * (AT+CNMI=2,1).  Each indication queues the index; the receiver reads the message with
+ * AT+CMGR=<index>, hands it to the handler and deletes it with AT+CMGD=<index>, one message at a
+ * time.  Messages stored before start() (received while the program was not running) are found
+ * with one AT+CMGL and go the same way.  Nothing crosses the radio UART while no message arrives.
+ *
+ * The handler runs inside the engine's poll(); the message is deleted from the SIM after it
+ * returns, so it has to keep what it needs.  Call poll() from the loop that polls the engine.
+ ****************************************************************************************************/
+#ifndef SMS_RECEIVER_H
+#define SMS_RECEIVER_H
+
+#include "at_engine.h"
+
+#define SMS_MAX_NUMBER          24
+#define SMS_MAX_TIMESTAMP       24
+#define SMS_MAX_TEXT            320     // 160 characters, more when the modem shows UCS2 as hex
+#define SMS_PENDING             8       // indices waiting to be read
+#define SMS_READ_TIMEOUT_MS     5000
+#define SMS_LIST_TIMEOUT_MS     20000
+
+struct SmsMessage {
+    int     index;                      // in the modem's message store, deleted after the handler
+    char    number[SMS_MAX_NUMBER];
+    char    timestamp[SMS_MAX_TIMESTAMP];   // "yy/MM/dd,hh:mm:ss+zz"
+    char    text[SMS_MAX_TEXT + 1];     // lines joined with '\n'
+    int     text_len;
+    bool    truncated;
+};
+
+typedef void (*SmsHandler)(const SmsMessage& msg, void* arg);
+
+class SmsReceiver
+{
+public:
+    SmsReceiver(AtEngine& at);
+
+    // text mode, indications on, stored messages listed; false if the engine had no room
+    bool start(SmsHandler handler, void* arg = NULL);
+
+    // starts the next read when the engine's queue was full before
+    void poll();
+
+    uint32_t    received;
+    uint32_t    errors;                 // reads or deletes that failed
+    uint32_t    overflows;              // indices that did not fit, read at the next start()
+
+private:
+    static void onIndication(const char* line, int len, void* arg);
+    static void onListLine(const char* line, int len, void* arg);
+    static void onReadLine(const char* line, int len, void* arg);
+    static void readDone(AtResult result, int error, void* arg);
+    static void deleteDone(AtResult result, int error, void* arg);
+
+    void push(int index);
+    void fetch();
+    void parseHeader(const char* line);
+
+    AtEngine&   at;
+    SmsHandler  handler;
+    void*       handler_arg;
+
+    int         pending[SMS_PENDING];
+    int         head;
+    int         count;
+    bool        reading;                // AT+CMGR for pending[head] is queued or running
+    bool        header_seen;
+    SmsMessage  message;
+};
+
+#endif
@@ -0,0 +1,32 @@
+/****************************************************************************************************
+ * MTSLog.h (Host_sim)
+ *
+ * The mtsas log macros, printed to stdout with the virtual time instead of the source location.
+ ****************************************************************************************************/
+#ifndef MTSLOG_H
+#define MTSLOG_H
+
+namespace mts {
+
+class MTSLog
+{
+public:
+    enum { NONE_LEVEL, FATAL_LEVEL, ERROR_LEVEL, WARNING_LEVEL, INFO_LEVEL, DEBUG_LEVEL, TRACE_LEVEL };
+
+    static void setLogLevel(int level);
+    static void printMessage(int level, const char* label, const char* format, ...);
+
+private:
+    static int currentLevel;
+};
+
+}
+
+#define logFatal(...)   mts::MTSLog::printMessage(mts::MTSLog::FATAL_LEVEL, "FATAL", __VA_ARGS__)
+#define logError(...)   mts::MTSLog::printMessage(mts::MTSLog::ERROR_LEVEL, "ERROR", __VA_ARGS__)
+#define logWarning(...) mts::MTSLog::printMessage(mts::MTSLog::WARNING_LEVEL, "WARNING", __VA_ARGS__)
+#define logInfo(...)    mts::MTSLog::printMessage(mts::MTSLog::INFO_LEVEL, "INFO", __VA_ARGS__)
+#define logDebug(...)   mts::MTSLog::printMessage(mts::MTSLog::DEBUG_LEVEL, "DEBUG", __VA_ARGS__)
+#define logTrace(...)   mts::MTSLog::printMessage(mts::MTSLog::TRACE_LEVEL, "TRACE", __VA_ARGS__)
+
+#endif
@@ -0,0 +1,495 @@
+/****************************************************************************************************
+ * coap_standin.cpp
+ *
+ * Local CoAP (RFC 7252) stand-in for the ingest API, the server side of Project_5's CoapTransport
+ * (coap_link.h), with the same paths and body checks as the HTTP stand-in (upload_body.h):
+ *   POST [/v2]/devices/<id>/update      single update, as post_latest()
+ *   POST [/v2]/devices/<id>/updates     timestamped batch, as JournalUplink::upload()
+ * The API key comes as a Uri-Query "key=...", the content type as a Content-Format.  Accepted
+ * bodies get 2.04 Changed; 4.04, 4.05, 4.01, 4.15 and 4.00 (a body that does not decode) follow
+ * the HTTP stand-in.  Non-confirmable requests are processed but never answered.
+ *
+ * Block1 bodies (RFC 7959) are put together per device address and path, a new token starts a
+ * new body.  An intermediate confirmable block is answered with 2.31 Continue; the last block
+ * with the response to the whole body, or, if blocks are missing, with 4.08 Request Entity
+ * Incomplete and the Block-Bitmap of the blocks received (coap_message.h), so the device sends
+ * only the missing ones again.  A retransmitted confirmable message (same address and message
+ * id) gets the response it got the first time and is not processed again.
+ *
+ *   coap_standin [options]
+ *      -p port (5683)              -a bind address (127.0.0.1)    -k required key
+ *      -d drop %                   -S seed (1)                    -r report interval s (5, 0 only at exit)
+ *      -t seconds to run (until SIGINT)
+ *
+ * -d drops datagrams in both directions, drawn from a hash of (seed, peer, datagram number of
+ * that peer), so the same traffic loses the same datagrams in every run.
+ *
+ * Build: make coap (in Host_sim)
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "coap_message.h"
+#include "upload_body.h"
+
+#define STANDIN_MAX_DATAGRAM    1500
+#define STANDIN_MAX_BODY        (64 * 1024)
+#define STANDIN_TRANSFER_MS     120000  // an unfinished Block1 body is forgotten after this long
+#define STANDIN_DEDUP_ENTRIES   32      // answers kept per peer for retransmissions
+
+static int64_t mono_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/****************************************************************************************************
+// configuration
+ ****************************************************************************************************/
+struct StandinConfig {
+    int         port;
+    std::string bind_addr;
+    std::string api_key;
+    double      drop;
+    uint64_t    seed;
+    int         report_s;
+    int         seconds;
+};
+
+static StandinConfig config;
+static volatile sig_atomic_t stop_requested = 0;
+
+// uniform in [0, 1) from (seed, peer, datagram, salt): splitmix64
+static double fault_draw(uint64_t peer, uint64_t datagram, uint64_t salt)
+{
+    uint64_t x = config.seed ^ (salt * 0x9E3779B97F4A7C15ull) ^ (peer * 0xBF58476D1CE4E5B9ull);
+    x += datagram * 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/****************************************************************************************************
+// statistics
+ ****************************************************************************************************/
+struct StandinStats {
+    uint64_t    datagrams_in;
+    uint64_t    datagrams_out;
+    uint64_t    bytes_in;               // CoAP messages, without UDP/IP headers
+    uint64_t    bytes_out;
+    uint64_t    dropped;                // in either direction
+    uint64_t    requests;               // complete bodies
+    uint64_t    accepted;
+    uint64_t    rejected;
+    uint64_t    blocks;
+    uint64_t    incomplete;             // 4.08 with a bitmap
+    uint64_t    retransmits;            // confirmable messages seen again
+    uint64_t    samples;
+    uint64_t    duplicates;
+
+    StandinStats() { clear(); }
+
+    void clear()
+    {
+        datagrams_in = datagrams_out = bytes_in = bytes_out = dropped = requests = accepted = rejected = blocks =
+            incomplete = retransmits = samples = duplicates = 0;
+    }
+
+    void merge(const StandinStats& s)
+    {
+        datagrams_in += s.datagrams_in;
+        datagrams_out += s.datagrams_out;
+        bytes_in += s.bytes_in;
+        bytes_out += s.bytes_out;
+        dropped += s.dropped;
+        requests += s.requests;
+        accepted += s.accepted;
+        rejected += s.rejected;
+        blocks += s.blocks;
+        incomplete += s.incomplete;
+        retransmits += s.retransmits;
+        samples += s.samples;
+        duplicates += s.duplicates;
+    }
+};
+
+static StandinStats stats;              // since the last report
+
+/****************************************************************************************************
+// peers
+ ****************************************************************************************************/
+struct Transfer {
+    std::string         token;
+    int                 szx;
+    std::string         body;
+    std::vector<bool>   received;
+    int64_t             touched_ms;
+};
+
+struct Answer {
+    uint16_t            message_id;
+    std::string         bytes;          // empty: processed, nothing was sent
+};
+
+struct Peer {
+    uint64_t                        datagrams;
+    std::map<std::string, Transfer> transfers;     // by path
+    std::deque<Answer>              answers;        // newest last
+
+    Peer() : datagrams(0) {}
+};
+
+struct DeviceState {
+    int64_t     newest_ms;              // newest stored sample
+
+    DeviceState() : newest_ms(INT64_MIN) {}
+};
+
+static int sock;
+static std::unordered_map<uint64_t, Peer> peers;   // by address << 16 | port
+static std::unordered_map<std::string, DeviceState> devices;
+
+static uint64_t peer_key(const struct sockaddr_in& addr)
+{
+    return ((uint64_t) ntohl(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+}
+
+static void send_to(const struct sockaddr_in& to, Peer& peer, const std::string& bytes)
+{
+    if (fault_draw(peer_key(to), peer.datagrams++, 2) < config.drop) {
+        stats.dropped++;
+        return;
+    }
+    sendto(sock, bytes.data(), bytes.size(), 0, (const struct sockaddr*) &to, sizeof(to));
+    stats.datagrams_out++;
+    stats.bytes_out += bytes.size();
+}
+
+/****************************************************************************************************
+// requests
+ ****************************************************************************************************/
+static const char* content_type(uint32_t format)
+{
+    switch (format) {
+    case COAP_FORMAT_JSON:      return "application/json";
+    case COAP_FORMAT_TELEMETRY: return "application/x-dragonfly-telemetry";
+    case COAP_FORMAT_TSC:       return "application/x-dragonfly-tsc";
+    default:                    return "application/octet-stream";
+    }
+}
+
+static uint8_t coap_status(int status)
+{
+    switch (status) {
+    case 401: return COAP_UNAUTHORIZED;
+    case 404: return COAP_NOT_FOUND;
+    case 405: return COAP_METHOD_NOT_ALLOWED;
+    case 415: return COAP_UNSUPPORTED_FORMAT;
+    default:  return COAP_BAD_REQUEST;
+    }
+}
+
+// Uri-Path options joined into "/a/b/c"
+static std::string uri_path(const CoapMessage& msg)
+{
+    std::string path;
+    for (int i = 0; const CoapOption* o = coap_find(msg, COAP_OPTION_URI_PATH, i); i++)
+        path.append("/").append((const char*) o->value, o->len);
+    return path;
+}
+
+static bool key_ok(const CoapMessage& msg)
+{
+    if (config.api_key.empty())
+        return true;
+    std::string want = "key=" + config.api_key;
+    for (int i = 0; const CoapOption* o = coap_find(msg, COAP_OPTION_URI_QUERY, i); i++) {
+        if (want.compare(0, std::string::npos, (const char*) o->value, o->len) == 0)
+            return true;
+    }
+    return false;
+}
+
+// store a complete body, returns the response code
+static uint8_t process(const CoapMessage& msg, const std::string& path, const std::string& body)
+{
+    std::string device, endpoint;
+    std::vector<int64_t> times;
+    const CoapOption* format = coap_find(msg, COAP_OPTION_CONTENT_FORMAT);
+
+    stats.requests++;
+    int status = upload_route(msg.code == COAP_POST ? "POST" : "OTHER", path, device, endpoint);
+    if (status == 0 && ! key_ok(msg))
+        status = 401;
+    if (status == 0)
+        status = upload_check(content_type(format ? coap_uint(*format) : COAP_FORMAT_OCTETS), body, times);
+    if (status != 0) {
+        stats.rejected++;
+        return coap_status(status);
+    }
+
+    // like M2X, values are keyed by timestamp so a batch sent again only adds duplicates
+    DeviceState& d = devices[device];
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+    for (size_t i = 0; i < times.size(); i++) {
+        if (times[i] != INT64_MIN && times[i] <= d.newest_ms)
+            stats.duplicates++;
+        else
+            d.newest_ms = times[i];
+    }
+    stats.samples += times.size();
+    stats.accepted++;
+    return COAP_CHANGED;
+}
+
+// response to msg, piggybacked on the ACK of a confirmable request
+static std::string response(const CoapMessage& msg, uint8_t code, const CoapOption* block1,
+                            const std::vector<uint8_t>* bitmap)
+{
+    uint8_t buf[STANDIN_MAX_DATAGRAM];
+    CoapWriter w;
+    w.begin(buf, sizeof(buf), COAP_ACK, code, msg.message_id, msg.token, msg.token_len);
+    if (block1)
+        w.option(COAP_OPTION_BLOCK1, block1->value, block1->len);
+    if (bitmap)
+        w.option(COAP_OPTION_BLOCK_BITMAP, bitmap->data(), bitmap->size());
+    int len = w.finish();
+    return len < 0 ? std::string() : std::string((const char*) buf, len);
+}
+
+// the answer to one request, "" when nothing is to be sent
+static std::string handle(Peer& peer, const CoapMessage& msg)
+{
+    bool con = msg.type == COAP_CON;
+    std::string path = uri_path(msg);
+    std::string payload((const char*) msg.payload, msg.payload_len);
+    const CoapOption* block1 = coap_find(msg, COAP_OPTION_BLOCK1);
+
+    if (! block1) {
+        uint8_t code = process(msg, path, payload);
+        return con ? response(msg, code, NULL, NULL) : std::string();
+    }
+
+    uint32_t v = coap_uint(*block1);
+    uint32_t num = COAP_BLOCK_NUM(v);
+    int size = COAP_BLOCK_SIZE(v);
+    std::string token((const char*) msg.token, msg.token_len);
+    stats.blocks++;
+    if ((v & 0x07) == 7 || (size_t) (num + 1) * size > STANDIN_MAX_BODY)
+        return con ? response(msg, COAP_TOO_LARGE, block1, NULL) : std::string();
+
+    Transfer& t = peer.transfers[path];
+    if (t.token != token || t.szx != (int) (v & 0x07)) {
+        t.token = token;
+        t.szx = v & 0x07;
+        t.body.clear();
+        t.received.clear();
+    }
+    t.touched_ms = mono_ms();
+    if (t.body.size() < (size_t) num * size + payload.size())
+        t.body.resize(num * size + payload.size());
+    t.body.replace(num * size, payload.size(), payload);
+    if (t.received.size() <= num)
+        t.received.resize(num + 1, false);
+    t.received[num] = true;
+
+    // the body is judged when its last block comes (again), a block resent before it only fills a gap
+    if (COAP_BLOCK_MORE(v))
+        return con ? response(msg, COAP_CONTINUE, block1, NULL) : std::string();
+    t.body.resize(num * size + payload.size());
+    std::vector<uint8_t> bitmap(num / 8 + 1, 0);
+    bool complete = true;
+    for (int i = 0; i <= (int) num; i++) {
+        if (i < (int) t.received.size() && t.received[i])
+            bitmap[i / 8] |= 1 << (i % 8);
+        else
+            complete = false;
+    }
+    if (! complete) {
+        stats.incomplete += con;
+        return con ? response(msg, COAP_INCOMPLETE, block1, &bitmap) : std::string();
+    }
+    uint8_t code = process(msg, path, t.body);
+    peer.transfers.erase(path);
+    return con ? response(msg, code, block1, NULL) : std::string();
+}
+
+static void on_datagram(const struct sockaddr_in& from, const uint8_t* buf, int len)
+{
+    Peer& peer = peers[peer_key(from)];
+    if (fault_draw(peer_key(from), peer.datagrams++, 1) < config.drop) {
+        stats.dropped++;
+        return;
+    }
+    stats.datagrams_in++;
+    stats.bytes_in += len;
+
+    CoapMessage msg;
+    if (! coap_parse(buf, len, msg) || msg.type == COAP_ACK || msg.type == COAP_RST || msg.code == COAP_EMPTY)
+        return;
+    if ((msg.code >> 5) != 0) {
+        std::string rst = response(msg, COAP_EMPTY, NULL, NULL);
+        rst[0] = (char) ((COAP_VERSION << 6) | (COAP_RST << 4));
+        rst.resize(COAP_HEADER_SIZE);
+        send_to(from, peer, rst);
+        return;
+    }
+
+    // a retransmission gets the first answer again
+    if (msg.type == COAP_CON) {
+        for (size_t i = 0; i < peer.answers.size(); i++) {
+            if (peer.answers[i].message_id == msg.message_id) {
+                stats.retransmits++;
+                if (! peer.answers[i].bytes.empty())
+                    send_to(from, peer, peer.answers[i].bytes);
+                return;
+            }
+        }
+    }
+
+    std::string answer = handle(peer, msg);
+    if (msg.type == COAP_CON) {
+        peer.answers.push_back(Answer{ msg.message_id, answer });
+        if (peer.answers.size() > STANDIN_DEDUP_ENTRIES)
+            peer.answers.pop_front();
+    }
+    if (! answer.empty())
+        send_to(from, peer, answer);
+}
+
+static void expire_transfers(int64_t now)
+{
+    for (auto& p : peers) {
+        for (auto t = p.second.transfers.begin(); t != p.second.transfers.end(); ) {
+            if (now - t->second.touched_ms > STANDIN_TRANSFER_MS)
+                t = p.second.transfers.erase(t);
+            else
+                ++t;
+        }
+    }
+}
+
+/****************************************************************************************************
+// main
+ ****************************************************************************************************/
+static void usage()
+{
+    fprintf(stderr, "usage: coap_standin [-p port] [-a bind_addr] [-k api_key] [-d drop%%] [-S seed] [-r report_s]\n"
+                    "                    [-t seconds]\n");
+    exit(2);
+}
+
+static void on_signal(int)
+{
+    stop_requested = 1;
+}
+
+static void print_stats(const char* what, const StandinStats& s, double seconds)
+{
+    printf("%s: %.1f req/s  %.1f samples/s  in %llu dgrams %.1f kB  out %llu dgrams %.1f kB  dropped %llu  "
+           "accepted %llu  rejected %llu  blocks %llu  incomplete %llu  retransmits %llu  duplicates %llu\n",
+           what, s.requests / seconds, s.samples / seconds, (unsigned long long) s.datagrams_in, s.bytes_in / 1000.0,
+           (unsigned long long) s.datagrams_out, s.bytes_out / 1000.0, (unsigned long long) s.dropped,
+           (unsigned long long) s.accepted, (unsigned long long) s.rejected, (unsigned long long) s.blocks,
+           (unsigned long long) s.incomplete, (unsigned long long) s.retransmits, (unsigned long long) s.duplicates);
+}
+
+int main(int argc, char** argv)
+{
+    config.port = 5683;
+    config.bind_addr = "127.0.0.1";
+    config.seed = 1;
+    config.report_s = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:a:k:d:S:r:t:")) != -1) {
+        switch (opt) {
+        case 'p': config.port = atoi(optarg); break;
+        case 'a': config.bind_addr = optarg; break;
+        case 'k': config.api_key = optarg; break;
+        case 'd': config.drop = atof(optarg) / 100; break;
+        case 'S': config.seed = strtoull(optarg, NULL, 0); break;
+        case 'r': config.report_s = atoi(optarg); break;
+        case 't': config.seconds = atoi(optarg); break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || config.port <= 0 || config.report_s < 0)
+        usage();
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    if (inet_pton(AF_INET, config.bind_addr.c_str(), &addr.sin_addr) != 1)
+        usage();
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        perror("bind");
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    printf("CoAP stand-in on %s:%d: drop %.1f%%, seed %llu\n", config.bind_addr.c_str(), config.port,
+           config.drop * 100, (unsigned long long) config.seed);
+    fflush(stdout);
+
+    StandinStats total;
+    int64_t start_ms = mono_ms();
+    int64_t last_report = start_ms, last_expire = start_ms;
+    uint8_t buf[STANDIN_MAX_DATAGRAM];
+    while (! stop_requested) {
+        int64_t now = mono_ms();
+        if (config.seconds && now - start_ms >= (int64_t) config.seconds * 1000)
+            break;
+        if (config.report_s && now - last_report >= (int64_t) config.report_s * 1000) {
+            char what[32];
+            snprintf(what, sizeof(what), "%6.1f s", (now - start_ms) / 1e3);
+            print_stats(what, stats, (now - last_report) / 1e3);
+            fflush(stdout);
+            total.merge(stats);
+            stats.clear();
+            last_report = now;
+        }
+        if (now - last_expire >= 1000) {
+            expire_transfers(now);
+            last_expire = now;
+        }
+
+        struct pollfd p;
+        p.fd = sock;
+        p.events = POLLIN;
+        if (poll(&p, 1, 100) != 1)
+            continue;
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr*) &from, &from_len);
+        if (n >= 0)
+            on_datagram(from, buf, n);
+    }
+
+    total.merge(stats);
+    print_stats("total", total, std::max<int64_t>(1, mono_ms() - start_ms) / 1e3);
+    printf("%lu devices\n", (unsigned long) devices.size());
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "fleet_device.h"
+#include "rohm_sensors.h"
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+#define FLEET_BATCH_SAMPLES     16                          // upload_batch_samples in main.cpp
+#define FLEET_MAX_SAMPLES       (4 * FLEET_BATCH_SAMPLES)   // upload_batches_per_post batches
+
+static int16_t raw16(double v)
+{
+    v = floor(v + 0.5);
+    return (int16_t) (v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+}
+
+static uint16_t rawu16(double v)
+{
+    v = floor(v + 0.5);
+    return (uint16_t) (v > 65535 ? 65535 : v < 0 ? 0 : v);
+}
+
+static void put16le(uint8_t* p, int v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+// 12-bit ADC code of volts as read_u16() returns it
+static uint16_t adc_u16(double volts)
+{
+    double level = volts / 3.3;
+    level = level < 0 ? 0 : level > 1 ? 1 : level;
+    return (uint16_t) ((uint16_t) (level * 4095 + 0.5) << 4);
+}
+
+FleetDevice::FleetDevice(uint32_t id, uint32_t sample_ms, int64_t now_ms)
+    : id(id), world(id * 2654435761u + 1), sample_ms(sample_ms), next_sample_ms(now_ms)
+{
+    phase_s = (id * 7919u) % 86400;
+}
+
+const char* FleetDevice::contentType(FleetFormat format)
+{
+    switch (format) {
+    case FLEET_TSC:     return "application/x-dragonfly-tsc";
+    case FLEET_FRAMES:  return "application/x-dragonfly-telemetry";
+    default:            return "application/json";
+    }
+}
+
+// one sampling cycle: the world -> register bytes and ADC codes -> the Project_5 conversions
+void FleetDevice::sample(int64_t ms, SensorSample& s)
+{
+    double t = phase_s + ms / 1000.0;
+    double v[3];
+
+    memset(&s, 0, sizeof(s));
+    s.timestamp = ms / 1000;
+    s.millis = ms % 1000;
+    s.flags = SAMPLE_THPM | SAMPLE_MOTION;
+
+    // ReadAnalogTemp() / ReadAnalogUV() / ReadHallSensor()
+    uint16_t temp_code = adc_u16(1.753 - 0.01068 * (world.temp_c(t) - 30));
+    uint16_t uv_code = adc_u16(2.2 + 0.129 * (world.uv_mw_cm2(t) - 10));
+    s.temp_c = ((float) temp_code * (float) 0.000050354 - (float) 1.753) / ((float) -0.01068) + (float) 30;
+    s.uv = ((float) uv_code * (float) 0.000050354 - (float) 2.2) / ((float) 0.129) + 10;
+    s.hall[0] = world.hall_south(t) ? 0 : 1;
+    s.hall[1] = world.hall_north(t) ? 0 : 1;
+
+    // shield readouts
+    uint8_t raw[12];
+    double d0 = world.lux(t) / (1.682 - 1.877 * 0.3);
+    put16le(raw, rawu16(world.proximity(t)));
+    put16le(raw + 2, rawu16(d0));
+    put16le(raw + 4, rawu16(d0 * 0.3));
+    RohmReading<Rpr0521> light;
+    rohm_convert<Rpr0521>(raw, light);
+    s.ambient_light = light.lux;
+    s.proximity = light.proximity;
+
+    world.rgb(t, v);
+    for (int i = 0; i < 3; i++)
+        put16le(raw + 2 * i, rawu16(v[i]));
+    RohmReading<Bh1745> color;
+    rohm_convert<Bh1745>(raw, color);
+    for (int i = 0; i < 3; i++)
+        s.color[i] = color.rgb[i];
+
+    double m[3];
+    world.accel_g(t, v);
+    world.mag_ut(t, m);
+    for (int i = 0; i < 3; i++) {
+        put16le(raw + 2 * i, raw16(v[i] * 8192));
+        put16le(raw + 6 + 2 * i, raw16(m[i] * 4 / 0.146));
+    }
+    RohmReading<Kmx62> motion;
+    rohm_convert<Kmx62>(raw, motion);
+    for (int i = 0; i < 3; i++) {
+        put16le(raw + 2 * i, raw16(v[i] * 16384));
+        s.mems_accel[i] = motion.accel[i];
+        s.mems_mag[i] = motion.mag[i];
+    }
+    RohmReading<Kx022> accel;
+    rohm_convert<Kx022>(raw, accel);
+    for (int i = 0; i < 3; i++)
+        s.kx022_accel[i] = accel.accel[i];
+
+    int16_t temp = raw16(world.temp_c(t) * 32);
+    uint32_t press = (uint32_t) floor(world.pressure_hpa(t) * 2048 + 0.5) & 0x3FFFFF;
+    raw[0] = (uint8_t) ((uint16_t) temp >> 8);
+    raw[1] = (uint8_t) temp;
+    raw[2] = (uint8_t) (press >> 14);
+    raw[3] = (uint8_t) (press >> 6);
+    raw[4] = (uint8_t) (press << 2);
+    RohmReading<Bm1383> pressure;
+    rohm_convert<Bm1383>(raw, pressure);
+    s.bm1383_temp = pressure.temp_c;
+    s.pressure_hpa = pressure.pressure_hpa;
+}
+
+/****************************************************************************************************
+// upload bodies
+ ****************************************************************************************************/
+struct FleetStream {
+    const char* name;
+    float       (*value)(const SensorSample& sample);
+};
+static float stream_temp_c (const SensorSample& sample) { return sample.temp_c; }
+static float stream_uv (const SensorSample& sample) { return sample.uv; }
+static float stream_amb_light (const SensorSample& sample) { return sample.ambient_light; }
+static float stream_prox (const SensorSample& sample) { return sample.proximity; }
+static const FleetStream upload_streams[] = {
+    { "temp_c",     stream_temp_c },
+    { "uv",         stream_uv },
+    { "amb_light",  stream_amb_light },
+    { "prox",       stream_prox },
+};
+
+static void append_json(std::string& body, const SensorSample* samples, int n)
+{
+    char buf[96];
+    body = "{\"values\":{";
+    for (unsigned i = 0; i < sizeof(upload_streams) / sizeof(upload_streams[0]); i++) {
+        body += i ? ",\"" : "\"";
+        body += upload_streams[i].name;
+        body += "\":[";
+        for (int j = 0; j < n; j++) {
+            time_t t = samples[j].timestamp;
+            struct tm tm;
+            gmtime_r(&t, &tm);
+            snprintf(buf, sizeof(buf), "%s{\"timestamp\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\",\"value\":%.6g}",
+                     j ? "," : "", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                     samples[j].millis, upload_streams[i].value(samples[j]));
+            body += buf;
+        }
+        body += "]";
+    }
+    body += "}}";
+}
+
+int FleetDevice::buildBody(int64_t now_ms, FleetFormat format, std::string& body)
+{
+    SensorSample samples[FLEET_MAX_SAMPLES];
+    int n = 0;
+
+    // a device that could not post for long only sends its newest samples
+    if (now_ms - next_sample_ms > (int64_t) FLEET_MAX_SAMPLES * sample_ms)
+        next_sample_ms += (now_ms - next_sample_ms) / sample_ms * sample_ms - (FLEET_MAX_SAMPLES - 1) * sample_ms;
+    for (; next_sample_ms <= now_ms && n < FLEET_MAX_SAMPLES; next_sample_ms += sample_ms)
+        sample(next_sample_ms, samples[n++]);
+
+    body.clear();
+    if (format == FLEET_JSON) {
+        append_json(body, samples, n);
+        return n;
+    }
+
+    uint8_t buf[FLEET_BATCH_SAMPLES * (TELEMETRY_MAX_FRAME + 8)];
+    for (int i = 0; i < n; ) {
+        int len = 0;
+        if (format == FLEET_TSC) {
+            TsCompressor compressor;
+            compressor.begin(buf, sizeof(buf));
+            for (int j = 0; j < FLEET_BATCH_SAMPLES && i < n && compressor.add(samples[i]); j++)
+                i++;
+            len = compressor.finish();
+        } else {
+            for (int j = 0; j < FLEET_BATCH_SAMPLES && i < n; j++)
+                len += telemetry_encode(samples[i++], buf + len, sizeof(buf) - len);
+        }
+        body.append((const char*) buf, len);
+    }
+    return n;
+}
@@ -0,0 +1,46 @@
+/****************************************************************************************************
+ * fleet_device.h
+ *
+ * One virtual Dragonfly of the fleet generator: its own SimWorld (seed and day phase per device),
+ * sampled at a fixed interval through the same path as Project_5 (raw register bytes and ADC codes,
+ * rohm_convert<>() and the ReadAnalog*() formulas, one SensorSample per cycle), and the samples
+ * since its last post encoded as an upload body the way main.cpp does it.
+ *
+ * A device holds no buffers of its own, so a fleet of tens of thousands fits in a few megabytes.
+ ****************************************************************************************************/
+#ifndef FLEET_DEVICE_H
+#define FLEET_DEVICE_H
+
+#include <stdint.h>
+#include <string>
+#include "sim_world.h"
+#include "sensor_sample.h"
+
+enum FleetFormat {
+    FLEET_TSC,                          // compressed blocks of up to 16 samples (CompressedBatches)
+    FLEET_FRAMES,                       // telemetry frames back to back (BinaryTelemetry)
+    FLEET_JSON                          // M2X multi-value JSON (JournalUplink without BinaryTelemetry)
+};
+
+class FleetDevice
+{
+public:
+    FleetDevice(uint32_t id, uint32_t sample_ms, int64_t now_ms);
+
+    // sample up to now_ms and encode the samples since the last body, returns the sample count
+    int buildBody(int64_t now_ms, FleetFormat format, std::string& body);
+
+    static const char* contentType(FleetFormat format);
+
+    uint32_t    id;
+
+private:
+    void sample(int64_t ms, SensorSample& s);
+
+    SimWorld    world;
+    double      phase_s;                // offset into the world's day, so devices differ
+    uint32_t    sample_ms;
+    int64_t     next_sample_ms;
+};
+
+#endif
@@ -0,0 +1,661 @@
+/****************************************************************************************************
+ * fleet_main.cpp
+ *
+ * Fleet traffic generator: N virtual Dragonflies (fleet_device.h) posting their upload bodies over
+ * HTTP/1.1 to one endpoint, for load tests of the ingestion side.
+ *
+ * The devices are split over worker threads (one per core by default).  A worker runs an epoll
+ * loop over the non-blocking connections of its devices and a deadline heap of their next posts,
+ * so there is no thread per device.  Every device keeps one keep-alive connection like the real
+ * link, posts every interval +- jitter, and skips a post while its previous one is still open.
+ *
+ *   dragonfly_fleet -u http://host:port/path [options]
+ *      -n devices      (1000)              -i post interval ms (10000)   -s sample interval ms (1000)
+ *      -j jitter %     (10)                -f tsc|frames|json (tsc)      -t seconds to run (60)
+ *      -w workers      (cores)             -k X-M2X-KEY header           -r report interval s (5)
+ *      -T request timeout ms (10000)
+ *   "{device}" in the path is replaced by the device name (dragonfly-000042).
+ *
+ * Reports messages/s, bytes/s, errors and latency percentiles (request written to response
+ * complete, including the connect of a new connection).  Responses need a Content-Length or
+ * Connection: close.
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fleet_device.h"
+
+static int64_t mono_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t wall_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/****************************************************************************************************
+// statistics
+ ****************************************************************************************************/
+// log-linear latency histogram, 16 buckets per power of two of microseconds (< 4.5% error)
+struct LatencyHistogram {
+    enum { SUB = 16, BUCKETS = 40 * SUB };
+    uint64_t    counts[BUCKETS];
+    uint64_t    max_us;
+
+    LatencyHistogram() { clear(); }
+
+    void clear()
+    {
+        memset(counts, 0, sizeof(counts));
+        max_us = 0;
+    }
+
+    static int bucket(uint64_t us)
+    {
+        if (us < SUB)
+            return us;
+        int msb = 63 - __builtin_clzll(us);
+        int b = (msb - 3) * SUB + (int) ((us >> (msb - 4)) & (SUB - 1));
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+
+    static uint64_t lower(int b)
+    {
+        if (b < SUB)
+            return b;
+        int msb = b / SUB + 3;
+        return ((uint64_t) (SUB + b % SUB)) << (msb - 4);
+    }
+
+    void add(uint64_t us)
+    {
+        counts[bucket(us)]++;
+        if (us > max_us)
+            max_us = us;
+    }
+
+    void merge(const LatencyHistogram& h)
+    {
+        for (int b = 0; b < BUCKETS; b++)
+            counts[b] += h.counts[b];
+        if (h.max_us > max_us)
+            max_us = h.max_us;
+    }
+
+    uint64_t total() const
+    {
+        uint64_t n = 0;
+        for (int b = 0; b < BUCKETS; b++)
+            n += counts[b];
+        return n;
+    }
+
+    // upper end of the bucket holding quantile q
+    double percentile_ms(double q) const
+    {
+        uint64_t n = total(), seen = 0;
+        if (n == 0)
+            return 0;
+        uint64_t rank = (uint64_t) (q * (n - 1)) + 1;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank)
+                return std::min(lower(b + 1), max_us) / 1000.0;
+        }
+        return max_us / 1000.0;
+    }
+};
+
+struct FleetStats {
+    uint64_t    posts;                  // requests written
+    uint64_t    ok;                     // 2xx responses
+    uint64_t    http_errors;            // other statuses
+    uint64_t    transport_errors;       // connect/reset/timeout/bad response
+    uint64_t    skipped;                // post due while the previous one was still open
+    uint64_t    connects;
+    uint64_t    samples;
+    uint64_t    bytes;                  // request bytes
+    LatencyHistogram latency;
+
+    FleetStats() { clear(); }
+
+    void clear()
+    {
+        posts = ok = http_errors = transport_errors = skipped = connects = samples = bytes = 0;
+        latency.clear();
+    }
+
+    void merge(const FleetStats& s)
+    {
+        posts += s.posts;
+        ok += s.ok;
+        http_errors += s.http_errors;
+        transport_errors += s.transport_errors;
+        skipped += s.skipped;
+        connects += s.connects;
+        samples += s.samples;
+        bytes += s.bytes;
+        latency.merge(s.latency);
+    }
+};
+
+/****************************************************************************************************
+// configuration
+ ****************************************************************************************************/
+struct FleetConfig {
+    int         devices;
+    int         workers;
+    uint32_t    post_ms;
+    uint32_t    sample_ms;
+    double      jitter;
+    FleetFormat format;
+    int         seconds;
+    int         report_s;
+    uint32_t    timeout_ms;
+    std::string host;
+    std::string port;
+    std::string path;
+    std::string api_key;
+    struct sockaddr_storage addr;
+    socklen_t   addr_len;
+};
+
+static FleetConfig config;
+static std::atomic<bool> stop_requested(false);
+
+static bool parse_url(const std::string& url)
+{
+    if (url.compare(0, 7, "http://") != 0)
+        return false;
+    std::string rest = url.substr(7);
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    config.path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t colon = authority.rfind(':');
+    config.host = authority.substr(0, colon);
+    config.port = colon == std::string::npos ? "80" : authority.substr(colon + 1);
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(config.host.c_str(), config.port.c_str(), &hints, &res) != 0)
+        return false;
+    memcpy(&config.addr, res->ai_addr, res->ai_addrlen);
+    config.addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+/****************************************************************************************************
+// worker
+ ****************************************************************************************************/
+enum ConnState { IDLE, CONNECTING, SENDING, RECEIVING };
+
+struct Connection {
+    FleetDevice device;
+    int         fd;
+    ConnState   state;
+    bool        fresh;                  // connected for this request
+    std::string out;
+    size_t      out_pos;
+    std::string in;
+    int64_t     start_ns;
+    int64_t     next_post_ms;
+
+    Connection(uint32_t id, int64_t now_ms)
+        : device(id, config.sample_ms, now_ms), fd(-1), state(IDLE), fresh(false), out_pos(0), start_ns(0),
+          next_post_ms(0) {}
+};
+
+class Worker
+{
+public:
+    Worker(int index) : index(index), epfd(-1)
+    {
+        rng[0] = 0x330E;
+        rng[1] = index;
+        rng[2] = index >> 16;
+    }
+
+    void run();
+
+    std::mutex          lock;
+    FleetStats          stats;          // since the last report, under lock
+
+private:
+    struct Due {
+        int64_t ms;
+        uint32_t conn;
+        bool operator<(const Due& d) const { return ms > d.ms; }
+    };
+
+    void schedule(uint32_t i, int64_t after_ms);
+    void startPost(uint32_t i);
+    void handle(uint32_t i, uint32_t events);
+    bool sendSome(Connection& c);
+    bool receiveSome(Connection& c);
+    void finish(uint32_t i, int status);
+    void fail(uint32_t i);
+    void closeConn(Connection& c);
+    void watch(Connection& c, uint32_t i, uint32_t events, bool add);
+    void checkTimeouts();
+
+    template<typename F> void record(F f)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        f(stats);
+    }
+
+    int                 index;
+    int                 epfd;
+    std::vector<Connection> conns;
+    std::priority_queue<Due> due;
+    unsigned short      rng[3];         // erand48() state, drand48() is shared between threads
+};
+
+void Worker::run()
+{
+    epfd = epoll_create1(0);
+    int64_t now = wall_ms();
+    for (int id = index; id < config.devices; id += config.workers)
+        conns.push_back(Connection(id, now));
+
+    // first posts spread over one interval so the fleet does not post in lockstep
+    for (uint32_t i = 0; i < conns.size(); i++) {
+        conns[i].next_post_ms = now + (int64_t) (erand48(rng) * config.post_ms);
+        due.push(Due{ conns[i].next_post_ms, i });
+    }
+
+    struct epoll_event events[256];
+    int64_t last_timeout_check = now;
+    while (! stop_requested.load(std::memory_order_relaxed)) {
+        now = wall_ms();
+        while (! due.empty() && due.top().ms <= now) {
+            uint32_t i = due.top().conn;
+            due.pop();
+            startPost(i);
+        }
+        if (now - last_timeout_check >= 100) {
+            checkTimeouts();
+            last_timeout_check = now;
+        }
+
+        int wait_ms = 100;
+        if (! due.empty())
+            wait_ms = (int) std::max<int64_t>(0, std::min<int64_t>(wait_ms, due.top().ms - wall_ms()));
+        int n = epoll_wait(epfd, events, 256, wait_ms);
+        for (int e = 0; e < n; e++)
+            handle(events[e].data.u32, events[e].events);
+    }
+    for (size_t i = 0; i < conns.size(); i++)
+        closeConn(conns[i]);
+    close(epfd);
+}
+
+void Worker::schedule(uint32_t i, int64_t after_ms)
+{
+    Connection& c = conns[i];
+    double j = config.jitter * (2 * erand48(rng) - 1);
+    c.next_post_ms = after_ms + (int64_t) (config.post_ms * (1 + j));
+    due.push(Due{ c.next_post_ms, i });
+}
+
+void Worker::watch(Connection& c, uint32_t i, uint32_t events, bool add)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u32 = i;
+    epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+void Worker::closeConn(Connection& c)
+{
+    if (c.fd >= 0)
+        close(c.fd);
+    c.fd = -1;
+    c.state = IDLE;
+}
+
+void Worker::startPost(uint32_t i)
+{
+    Connection& c = conns[i];
+    schedule(i, c.next_post_ms);
+    if (c.state != IDLE) {
+        record([](FleetStats& s) { s.skipped++; });
+        return;
+    }
+
+    std::string body;
+    int samples = c.device.buildBody(wall_ms(), config.format, body);
+    if (samples == 0)
+        return;                 // like JournalUplink::upload(), nothing is posted while the journal is empty
+
+    char name[32];
+    snprintf(name, sizeof(name), "dragonfly-%06u", c.device.id);
+    std::string path = config.path;
+    size_t pos = path.find("{device}");
+    if (pos != std::string::npos)
+        path.replace(pos, 8, name);
+
+    char header[512];
+    int len = snprintf(header, sizeof(header),
+                       "POST %s HTTP/1.1\r\nHost: %s\r\nX-M2X-KEY: %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n\r\n",
+                       path.c_str(), config.host.c_str(), config.api_key.c_str(),
+                       FleetDevice::contentType(config.format), (unsigned) body.size());
+    c.out.assign(header, len);
+    c.out += body;
+    c.out_pos = 0;
+    c.in.clear();
+    c.start_ns = mono_ns();
+    record([&](FleetStats& s) { s.posts++; s.samples += samples; s.bytes += c.out.size(); });
+
+    c.fresh = c.fd < 0;
+    if (c.fresh) {
+        c.fd = socket(config.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (c.fd < 0) {
+            fail(i);
+            return;
+        }
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        record([](FleetStats& s) { s.connects++; });
+        if (connect(c.fd, (struct sockaddr*) &config.addr, config.addr_len) != 0 && errno != EINPROGRESS) {
+            fail(i);
+            return;
+        }
+        c.state = CONNECTING;
+        watch(c, i, EPOLLOUT, true);
+        return;
+    }
+    c.state = SENDING;
+    if (! sendSome(c)) {
+        fail(i);
+        return;
+    }
+    watch(c, i, c.state == SENDING ? EPOLLOUT : EPOLLIN | EPOLLRDHUP, false);
+}
+
+bool Worker::sendSome(Connection& c)
+{
+    while (c.out_pos < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN;
+        c.out_pos += n;
+    }
+    c.state = RECEIVING;
+    return true;
+}
+
+// returns false on a transport error, state becomes IDLE once the response is complete
+bool Worker::receiveSome(Connection& c)
+{
+    char buf[4096];
+    bool eof = false;
+    for (;;) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n == 0)
+            eof = true;
+        else if (errno != EAGAIN)
+            return false;
+        break;
+    }
+
+    size_t end = c.in.find("\r\n\r\n");
+    if (end == std::string::npos)
+        return ! eof;
+    std::string head = c.in.substr(0, end);
+    for (size_t k = 0; k < head.size(); k++)
+        head[k] = tolower(head[k]);
+    size_t cl = head.find("\r\ncontent-length:");
+    bool close_after = head.find("\r\nconnection: close") != std::string::npos;
+    if (cl != std::string::npos) {
+        size_t body_len = strtoul(head.c_str() + cl + 17, NULL, 10);
+        if (c.in.size() < end + 4 + body_len)
+            return ! eof;
+    } else if (! eof) {
+        return true;            // no Content-Length: the response ends with the close
+    }
+    if (eof)
+        close_after = true;
+    c.state = IDLE;
+    if (close_after)
+        closeConn(c);
+    return true;
+}
+
+void Worker::handle(uint32_t i, uint32_t events)
+{
+    Connection& c = conns[i];
+    if (c.fd < 0)
+        return;
+
+    if (c.state == IDLE) {
+        // the server closed an idle keep-alive connection
+        closeConn(c);
+        return;
+    }
+    if (c.state == CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            fail(i);
+            return;
+        }
+        c.state = SENDING;
+    }
+    if (c.state == SENDING) {
+        if (! sendSome(c)) {
+            fail(i);
+            return;
+        }
+        if (c.state == RECEIVING)
+            watch(c, i, EPOLLIN | EPOLLRDHUP, false);
+        return;
+    }
+    if (c.state == RECEIVING) {
+        if (! receiveSome(c)) {
+            fail(i);
+            return;
+        }
+        if (c.state == IDLE) {
+            int status = 0;
+            if (c.in.compare(0, 5, "HTTP/") == 0) {
+                size_t sp = c.in.find(' ');
+                if (sp != std::string::npos)
+                    status = atoi(c.in.c_str() + sp + 1);
+            }
+            finish(i, status);
+        }
+    }
+}
+
+void Worker::finish(uint32_t i, int status)
+{
+    Connection& c = conns[i];
+    uint64_t us = (mono_ns() - c.start_ns) / 1000;
+    record([&](FleetStats& s) {
+        if (status >= 200 && status < 300)
+            s.ok++;
+        else if (status)
+            s.http_errors++;
+        else
+            s.transport_errors++;
+        s.latency.add(us);
+    });
+    if (c.fd >= 0)
+        watch(c, i, EPOLLIN | EPOLLRDHUP, false);
+}
+
+void Worker::fail(uint32_t i)
+{
+    Connection& c = conns[i];
+    closeConn(c);
+    record([](FleetStats& s) { s.transport_errors++; });
+}
+
+void Worker::checkTimeouts()
+{
+    int64_t limit = mono_ns() - (int64_t) config.timeout_ms * 1000000;
+    for (uint32_t i = 0; i < conns.size(); i++) {
+        if (conns[i].state != IDLE && conns[i].start_ns < limit)
+            fail(i);
+    }
+}
+
+/****************************************************************************************************
+// main
+ ****************************************************************************************************/
+static void usage()
+{
+    fprintf(stderr, "usage: dragonfly_fleet -u http://host:port/path [-n devices] [-i post_ms] [-s sample_ms] [-j jitter%%]\n"
+                    "                       [-f tsc|frames|json] [-t seconds] [-w workers] [-k api_key] [-r report_s]\n"
+                    "                       [-T timeout_ms]\n");
+    exit(2);
+}
+
+static void on_signal(int)
+{
+    stop_requested = true;
+}
+
+static void print_stats(const char* what, const FleetStats& s, double seconds)
+{
+    printf("%s: %.1f posts/s  %.1f samples/s  %.1f kB/s  ok %llu  http errors %llu  transport errors %llu  "
+           "skipped %llu  connects %llu\n",
+           what, s.posts / seconds, s.samples / seconds, s.bytes / seconds / 1000, (unsigned long long) s.ok,
+           (unsigned long long) s.http_errors, (unsigned long long) s.transport_errors,
+           (unsigned long long) s.skipped, (unsigned long long) s.connects);
+    printf("    latency ms: p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n", s.latency.percentile_ms(0.5),
+           s.latency.percentile_ms(0.9), s.latency.percentile_ms(0.99), s.latency.percentile_ms(0.999),
+           s.latency.max_us / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    std::string url;
+    config.devices = 1000;
+    config.workers = std::max(1u, std::thread::hardware_concurrency());
+    config.post_ms = 10000;
+    config.sample_ms = 1000;
+    config.jitter = 0.1;
+    config.format = FLEET_TSC;
+    config.seconds = 60;
+    config.report_s = 5;
+    config.timeout_ms = 10000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "u:n:i:s:j:f:t:w:k:r:T:")) != -1) {
+        switch (opt) {
+        case 'u': url = optarg; break;
+        case 'n': config.devices = atoi(optarg); break;
+        case 'i': config.post_ms = atoi(optarg); break;
+        case 's': config.sample_ms = atoi(optarg); break;
+        case 'j': config.jitter = atof(optarg) / 100; break;
+        case 't': config.seconds = atoi(optarg); break;
+        case 'w': config.workers = atoi(optarg); break;
+        case 'k': config.api_key = optarg; break;
+        case 'r': config.report_s = atoi(optarg); break;
+        case 'T': config.timeout_ms = atoi(optarg); break;
+        case 'f':
+            if (strcmp(optarg, "tsc") == 0)
+                config.format = FLEET_TSC;
+            else if (strcmp(optarg, "frames") == 0)
+                config.format = FLEET_FRAMES;
+            else if (strcmp(optarg, "json") == 0)
+                config.format = FLEET_JSON;
+            else
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    if (url.empty() || config.devices <= 0 || config.workers <= 0 || config.post_ms == 0 || config.sample_ms == 0 ||
+        config.report_s <= 0)
+        usage();
+    if (! parse_url(url)) {
+        fprintf(stderr, "cannot resolve %s\n", url.c_str());
+        return 1;
+    }
+    config.workers = std::min(config.workers, config.devices);
+
+    // one socket per device
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t) config.devices + 64)
+        fprintf(stderr, "warning: open file limit %lu is below the device count\n", (unsigned long) rl.rlim_cur);
+
+    signal(SIGINT, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d devices on %d workers posting %s to %s every %u ms +- %.0f%%, %u ms samples\n", config.devices,
+           config.workers, FleetDevice::contentType(config.format), url.c_str(), config.post_ms, config.jitter * 100,
+           config.sample_ms);
+
+    std::vector<Worker*> workers;
+    std::vector<std::thread> threads;
+    for (int w = 0; w < config.workers; w++)
+        workers.push_back(new Worker(w));
+    for (int w = 0; w < config.workers; w++)
+        threads.push_back(std::thread(&Worker::run, workers[w]));
+
+    FleetStats total;
+    int64_t start = mono_ns(), last = start;
+    while (! stop_requested && (mono_ns() - start) / 1000000000 < config.seconds) {
+        int64_t next = last + (int64_t) config.report_s * 1000000000;
+        while (! stop_requested && mono_ns() < next && (mono_ns() - start) / 1000000000 < config.seconds)
+            usleep(50000);
+        FleetStats interval;
+        for (int w = 0; w < config.workers; w++) {
+            std::lock_guard<std::mutex> guard(workers[w]->lock);
+            interval.merge(workers[w]->stats);
+            workers[w]->stats.clear();
+        }
+        int64_t now = mono_ns();
+        char what[32];
+        snprintf(what, sizeof(what), "%6.1f s", (now - start) / 1e9);
+        print_stats(what, interval, (now - last) / 1e9);
+        total.merge(interval);
+        last = now;
+    }
+    stop_requested = true;
+    for (int w = 0; w < config.workers; w++) {
+        threads[w].join();
+        total.merge(workers[w]->stats);
+        delete workers[w];
+    }
+    print_stats("total", total, (mono_ns() - start) / 1e9);
+    return total.transport_errors || total.http_errors ? 1 : 0;
+}
@@ -0,0 +1,614 @@
+/****************************************************************************************************
+ * m2x_standin.cpp
+ *
+ * Local stand-in for the M2X ingest API that Project_5 posts to (api-m2x.att.com is gone), with
+ * fault injection so the upload path can be tested offline and repeatably.
+ *
+ * Serves HTTP/1.1 with keep-alive (Content-Length or chunked request bodies) from one epoll loop:
+ *   POST|PUT [/v2]/devices/<id>/update      single update, as post_latest()
+ *   POST     [/v2]/devices/<id>/updates     timestamped batch, as JournalUplink::upload()
+ * and answers 202 {"status":"accepted"} like M2X.  Bodies are checked by their Content-Type:
+ * telemetry frames and compressed blocks must decode (telemetry_codec.h, ts_compress.h), JSON
+ * must carry "values"; a bad body gets 422, an unknown type 415.
+ *
+ *   m2x_standin [options]
+ *      -p port (8080)              -a bind address (127.0.0.1)    -k required X-M2X-KEY
+ *      -l latency ms[:jitter ms]   -d drop %                      -e error %[:status] (503)
+ *      -s slow %[:ms] (5000)       -S seed (1)                    -o record file prefix
+ *      -r report interval s (5, 0 only at exit)                   -t seconds to run (until SIGINT)
+ *
+ * Faults are drawn from a hash of (seed, device, request number of that device), so the same
+ * traffic sees the same faults in every run, however the devices interleave:
+ *   drop     the body is stored but the connection is closed without a response (a lost
+ *            response, the device has to send the batch again)
+ *   error    nothing is stored, the response is the error status
+ *   slow     stored and answered, but the response is written in ten pieces over the slow time
+ *   latency  added before every response
+ *
+ * With -o, <prefix>.log gets one tab separated line per request and <prefix>.bodies every request
+ * body as received (the log has its offset).  Duplicates are samples at or before the newest one
+ * already stored for the device, i.e. batches the device sent again.
+ *
+ * Build: make standin (in Host_sim)
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "upload_body.h"
+
+#define STANDIN_SLOW_PIECES     10
+
+static int64_t mono_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/****************************************************************************************************
+// configuration
+ ****************************************************************************************************/
+struct StandinConfig {
+    int         port;
+    std::string bind_addr;
+    std::string api_key;
+    uint32_t    latency_ms;
+    uint32_t    latency_jitter_ms;
+    double      drop;
+    double      error;
+    int         error_status;
+    double      slow;
+    uint32_t    slow_ms;
+    uint64_t    seed;
+    std::string record;
+    int         report_s;
+    int         seconds;
+};
+
+static StandinConfig config;
+static volatile sig_atomic_t stop_requested = 0;
+
+// uniform in [0, 1) from (seed, device, request, salt): FNV-1a of the device, splitmix64 finish
+static double fault_draw(const std::string& device, uint64_t request, uint64_t salt)
+{
+    uint64_t x = 0xCBF29CE484222325ull ^ config.seed ^ (salt * 0x9E3779B97F4A7C15ull);
+    for (size_t i = 0; i < device.size(); i++)
+        x = (x ^ (uint8_t) device[i]) * 0x100000001B3ull;
+    x += request * 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/****************************************************************************************************
+// statistics
+ ****************************************************************************************************/
+struct StandinStats {
+    uint64_t    requests;
+    uint64_t    accepted;               // 2xx answered (slow ones included)
+    uint64_t    dropped;                // stored, closed without a response
+    uint64_t    errors;                 // injected error status
+    uint64_t    slow;
+    uint64_t    rejected;               // 4xx: routing, key, bad body
+    uint64_t    samples;                // stored
+    uint64_t    duplicates;             // stored again
+    uint64_t    bytes;                  // request bodies
+    uint64_t    connects;
+
+    StandinStats() { clear(); }
+
+    void clear()
+    {
+        requests = accepted = dropped = errors = slow = rejected = samples = duplicates = bytes = connects = 0;
+    }
+
+    void merge(const StandinStats& s)
+    {
+        requests += s.requests;
+        accepted += s.accepted;
+        dropped += s.dropped;
+        errors += s.errors;
+        slow += s.slow;
+        rejected += s.rejected;
+        samples += s.samples;
+        duplicates += s.duplicates;
+        bytes += s.bytes;
+        connects += s.connects;
+    }
+};
+
+struct DeviceState {
+    uint64_t    requests;
+    int64_t     newest_ms;              // newest stored sample
+
+    DeviceState() : requests(0), newest_ms(INT64_MIN) {}
+};
+
+static StandinStats stats;              // since the last report
+static std::unordered_map<std::string, DeviceState> devices;
+static FILE* record_log;
+static FILE* record_bodies;
+
+/****************************************************************************************************
+// connections
+ ****************************************************************************************************/
+enum ConnState { READING, WAITING, WRITING };
+
+struct Connection {
+    int         fd;
+    uint32_t    gen;                    // tells a timer of this connection from one of a reused fd
+    ConnState   state;
+    std::string in;
+    std::string out;
+    size_t      out_pos;
+    size_t      out_limit;              // a slow response is released piece by piece
+    uint32_t    piece_ms;
+    bool        drop;
+    bool        close_after;
+};
+
+struct Due {
+    int64_t     ms;
+    int         fd;
+    uint32_t    gen;
+    bool operator<(const Due& d) const { return ms > d.ms; }
+};
+
+static int epfd;
+static std::vector<Connection*> conns;  // by fd
+static std::priority_queue<Due> due;
+static uint32_t next_gen;
+static int open_conns;
+static int64_t start_ms;
+
+static void watch(Connection& c, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = c.fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+static void close_conn(Connection* c)
+{
+    close(c->fd);
+    conns[c->fd] = NULL;
+    delete c;
+    open_conns--;
+}
+
+static const char* reason(int status)
+{
+    switch (status) {
+    case 202: return "Accepted";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 415: return "Unsupported Media Type";
+    case 422: return "Unprocessable Entity";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default:  return "Error";
+    }
+}
+
+static void set_response(Connection& c, int status)
+{
+    char body[64], head[256];
+    if (status == 202)
+        snprintf(body, sizeof(body), "{\"status\":\"accepted\"}");
+    else
+        snprintf(body, sizeof(body), "{\"message\":\"%s\"}", reason(status));
+    int len = snprintf(head, sizeof(head),
+                       "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %u\r\n%s\r\n",
+                       status, reason(status), (unsigned) strlen(body), c.close_after ? "Connection: close\r\n" : "");
+    c.out.assign(head, len);
+    c.out += body;
+    c.out_pos = 0;
+    c.out_limit = c.out.size();
+}
+
+static void record(int64_t now, const std::string& device, const std::string& endpoint, const HttpRequest& req,
+                   size_t samples, size_t duplicates, const char* outcome, int status, uint32_t delay_ms)
+{
+    if (! record_log)
+        return;
+    long offset = ftell(record_bodies);
+    fwrite(req.body.data(), 1, req.body.size(), record_bodies);
+    fprintf(record_log, "%lld\t%s\t%s %s\t%s\t%u\t%u\t%u\t%s%d\t%u\t%ld\n", (long long) (now - start_ms),
+            device.empty() ? "-" : device.c_str(), req.method.c_str(), endpoint.c_str(),
+            req.content_type.empty() ? "-" : req.content_type.c_str(), (unsigned) req.body.size(), (unsigned) samples,
+            (unsigned) duplicates, outcome, status, delay_ms, offset);
+}
+
+// decide the answer to one request; the response goes out when its delay is due
+static void process(Connection& c, HttpRequest& req)
+{
+    int64_t now = mono_ms();
+    std::string device, endpoint = req.path;
+    std::vector<int64_t> times;
+    size_t samples = 0, duplicates = 0;
+    const char* outcome = "";
+    uint32_t delay_ms = 0;
+
+    stats.requests++;
+    stats.bytes += req.body.size();
+    c.close_after = req.close;
+    c.drop = false;
+    c.piece_ms = 0;
+
+    int status = upload_route(req.method, req.path, device, endpoint);
+    if (status == 0 && ! config.api_key.empty() && req.api_key != config.api_key)
+        status = 401;
+    if (status == 0)
+        status = upload_check(req.content_type, req.body, times);
+
+    if (status != 0) {
+        stats.rejected++;
+    } else {
+        DeviceState& d = devices[device];
+        uint64_t n = d.requests++;
+        delay_ms = config.latency_ms;
+        if (config.latency_jitter_ms)
+            delay_ms += (uint32_t) (fault_draw(device, n, 1) * (config.latency_jitter_ms + 1));
+
+        if (fault_draw(device, n, 2) < config.error) {
+            status = config.error_status;
+            stats.errors++;
+        } else {
+            // stored, M2X keys values by timestamp so a batch sent again only adds duplicates
+            std::sort(times.begin(), times.end());
+            times.erase(std::unique(times.begin(), times.end()), times.end());
+            samples = times.size();
+            for (size_t i = 0; i < times.size(); i++) {
+                if (times[i] == INT64_MIN)
+                    continue;
+                if (times[i] <= d.newest_ms)
+                    duplicates++;
+                else
+                    d.newest_ms = times[i];
+            }
+            stats.samples += samples - duplicates;
+            stats.duplicates += duplicates;
+            status = 202;
+
+            if (fault_draw(device, n, 3) < config.drop) {
+                c.drop = true;
+                outcome = "drop ";
+                stats.dropped++;
+            } else if (fault_draw(device, n, 4) < config.slow) {
+                c.piece_ms = config.slow_ms / STANDIN_SLOW_PIECES;
+                outcome = "slow ";
+                stats.slow++;
+                stats.accepted++;
+            } else {
+                stats.accepted++;
+            }
+        }
+    }
+    record(now, device, endpoint, req, samples, duplicates, outcome, status, delay_ms);
+
+    set_response(c, status);
+    if (c.piece_ms)
+        c.out_limit = 0;
+    c.state = WAITING;
+    due.push(Due{ now + delay_ms, c.fd, c.gen });
+}
+
+static void read_requests(Connection* c);
+
+// returns false once the connection is closed
+static bool write_some(Connection* c)
+{
+    while (c->out_pos < c->out_limit) {
+        ssize_t n = send(c->fd, c->out.data() + c->out_pos, c->out_limit - c->out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN) {
+                close_conn(c);
+                return false;
+            }
+            watch(*c, EPOLLOUT | EPOLLRDHUP);
+            return true;
+        }
+        c->out_pos += n;
+    }
+    if (c->out_pos < c->out.size()) {
+        watch(*c, EPOLLRDHUP);          // the next slow piece is due later
+        return true;
+    }
+
+    if (c->close_after) {
+        close_conn(c);
+        return false;
+    }
+    c->state = READING;
+    watch(*c, EPOLLIN | EPOLLRDHUP);
+    read_requests(c);                   // a pipelined request may be waiting
+    return true;
+}
+
+// the response delay of a connection is over, or the next piece of a slow response is due
+static void on_due(Connection* c)
+{
+    if (c->drop) {
+        close_conn(c);
+        return;
+    }
+    c->state = WRITING;
+    if (c->piece_ms) {
+        size_t piece = (c->out.size() + STANDIN_SLOW_PIECES - 1) / STANDIN_SLOW_PIECES;
+        c->out_limit = std::min(c->out.size(), c->out_limit + piece);
+        if (c->out_limit < c->out.size())
+            due.push(Due{ mono_ms() + c->piece_ms, c->fd, c->gen });
+    }
+    write_some(c);
+}
+
+static void read_requests(Connection* c)
+{
+    HttpRequest req;
+    int ret = http_parse_request(c->in, req);
+    if (ret == 0)
+        return;
+    if (ret < 0) {
+        stats.requests++;
+        stats.rejected++;
+        c->close_after = true;
+        c->drop = false;
+        c->piece_ms = 0;
+        set_response(*c, 400);
+        c->state = WRITING;
+        write_some(c);
+        return;
+    }
+    process(*c, req);
+    // no reads while the response is pending, the client waits for it anyway
+    watch(*c, EPOLLRDHUP);
+}
+
+static void on_readable(Connection* c, uint32_t events)
+{
+    char buf[16384];
+    int fd = c->fd;
+    bool eof = false;
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c->in.append(buf, n);
+            continue;
+        }
+        if (n == 0 || errno != EAGAIN)
+            eof = true;
+        break;
+    }
+    if (c->state == READING && ! c->in.empty())
+        read_requests(c);
+    else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        eof = true;
+    // the client went away: whatever was answered or pending is lost with the socket
+    if (eof && conns[fd] == c)
+        close_conn(c);
+}
+
+static void on_accept(int listen_fd)
+{
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0)
+            return;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if ((size_t) fd >= conns.size())
+            conns.resize(fd + 1, NULL);
+        Connection* c = new Connection();
+        c->fd = fd;
+        c->gen = ++next_gen;
+        c->state = READING;
+        c->out_pos = c->out_limit = 0;
+        c->piece_ms = 0;
+        c->drop = c->close_after = false;
+        conns[fd] = c;
+        open_conns++;
+        stats.connects++;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/****************************************************************************************************
+// main
+ ****************************************************************************************************/
+static void usage()
+{
+    fprintf(stderr, "usage: m2x_standin [-p port] [-a bind_addr] [-k api_key] [-l latency_ms[:jitter_ms]] [-d drop%%]\n"
+                    "                   [-e error%%[:status]] [-s slow%%[:ms]] [-S seed] [-o record_prefix]\n"
+                    "                   [-r report_s] [-t seconds]\n");
+    exit(2);
+}
+
+static void on_signal(int)
+{
+    stop_requested = 1;
+}
+
+// "a[:b]" -> a and, when given, b
+static void parse_pair(const char* arg, double& a, double& b)
+{
+    char* end;
+    a = strtod(arg, &end);
+    if (*end == ':')
+        b = strtod(end + 1, NULL);
+}
+
+static void print_stats(const char* what, const StandinStats& s, double seconds)
+{
+    printf("%s: %.1f req/s  %.1f samples/s  %.1f kB/s  accepted %llu  dropped %llu  errors %llu  slow %llu  "
+           "rejected %llu  duplicates %llu  connects %llu  open %d\n",
+           what, s.requests / seconds, s.samples / seconds, s.bytes / seconds / 1000, (unsigned long long) s.accepted,
+           (unsigned long long) s.dropped, (unsigned long long) s.errors, (unsigned long long) s.slow,
+           (unsigned long long) s.rejected, (unsigned long long) s.duplicates, (unsigned long long) s.connects,
+           open_conns);
+}
+
+int main(int argc, char** argv)
+{
+    double latency = 0, jitter = 0, error_status = 503, slow_ms = 5000;
+    config.port = 8080;
+    config.bind_addr = "127.0.0.1";
+    config.seed = 1;
+    config.report_s = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:a:k:l:d:e:s:S:o:r:t:")) != -1) {
+        switch (opt) {
+        case 'p': config.port = atoi(optarg); break;
+        case 'a': config.bind_addr = optarg; break;
+        case 'k': config.api_key = optarg; break;
+        case 'l': parse_pair(optarg, latency, jitter); break;
+        case 'd': config.drop = atof(optarg) / 100; break;
+        case 'e': parse_pair(optarg, config.error, error_status); config.error /= 100; break;
+        case 's': parse_pair(optarg, config.slow, slow_ms); config.slow /= 100; break;
+        case 'S': config.seed = strtoull(optarg, NULL, 0); break;
+        case 'o': config.record = optarg; break;
+        case 'r': config.report_s = atoi(optarg); break;
+        case 't': config.seconds = atoi(optarg); break;
+        default:
+            usage();
+        }
+    }
+    config.latency_ms = (uint32_t) latency;
+    config.latency_jitter_ms = (uint32_t) jitter;
+    config.error_status = (int) error_status;
+    config.slow_ms = (uint32_t) slow_ms;
+    if (optind != argc || config.port <= 0 || config.report_s < 0 || config.error_status < 100 ||
+        config.error_status > 599)
+        usage();
+
+    if (! config.record.empty()) {
+        std::string log_path = config.record + ".log", bodies_path = config.record + ".bodies";
+        record_log = fopen(log_path.c_str(), "w");
+        record_bodies = fopen(bodies_path.c_str(), "wb");
+        if (! record_log || ! record_bodies) {
+            perror(config.record.c_str());
+            return 1;
+        }
+        fprintf(record_log, "ms\tdevice\trequest\tcontent_type\tbytes\tsamples\tduplicates\tstatus\tdelay_ms\toffset\n");
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    if (inet_pton(AF_INET, config.bind_addr.c_str(), &addr.sin_addr) != 1)
+        usage();
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, 1024) != 0) {
+        perror("listen");
+        return 1;
+    }
+
+    // one socket per device
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    printf("M2X stand-in on %s:%d: latency %u+%u ms, drop %.1f%%, error %.1f%% (%d), slow %.1f%% (%u ms), seed %llu\n",
+           config.bind_addr.c_str(), config.port, config.latency_ms, config.latency_jitter_ms, config.drop * 100,
+           config.error * 100, config.error_status, config.slow * 100, config.slow_ms,
+           (unsigned long long) config.seed);
+    fflush(stdout);
+
+    StandinStats total;
+    start_ms = mono_ms();
+    int64_t last_report = start_ms;
+    struct epoll_event events[256];
+    while (! stop_requested) {
+        int64_t now = mono_ms();
+        if (config.seconds && now - start_ms >= (int64_t) config.seconds * 1000)
+            break;
+        while (! due.empty() && due.top().ms <= now) {
+            Due d = due.top();
+            due.pop();
+            Connection* c = (size_t) d.fd < conns.size() ? conns[d.fd] : NULL;
+            if (c && c->gen == d.gen)
+                on_due(c);
+        }
+        if (config.report_s && now - last_report >= (int64_t) config.report_s * 1000) {
+            char what[32];
+            snprintf(what, sizeof(what), "%6.1f s", (now - start_ms) / 1e3);
+            print_stats(what, stats, (now - last_report) / 1e3);
+            fflush(stdout);
+            if (record_log) {
+                fflush(record_log);
+                fflush(record_bodies);
+            }
+            total.merge(stats);
+            stats.clear();
+            last_report = now;
+        }
+
+        int wait_ms = 100;
+        if (! due.empty())
+            wait_ms = (int) std::max<int64_t>(0, std::min<int64_t>(wait_ms, due.top().ms - mono_ms()));
+        int n = epoll_wait(epfd, events, 256, wait_ms);
+        for (int e = 0; e < n; e++) {
+            int fd = events[e].data.fd;
+            if (fd == listen_fd) {
+                on_accept(listen_fd);
+                continue;
+            }
+            Connection* c = conns[fd];
+            if (! c)
+                continue;
+            if (c->state == WRITING && (events[e].events & EPOLLOUT))
+                write_some(c);
+            else
+                on_readable(c, events[e].events);
+        }
+    }
+
+    total.merge(stats);
+    print_stats("total", total, std::max<int64_t>(1, mono_ms() - start_ms) / 1e3);
+    printf("%lu devices\n", (unsigned long) devices.size());
+    if (record_log) {
+        fclose(record_log);
+        fclose(record_bodies);
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+/****************************************************************************************************
+ * mbed.h (Host_sim)
+ *
+ * The part of the mbed 2 API used by the Project_5 sampling code, on top of the simulated HAL in
+ * sim_hal.h.  Interrupt handlers (InterruptIn, Timeout, Ticker, I2C::transfer callbacks) run from
+ * the event queue, interleaved with the program only where it waits, just like a single core
+ * taking interrupts.
+ ****************************************************************************************************/
+#ifndef MBED_H
+#define MBED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "sim_hal.h"
+
+#define DEVICE_I2C_ASYNCH   1
+
+enum PinName {
+    PA_0, PA_1, PA_2, PA_3, PA_4, PA_5, PA_6, PA_7, PA_8, PA_9, PA_10, PA_11, PA_12, PA_13, PA_14, PA_15,
+    PB_0, PB_1, PB_2, PB_3, PB_4, PB_5, PB_6, PB_7, PB_8, PB_9, PB_10, PB_12, PB_13, PB_14, PB_15,
+    PC_0, PC_1, PC_2, PC_3, PC_4, PC_5, PC_6, PC_7, PC_8, PC_9, PC_10, PC_11, PC_12, PC_13,
+    D0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13, A0, A1, A2, A3, A4, A5,
+    I2C_SDA, I2C_SCL, USBTX, USBRX, RADIO_TX, RADIO_RX, RADIO_RTS, RADIO_CTS,
+    NC = -1
+};
+
+enum PinMode { PullNone, PullUp, PullDown };
+
+static inline void __DMB() {}
+static inline void __disable_irq() {}
+static inline void __enable_irq() {}
+
+uint32_t us_ticker_read();
+void set_time(time_t t);
+void wait(float s);
+void wait_ms(int ms);
+void wait_us(int us);
+void error(const char* format, ...);
+
+// MCU sleep: nothing to do, time passes in Thread::signal_wait()
+static inline void sleep() {}
+
+/****************************************************************************************************
+// callbacks
+ ****************************************************************************************************/
+template<typename R, typename A>
+class FunctionPointerArg1
+{
+public:
+    FunctionPointerArg1() {}
+    FunctionPointerArg1(R (*fn)(A)) { attach(fn); }
+    void attach(R (*fn)(A)) { f = fn; }
+    template<typename T> void attach(T* obj, R (T::*method)(A))
+    {
+        f = [obj, method](A a) { return (obj->*method)(a); };
+    }
+    R call(A a) const { return f(a); }
+    operator bool() const { return (bool) f; }
+
+private:
+    std::function<R(A)> f;
+};
+
+typedef FunctionPointerArg1<void, int> event_callback_t;
+
+/****************************************************************************************************
+// time
+ ****************************************************************************************************/
+class Timer
+{
+public:
+    Timer() : running(false), start_us(0), total_us(0) {}
+    void start() { if (! running) { start_us = sim::now_us(); running = true; } }
+    void stop() { total_us = elapsed(); running = false; }
+    void reset() { start_us = sim::now_us(); total_us = 0; }
+    float read() { return elapsed() / 1e6f; }
+    int read_ms() { return (int) (elapsed() / 1000); }
+    int read_us() { return (int) elapsed(); }
+    operator float() { return read(); }
+
+private:
+    uint64_t elapsed() { return total_us + (running ? sim::now_us() - start_us : 0); }
+    bool        running;
+    uint64_t    start_us;
+    uint64_t    total_us;
+};
+
+class Timeout
+{
+public:
+    Timeout() : id(0) {}
+    ~Timeout() { detach(); }
+    void attach(void (*fn)(), float s) { arm(fn, (uint64_t) (s * 1e6f)); }
+    void attach_us(void (*fn)(), uint32_t us) { arm(fn, us); }
+    template<typename T> void attach(T* obj, void (T::*method)(), float s)
+    {
+        arm([obj, method]() { (obj->*method)(); }, (uint64_t) (s * 1e6f));
+    }
+    template<typename T> void attach_us(T* obj, void (T::*method)(), uint32_t us)
+    {
+        arm([obj, method]() { (obj->*method)(); }, us);
+    }
+    void detach() { if (id) sim::cancel(id); id = 0; }
+
+protected:
+    virtual void arm(std::function<void()> fn, uint64_t us)
+    {
+        detach();
+        id = sim::schedule(sim::now_us() + us, [this, fn]() { id = 0; fn(); });
+    }
+    sim::EventId id;
+};
+
+class Ticker : public Timeout
+{
+protected:
+    virtual void arm(std::function<void()> fn, uint64_t us)
+    {
+        detach();
+        handler = fn;
+        period_us = us ? us : 1;
+        next_us = sim::now_us() + period_us;
+        fire_at();
+    }
+
+private:
+    void fire_at()
+    {
+        id = sim::schedule(next_us, [this]() { next_us += period_us; fire_at(); handler(); });
+    }
+    std::function<void()>   handler;
+    uint64_t                period_us;
+    uint64_t                next_us;
+};
+
+/****************************************************************************************************
+// pins
+ ****************************************************************************************************/
+class AnalogIn
+{
+public:
+    AnalogIn(PinName pin) : pin(pin) {}
+    float read() { return (read_u16() >> 4) / 4095.0f; }
+    // 12-bit conversion scaled to 16 bits like the STM32 target
+    unsigned short read_u16()
+    {
+        float level = sim::analog_level(pin);
+        int raw = level <= 0 ? 0 : level >= 1 ? 4095 : (int) (level * 4095 + 0.5f);
+        return (unsigned short) ((raw << 4) | (raw >> 8));
+    }
+    operator float() { return read(); }
+
+private:
+    PinName pin;
+};
+
+class DigitalIn
+{
+public:
+    DigitalIn(PinName pin) : pin(pin) {}
+    void mode(PinMode) {}
+    int read() { return sim::digital_level(pin); }
+    operator int() { return read(); }
+
+private:
+    PinName pin;
+};
+
+class DigitalOut
+{
+public:
+    DigitalOut(PinName pin, int value = 0) : pin(pin), value(value) {}
+    void write(int v) { value = v; }
+    int read() { return value; }
+    DigitalOut& operator=(int v) { write(v); return *this; }
+    operator int() { return read(); }
+
+private:
+    PinName pin;
+    int     value;
+};
+
+class InterruptIn
+{
+public:
+    InterruptIn(PinName pin) : pin(pin) {}
+    void rise(void (*fn)()) { sim::pin_on_edge(pin, true, fn); }
+    void fall(void (*fn)()) { sim::pin_on_edge(pin, false, fn); }
+    template<typename T> void rise(T* obj, void (T::*method)())
+    {
+        sim::pin_on_edge(pin, true, [obj, method]() { (obj->*method)(); });
+    }
+    template<typename T> void fall(T* obj, void (T::*method)())
+    {
+        sim::pin_on_edge(pin, false, [obj, method]() { (obj->*method)(); });
+    }
+    void mode(PinMode) {}
+    int read() { return sim::digital_level(pin); }
+
+private:
+    PinName pin;
+};
+
+class Serial
+{
+public:
+    Serial(PinName, PinName) {}
+    void baud(int) {}
+    int printf(const char* fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vprintf(fmt, ap);
+        va_end(ap);
+        return n;
+    }
+    int putc(int c) { return putchar(c); }
+    int getc() { return EOF; }
+    int readable() { return 0; }
+};
+
+/****************************************************************************************************
+// I2C
+ ****************************************************************************************************/
+#define I2C_EVENT_ERROR                 (1 << 1)
+#define I2C_EVENT_ERROR_NO_SLAVE        (1 << 2)
+#define I2C_EVENT_TRANSFER_COMPLETE     (1 << 3)
+#define I2C_EVENT_TRANSFER_EARLY_NACK   (1 << 4)
+#define I2C_EVENT_ALL                   (I2C_EVENT_ERROR | I2C_EVENT_TRANSFER_COMPLETE | \
+                                         I2C_EVENT_ERROR_NO_SLAVE | I2C_EVENT_TRANSFER_EARLY_NACK)
+
+class I2C
+{
+public:
+    I2C(PinName sda, PinName scl);
+    void frequency(int hz);
+
+    // blocking, return 0 on acknowledge; the CPU is busy for the bus time
+    int read(int address, char* data, int length, bool repeated = false);
+    int write(int address, const char* data, int length, bool repeated = false);
+
+    // asynchronous write + repeated start + read, callback runs at completion time
+    int transfer(int address, const char* tx, int tx_length, char* rx, int rx_length,
+                 const event_callback_t& callback, int event = I2C_EVENT_TRANSFER_COMPLETE, bool repeated = false);
+    void abort_transfer();
+
+private:
+    bool            busy;
+    sim::EventId    done_id;
+};
+
+#endif
@@ -0,0 +1,1562 @@
+/****************************************************************************************************
+ * modem_emu.cpp
+ *
+ * Scriptable emulator of the Dragonfly's Telit radio on a Linux pseudo-terminal, so the SMS and
+ * data paths of Project_3 and Project_5 (mtsas Cellular, Common/at_engine.h) can be run and
+ * measured without a SIM or coverage.  Programs open the pty's slave side as their radio UART.
+ *
+ * Emulated: AT, ATE, ATI, ATH, ATO, +CGMI/+CGMM/+CGMR/+CGSN/+CIMI, +CSQ, +CREG/+CGREG/+CEREG (with
+ * the URCs of mode 1 and 2), +CMGF, +CMGS (text mode, "> " prompt, Ctrl-Z/ESC), +CMGL, +CMGR,
+ * +CMGD, +CNMI (+CMTI or +CMT for new messages), +CPMS, +CGDCONT, +CCLK, +CFUN, +CMEE, and the
+ * Telit IP stack mtsas uses: #SGACT, #SD (TCP or UDP, online mode), #SO, #SH, #SS.  Data mode is
+ * carried by a real host socket: #SD connects to the given host (or where -H maps it, e.g. the
+ * M2X and CoAP stand-ins), "+++" between guard times suspends it.  ATD*99# starts the -P command
+ * (e.g. pppd notty) on the data stream, so PPP runs against the host's TCP stack.  Anything else
+ * answers ERROR.
+ *
+ *   modem_emu [options]
+ *      -L link             symlink to the pty slave (the slave name is printed either way)
+ *      -f script           timed events, below                 -c csq (20)
+ *      -g seconds          searching (+CREG 2) before registering (0)
+ *      -d ms               delay before every response (0)     -G guard ms for "+++" (500)
+ *      -H host[:port]=addr:port  where #SD connects for host   -P command for ATD*99# data mode
+ *      -n number           own number, an SMS sent to it comes back as a new message
+ *      -o file             record the transcript               -R file  replay a transcript
+ *      -T tty[:baud]       capture: pass through to a real modem (115200) and record
+ *      -t seconds          run time (until SIGINT or the script's end)     -v  log every line
+ *
+ * Script lines are "time verb args", the time in seconds from the start, or "+seconds" after the
+ * previous event; '#' starts a comment:
+ *      csq N               signal (99: lost, drops the data connection)
+ *      creg N              registration: 0 not registered, 1 home, 2 searching, 3 denied, 5 roaming;
+ *                          anything but 1 and 5 drops the data connection
+ *      sms NUMBER TEXT     a message arrives
+ *      delay MS [PREFIX]   response delay for commands starting with PREFIX (all without)
+ *      silent PREFIX       commands starting with PREFIX are not answered; "answer PREFIX" undoes
+ *      drop                the peer closes the data connection
+ *      urc TEXT            send TEXT as an unsolicited line
+ *      end                 stop
+ *
+ * A transcript has one line per read or write: "ms<TAB>dir<TAB>bytes", dir '>' from the program
+ * to the modem, '<' from the modem, '#' events; bytes escaped as \r \n \t \\ \xNN.  Replaying
+ * one (-R) plays the modem side: each '<' record goes out when everything the program sent before
+ * it has arrived, after the recorded gap, and the program's bytes must match the recording byte by
+ * byte (reads may be split differently); the first mismatch ends the replay with exit status 1.
+ * With -T, transcripts of a real modem are captured for that.
+ *
+ * Build: make modem (in Host_sim)
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#define MODEM_MAX_LINE          560     // command line, +CMGS text included
+#define MODEM_SMS_SLOTS         30      // "SM" storage
+#define MODEM_SMS_MAX           160
+#define MODEM_MAX_OUT           65536   // queued output before the data socket stops being read
+#define MODEM_CTRL_Z            0x1A
+#define MODEM_ESC               0x1B
+
+static int64_t mono_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t start_ms;
+
+static int64_t now_ms()
+{
+    return mono_ms() - start_ms;
+}
+
+static bool starts_with_nocase(const std::string& s, const std::string& prefix)
+{
+    return s.size() >= prefix.size() && strncasecmp(s.c_str(), prefix.c_str(), prefix.size()) == 0;
+}
+
+static std::string upper(std::string s)
+{
+    for (size_t i = 0; i < s.size(); i++)
+        s[i] = toupper((unsigned char) s[i]);
+    return s;
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/****************************************************************************************************
+// configuration
+ ****************************************************************************************************/
+struct ModemConfig {
+    std::string link;
+    std::string script;
+    std::string record;
+    std::string replay;
+    std::string capture;
+    std::string ppp_command;
+    std::string own_number;
+    std::map<std::string, std::string> host_map;    // "host" or "host:port" -> "addr:port"
+    int         csq;
+    int         register_after_s;
+    int         delay_ms;
+    int         guard_ms;
+    int         seconds;
+    bool        verbose;
+};
+
+static ModemConfig config;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+    stop_requested = 1;
+}
+
+/****************************************************************************************************
+// transcript
+ ****************************************************************************************************/
+static FILE* record_file;
+
+static std::string escape(const char* data, int len)
+{
+    std::string s;
+    for (int i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        char hex[5];
+        if (c == '\r') s += "\\r";
+        else if (c == '\n') s += "\\n";
+        else if (c == '\t') s += "\\t";
+        else if (c == '\\') s += "\\\\";
+        else if (c < 0x20 || c >= 0x7F) { snprintf(hex, sizeof(hex), "\\x%02X", c); s += hex; }
+        else s += (char) c;
+    }
+    return s;
+}
+
+static bool unescape(const std::string& s, std::string& out)
+{
+    out.clear();
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] != '\\') {
+            out += s[i];
+            continue;
+        }
+        if (++i == s.size())
+            return false;
+        switch (s[i]) {
+        case 'r': out += '\r'; break;
+        case 'n': out += '\n'; break;
+        case 't': out += '\t'; break;
+        case '\\': out += '\\'; break;
+        case 'x':
+            if (i + 2 >= s.size() || ! isxdigit((unsigned char) s[i + 1]) || ! isxdigit((unsigned char) s[i + 2]))
+                return false;
+            out += (char) strtol(s.substr(i + 1, 2).c_str(), NULL, 16);
+            i += 2;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+static void record(char dir, const char* data, int len)
+{
+    if (record_file && len > 0) {
+        fprintf(record_file, "%lld\t%c\t%s\n", (long long) now_ms(), dir, escape(data, len).c_str());
+        fflush(record_file);
+    }
+}
+
+static void note(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// event for the console and the transcript
+static void note(const char* fmt, ...)
+{
+    char text[600];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    printf("[%8.3f] %s\n", now_ms() / 1000.0, text);
+    fflush(stdout);
+    record('#', text, strlen(text));
+}
+
+/****************************************************************************************************
+// pty
+ ****************************************************************************************************/
+static int pty_fd = -1;
+static int pty_keep_fd = -1;            // our own slave fd: no hangup while the program has it closed
+static std::string pty_name;
+
+static bool open_pty()
+{
+    pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_fd < 0 || grantpt(pty_fd) || unlockpt(pty_fd)) {
+        perror("pty");
+        return false;
+    }
+    pty_name = ptsname(pty_fd);
+    pty_keep_fd = open(pty_name.c_str(), O_RDWR | O_NOCTTY);
+    if (pty_keep_fd < 0) {
+        perror(pty_name.c_str());
+        return false;
+    }
+    struct termios tio;
+    tcgetattr(pty_keep_fd, &tio);
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, B115200);
+    tcsetattr(pty_keep_fd, TCSANOW, &tio);
+    set_nonblocking(pty_fd);
+
+    if (! config.link.empty()) {
+        unlink(config.link.c_str());
+        if (symlink(pty_name.c_str(), config.link.c_str())) {
+            perror(config.link.c_str());
+            return false;
+        }
+    }
+    printf("modem on %s%s%s\n", pty_name.c_str(), config.link.empty() ? "" : " as ", config.link.c_str());
+    fflush(stdout);
+    return true;
+}
+
+// output to the program, in order, each piece not before its due time
+struct PendingOut {
+    int64_t     due;
+    std::string data;
+};
+
+static std::deque<PendingOut> out_queue;
+static size_t out_bytes;
+
+static void out(const std::string& data, int delay_ms = 0)
+{
+    if (data.empty())
+        return;
+    int64_t due = now_ms() + delay_ms;
+    out_bytes += data.size();
+    if (! out_queue.empty()) {
+        due = std::max(due, out_queue.back().due);
+        if (due == out_queue.back().due) {
+            out_queue.back().data += data;      // echo comes a byte at a time
+            return;
+        }
+    }
+    PendingOut p = { due, data };
+    out_queue.push_back(p);
+}
+
+static void flush_out()
+{
+    while (! out_queue.empty() && out_queue.front().due <= now_ms()) {
+        std::string& data = out_queue.front().data;
+        ssize_t n = write(pty_fd, data.data(), data.size());
+        if (n <= 0)
+            return;                     // the program is not reading, POLLOUT
+        record('<', data.data(), n);
+        if (config.verbose)
+            note("< %s", escape(data.data(), n).c_str());
+        out_bytes -= n;
+        if ((size_t) n < data.size()) {
+            data.erase(0, n);
+            return;
+        }
+        out_queue.pop_front();
+    }
+}
+
+static int out_wait_ms()
+{
+    if (out_queue.empty())
+        return -1;
+    return (int) std::max<int64_t>(0, out_queue.front().due - now_ms());
+}
+
+/****************************************************************************************************
+// script
+ ****************************************************************************************************/
+struct ScriptEvent {
+    int64_t                     at_ms;
+    std::string                 verb;
+    std::vector<std::string>    args;
+    std::string                 rest;       // everything after the first argument
+    int                         line;
+};
+
+static std::vector<ScriptEvent> script;
+static size_t script_next;
+
+static bool event_before(const ScriptEvent& a, const ScriptEvent& b)
+{
+    return a.at_ms < b.at_ms;
+}
+
+// an event from the emulator itself, after the ones already due at that time
+static void schedule(int64_t at_ms, const std::string& verb, const std::vector<std::string>& args,
+                     const std::string& rest)
+{
+    ScriptEvent ev;
+    ev.at_ms = at_ms;
+    ev.verb = verb;
+    ev.args = args;
+    ev.rest = rest;
+    ev.line = 0;
+    script.insert(std::upper_bound(script.begin() + script_next, script.end(), ev, event_before), ev);
+}
+
+static bool load_script(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (! f) {
+        perror(path.c_str());
+        return false;
+    }
+    char buf[1024];
+    int line_no = 0;
+    int64_t last = 0;
+    while (fgets(buf, sizeof(buf), f)) {
+        line_no++;
+        char* hash = strchr(buf, '#');
+        if (hash)
+            *hash = '\0';
+        char* p = buf;
+        char* tok = strtok(p, " \t\r\n");
+        if (! tok)
+            continue;
+        ScriptEvent ev;
+        ev.line = line_no;
+        double t = atof(tok + (tok[0] == '+'));
+        ev.at_ms = (tok[0] == '+' ? last : 0) + (int64_t) (t * 1000);
+        char* verb = strtok(NULL, " \t\r\n");
+        if (! verb) {
+            fprintf(stderr, "%s:%d: no event\n", path.c_str(), line_no);
+            fclose(f);
+            return false;
+        }
+        ev.verb = verb;
+        char* rest = strtok(NULL, "\r\n");
+        if (rest) {
+            while (*rest == ' ' || *rest == '\t')
+                rest++;
+            char* end = rest + strlen(rest);
+            while (end > rest && (end[-1] == ' ' || end[-1] == '\t'))
+                *--end = '\0';
+            std::string r = rest;
+            size_t sp = r.find_first_of(" \t");
+            ev.rest = sp == std::string::npos ? "" : r.substr(r.find_first_not_of(" \t", sp));
+            for (char* a = strtok(rest, " \t"); a; a = strtok(NULL, " \t"))
+                ev.args.push_back(a);
+        }
+        last = ev.at_ms;
+        script.push_back(ev);
+    }
+    fclose(f);
+    std::stable_sort(script.begin(), script.end(), event_before);
+    return true;
+}
+
+/****************************************************************************************************
+// modem state
+ ****************************************************************************************************/
+struct Sms {
+    bool        used;
+    std::string status;                 // "REC UNREAD", "REC READ", "STO SENT"
+    std::string number;
+    std::string time;
+    std::string text;
+};
+
+enum DataKind { DATA_NONE, DATA_TCP, DATA_UDP, DATA_PPP };
+enum Final { FINAL_OK, FINAL_ERROR, FINAL_DONE };
+
+struct ModemStats {
+    uint64_t    commands;
+    uint64_t    errors;
+    uint64_t    unknown;
+    uint64_t    silenced;
+    uint64_t    sms_sent;
+    uint64_t    sms_received;
+    uint64_t    sms_lost;               // storage full
+    uint64_t    sessions;
+    uint64_t    escapes;
+    uint64_t    drops;                  // data connections ended by the script or signal loss
+    uint64_t    bytes_up;
+    uint64_t    bytes_down;
+};
+
+static struct {
+    bool        echo;
+    int         csq;
+    int         reg;
+    int         reg_urc[3];             // +CREG, +CGREG, +CEREG mode
+    int         cmee;                   // +CMEE error reporting mode
+    int         cmgf;
+    int         cnmi_mode;
+    int         cnmi_mt;
+    int         message_ref;
+    Sms         sms[MODEM_SMS_SLOTS + 1];   // index 1..
+    std::map<int, std::string> contexts;    // +CGDCONT cid -> APN
+    bool        pdp_active;
+
+    // command line
+    std::string line;
+    bool        sms_input;
+    std::string sms_number;
+    std::string sms_command;            // for the response delay
+
+    // data connection
+    DataKind    data;
+    int         data_fd;
+    pid_t       data_pid;
+    bool        online;                 // bytes go to data_fd, not the command parser
+    int         plus_count;             // "+++" being collected
+    int64_t     last_in_ms;
+    int64_t     escape_at;              // "+++" followed by the guard time: command mode then
+
+    std::vector<std::string> held_urcs; // raised during data mode
+    std::vector<std::pair<std::string, int> > delays;
+    std::vector<std::string> silent;
+} modem;
+
+static ModemStats stats;
+
+static bool registered()
+{
+    return (modem.reg == 1 || modem.reg == 5) && modem.csq != 99;
+}
+
+static std::string network_time()
+{
+    time_t t = time(NULL);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%02d/%02d/%02d,%02d:%02d:%02d+00", tm.tm_year % 100, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec);
+    return buf;
+}
+
+static void urc(const std::string& text)
+{
+    if (modem.online) {
+        modem.held_urcs.push_back(text);
+        return;
+    }
+    out("\r\n" + text + "\r\n");
+}
+
+static void flush_held_urcs()
+{
+    for (size_t i = 0; i < modem.held_urcs.size(); i++)
+        out("\r\n" + modem.held_urcs[i] + "\r\n");
+    modem.held_urcs.clear();
+}
+
+static int response_delay(const std::string& command)
+{
+    size_t best = 0;
+    int ms = config.delay_ms;
+    for (size_t i = 0; i < modem.delays.size(); i++) {
+        const std::string& prefix = modem.delays[i].first;
+        if (prefix.size() > best && starts_with_nocase(command, prefix)) {
+            best = prefix.size();
+            ms = modem.delays[i].second;
+        }
+    }
+    return ms;
+}
+
+static bool silenced(const std::string& command)
+{
+    for (size_t i = 0; i < modem.silent.size(); i++)
+        if (starts_with_nocase(command, modem.silent[i]))
+            return true;
+    return false;
+}
+
+/****************************************************************************************************
+// data connection
+ ****************************************************************************************************/
+static void data_close(bool no_carrier)
+{
+    if (modem.data == DATA_NONE)
+        return;
+    close(modem.data_fd);
+    if (modem.data_pid > 0) {
+        kill(modem.data_pid, SIGTERM);
+        waitpid(modem.data_pid, NULL, 0);
+    }
+    modem.data = DATA_NONE;
+    modem.data_fd = -1;
+    modem.data_pid = 0;
+    modem.plus_count = 0;
+    modem.escape_at = 0;
+    if (modem.online) {
+        modem.online = false;
+        if (no_carrier)
+            out("\r\nNO CARRIER\r\n");
+        flush_held_urcs();
+    }
+}
+
+// "host" or "host:port" mapped by -H, else resolved
+static int data_connect(const std::string& host, int port, bool udp)
+{
+    std::string addr = host;
+    char port_text[16];
+    snprintf(port_text, sizeof(port_text), "%d", port);
+    std::map<std::string, std::string>::const_iterator it = config.host_map.find(host + ":" + port_text);
+    if (it == config.host_map.end())
+        it = config.host_map.find(host);
+    if (it != config.host_map.end()) {
+        size_t colon = it->second.rfind(':');
+        addr = it->second.substr(0, colon);
+        if (colon != std::string::npos)
+            snprintf(port_text, sizeof(port_text), "%s", it->second.c_str() + colon + 1);
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+    if (getaddrinfo(addr.c_str(), port_text, &hints, &res))
+        return -1;
+    int fd = socket(AF_INET, hints.ai_socktype, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen)) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+        set_nonblocking(fd);
+    return fd;
+}
+
+static bool ppp_start()
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        return false;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(sv[1], 0);
+        dup2(sv[1], 1);
+        close(sv[0]);
+        close(sv[1]);
+        execl("/bin/sh", "sh", "-c", config.ppp_command.c_str(), (char*) NULL);
+        _exit(127);
+    }
+    close(sv[1]);
+    set_nonblocking(sv[0]);
+    modem.data = DATA_PPP;
+    modem.data_fd = sv[0];
+    modem.data_pid = pid;
+    return true;
+}
+
+static void go_online()
+{
+    modem.online = true;
+    modem.plus_count = 0;
+    modem.escape_at = 0;
+    modem.last_in_ms = now_ms();
+}
+
+// signal or registration lost: the network takes the data connection and the context
+static void network_lost()
+{
+    if (modem.data != DATA_NONE) {
+        stats.drops++;
+        note("data connection lost");
+        data_close(true);
+    }
+    modem.pdp_active = false;
+}
+
+/****************************************************************************************************
+// SMS
+ ****************************************************************************************************/
+static int sms_store(const std::string& status, const std::string& number, const std::string& text)
+{
+    for (int i = 1; i <= MODEM_SMS_SLOTS; i++) {
+        if (! modem.sms[i].used) {
+            Sms& s = modem.sms[i];
+            s.used = true;
+            s.status = status;
+            s.number = number;
+            s.time = network_time();
+            s.text = text.substr(0, MODEM_SMS_MAX);
+            return i;
+        }
+    }
+    return 0;
+}
+
+static void sms_arrive(const std::string& number, const std::string& text)
+{
+    stats.sms_received++;
+    if (modem.cnmi_mode && modem.cnmi_mt == 2) {
+        urc("+CMT: \"" + number + "\",,\"" + network_time() + "\"\r\n" + text);
+        return;
+    }
+    int index = sms_store("REC UNREAD", number, text);
+    if (! index) {
+        stats.sms_lost++;
+        note("SMS from %s lost, storage full", number.c_str());
+        return;
+    }
+    if (modem.cnmi_mode && modem.cnmi_mt == 1)
+        urc("+CMTI: \"SM\"," + std::to_string(index));
+}
+
+static std::string sms_header(const Sms& s)
+{
+    return "\"" + s.status + "\",\"" + s.number + "\",,\"" + s.time + "\"";
+}
+
+static std::string cms_error(int code)
+{
+    stats.errors++;
+    return "\r\n+CMS ERROR: " + std::to_string(code) + "\r\n";
+}
+
+static std::string cme_error(int code)
+{
+    stats.errors++;
+    return "\r\n+CME ERROR: " + std::to_string(code) + "\r\n";
+}
+
+// the text after the "> " prompt ended with Ctrl-Z
+static std::string sms_send(const std::string& text)
+{
+    if (! registered())
+        return cms_error(331);          // no network service
+    stats.sms_sent++;
+    note("SMS to %s: %s", modem.sms_number.c_str(), escape(text.data(), text.size()).c_str());
+    modem.message_ref = (modem.message_ref + 1) % 256;
+    std::string resp = "\r\n+CMGS: " + std::to_string(modem.message_ref) + "\r\n\r\nOK\r\n";
+    // to the own number it comes back through the network, a second later
+    if (! config.own_number.empty() && modem.sms_number.find(config.own_number) != std::string::npos)
+        schedule(now_ms() + 1000, "sms", std::vector<std::string>(1, modem.sms_number), text);
+    return resp;
+}
+
+/****************************************************************************************************
+// commands
+ ****************************************************************************************************/
+// comma separated, quotes removed
+static std::vector<std::string> split_args(const std::string& s)
+{
+    std::vector<std::string> args;
+    std::string cur;
+    bool quoted = false;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"')
+            quoted = ! quoted;
+        else if (s[i] == ',' && ! quoted) {
+            args.push_back(cur);
+            cur.clear();
+        } else
+            cur += s[i];
+    }
+    args.push_back(cur);
+    return args;
+}
+
+static int arg_int(const std::vector<std::string>& args, size_t i, int fallback)
+{
+    return i < args.size() && ! args[i].empty() ? atoi(args[i].c_str()) : fallback;
+}
+
+static Final registration(int which, const char* name, bool query, const std::vector<std::string>& args,
+                          std::string& resp)
+{
+    if (! query) {
+        int n = arg_int(args, 0, 0);
+        if (n < 0 || n > 2)
+            return FINAL_ERROR;
+        modem.reg_urc[which] = n;
+        return FINAL_OK;
+    }
+    resp += "\r\n" + std::string(name) + ": " + std::to_string(modem.reg_urc[which]) + "," + std::to_string(modem.reg);
+    if (modem.reg_urc[which] == 2 && registered())
+        resp += ",\"1A2B\",\"00C0FFEE\"";
+    resp += "\r\n";
+    return FINAL_OK;
+}
+
+static void registration_urcs()
+{
+    static const char* names[3] = { "+CREG", "+CGREG", "+CEREG" };
+    for (int i = 0; i < 3; i++) {
+        if (modem.reg_urc[i] == 0)
+            continue;
+        std::string text = std::string(names[i]) + ": " + std::to_string(modem.reg);
+        if (modem.reg_urc[i] == 2 && registered())
+            text += ",\"1A2B\",\"00C0FFEE\"";
+        urc(text);
+    }
+}
+
+static bool sms_matches(const Sms& s, const std::string& filter)
+{
+    return filter == "ALL" || filter == "4" || s.status == filter ||
+           (filter == "0" && s.status == "REC UNREAD") || (filter == "1" && s.status == "REC READ");
+}
+
+// one extended command: name with its '+' or '#', test "=?", query "?", set "=args" or action
+static Final extended(const std::string& name, const std::string& op, const std::string& arg_text,
+                      std::string& resp)
+{
+    std::vector<std::string> args = split_args(arg_text);
+    bool query = op == "?";
+    bool test = op == "=?";
+    if (test)
+        return FINAL_OK;
+
+    if (name == "+CGMI") { resp += "\r\nTelit\r\n"; return FINAL_OK; }
+    if (name == "+CGMM") { resp += "\r\nLE910-NA1\r\n"; return FINAL_OK; }
+    if (name == "+CGMR") { resp += "\r\n20.00.522\r\n"; return FINAL_OK; }
+    if (name == "+CGSN") { resp += "\r\n357520070000001\r\n"; return FINAL_OK; }
+    if (name == "+CIMI") { resp += "\r\n310410000000001\r\n"; return FINAL_OK; }
+    if (name == "#CCID" || name == "+CCID") { resp += "\r\n" + name + ": 89014100000000000001\r\n"; return FINAL_OK; }
+    if (name == "+CMEE") {
+        if (query)
+            resp += "\r\n+CMEE: " + std::to_string(modem.cmee) + "\r\n";
+        else
+            modem.cmee = arg_int(args, 0, 0);
+        return FINAL_OK;
+    }
+    if (name == "+IFC" || name == "#SCFG" || name == "#SCFGEXT" || name == "#SLED" ||
+        name == "+CSCS" || name == "+CSMP")
+        return FINAL_OK;
+    if (name == "+CFUN") {
+        if (query)
+            resp += "\r\n+CFUN: 1\r\n";
+        return FINAL_OK;
+    }
+    if (name == "+CSQ") {
+        resp += "\r\n+CSQ: " + std::to_string(modem.csq) + ",99\r\n";
+        return FINAL_OK;
+    }
+    if (name == "+CREG") return registration(0, "+CREG", query, args, resp);
+    if (name == "+CGREG") return registration(1, "+CGREG", query, args, resp);
+    if (name == "+CEREG") return registration(2, "+CEREG", query, args, resp);
+    if (name == "+CCLK") {
+        if (! query)
+            return FINAL_OK;
+        resp += "\r\n+CCLK: \"" + network_time() + "\"\r\n";
+        return FINAL_OK;
+    }
+
+    if (name == "+CMGF") {
+        if (query) {
+            resp += "\r\n+CMGF: " + std::to_string(modem.cmgf) + "\r\n";
+            return FINAL_OK;
+        }
+        int mode = arg_int(args, 0, 0);
+        if (mode != 0 && mode != 1)
+            return FINAL_ERROR;
+        modem.cmgf = mode;
+        return FINAL_OK;
+    }
+    if (name == "+CNMI") {
+        if (query) {
+            resp += "\r\n+CNMI: " + std::to_string(modem.cnmi_mode) + "," + std::to_string(modem.cnmi_mt) +
+                    ",0,0,0\r\n";
+            return FINAL_OK;
+        }
+        modem.cnmi_mode = arg_int(args, 0, 0);
+        modem.cnmi_mt = arg_int(args, 1, 0);
+        return FINAL_OK;
+    }
+    if (name == "+CPMS") {
+        int used = 0;
+        for (int i = 1; i <= MODEM_SMS_SLOTS; i++)
+            used += modem.sms[i].used;
+        std::string counts = std::to_string(used) + "," + std::to_string(MODEM_SMS_SLOTS);
+        resp += query ? "\r\n+CPMS: \"SM\"," + counts + ",\"SM\"," + counts + ",\"SM\"," + counts + "\r\n"
+                      : "\r\n+CPMS: " + counts + "," + counts + "," + counts + "\r\n";
+        return FINAL_OK;
+    }
+    if (name == "+CMGS") {
+        if (modem.cmgf != 1) {
+            resp += cms_error(303);     // PDU mode is not emulated
+            return FINAL_DONE;
+        }
+        if (args[0].empty())
+            return FINAL_ERROR;
+        modem.sms_input = true;
+        modem.sms_number = args[0];
+        resp += "\r\n> ";
+        return FINAL_DONE;
+    }
+    if (name == "+CMGL") {
+        if (modem.cmgf != 1) {
+            resp += cms_error(303);
+            return FINAL_DONE;
+        }
+        std::string filter = args[0].empty() ? "REC UNREAD" : upper(args[0]);
+        for (int i = 1; i <= MODEM_SMS_SLOTS; i++) {
+            Sms& s = modem.sms[i];
+            if (! s.used || ! sms_matches(s, filter))
+                continue;
+            resp += "\r\n+CMGL: " + std::to_string(i) + "," + sms_header(s) + "\r\n" + s.text;
+            if (s.status == "REC UNREAD")
+                s.status = "REC READ";
+        }
+        if (! resp.empty())
+            resp += "\r\n";
+        return FINAL_OK;
+    }
+    if (name == "+CMGR") {
+        int index = arg_int(args, 0, 0);
+        if (index < 1 || index > MODEM_SMS_SLOTS || ! modem.sms[index].used) {
+            resp += cms_error(321);     // invalid memory index
+            return FINAL_DONE;
+        }
+        Sms& s = modem.sms[index];
+        resp += "\r\n+CMGR: " + sms_header(s) + "\r\n" + s.text + "\r\n";
+        if (s.status == "REC UNREAD")
+            s.status = "REC READ";
+        return FINAL_OK;
+    }
+    if (name == "+CMGD") {
+        int index = arg_int(args, 0, 0);
+        int flag = arg_int(args, 1, 0);
+        if (flag == 0) {
+            if (index < 1 || index > MODEM_SMS_SLOTS) {
+                resp += cms_error(321);
+                return FINAL_DONE;
+            }
+            modem.sms[index].used = false;
+            return FINAL_OK;
+        }
+        for (int i = 1; i <= MODEM_SMS_SLOTS; i++) {
+            const std::string& st = modem.sms[i].status;
+            if (flag == 4 || st == "REC READ" || (flag >= 2 && st == "STO SENT") || (flag >= 3 && st == "STO UNSENT"))
+                modem.sms[i].used = false;
+        }
+        return FINAL_OK;
+    }
+
+    if (name == "+CGDCONT") {
+        if (query) {
+            for (std::map<int, std::string>::const_iterator it = modem.contexts.begin(); it != modem.contexts.end(); ++it)
+                resp += "\r\n+CGDCONT: " + std::to_string(it->first) + ",\"IP\",\"" + it->second + "\",\"\",0,0";
+            if (! modem.contexts.empty())
+                resp += "\r\n";
+            return FINAL_OK;
+        }
+        int cid = arg_int(args, 0, 0);
+        if (cid < 1 || cid > 5)
+            return FINAL_ERROR;
+        if (args.size() == 1)
+            modem.contexts.erase(cid);
+        else
+            modem.contexts[cid] = args.size() > 2 ? args[2] : "";
+        return FINAL_OK;
+    }
+    if (name == "#SGACT") {
+        if (query) {
+            resp += "\r\n#SGACT: 1," + std::to_string(modem.pdp_active) + "\r\n";
+            return FINAL_OK;
+        }
+        if (arg_int(args, 1, 0) == 0) {
+            data_close(false);
+            modem.pdp_active = false;
+            return FINAL_OK;
+        }
+        if (! registered() || ! modem.contexts.count(arg_int(args, 0, 1))) {
+            resp += cme_error(555);     // activation failed
+            return FINAL_DONE;
+        }
+        modem.pdp_active = true;
+        resp += "\r\n#SGACT: 10.64.0.2\r\n";
+        return FINAL_OK;
+    }
+    if (name == "#SD") {
+        // #SD=connId,txProt,rPort,"IPaddr"[,closureType[,lPort[,connMode]]], online mode only
+        if (! modem.pdp_active || modem.data != DATA_NONE || arg_int(args, 6, 0) != 0 || args.size() < 4) {
+            resp += cme_error(556);
+            return FINAL_DONE;
+        }
+        bool udp = arg_int(args, 1, 0) == 1;
+        int fd = data_connect(args[3], arg_int(args, 2, 0), udp);
+        if (fd < 0) {
+            note("#SD to %s:%s failed", args[3].c_str(), args[2].c_str());
+            resp += "\r\nNO CARRIER\r\n";
+            return FINAL_DONE;
+        }
+        stats.sessions++;
+        modem.data = udp ? DATA_UDP : DATA_TCP;
+        modem.data_fd = fd;
+        go_online();
+        resp += "\r\nCONNECT\r\n";
+        return FINAL_DONE;
+    }
+    if (name == "#SO") {
+        if (modem.data == DATA_NONE) {
+            resp += "\r\nNO CARRIER\r\n";
+            return FINAL_DONE;
+        }
+        go_online();
+        resp += "\r\nCONNECT\r\n";
+        return FINAL_DONE;
+    }
+    if (name == "#SH") {
+        data_close(false);
+        return FINAL_OK;
+    }
+    if (name == "#SS") {
+        int state = modem.data == DATA_NONE ? 0 : modem.online ? 1 : 2;
+        resp += "\r\n#SS: 1," + std::to_string(state) + "\r\n";
+        return FINAL_OK;
+    }
+    stats.unknown++;
+    return FINAL_ERROR;
+}
+
+// basic commands after "AT": E0, V1, &K3, Z, I4, H, O, D...; one per call, consumes from pos
+static Final basic(const std::string& body, size_t& pos, std::string& resp)
+{
+    int c = toupper((unsigned char) body[pos++]);
+    if (c == '&' && pos < body.size())
+        c = toupper((unsigned char) body[pos++]) | 0x80;        // &F, &K, &D, &C: accepted
+    if (c == 'D') {
+        std::string number = body.substr(pos);
+        pos = body.size();
+        if (number.find("*99") == std::string::npos || config.ppp_command.empty() || ! registered() ||
+            modem.data != DATA_NONE || ! ppp_start()) {
+            resp += "\r\nNO CARRIER\r\n";
+            return FINAL_DONE;
+        }
+        stats.sessions++;
+        note("PPP on %s", config.ppp_command.c_str());
+        go_online();
+        resp += "\r\nCONNECT\r\n";
+        return FINAL_DONE;
+    }
+    if (c == 'S') {
+        // S-registers: Snn=v or Snn?, ignored
+        while (pos < body.size() && (isdigit((unsigned char) body[pos]) || body[pos] == '=' || body[pos] == '?'))
+            pos++;
+        return FINAL_OK;
+    }
+    int n = 0;
+    while (pos < body.size() && isdigit((unsigned char) body[pos]))
+        n = n * 10 + body[pos++] - '0';
+    switch (c) {
+    case 'E':
+        modem.echo = n != 0;
+        return FINAL_OK;
+    case 'I':
+        resp += n == 4 ? "\r\nLE910-NA1\r\n" : "\r\nTelit\r\n";
+        return FINAL_OK;
+    case 'H':
+        data_close(false);
+        return FINAL_OK;
+    case 'O':
+        if (modem.data == DATA_NONE) {
+            resp += "\r\nNO CARRIER\r\n";
+            return FINAL_DONE;
+        }
+        go_online();
+        resp += "\r\nCONNECT\r\n";
+        return FINAL_DONE;
+    case 'V': case 'Q': case 'X': case 'Z':
+    case 'F' | 0x80: case 'K' | 0x80: case 'D' | 0x80: case 'C' | 0x80: case 'W' | 0x80:
+        return FINAL_OK;
+    }
+    stats.unknown++;
+    return FINAL_ERROR;
+}
+
+static void command_line(std::string line)
+{
+    // like real modems, a command starts at "AT", whatever came before it
+    size_t at = 0;
+    while (at + 1 < line.size() && ! (toupper((unsigned char) line[at]) == 'A' &&
+                                      toupper((unsigned char) line[at + 1]) == 'T'))
+        at++;
+    if (at + 1 >= line.size())
+        return;
+    line.erase(0, at);
+    stats.commands++;
+    if (config.verbose)
+        note("> %s", line.c_str());
+    if (silenced(line)) {
+        stats.silenced++;
+        return;
+    }
+
+    std::string body = line.substr(2);
+    std::string resp;
+    Final final = FINAL_OK;
+    size_t pos = 0;
+    while (pos < body.size() && final == FINAL_OK) {
+        if (body[pos] == ';') {
+            pos++;
+            continue;
+        }
+        if (body[pos] != '+' && body[pos] != '#') {
+            final = basic(body, pos, resp);
+            continue;
+        }
+        // name up to '=', '?' or ';', then arguments up to an unquoted ';'
+        size_t end = body.find_first_of("=?;", pos);
+        if (end == std::string::npos)
+            end = body.size();
+        std::string name = upper(body.substr(pos, end - pos));
+        std::string op;
+        if (end < body.size() && body[end] == '?')
+            op = "?", end++;
+        else if (end + 1 < body.size() && body[end] == '=' && body[end + 1] == '?')
+            op = "=?", end += 2;
+        else if (end < body.size() && body[end] == '=')
+            op = "=", end++;
+        size_t args_end = end;
+        bool quoted = false;
+        while (args_end < body.size() && (quoted || body[args_end] != ';'))
+            quoted ^= body[args_end++] == '"';
+        final = extended(name, op, body.substr(end, args_end - end), resp);
+        pos = args_end;
+    }
+    if (final == FINAL_OK)
+        resp += "\r\nOK\r\n";
+    else if (final == FINAL_ERROR) {
+        stats.errors++;
+        resp += "\r\nERROR\r\n";
+    }
+    if (modem.sms_input)
+        modem.sms_command = line;
+    out(resp, response_delay(line));
+}
+
+/****************************************************************************************************
+// input from the program
+ ****************************************************************************************************/
+static void command_byte(char c)
+{
+    if (modem.sms_input) {
+        if (c == MODEM_CTRL_Z) {
+            modem.sms_input = false;
+            if (modem.echo)
+                out("\r\n");
+            out(sms_send(modem.line), response_delay(modem.sms_command));
+            modem.line.clear();
+        } else if (c == MODEM_ESC) {
+            modem.sms_input = false;
+            modem.line.clear();
+            out("\r\nOK\r\n");
+        } else {
+            if (modem.echo)
+                out(std::string(1, c));
+            if (c == '\r')
+                c = '\n';
+            if (modem.line.size() < MODEM_MAX_LINE)
+                modem.line += c;
+        }
+        return;
+    }
+    if (modem.echo)
+        out(std::string(1, c));
+    if (c == '\r') {
+        std::string line = modem.line;
+        modem.line.clear();
+        command_line(line);
+    } else if (c == '\b' || c == 0x7F) {
+        if (! modem.line.empty())
+            modem.line.erase(modem.line.size() - 1);
+    } else if (c != '\n' && modem.line.size() < MODEM_MAX_LINE) {
+        modem.line += c;
+    }
+}
+
+static void data_send(const char* data, int len)
+{
+    if (len <= 0)
+        return;
+    if (send(modem.data_fd, data, len, MSG_NOSIGNAL) > 0)
+        stats.bytes_up += len;
+}
+
+// data mode: everything goes to the peer except "+++" with the guard time of silence around it
+static void data_input(const char* data, int len)
+{
+    int64_t now = now_ms();
+    std::string forward;
+    for (int i = 0; i < len; i++) {
+        bool quiet = now - modem.last_in_ms >= config.guard_ms;
+        if (data[i] == '+' && modem.plus_count < 3 && (modem.plus_count > 0 || quiet)) {
+            if (++modem.plus_count == 3)
+                modem.escape_at = now + config.guard_ms;
+        } else {
+            forward.append(modem.plus_count, '+');
+            forward += data[i];
+            modem.plus_count = 0;
+            modem.escape_at = 0;
+        }
+        modem.last_in_ms = now;
+    }
+    data_send(forward.data(), forward.size());
+}
+
+static void input(const char* data, int len)
+{
+    record('>', data, len);
+    for (int i = 0; i < len; i++) {
+        if (modem.online) {
+            data_input(data + i, len - i);
+            return;
+        }
+        command_byte(data[i]);
+    }
+}
+
+// "+++" and the guard time after it: back to command mode, the connection stays
+static void check_escape()
+{
+    if (modem.online && modem.escape_at && now_ms() >= modem.escape_at) {
+        modem.online = false;
+        modem.plus_count = 0;
+        modem.escape_at = 0;
+        stats.escapes++;
+        out("\r\nOK\r\n");
+        flush_held_urcs();
+    }
+}
+
+static void data_output()
+{
+    char buf[4096];
+    ssize_t n = read(modem.data_fd, buf, sizeof(buf));
+    if (n > 0) {
+        stats.bytes_down += n;
+        out(std::string(buf, n));
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        note("data connection closed by the peer");
+        data_close(true);
+    }
+}
+
+/****************************************************************************************************
+// script events
+ ****************************************************************************************************/
+static bool run_event(const ScriptEvent& ev)
+{
+    note("script: %s %s", ev.verb.c_str(), ev.args.empty() ? "" : ev.args[0].c_str());
+    if (ev.verb == "csq" && ev.args.size() == 1) {
+        modem.csq = atoi(ev.args[0].c_str());
+        if (! registered())
+            network_lost();
+    } else if (ev.verb == "creg" && ev.args.size() == 1) {
+        int reg = atoi(ev.args[0].c_str());
+        if (reg != modem.reg) {
+            modem.reg = reg;
+            registration_urcs();
+            if (! registered())
+                network_lost();
+        }
+    } else if (ev.verb == "sms" && ev.args.size() >= 1) {
+        sms_arrive(ev.args[0], ev.rest);
+    } else if (ev.verb == "delay" && ev.args.size() >= 1) {
+        std::string prefix = ev.args.size() > 1 ? ev.args[1] : "";
+        int ms = atoi(ev.args[0].c_str());
+        if (prefix.empty()) {
+            config.delay_ms = ms;
+        } else {
+            size_t i = 0;
+            while (i < modem.delays.size() && strcasecmp(modem.delays[i].first.c_str(), prefix.c_str()))
+                i++;
+            if (i == modem.delays.size())
+                modem.delays.push_back(std::make_pair(prefix, ms));
+            else
+                modem.delays[i].second = ms;
+        }
+    } else if (ev.verb == "silent" && ev.args.size() == 1) {
+        modem.silent.push_back(ev.args[0]);
+    } else if (ev.verb == "answer" && ev.args.size() == 1) {
+        for (size_t i = 0; i < modem.silent.size(); i++)
+            if (strcasecmp(modem.silent[i].c_str(), ev.args[0].c_str()) == 0)
+                modem.silent.erase(modem.silent.begin() + i--);
+    } else if (ev.verb == "drop") {
+        if (modem.data != DATA_NONE) {
+            stats.drops++;
+            data_close(true);
+        }
+    } else if (ev.verb == "urc" && ev.args.size() >= 1) {
+        urc(ev.args[0] + (ev.rest.empty() ? "" : " " + ev.rest));
+    } else if (ev.verb == "end") {
+        return false;
+    } else {
+        fprintf(stderr, "script line %d: unknown event %s\n", ev.line, ev.verb.c_str());
+    }
+    return true;
+}
+
+/****************************************************************************************************
+// emulation
+ ****************************************************************************************************/
+static void report()
+{
+    printf("commands %llu (%llu errors, %llu unknown, %llu not answered), SMS %llu sent, %llu received, "
+           "%llu lost\n",
+           (unsigned long long) stats.commands, (unsigned long long) stats.errors,
+           (unsigned long long) stats.unknown, (unsigned long long) stats.silenced,
+           (unsigned long long) stats.sms_sent, (unsigned long long) stats.sms_received,
+           (unsigned long long) stats.sms_lost);
+    printf("data sessions %llu, %llu escapes, %llu dropped, %llu bytes up, %llu down\n",
+           (unsigned long long) stats.sessions, (unsigned long long) stats.escapes,
+           (unsigned long long) stats.drops, (unsigned long long) stats.bytes_up,
+           (unsigned long long) stats.bytes_down);
+}
+
+static int run_emulator()
+{
+    modem.echo = true;
+    modem.csq = config.csq;
+    modem.reg = config.register_after_s ? 2 : 1;
+    modem.data_fd = -1;
+    if (config.register_after_s)
+        schedule((int64_t) config.register_after_s * 1000, "creg", std::vector<std::string>(1, "1"), "");
+
+    while (! stop_requested) {
+        int64_t now = now_ms();
+        if (config.seconds && now >= (int64_t) config.seconds * 1000)
+            break;
+        bool ended = false;
+        while (script_next < script.size() && script[script_next].at_ms <= now)
+            if (! run_event(script[script_next++]))
+                ended = true;
+        if (ended)
+            break;
+        check_escape();
+        flush_out();
+
+        int timeout = 1000;
+        if (script_next < script.size())
+            timeout = std::min<int64_t>(timeout, std::max<int64_t>(0, script[script_next].at_ms - now));
+        if (out_wait_ms() >= 0)
+            timeout = std::min(timeout, out_wait_ms());
+        if (modem.escape_at)
+            timeout = std::min<int64_t>(timeout, std::max<int64_t>(0, modem.escape_at - now));
+
+        struct pollfd fds[2];
+        int nfds = 1;
+        fds[0].fd = pty_fd;
+        fds[0].events = POLLIN | (out_wait_ms() == 0 ? POLLOUT : 0);
+        if (modem.data != DATA_NONE && modem.online && out_bytes < MODEM_MAX_OUT) {
+            fds[1].fd = modem.data_fd;
+            fds[1].events = POLLIN;
+            nfds = 2;
+        }
+        // a stalled program (POLLOUT pending) must not spin
+        if (out_wait_ms() == 0)
+            timeout = 10;
+        if (poll(fds, nfds, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return 1;
+        }
+        if (fds[0].revents & POLLIN) {
+            char buf[4096];
+            ssize_t n = read(pty_fd, buf, sizeof(buf));
+            if (n > 0)
+                input(buf, n);
+        }
+        if (nfds == 2 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+            data_output();
+    }
+    data_close(false);
+    report();
+    return 0;
+}
+
+/****************************************************************************************************
+// replay and capture
+ ****************************************************************************************************/
+struct Record {
+    int64_t     ms;
+    char        dir;
+    std::string data;
+    int         line;
+};
+
+static bool load_transcript(const std::string& path, std::vector<Record>& records)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (! f) {
+        perror(path.c_str());
+        return false;
+    }
+    char buf[16384];
+    int line_no = 0;
+    while (fgets(buf, sizeof(buf), f)) {
+        line_no++;
+        std::string s = buf;
+        while (! s.empty() && (s[s.size() - 1] == '\n' || s[s.size() - 1] == '\r'))
+            s.erase(s.size() - 1);
+        size_t t1 = s.find('\t');
+        if (t1 == std::string::npos || s.size() < t1 + 3 || s[t1 + 2] != '\t') {
+            fprintf(stderr, "%s:%d: not a transcript line\n", path.c_str(), line_no);
+            fclose(f);
+            return false;
+        }
+        Record r;
+        r.ms = atoll(s.c_str());
+        r.dir = s[t1 + 1];
+        r.line = line_no;
+        if (r.dir == '#')
+            continue;
+        if ((r.dir != '>' && r.dir != '<') || ! unescape(s.substr(t1 + 3), r.data)) {
+            fprintf(stderr, "%s:%d: bad record\n", path.c_str(), line_no);
+            fclose(f);
+            return false;
+        }
+        records.push_back(r);
+    }
+    fclose(f);
+    return true;
+}
+
+static int run_replay()
+{
+    std::vector<Record> records;
+    if (! load_transcript(config.replay, records))
+        return 1;
+    // the program's bytes are matched on their own, as they come; a modem record goes out once
+    // the record before it has happened, after the recorded gap
+    std::vector<int64_t> happened(records.size(), -1);
+    size_t in_next = 0;                 // next '>' record to match
+    size_t matched = 0;                 // of its bytes
+    size_t out_next = 0;                // next '<' record to send
+    const int64_t silence_limit_ms = (int64_t) (config.seconds ? config.seconds : 30) * 1000;
+    int64_t last_event_ms = 0;
+
+    while (! stop_requested) {
+        while (in_next < records.size() && records[in_next].dir != '>')
+            in_next++;
+        while (out_next < records.size() && records[out_next].dir != '<')
+            out_next++;
+        if (in_next == records.size() && out_next == records.size())
+            break;
+
+        int64_t now = now_ms();
+        int timeout = 100;
+        if (out_next < records.size()) {
+            int64_t base = out_next ? happened[out_next - 1] : 0;
+            if (base >= 0) {
+                int64_t due = base + (out_next ? records[out_next].ms - records[out_next - 1].ms : 0);
+                if (now >= due) {
+                    out(records[out_next].data);
+                    happened[out_next++] = now;
+                    last_event_ms = now;
+                    continue;
+                }
+                timeout = (int) std::min<int64_t>(timeout, due - now);
+            }
+        }
+        if (now - last_event_ms > silence_limit_ms) {
+            printf("replay: program silent at %s line %d, expected %s\n", config.replay.c_str(),
+                   records[in_next].line, escape(records[in_next].data.data() + matched,
+                                                 records[in_next].data.size() - matched).c_str());
+            return 1;
+        }
+        flush_out();
+
+        struct pollfd pfd = { pty_fd, (short) (POLLIN | (out_wait_ms() == 0 ? POLLOUT : 0)), 0 };
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+            return 1;
+        if (! (pfd.revents & POLLIN))
+            continue;
+        char buf[4096];
+        ssize_t n = read(pty_fd, buf, sizeof(buf));
+        record('>', buf, n);
+        for (ssize_t i = 0; i < n; i++) {
+            while (in_next < records.size() && records[in_next].dir != '>')
+                in_next++;
+            if (in_next == records.size()) {
+                printf("replay: unexpected %s after the end of %s\n", escape(buf + i, n - i).c_str(),
+                       config.replay.c_str());
+                return 1;
+            }
+            const Record& r = records[in_next];
+            if (buf[i] != r.data[matched]) {
+                printf("replay: diverged at %s line %d byte %zu: expected %s, got %s\n", config.replay.c_str(),
+                       r.line, matched, escape(r.data.data() + matched, r.data.size() - matched).c_str(),
+                       escape(buf + i, n - i).c_str());
+                return 1;
+            }
+            if (++matched == r.data.size()) {
+                happened[in_next++] = now_ms();
+                matched = 0;
+            }
+        }
+        last_event_ms = now_ms();
+    }
+    while (! out_queue.empty() && ! stop_requested) {
+        flush_out();
+        usleep(10000);
+    }
+    printf("replay: %zu records matched\n", records.size());
+    return 0;
+}
+
+static int run_capture()
+{
+    std::string dev = config.capture;
+    int baud = 115200;
+    size_t colon = dev.rfind(':');
+    if (colon != std::string::npos) {
+        baud = atoi(dev.c_str() + colon + 1);
+        dev.erase(colon);
+    }
+    int tty = open(dev.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (tty < 0) {
+        perror(dev.c_str());
+        return 1;
+    }
+    struct termios tio;
+    tcgetattr(tty, &tio);
+    cfmakeraw(&tio);
+    speed_t speed = baud == 9600 ? B9600 : baud == 57600 ? B57600 : baud == 230400 ? B230400 :
+                    baud == 460800 ? B460800 : baud == 921600 ? B921600 : B115200;
+    cfsetspeed(&tio, speed);
+    tio.c_cflag |= CRTSCTS;
+    tcsetattr(tty, TCSANOW, &tio);
+    note("capturing %s at %d baud", dev.c_str(), baud);
+
+    while (! stop_requested) {
+        if (config.seconds && now_ms() >= (int64_t) config.seconds * 1000)
+            break;
+        struct pollfd fds[2] = { { pty_fd, POLLIN, 0 }, { tty, POLLIN, 0 } };
+        if (poll(fds, 2, 1000) < 0 && errno != EINTR)
+            break;
+        char buf[4096];
+        if (fds[0].revents & POLLIN) {
+            ssize_t n = read(pty_fd, buf, sizeof(buf));
+            if (n > 0) {
+                record('>', buf, n);
+                if (write(tty, buf, n) != n)
+                    note("modem write short");
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            ssize_t n = read(tty, buf, sizeof(buf));
+            if (n > 0) {
+                record('<', buf, n);
+                if (write(pty_fd, buf, n) != n)
+                    note("program write short");
+            }
+        }
+    }
+    close(tty);
+    return 0;
+}
+
+/****************************************************************************************************
+// main
+ ****************************************************************************************************/
+static void usage()
+{
+    fprintf(stderr, "usage: modem_emu [-L link] [-f script] [-c csq] [-g seconds] [-d ms] [-G guard ms]\n"
+                    "                 [-H host[:port]=addr:port]... [-P ppp command] [-n own number]\n"
+                    "                 [-o transcript] [-R transcript | -T tty[:baud]] [-t seconds] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    start_ms = mono_ms();
+    config.csq = 20;
+    config.guard_ms = 500;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "L:f:c:g:d:G:H:P:n:o:R:T:t:v")) != -1) {
+        switch (opt) {
+        case 'L': config.link = optarg; break;
+        case 'f': config.script = optarg; break;
+        case 'c': config.csq = atoi(optarg); break;
+        case 'g': config.register_after_s = atoi(optarg); break;
+        case 'd': config.delay_ms = atoi(optarg); break;
+        case 'G': config.guard_ms = atoi(optarg); break;
+        case 'H': {
+            const char* eq = strchr(optarg, '=');
+            if (! eq)
+                usage();
+            config.host_map[std::string(optarg, eq - optarg)] = eq + 1;
+            break;
+        }
+        case 'P': config.ppp_command = optarg; break;
+        case 'n': config.own_number = optarg; break;
+        case 'o': config.record = optarg; break;
+        case 'R': config.replay = optarg; break;
+        case 'T': config.capture = optarg; break;
+        case 't': config.seconds = atoi(optarg); break;
+        case 'v': config.verbose = true; break;
+        default: usage();
+        }
+    }
+    if (optind != argc || (! config.replay.empty() && ! config.capture.empty()))
+        usage();
+    if (! config.script.empty() && ! load_script(config.script))
+        return 1;
+    if (! config.record.empty()) {
+        record_file = fopen(config.record.c_str(), "w");
+        if (! record_file) {
+            perror(config.record.c_str());
+            return 1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    if (! open_pty())
+        return 1;
+
+    int ret;
+    if (! config.replay.empty())
+        ret = run_replay();
+    else if (! config.capture.empty())
+        ret = run_capture();
+    else
+        ret = run_emulator();
+
+    if (! config.link.empty())
+        unlink(config.link.c_str());
+    if (record_file)
+        fclose(record_file);
+    return ret;
+}
@@ -0,0 +1,232 @@
+/****************************************************************************************************
+ * mtsas.h (Host_sim)
+ *
+ * The cellular side of the mtsas library used by the Project_5 uplinks (link_manager.cpp,
+ * coap_link.cpp), on real host sockets with the radio modelled on the virtual clock, so the
+ * firmware links can be measured against the local stand-ins (uplink_bench.cpp) and the
+ * simulation posts through the firmware's upload code (sim_main.cpp).
+ *
+ * Data crosses the loopback for real; what it would have cost over the air is charged to the
+ * virtual clock and to simnet::stats():
+ *      - a TCP connect and the first data received after sending each take one round trip
+ *      - every send and receive takes its bytes on air at the configured bit rate
+ *      - a receive that times out takes the whole timeout (the host waits at most a few ms)
+ *      - bytes on air are IP level: 28 header bytes per UDP datagram; for TCP the segments and
+ *        payload bytes the kernel counted (TCP_INFO) with 40 header bytes per segment, plus the
+ *        four segments of the FIN handshake when the socket is closed
+ *
+ * The serial side (MTSBufferedIO, CellularFactory, the SMS and AT calls of Cellular) is only
+ * declared, so main.cpp, cmux.cpp and at_engine.cpp can be compiled for make check.
+ ****************************************************************************************************/
+#ifndef MTSAS_H
+#define MTSAS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <string>
+#include "mbed.h"
+#include "MTSLog.h"
+
+namespace simnet {
+
+struct Config {
+    int         rtt_ms;                 // round trip of the radio network (300)
+    int         bps;                    // bit rate in both directions (64000)
+    int         link_setup_ms;          // bringing the data session up (2000)
+};
+
+struct Stats {
+    uint64_t    packets_up;
+    uint64_t    packets_down;
+    uint64_t    bytes_up;               // on air, IP headers included
+    uint64_t    bytes_down;
+    uint64_t    link_connects;
+    uint64_t    tcp_connects;
+};
+
+Config& config();
+Stats& stats();
+
+}
+
+namespace mts {
+
+enum Code { MTS_SUCCESS, MTS_ERROR, MTS_FAILURE, MTS_NO_RESPONSE };
+
+class MTSCircularBuffer
+{
+public:
+    MTSCircularBuffer(int bufferSize);
+    int read(char* data, int length);
+    int read(char& data);
+    int write(const char* data, int length);
+    int write(char data);
+    int capacity();
+    int available();
+    int size();
+    bool isFull();
+    bool isEmpty();
+    void clear();
+};
+
+class MTSBufferedIO
+{
+public:
+    MTSBufferedIO(int txBufferSize = 256, int rxBufferSize = 256);
+    virtual ~MTSBufferedIO();
+    int write(const char* data, int length, unsigned int timeoutMillis);
+    int write(const char* data, int length);
+    int write(char data, unsigned int timeoutMillis);
+    int write(char data);
+    int writeable();
+    int read(char* data, int length, unsigned int timeoutMillis);
+    int read(char* data, int length);
+    int read(char& data, unsigned int timeoutMillis);
+    int read(char& data);
+    int readable();
+    bool txEmpty();
+    bool rxEmpty();
+    bool txFull();
+    bool rxFull();
+    void txClear();
+    void rxClear();
+
+protected:
+    virtual void handleRead() = 0;
+    virtual void handleWrite() = 0;
+
+    MTSCircularBuffer txBuffer;
+    MTSCircularBuffer rxBuffer;
+};
+
+class MTSSerialFlowControl : public MTSBufferedIO
+{
+public:
+    MTSSerialFlowControl(PinName TXD, PinName RXD, PinName RTS, PinName CTS, int txBufSize = 256,
+                         int rxBufSize = 2064);
+    void baud(int baudrate);
+
+protected:
+    virtual void handleRead();
+    virtual void handleWrite();
+};
+
+class IPStack
+{
+public:
+    virtual ~IPStack() {}
+};
+
+class Cellular : public IPStack
+{
+public:
+    Cellular() : connected(false) {}
+    bool connect();
+    void disconnect();
+    bool isConnected();
+
+    Code setApn(const std::string& apn);
+    Code sendSMS(const std::string& phoneNumber, const std::string& message);
+    std::string sendCommand(const std::string& command, unsigned int timeoutMillis, char esc = '\r');
+    Code sendBasicCommand(const std::string& command, unsigned int timeoutMillis, char esc = '\r');
+    int getSignalStrength();
+
+private:
+    bool    connected;
+};
+
+class CellularFactory
+{
+public:
+    static Cellular* create(MTSBufferedIO* io);
+};
+
+}
+
+using namespace mts;
+
+class Transport
+{
+public:
+    static void setTransport(IPStack* type);
+};
+
+class Endpoint
+{
+public:
+    Endpoint();
+    int set_address(const char* host, const int port);
+    char* get_address();
+    int get_port();
+
+    struct sockaddr_in addr;
+
+private:
+    char    text[16];
+};
+
+class Socket
+{
+public:
+    Socket() : fd(-1), timeout_ms(1500) {}
+    ~Socket() { close(); }
+    void set_blocking(bool blocking, unsigned int timeout = 1500);
+    int close(bool shutdown = true);
+
+protected:
+    bool wait_readable();               // false (and the timeout charged) if nothing came in time
+    virtual void closing() {}
+
+    int         fd;
+    int         timeout_ms;
+};
+
+class TCPSocketConnection : public Socket
+{
+public:
+    TCPSocketConnection() : reply_pending(false) {}
+    ~TCPSocketConnection() { close(); }
+    int connect(const char* host, const int port);
+    bool is_connected();
+    int send(char* data, int length);
+    int send_all(char* data, int length);
+    int receive(char* data, int length);
+    int receive_all(char* data, int length);
+
+private:
+    virtual void closing();
+
+    bool    reply_pending;              // data was sent, the next data received pays the round trip
+};
+
+class UDPSocket : public Socket
+{
+public:
+    UDPSocket() : reply_pending(false) {}
+    int init();
+    int bind(int port);
+    int sendTo(Endpoint& remote, char* packet, int length);
+    int receiveFrom(Endpoint& remote, char* buffer, int length);
+
+private:
+    bool    reply_pending;
+};
+
+enum HTTPResult {
+    HTTP_PROCESSING, HTTP_PARSE, HTTP_DNS, HTTP_PRTCL, HTTP_NOTFOUND, HTTP_REFUSED, HTTP_ERROR, HTTP_TIMEOUT,
+    HTTP_CONN, HTTP_CLOSED, HTTP_REDIRECT, HTTP_OK = 0
+};
+
+class IHTTPDataOut
+{
+protected:
+    virtual ~IHTTPDataOut() {}
+    virtual void readReset() = 0;
+    virtual int read(char* buf, size_t len, size_t* pReadLen) = 0;
+    virtual int getDataType(char* type, size_t maxTypeLen) = 0;
+    virtual bool getIsChunked() = 0;
+    virtual size_t getDataLen() = 0;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/****************************************************************************************************
+ * rtos.h (Host_sim)
+ *
+ * The mbed-rtos signal API for a single simulated thread: Thread::signal_wait() runs the event
+ * queue (advancing the virtual clock) until one of the signals is set.
+ *
+ * Thread's constructor and Mutex are only declared, for the main.cpp check (make check).
+ ****************************************************************************************************/
+#ifndef RTOS_H
+#define RTOS_H
+
+#include "mbed.h"
+
+#define osWaitForever       0xFFFFFFFF
+#define DEFAULT_STACK_SIZE  2048
+
+typedef void* osThreadId;
+
+enum osStatus {
+    osOK            = 0,
+    osEventSignal   = 0x08,
+    osEventTimeout  = 0x40,
+};
+
+enum osPriority {
+    osPriorityIdle          = -3,
+    osPriorityLow           = -2,
+    osPriorityBelowNormal   = -1,
+    osPriorityNormal        = 0,
+    osPriorityAboveNormal   = 1,
+    osPriorityHigh          = 2,
+    osPriorityRealtime      = 3,
+};
+
+struct osEvent {
+    osStatus    status;
+    union {
+        int32_t signals;
+    } value;
+};
+
+osThreadId osThreadGetId();
+int32_t osSignalSet(osThreadId thread_id, int32_t signals);
+
+class Thread
+{
+public:
+    Thread(void (*task)(void const* argument), void* argument = NULL, osPriority priority = osPriorityNormal,
+           uint32_t stack_size = DEFAULT_STACK_SIZE, unsigned char* stack_pointer = NULL);
+    int32_t signal_set(int32_t signals);
+    static osEvent signal_wait(int32_t signals, uint32_t millisec = osWaitForever);
+    static osStatus wait(uint32_t millisec);
+};
+
+class Mutex
+{
+public:
+    osStatus lock(uint32_t millisec = osWaitForever);
+    bool trylock();
+    osStatus unlock();
+};
+
+#endif
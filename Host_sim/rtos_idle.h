@@ -0,0 +1,7 @@
+#ifndef RTOS_IDLE_H
+#define RTOS_IDLE_H
+
+// the simulated idle time is the event queue, there is nothing to hook
+void rtos_attach_idle_hook(void (*fct)(void));
+
+#endif
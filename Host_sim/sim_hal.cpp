@@ -0,0 +1,147 @@
+#include "sim_hal.h"
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace sim {
+
+struct EventKey {
+    uint64_t    at;
+    EventId     id;
+    bool operator<(const EventKey& o) const { return at != o.at ? at < o.at : id < o.id; }
+};
+
+static uint64_t now;
+static EventId next_id = 1;
+static std::map<EventKey, std::function<void()> > events;
+static std::map<EventId, uint64_t> event_time;
+static Stats counters;
+
+uint64_t now_us()
+{
+    return now;
+}
+
+EventId schedule(uint64_t at_us, std::function<void()> fn)
+{
+    if (at_us < now)
+        at_us = now;
+    EventId id = next_id++;
+    EventKey key = { at_us, id };
+    events[key] = fn;
+    event_time[id] = at_us;
+    return id;
+}
+
+void cancel(EventId id)
+{
+    std::map<EventId, uint64_t>::iterator t = event_time.find(id);
+    if (t == event_time.end())
+        return;
+    EventKey key = { t->second, id };
+    events.erase(key);
+    event_time.erase(t);
+}
+
+bool run_next()
+{
+    if (events.empty())
+        return false;
+    std::map<EventKey, std::function<void()> >::iterator e = events.begin();
+    std::function<void()> fn = e->second;
+    now = e->first.at;
+    event_time.erase(e->first.id);
+    events.erase(e);
+    counters.events++;
+    fn();
+    return true;
+}
+
+void advance(uint64_t us)
+{
+    uint64_t until = now + us;
+    while (! events.empty() && events.begin()->first.at <= until)
+        run_next();
+    now = until;
+}
+
+Stats& stats()
+{
+    return counters;
+}
+
+/****************************************************************************************************
+// I2C bus
+ ****************************************************************************************************/
+static std::map<uint8_t, I2CDevice*> devices;
+static int i2c_hz = 100000;
+
+void i2c_attach(uint8_t address7, I2CDevice* dev)
+{
+    devices[address7] = dev;
+}
+
+I2CDevice* i2c_device(uint8_t address7)
+{
+    std::map<uint8_t, I2CDevice*>::iterator d = devices.find(address7);
+    return d == devices.end() ? NULL : d->second;
+}
+
+void i2c_set_frequency(int hz)
+{
+    i2c_hz = hz;
+}
+
+uint64_t i2c_bus_us(int bytes)
+{
+    // 9 clocks per byte plus start and stop
+    return ((uint64_t) bytes * 9 + 2) * 1000000 / i2c_hz;
+}
+
+/****************************************************************************************************
+// pins
+ ****************************************************************************************************/
+static std::map<int, std::function<float()> > analog_pins;
+static std::map<int, std::function<int()> > digital_pins;
+static std::map<int, std::vector<std::function<void()> > > rise_handlers;
+static std::map<int, std::vector<std::function<void()> > > fall_handlers;
+
+void analog_source(int pin, std::function<float()> level)
+{
+    analog_pins[pin] = level;
+}
+
+float analog_level(int pin)
+{
+    std::map<int, std::function<float()> >::iterator p = analog_pins.find(pin);
+    return p == analog_pins.end() ? 0 : p->second();
+}
+
+void digital_source(int pin, std::function<int()> level)
+{
+    digital_pins[pin] = level;
+}
+
+int digital_level(int pin)
+{
+    std::map<int, std::function<int()> >::iterator p = digital_pins.find(pin);
+    return p == digital_pins.end() ? 0 : p->second();
+}
+
+void pin_on_edge(int pin, bool rise, std::function<void()> handler)
+{
+    (rise ? rise_handlers : fall_handlers)[pin].push_back(handler);
+}
+
+void pin_pulse(int pin)
+{
+    std::vector<std::function<void()> >& r = rise_handlers[pin];
+    for (size_t i = 0; i < r.size(); i++)
+        r[i]();
+    std::vector<std::function<void()> >& f = fall_handlers[pin];
+    for (size_t i = 0; i < f.size(); i++)
+        f[i]();
+}
+
+}
@@ -0,0 +1,85 @@
+/****************************************************************************************************
+ * sim_hal.h
+ *
+ * Core of the simulated HAL: virtual clock, event queue, I2C bus and board pins.
+ *
+ * Time only moves when the program waits: Thread::signal_wait() and blocking bus calls advance
+ * the clock to the next event (a Timeout, a transfer completion, a sensor interrupt) and run it
+ * as an interrupt would run, so a day of sampling takes seconds of host time and every run is
+ * exactly repeatable.
+ ****************************************************************************************************/
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <stdint.h>
+#include <functional>
+
+namespace sim {
+
+typedef uint64_t EventId;
+
+// virtual microseconds since reset
+uint64_t now_us();
+
+// run fn at at_us (not before now), events at the same time run in the order they were scheduled
+EventId schedule(uint64_t at_us, std::function<void()> fn);
+void cancel(EventId id);
+
+// run the earliest pending event, advancing the clock to it; false when there is none
+bool run_next();
+
+// let us microseconds pass (busy CPU or bus), running the events that fall into them
+void advance(uint64_t us);
+
+// statistics
+struct Stats {
+    uint64_t    events;                 // events run
+    uint64_t    i2c_transactions;
+    uint64_t    i2c_bytes;
+    uint64_t    i2c_busy_us;            // time the bus was driven
+    uint64_t    i2c_nacks;
+};
+Stats& stats();
+
+/****************************************************************************************************
+// I2C bus
+ ****************************************************************************************************/
+class I2CDevice
+{
+public:
+    virtual ~I2CDevice() {}
+    // master write of len bytes, false to not acknowledge
+    virtual bool write(const uint8_t* data, int len) = 0;
+    // master read of len bytes
+    virtual bool read(uint8_t* data, int len) = 0;
+};
+
+// put dev on the bus at the 7-bit address
+void i2c_attach(uint8_t address7, I2CDevice* dev);
+I2CDevice* i2c_device(uint8_t address7);
+
+// bus frequency, 100 kHz after reset
+void i2c_set_frequency(int hz);
+
+// duration of a transaction moving bytes bytes (address bytes included)
+uint64_t i2c_bus_us(int bytes);
+
+/****************************************************************************************************
+// pins
+ ****************************************************************************************************/
+// analog input level, 0..1 of the reference
+void analog_source(int pin, std::function<float()> level);
+float analog_level(int pin);
+
+void digital_source(int pin, std::function<int()> level);
+int digital_level(int pin);
+
+// edge handlers of InterruptIn
+void pin_on_edge(int pin, bool rise, std::function<void()> handler);
+
+// a short high pulse on pin: runs the rise and then the fall handlers
+void pin_pulse(int pin);
+
+}
+
+#endif
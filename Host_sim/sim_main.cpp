@@ -0,0 +1,462 @@
+/****************************************************************************************************
+ * sim_main.cpp
+ *
+ * Runs the Project_5 sampling loop and batch upload on the simulated shield in virtual time.
+ *
+ * The firmware's sampling code (sensor_sampler.cpp and the modules below it) is built unchanged
+ * against the Host_sim HAL; the shield chips are the register models of sim_rohm.h, the analog
+ * and hall inputs follow the SimWorld.  So is the upload side: every post interval a scheduler job
+ * does what network_task() does for the HTTP transport, the samples go through JournalUplink into
+ * the journal and are posted in compressed batches by LinkManager, over the sockets of sim_net.cpp
+ * to a server thread on the loopback that decodes every block.  At the end the run is checked:
+ *
+ *   - every uploaded sample decodes to exactly the journaled sample
+ *   - the sampled values match the world at the sample time within the world's noise and the
+ *     sensors' resolution
+ *   - no sample, scheduler deadline or chip buffer was lost
+ *
+ * and the exit status is non-zero if a check failed.
+ *
+ *   dragonfly_sim [hours] [-v]         default 24 hours, -v shows the firmware's debug output
+ ****************************************************************************************************/
+#include "mbed.h"
+#include "rtos.h"
+#include "MTSLog.h"
+#include "sim_world.h"
+#include "sim_rohm.h"
+#include "sensor_sampler.h"
+#include "sample_queue.h"
+#include "sample_clock.h"
+#include "sample_journal.h"
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+#include "link_manager.h"
+#include "journal_body.h"
+#include "journal_uplink.h"
+#include "upload_body.h"
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint32_t sim_epoch = 1476700000;               // network time handed out at the sync
+static const uint64_t clock_sync_at_ms = 45000;             // network time arrives this long after boot
+static const int post_interval_ms = 10000;
+static const int print_interval_ms = 60000;
+
+// the HTTP transport of main.cpp with BinaryTelemetry and CompressedBatches
+static const int upload_batch_samples = 16;
+static const int upload_batches_per_post = 4;
+static const int upload_post_samples = 256;
+static const char batch_path[] = "/v2/devices/dragonfly-sim/updates";
+
+static SimWorld world;
+static SimWorld truth(1, 0);
+static SampleQueue<SensorSample, 16> sample_queue;
+static SampleJournal journal;
+static SensorSample upload_batch[upload_batch_samples];
+static uint8_t upload_frames[upload_batch_samples * TELEMETRY_MAX_FRAME];
+static JournalBodyOut upload_body(journal, JOURNAL_BODY_TSC, upload_batch, upload_batch_samples,
+                                  upload_frames, sizeof(upload_frames));
+static JournalUplink uplink(journal, upload_body, batch_path, upload_post_samples, upload_batches_per_post);
+static Cellular radio;
+static LinkManager* http_link;
+
+// what the server received
+struct UploadStats {
+    uint64_t    posts;
+    uint64_t    samples;
+    uint64_t    blocks;
+    uint64_t    bytes;
+    uint64_t    frame_bytes;                                // the same samples as plain frames
+    uint64_t    mismatches;
+    uint64_t    refused;                                    // requests answered with an error status
+};
+static UploadStats uploaded;
+
+// largest difference between a sampled value and the noise-free world
+struct ChannelCheck {
+    const char* name;
+    double      tolerance;
+    double      max_error;
+    uint64_t    checked;
+    uint64_t    failed;
+};
+enum { CHK_TEMP, CHK_UV, CHK_LIGHT, CHK_PROX, CHK_HALL, CHK_COLOR, CHK_MEMS_ACCEL, CHK_MEMS_MAG, CHK_KX022,
+       CHK_BM1383_TEMP, CHK_PRESSURE, CHK_COUNT };
+
+// Each limit is the noise amplitude the SimWorld adds to the signal (sim_world.cpp) plus what the
+// sensor model and the firmware conversion can add to it: the rounding to the register's or the
+// ADC's step, and the change of the signal between the read and the nearest instant check() tries.
+// Upload decoding adds nothing, the compressed blocks are lossless for the float channels and
+// give back raw / scale for the raw ones, as the conversions do.
+static const double adc_step_v = 3.3 / 4095;            // 12-bit conversion of 3.3 V
+// read_u16() repeats the top bits of the 12-bit result in the low ones, and the firmware scales
+// that by 0.000050354 V: together within two 16-bit counts of the voltage of the 12-bit result
+static const double adc_scale_v = 2 * 3.3 / 65535;
+static const int search_step_us = 250;                  // of check()
+// the steepest signal that is not a step: the machine's 25 Hz, 0.05 g vibration on accel x
+static const double vibration_g_per_s = 2 * M_PI * 25 * 0.05;
+// the daily curves move by less than this within half a search step (daylight: 600 lux * 2 pi / day
+// * 125 us is 5.5e-6 lux, 8e-6 for green)
+static const double drift = 1e-5;
+
+static ChannelCheck checks[CHK_COUNT] = {
+    // BDE0600 -10.68 mV/C
+    { "temp_c",         0.05 + (adc_step_v / 2 + adc_scale_v) / 0.01068 + drift },
+    // ML8511 129 mV per mW/cm2
+    { "uv",             0.05 + (adc_step_v / 2 + adc_scale_v) / 0.129 + drift },
+    // 1.682 * DATA0 - 1.877 * DATA1 with both counts rounded
+    { "ambient_light",  2 + (1.682 + 1.877) / 2 + drift },
+    // 800 +- 50 counts while something passes, a step otherwise: some instant tried is on the read's
+    // side of the edge, where the noise-free value is the same
+    { "proximity",      50 + 0.5 },
+    { "hall",           0 },
+    // each channel's own noise, plus the ambient light's (+-2 lux) times the green factor 1.45
+    { "color",          3 + 2 * 1.45 + 0.5 + drift },
+    // the nearest instant tried is half a search step from the read
+    { "mems_accel",     0.002 + 0.5 / 8192 + vibration_g_per_s * search_step_us / 2e6 },
+    // in uT, the model rounds to the 16-bit register (0.146 / 4 uT); the hall magnet's 150 uT is a
+    // step like the proximity
+    { "mems_mag",       0.2 + 0.146 / 4 / 2 },
+    { "kx022_accel",    0.002 + 0.5 / 16384 + vibration_g_per_s * search_step_us / 2e6 },
+    // BM1383 temperature in 1/32 C, pressure in 1/2048 hPa
+    { "bm1383_temp",    0.05 + 0.5 / 32 + drift },
+    { "pressure_hpa",   0.02 + 0.5 / 2048 + drift },
+};
+
+/****************************************************************************************************
+// checks against the world
+ ****************************************************************************************************/
+// The sensors were read a little before the sample was stamped: take the best match within 30 ms.
+// The stamp is cut to the millisecond, so the read may also lie up to 1 ms after t.
+static void check(int channel, double t, double sampled, double (*value)(double t, int arg), int arg)
+{
+    ChannelCheck& c = checks[channel];
+    double best = 1e30;
+    for (int back_us = -1000; back_us <= 30000; back_us += search_step_us) {
+        double e = fabs(sampled - value(t - back_us / 1e6, arg));
+        if (e < best)
+            best = e;
+    }
+    c.checked++;
+    if (best > c.max_error)
+        c.max_error = best;
+    if (best > c.tolerance)
+        c.failed++;
+}
+
+static double truth_temp(double t, int) { return truth.temp_c(t); }
+static double truth_uv(double t, int) { return truth.uv_mw_cm2(t); }
+static double truth_lux(double t, int) { return truth.lux(t); }
+static double truth_prox(double t, int) { return truth.proximity(t); }
+static double truth_hall(double t, int i) { return i == 0 ? ! truth.hall_south(t) : ! truth.hall_north(t); }
+static double truth_rgb(double t, int i) { double v[3]; truth.rgb(t, v); return v[i]; }
+static double truth_accel(double t, int i) { double v[3]; truth.accel_g(t, v); return v[i]; }
+static double truth_mag(double t, int i) { double v[3]; truth.mag_ut(t, v); return v[i]; }
+
+// rohm_convert<Kmx62>() scales the magnetometer as raw/4096*0.146 while one 14-bit count (raw/4)
+// is 0.146 uT, so the firmware reports 1/1024 of the field in uT; the check is in uT
+static const double mems_mag_ut_per_unit = 1024;
+static double truth_pressure(double t, int) { return truth.pressure_hpa(t); }
+
+static void check_sample(const SensorSample& s)
+{
+    // back from the wall clock to virtual uptime
+    double t = ((uint64_t) s.timestamp * 1000 + s.millis - clock_sync_offset_ms()) / 1000.0;
+
+    if (s.flags & SAMPLE_TEMP)
+        check(CHK_TEMP, t, s.temp_c, truth_temp, 0);
+    if (s.flags & SAMPLE_UV)
+        check(CHK_UV, t, s.uv, truth_uv, 0);
+    if (s.flags & SAMPLE_LIGHT) {
+        check(CHK_LIGHT, t, s.ambient_light, truth_lux, 0);
+        check(CHK_PROX, t, s.proximity, truth_prox, 0);
+    }
+    for (int i = 0; i < 2 && (s.flags & SAMPLE_HALL); i++)
+        check(CHK_HALL, t, s.hall[i], truth_hall, i);
+    for (int i = 0; i < 3 && (s.flags & SAMPLE_COLOR); i++)
+        check(CHK_COLOR, t, s.color[i], truth_rgb, i);
+    for (int i = 0; i < 3 && (s.flags & SAMPLE_KMX62); i++) {
+        check(CHK_MEMS_ACCEL, t, s.mems_accel[i], truth_accel, i);
+        check(CHK_MEMS_MAG, t, s.mems_mag[i] * mems_mag_ut_per_unit, truth_mag, i);
+    }
+    for (int i = 0; i < 3 && (s.flags & SAMPLE_KX022); i++)
+        check(CHK_KX022, t, s.kx022_accel[i], truth_accel, i);
+    if (s.flags & SAMPLE_PRESSURE) {
+        check(CHK_BM1383_TEMP, t, s.bm1383_temp, truth_temp, 0);
+        check(CHK_PRESSURE, t, s.pressure_hpa, truth_pressure, 0);
+    }
+}
+
+/****************************************************************************************************
+// server
+ ****************************************************************************************************/
+// Decodes a batch and compares every sample with the journal, where it is still pending: the
+// device only acks it once this answer arrives, and the simulation thread waits in the post
+// meanwhile, so the journal does not change under the server.
+static int accept_batch(const HttpRequest& req)
+{
+    std::string device, endpoint;
+    if (upload_route(req.method, req.path, device, endpoint) != 0 || endpoint != "updates")
+        return 404;
+    if (req.content_type != "application/x-dragonfly-tsc")
+        return 415;
+
+    const uint8_t* buf = (const uint8_t*) req.body.data();
+    int len = req.body.size();
+    int got = 0;
+    for (int pos = 0; pos < len; ) {
+        TsDecompressor decompressor;
+        if (! decompressor.begin(buf + pos, len - pos))
+            return 422;
+        SensorSample decoded, sent;
+        while (decompressor.next(decoded)) {
+            uint8_t a[TELEMETRY_MAX_FRAME], b[TELEMETRY_MAX_FRAME];
+            int la = 0;
+            if (journal.peek(&sent, 1, got) == 1)
+                la = telemetry_encode(sent, a, sizeof(a));
+            int lb = telemetry_encode(decoded, b, sizeof(b));
+            if (la != lb || memcmp(a, b, la) != 0)
+                uploaded.mismatches++;
+            uploaded.frame_bytes += lb;
+            check_sample(decoded);
+            got++;
+        }
+        if (decompressor.remaining())
+            return 422;
+        pos += decompressor.blockSize();
+        uploaded.blocks++;
+    }
+    uploaded.samples += got;
+    uploaded.bytes += len;
+    return 0;
+}
+
+// one connection at a time, the device keeps it alive between posts
+static void serve(int listen_fd)
+{
+    while (true) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+        std::string in;
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            // LinkManager sends a request in several small writes; without the ack right away
+            // Nagle holds every one of them back for the delayed ack, a host wait of 40 ms
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+            in.append(buf, n);
+            HttpRequest req;
+            int ret;
+            while ((ret = http_parse_request(in, req)) == 1) {
+                uploaded.posts++;
+                int status = accept_batch(req);
+                if (status)
+                    uploaded.refused++;
+                const char* body = status ? "{}" : "{\"status\":\"accepted\"}";
+                char response[160];
+                int len = snprintf(response, sizeof(response),
+                                   "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s",
+                                   status ? status : 202, status ? "Error" : "Accepted", (int) strlen(body), body);
+                send(fd, response, len, MSG_NOSIGNAL);
+            }
+            if (ret < 0)
+                break;
+        }
+        close(fd);
+    }
+}
+
+// listens on an ephemeral loopback port, returns it
+static int start_server()
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 1) != 0 ||
+        getsockname(fd, (struct sockaddr*) &addr, &addr_len) != 0) {
+        perror("sim: server socket");
+        exit(2);
+    }
+    std::thread(serve, fd).detach();
+    return ntohs(addr.sin_port);
+}
+
+/****************************************************************************************************
+// network side
+ ****************************************************************************************************/
+// scheduler job doing what network_task() does: journal the queued samples, set the clock once
+// the network time "arrives", post the journal
+static void network_job(void*)
+{
+    if (! clock_synced() && clock_uptime_us() / 1000 >= clock_sync_at_ms) {
+        clock_set(sim_epoch + (uint32_t) (clock_uptime_us() / 1000000));
+        uplink.clockSet();
+    }
+
+    SensorSample sample;
+    while (sample_queue.pop(sample))
+        uplink.add(sample);
+    if (clock_synced())
+        uplink.upload(*http_link);
+    http_link->poll();
+}
+
+static void print_job(void* arg)
+{
+    EventScheduler* scheduler = (EventScheduler*) arg;
+    sampler_print(print_interval_ms);
+    for (int i = 0; i < scheduler->jobCount(); i++) {
+        SchedulerStats stats = scheduler->stats(i);
+        logDebug("job %-8s every %lu ms: runs %lu, missed %lu, max late %lu us, max run %lu us", stats.name,
+                 (unsigned long) stats.period_ms, (unsigned long) stats.runs, (unsigned long) stats.misses,
+                 (unsigned long) stats.late_max_us, (unsigned long) stats.run_max_us);
+    }
+}
+
+/****************************************************************************************************
+// board
+ ****************************************************************************************************/
+static float adc_level(double volts)
+{
+    return (float) (volts / 3.3);
+}
+
+static void wire_board(Kx022Model& kx022, Rpr0521Model& rpr0521, Kmx62Model& kmx62, Bh1745Model& bh1745,
+                       Bm1383Model& bm1383)
+{
+    sim::i2c_attach(0x38, &rpr0521);
+    sim::i2c_attach(0x0E, &kmx62);
+    sim::i2c_attach(0x39, &bh1745);
+    sim::i2c_attach(0x1E, &kx022);
+    sim::i2c_attach(0x5D, &bm1383);
+
+    // inverses of the conversions in ReadAnalogTemp() / ReadAnalogUV()
+    sim::analog_source(PC_4, []() { return adc_level(1.753 - 0.01068 * (world.temp_c(sim::now_us() / 1e6) - 30)); });
+    sim::analog_source(PC_1, []() { return adc_level(2.2 + 0.129 * (world.uv_mw_cm2(sim::now_us() / 1e6) - 10)); });
+
+    // BU52011 outputs are active low
+    sim::digital_source(PC_8, []() { return world.hall_south(sim::now_us() / 1e6) ? 0 : 1; });
+    sim::digital_source(PB_5, []() { return world.hall_north(sim::now_us() / 1e6) ? 0 : 1; });
+}
+
+static double host_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    double hours = 24;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "-v")
+            verbose = true;
+        else
+            hours = atof(argv[i]);
+    }
+    mts::MTSLog::setLogLevel(verbose ? mts::MTSLog::DEBUG_LEVEL : mts::MTSLog::WARNING_LEVEL);
+
+    Rpr0521Model rpr0521(world);
+    Kmx62Model kmx62(world);
+    Bh1745Model bh1745(world);
+    Kx022Model kx022(world, D2);
+    Bm1383Model bm1383(world);
+    wire_board(kx022, rpr0521, kmx62, bh1745, bm1383);
+
+    // on the device the network thread never holds up sampling; here the job runs in the sampling
+    // loop, so the radio's time on air is not charged to the virtual clock
+    simnet::Config& net = simnet::config();
+    net.rtt_ms = 0;
+    net.bps = 1000000000;
+    net.link_setup_ms = 0;
+    http_link = new LinkManager(&radio, "127.0.0.1", start_server());
+    http_link->setHeader("X-M2X-KEY: sim\r\n");
+
+    double host_start = host_seconds();
+    sampler_init();
+    EventScheduler scheduler;
+    sampler_start(scheduler);
+    scheduler.add("network", network_job, NULL, post_interval_ms);
+    scheduler.add("print", print_job, &scheduler, print_interval_ms);
+
+    uint64_t end_us = (uint64_t) (hours * 3600e6);
+    uint64_t samples = 0;
+    while (clock_uptime_us() < end_us) {
+        scheduler.waitNext();
+        scheduler.runDue();
+
+        SensorSample sample;
+        if (sampler_collect(sample)) {
+            sample_queue.push(sample);
+            samples++;
+        }
+    }
+    // the last samples, a post takes at most upload_batches_per_post bodies
+    network_job(NULL);
+    for (int i = 0; i < 100 && journal.pending(); i++)
+        network_job(NULL);
+    double host_s = host_seconds() - host_start;
+
+    // profile
+    sim::Stats& st = sim::stats();
+    double sim_s = clock_uptime_us() / 1e6;
+    printf("simulated %.1f h in %.2f s host time (%.0fx), %llu events\n", sim_s / 3600, host_s, sim_s / host_s,
+           (unsigned long long) st.events);
+    printf("samples: %llu taken, %llu uploaded in %llu blocks, %llu bytes (%.1f bytes/sample, frames %.1f)\n",
+           (unsigned long long) samples, (unsigned long long) uploaded.samples, (unsigned long long) uploaded.blocks,
+           (unsigned long long) uploaded.bytes, uploaded.samples ? (double) uploaded.bytes / uploaded.samples : 0,
+           uploaded.samples ? (double) uploaded.frame_bytes / uploaded.samples : 0);
+    printf("uplink: %llu posts, %d TCP connects, %llu refused, %lu samples dropped\n",
+           (unsigned long long) uploaded.posts, http_link->socket_connects, (unsigned long long) uploaded.refused,
+           (unsigned long) uplink.rejected);
+    printf("i2c: %llu transactions, %llu bytes, bus busy %.3f%%, %llu nacks\n",
+           (unsigned long long) st.i2c_transactions, (unsigned long long) st.i2c_bytes,
+           100.0 * st.i2c_busy_us / (sim_s * 1e6), (unsigned long long) st.i2c_nacks);
+    printf("kx022: %llu watermark interrupts, %llu samples lost in the buffer; kmx62: %llu lost\n",
+           (unsigned long long) kx022.interrupts, (unsigned long long) kx022.buffer.overflowed,
+           (unsigned long long) kmx62.buffer.overflowed);
+
+    // checks
+    int failed = 0;
+    for (int i = 0; i < CHK_COUNT; i++) {
+        const ChannelCheck& c = checks[i];
+        printf("check %-14s %8llu values, max error %.5f (limit %.5f)%s\n", c.name, (unsigned long long) c.checked,
+               c.max_error, c.tolerance, c.failed ? "  FAILED" : "");
+        if (c.failed || ! c.checked)
+            failed++;
+    }
+    uint32_t misses = 0;
+    for (int i = 0; i < scheduler.jobCount(); i++)
+        misses += scheduler.stats(i).misses;
+    struct { const char* what; uint64_t count; } losses[] = {
+        { "upload mismatches", uploaded.mismatches },
+        { "posts refused", uploaded.refused },
+        { "samples not uploaded", samples - uploaded.samples },
+        { "sample queue drops", sample_queue.overflows() },
+        { "journal drops", journal.dropped },
+        { "scheduler misses", misses },
+        { "i2c nacks", st.i2c_nacks },
+        { "kx022 buffer overflows", kx022.buffer.overflowed },
+        { "kmx62 buffer overflows", kmx62.buffer.overflowed },
+    };
+    for (unsigned i = 0; i < sizeof(losses) / sizeof(losses[0]); i++) {
+        if (losses[i].count) {
+            printf("check %s: %llu  FAILED\n", losses[i].what, (unsigned long long) losses[i].count);
+            failed++;
+        }
+    }
+    printf(failed ? "FAILED: %d checks\n" : "all checks passed\n", failed);
+    return failed ? 1 : 0;
+}
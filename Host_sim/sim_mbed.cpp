@@ -0,0 +1,217 @@
+#include "mbed.h"
+#include "rtos.h"
+#include "rtos_idle.h"
+#include "MTSLog.h"
+#include "heap_arena.h"
+
+static time_t rtc_base;
+
+uint32_t us_ticker_read()
+{
+    return (uint32_t) sim::now_us();
+}
+
+void set_time(time_t t)
+{
+    rtc_base = t - (time_t) (sim::now_us() / 1000000);
+}
+
+void wait(float s)
+{
+    sim::advance((uint64_t) (s * 1e6f));
+}
+
+void wait_ms(int ms)
+{
+    sim::advance((uint64_t) ms * 1000);
+}
+
+void wait_us(int us)
+{
+    sim::advance(us);
+}
+
+/****************************************************************************************************
+// I2C
+ ****************************************************************************************************/
+I2C::I2C(PinName, PinName) : busy(false), done_id(0)
+{
+}
+
+void I2C::frequency(int hz)
+{
+    sim::i2c_set_frequency(hz);
+}
+
+static int bus_write(int address, const char* data, int length)
+{
+    sim::Stats& st = sim::stats();
+    sim::I2CDevice* dev = sim::i2c_device(address >> 1);
+    st.i2c_transactions++;
+    st.i2c_bytes += 1 + length;
+    st.i2c_busy_us += sim::i2c_bus_us(1 + length);
+    if (! dev || ! dev->write((const uint8_t*) data, length)) {
+        st.i2c_nacks++;
+        return -1;
+    }
+    return 0;
+}
+
+static int bus_read(int address, char* data, int length)
+{
+    sim::Stats& st = sim::stats();
+    sim::I2CDevice* dev = sim::i2c_device(address >> 1);
+    st.i2c_transactions++;
+    st.i2c_bytes += 1 + length;
+    st.i2c_busy_us += sim::i2c_bus_us(1 + length);
+    if (! dev || ! dev->read((uint8_t*) data, length)) {
+        st.i2c_nacks++;
+        return -1;
+    }
+    return 0;
+}
+
+int I2C::read(int address, char* data, int length, bool)
+{
+    int ret = bus_read(address, data, length);
+    sim::advance(sim::i2c_bus_us(1 + length));
+    return ret;
+}
+
+int I2C::write(int address, const char* data, int length, bool)
+{
+    int ret = bus_write(address, data, length);
+    sim::advance(sim::i2c_bus_us(1 + length));
+    return ret;
+}
+
+int I2C::transfer(int address, const char* tx, int tx_length, char* rx, int rx_length,
+                  const event_callback_t& callback, int event, bool)
+{
+    if (busy)
+        return -1;
+
+    // the device sees the transaction when it starts, the callback comes when the bus is done
+    int result = I2C_EVENT_TRANSFER_COMPLETE;
+    int bytes = 0;
+    if (tx_length) {
+        bytes += 1 + tx_length;
+        if (bus_write(address, tx, tx_length) != 0)
+            result = sim::i2c_device(address >> 1) ? I2C_EVENT_TRANSFER_EARLY_NACK : I2C_EVENT_ERROR_NO_SLAVE;
+    }
+    if (rx_length && result == I2C_EVENT_TRANSFER_COMPLETE) {
+        bytes += 1 + rx_length;
+        if (bus_read(address | 1, rx, rx_length) != 0)
+            result = I2C_EVENT_ERROR;
+    }
+    if (result != I2C_EVENT_TRANSFER_COMPLETE)
+        result |= I2C_EVENT_ERROR;
+
+    busy = true;
+    event_callback_t cb = callback;
+    int mask = event;
+    done_id = sim::schedule(sim::now_us() + sim::i2c_bus_us(bytes), [this, cb, result, mask]() {
+        busy = false;
+        done_id = 0;
+        if (result & mask)
+            cb.call(result & mask);
+    });
+    return 0;
+}
+
+void I2C::abort_transfer()
+{
+    if (done_id)
+        sim::cancel(done_id);
+    done_id = 0;
+    busy = false;
+}
+
+/****************************************************************************************************
+// rtos: one thread, waiting means running the event queue
+ ****************************************************************************************************/
+static int32_t thread_signals;
+
+osThreadId osThreadGetId()
+{
+    return (osThreadId) &thread_signals;
+}
+
+int32_t osSignalSet(osThreadId, int32_t signals)
+{
+    int32_t old = thread_signals;
+    thread_signals |= signals;
+    return old;
+}
+
+int32_t Thread::signal_set(int32_t signals)
+{
+    return osSignalSet(osThreadGetId(), signals);
+}
+
+osEvent Thread::signal_wait(int32_t signals, uint32_t millisec)
+{
+    osEvent ev;
+    bool timed_out = false;
+    sim::EventId timeout = 0;
+    if (millisec != osWaitForever)
+        timeout = sim::schedule(sim::now_us() + (uint64_t) millisec * 1000, [&timed_out]() { timed_out = true; });
+
+    int32_t mask = signals ? signals : 0x7FFFFFFF;
+    while (! (thread_signals & mask) && ! timed_out) {
+        if (! sim::run_next()) {
+            fprintf(stderr, "sim: thread waits for signal 0x%x with no event pending\n", (unsigned) signals);
+            exit(2);
+        }
+    }
+    if (! timed_out)
+        sim::cancel(timeout);
+
+    if (thread_signals & mask) {
+        ev.status = osEventSignal;
+        ev.value.signals = thread_signals & mask;
+        thread_signals &= ~mask;
+    } else {
+        ev.status = osEventTimeout;
+        ev.value.signals = 0;
+    }
+    return ev;
+}
+
+void rtos_attach_idle_hook(void (*)())
+{
+}
+
+/****************************************************************************************************
+// heap: the arena of heap_arena.cpp is not built, allocations go to the host heap uncounted
+ ****************************************************************************************************/
+HeapSubsystem heap_enter(HeapSubsystem)
+{
+    return HEAP_OTHER;
+}
+
+/****************************************************************************************************
+// log
+ ****************************************************************************************************/
+namespace mts {
+
+int MTSLog::currentLevel = MTSLog::INFO_LEVEL;
+
+void MTSLog::setLogLevel(int level)
+{
+    currentLevel = level;
+}
+
+void MTSLog::printMessage(int level, const char* label, const char* format, ...)
+{
+    if (level > currentLevel)
+        return;
+    printf("[%11.3f] [%s] ", sim::now_us() / 1e6, label);
+    va_list ap;
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+}
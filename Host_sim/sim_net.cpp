@@ -0,0 +1,270 @@
+#include "mbed.h"
+#include "mtsas.h"
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/tcp.h>
+
+#define SIMNET_UDP_HEADER       28
+#define SIMNET_TCP_HEADER       40
+#define SIMNET_FIN_SEGMENTS     4
+#define SIMNET_MAX_HOST_WAIT_MS 50      // the stand-ins answer within this on the loopback
+
+namespace simnet {
+
+static Config cfg = { 300, 64000, 2000 };
+static Stats counters;
+
+Config& config()
+{
+    return cfg;
+}
+
+Stats& stats()
+{
+    return counters;
+}
+
+// time on air of a transfer
+static void charge(uint64_t bytes)
+{
+    sim::advance(bytes * 8 * 1000000 / cfg.bps);
+}
+
+static void round_trip()
+{
+    sim::advance((uint64_t) cfg.rtt_ms * 1000);
+}
+
+}
+
+/****************************************************************************************************
+// radio
+ ****************************************************************************************************/
+namespace mts {
+
+bool Cellular::connect()
+{
+    if (! connected) {
+        sim::advance((uint64_t) simnet::cfg.link_setup_ms * 1000);
+        simnet::counters.link_connects++;
+        connected = true;
+    }
+    return true;
+}
+
+void Cellular::disconnect()
+{
+    connected = false;
+}
+
+bool Cellular::isConnected()
+{
+    return connected;
+}
+
+}
+
+/****************************************************************************************************
+// sockets
+ ****************************************************************************************************/
+Endpoint::Endpoint()
+{
+    memset(&addr, 0, sizeof(addr));
+    text[0] = '\0';
+}
+
+int Endpoint::set_address(const char* host, const int port)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0)
+        return -1;
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    freeaddrinfo(res);
+    addr.sin_port = htons(port);
+    return 0;
+}
+
+char* Endpoint::get_address()
+{
+    inet_ntop(AF_INET, &addr.sin_addr, text, sizeof(text));
+    return text;
+}
+
+int Endpoint::get_port()
+{
+    return ntohs(addr.sin_port);
+}
+
+void Socket::set_blocking(bool blocking, unsigned int timeout)
+{
+    timeout_ms = blocking ? -1 : (int) timeout;
+}
+
+int Socket::close(bool)
+{
+    if (fd < 0)
+        return 0;
+    closing();
+    ::close(fd);
+    fd = -1;
+    return 0;
+}
+
+bool Socket::wait_readable()
+{
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    int host_wait = timeout_ms < 0 || timeout_ms > SIMNET_MAX_HOST_WAIT_MS ? SIMNET_MAX_HOST_WAIT_MS : timeout_ms;
+    if (poll(&p, 1, host_wait) == 1)
+        return true;
+    sim::advance((uint64_t) (timeout_ms < 0 ? 0 : timeout_ms) * 1000);
+    return false;
+}
+
+int TCPSocketConnection::connect(const char* host, const int port)
+{
+    Endpoint remote;
+    close();
+    if (remote.set_address(host, port) != 0)
+        return -1;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    simnet::round_trip();
+    if (::connect(fd, (struct sockaddr*) &remote.addr, sizeof(remote.addr)) != 0) {
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    simnet::counters.tcp_connects++;
+    reply_pending = false;
+    return 0;
+}
+
+bool TCPSocketConnection::is_connected()
+{
+    char c;
+    if (fd < 0)
+        return false;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+int TCPSocketConnection::send(char* data, int length)
+{
+    if (fd < 0)
+        return -1;
+    ssize_t n = ::send(fd, data, length, MSG_NOSIGNAL);
+    if (n <= 0)
+        return -1;
+    simnet::charge(n + SIMNET_TCP_HEADER);
+    reply_pending = true;
+    return n;
+}
+
+int TCPSocketConnection::send_all(char* data, int length)
+{
+    int sent = 0;
+    while (sent < length) {
+        int n = send(data + sent, length - sent);
+        if (n < 0)
+            return sent ? sent : -1;
+        sent += n;
+    }
+    return sent;
+}
+
+int TCPSocketConnection::receive(char* data, int length)
+{
+    if (fd < 0 || ! wait_readable())
+        return -1;
+    ssize_t n = recv(fd, data, length, 0);
+    if (n <= 0)
+        return -1;
+    if (reply_pending)
+        simnet::round_trip();
+    reply_pending = false;
+    simnet::charge(n + SIMNET_TCP_HEADER);
+    return n;
+}
+
+int TCPSocketConnection::receive_all(char* data, int length)
+{
+    int got = 0;
+    while (got < length) {
+        int n = receive(data + got, length - got);
+        if (n < 0)
+            return got ? got : -1;
+        got += n;
+    }
+    return got;
+}
+
+// the kernel's count of what went over this connection, before its teardown
+void TCPSocketConnection::closing()
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+        return;
+    simnet::counters.packets_up += info.tcpi_segs_out + SIMNET_FIN_SEGMENTS / 2;
+    simnet::counters.packets_down += info.tcpi_segs_in + SIMNET_FIN_SEGMENTS / 2;
+    simnet::counters.bytes_up += info.tcpi_bytes_sent + (uint64_t) SIMNET_TCP_HEADER * (info.tcpi_segs_out + SIMNET_FIN_SEGMENTS / 2);
+    simnet::counters.bytes_down += info.tcpi_bytes_received + (uint64_t) SIMNET_TCP_HEADER * (info.tcpi_segs_in + SIMNET_FIN_SEGMENTS / 2);
+}
+
+int UDPSocket::init()
+{
+    close();
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    reply_pending = false;
+    return fd < 0 ? -1 : 0;
+}
+
+int UDPSocket::bind(int port)
+{
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    return ::bind(fd, (struct sockaddr*) &local, sizeof(local));
+}
+
+int UDPSocket::sendTo(Endpoint& remote, char* packet, int length)
+{
+    if (fd < 0)
+        return -1;
+    ssize_t n = sendto(fd, packet, length, 0, (struct sockaddr*) &remote.addr, sizeof(remote.addr));
+    if (n < 0)
+        return -1;
+    simnet::charge(n + SIMNET_UDP_HEADER);
+    simnet::counters.packets_up++;
+    simnet::counters.bytes_up += n + SIMNET_UDP_HEADER;
+    reply_pending = true;
+    return n;
+}
+
+int UDPSocket::receiveFrom(Endpoint& remote, char* buffer, int length)
+{
+    if (fd < 0 || ! wait_readable())
+        return -1;
+    socklen_t addr_len = sizeof(remote.addr);
+    ssize_t n = recvfrom(fd, buffer, length, 0, (struct sockaddr*) &remote.addr, &addr_len);
+    if (n < 0)
+        return -1;
+    if (reply_pending)
+        simnet::round_trip();
+    reply_pending = false;
+    simnet::charge(n + SIMNET_UDP_HEADER);
+    simnet::counters.packets_down++;
+    simnet::counters.bytes_down += n + SIMNET_UDP_HEADER;
+    return n;
+}
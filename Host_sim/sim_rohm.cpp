@@ -0,0 +1,380 @@
+#include "sim_rohm.h"
+#include <string.h>
+#include <math.h>
+
+static int16_t clamp16(double v)
+{
+    v = floor(v + 0.5);
+    return (int16_t) (v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+}
+
+static uint16_t clampu16(double v)
+{
+    v = floor(v + 0.5);
+    return (uint16_t) (v > 65535 ? 65535 : v < 0 ? 0 : v);
+}
+
+/****************************************************************************************************
+// register file
+ ****************************************************************************************************/
+RegisterModel::RegisterModel(const SimWorld& world) : world(world), pointer(0)
+{
+    memset(regs, 0, sizeof(regs));
+}
+
+bool RegisterModel::write(const uint8_t* data, int len)
+{
+    update();
+    if (len > 0)
+        pointer = data[0];
+    for (int i = 1; i < len; i++) {
+        regs[pointer] = data[i];
+        written(pointer);
+        pointer++;
+    }
+    accessed();
+    return true;
+}
+
+bool RegisterModel::read(uint8_t* data, int len)
+{
+    update();
+    for (int i = 0; i < len; i++) {
+        if (isPort(pointer))
+            data[i] = readPort(pointer);
+        else
+            data[i] = regs[pointer++];
+    }
+    accessed();
+    return true;
+}
+
+double RegisterModel::now_s() const
+{
+    return sim::now_us() / 1e6;
+}
+
+void RegisterModel::put16le(uint8_t reg, double value)
+{
+    int16_t v = clamp16(value);
+    regs[reg] = (uint8_t) v;
+    regs[reg + 1] = (uint8_t) ((uint16_t) v >> 8);
+}
+
+/****************************************************************************************************
+// sample buffer
+ ****************************************************************************************************/
+SampleBuffer::SampleBuffer(int capacity_bytes, int sample_bytes)
+    : capacity(capacity_bytes), sample_bytes(sample_bytes), overflowed(0), t0_us(0), period_us(0), taken(0)
+{
+}
+
+void SampleBuffer::start(uint64_t now_us, uint32_t period_us)
+{
+    t0_us = now_us;
+    this->period_us = period_us;
+    taken = 0;
+}
+
+void SampleBuffer::stop()
+{
+    period_us = 0;
+}
+
+void SampleBuffer::clear()
+{
+    data.clear();
+}
+
+uint64_t SampleBuffer::timeOfLevel(int samples) const
+{
+    int need = samples - level() / sample_bytes;
+    if (need < 1)
+        need = 1;
+    return t0_us + (taken + need) * period_us;
+}
+
+uint8_t SampleBuffer::pop()
+{
+    if (data.empty())
+        return 0;
+    uint8_t b = data.front();
+    data.pop_front();
+    return b;
+}
+
+/****************************************************************************************************
+// RPR-0521RS
+ ****************************************************************************************************/
+#define RPR0521_MODE_CONTROL    0x41
+#define RPR0521_ALS_EN          0x80
+#define RPR0521_PS_EN           0x40
+
+Rpr0521Model::Rpr0521Model(const SimWorld& world) : RegisterModel(world)
+{
+    regs[0x40] = 0x0A;                          // SYSTEM_CONTROL: part id
+    regs[0x92] = 0xE0;                          // MANUFACT_ID
+}
+
+void Rpr0521Model::update()
+{
+    double t = now_s();
+    if (regs[RPR0521_MODE_CONTROL] & RPR0521_PS_EN)
+        put16le(0x44, world.proximity(t));
+    if (regs[RPR0521_MODE_CONTROL] & RPR0521_ALS_EN) {
+        // DATA1 at 0.3 of DATA0: lux = 1.682 * d0 - 1.877 * d1
+        double d0 = world.lux(t) / (1.682 - 1.877 * 0.3);
+        uint16_t a0 = clampu16(d0), a1 = clampu16(d0 * 0.3);
+        regs[0x46] = (uint8_t) a0;
+        regs[0x47] = (uint8_t) (a0 >> 8);
+        regs[0x48] = (uint8_t) a1;
+        regs[0x49] = (uint8_t) (a1 >> 8);
+    }
+}
+
+/****************************************************************************************************
+// KMX62
+ ****************************************************************************************************/
+#define KMX62_ODCNTL            0x38
+#define KMX62_CNTL2             0x3A
+#define KMX62_ACCEL_EN          0x01
+#define KMX62_MAG_EN            0x02
+#define KMX62_BUF_CTRL_3        0x79
+#define KMX62_BUF_CLEAR         0x7A
+#define KMX62_BUF_STATUS_1      0x7B
+#define KMX62_BUF_STATUS_2      0x7C
+#define KMX62_BUF_READ          0x7E
+
+static const double kmx62_accel_lsb_per_g = 8192;
+static const double kmx62_mag_lsb_per_ut = 4 / 0.146;      // 0.146 uT per 14-bit count, left aligned
+
+// OSA/OSM code -> sample period, 0 is 12.5 Hz and every step doubles the rate
+static uint32_t odr_period_us(uint8_t code)
+{
+    if (code > 7)
+        code = 0;
+    return (uint32_t) (80000 >> code);
+}
+
+Kmx62Model::Kmx62Model(const SimWorld& world) : RegisterModel(world), buffer(384, 12)
+{
+    regs[0x00] = 0x18;                          // WHO_AM_I
+}
+
+void Kmx62Model::encode(double t, uint8_t* out)
+{
+    double a[3], m[3];
+    world.accel_g(t, a);
+    world.mag_ut(t, m);
+    for (int i = 0; i < 3; i++) {
+        int16_t va = clamp16(a[i] * kmx62_accel_lsb_per_g), vm = clamp16(m[i] * kmx62_mag_lsb_per_ut);
+        out[2 * i] = (uint8_t) va;
+        out[2 * i + 1] = (uint8_t) ((uint16_t) va >> 8);
+        out[6 + 2 * i] = (uint8_t) vm;
+        out[6 + 2 * i + 1] = (uint8_t) ((uint16_t) vm >> 8);
+    }
+}
+
+void Kmx62Model::update()
+{
+    uint64_t now = sim::now_us();
+    if (regs[KMX62_CNTL2] & (KMX62_ACCEL_EN | KMX62_MAG_EN)) {
+        uint8_t out[12];
+        encode(now / 1e6, out);
+        if (regs[KMX62_CNTL2] & KMX62_ACCEL_EN)
+            memcpy(regs + 0x0A, out, 6);
+        if (regs[KMX62_CNTL2] & KMX62_MAG_EN)
+            memcpy(regs + 0x10, out + 6, 6);
+    }
+    buffer.fill(now, [this](uint64_t t_us, uint8_t* out) { encode(t_us / 1e6, out); });
+    regs[KMX62_BUF_STATUS_1] = (uint8_t) buffer.level();
+    regs[KMX62_BUF_STATUS_2] = (uint8_t) (buffer.level() >> 8);
+}
+
+void Kmx62Model::configure()
+{
+    bool on = (regs[KMX62_CNTL2] & (KMX62_ACCEL_EN | KMX62_MAG_EN)) && regs[KMX62_BUF_CTRL_3];
+    if (on)
+        buffer.start(sim::now_us(), odr_period_us(regs[KMX62_ODCNTL] & 0x0F));
+    else
+        buffer.stop();
+}
+
+void Kmx62Model::written(uint8_t reg)
+{
+    if (reg == KMX62_CNTL2 || reg == KMX62_ODCNTL || reg == KMX62_BUF_CTRL_3)
+        configure();
+    else if (reg == KMX62_BUF_CLEAR)
+        buffer.clear();
+}
+
+bool Kmx62Model::isPort(uint8_t reg)
+{
+    return reg == KMX62_BUF_READ;
+}
+
+uint8_t Kmx62Model::readPort(uint8_t)
+{
+    return buffer.pop();
+}
+
+/****************************************************************************************************
+// BH1745NUC
+ ****************************************************************************************************/
+#define BH1745_MODE_CONTROL2    0x42
+#define BH1745_RGBC_EN          0x10
+
+Bh1745Model::Bh1745Model(const SimWorld& world) : RegisterModel(world)
+{
+    regs[0x40] = 0x0B;                          // SYSTEM_CONTROL: part id
+    regs[0x92] = 0xE0;                          // MANUFACTURER_ID
+}
+
+void Bh1745Model::update()
+{
+    if (! (regs[BH1745_MODE_CONTROL2] & BH1745_RGBC_EN))
+        return;
+    double rgb[3];
+    world.rgb(now_s(), rgb);
+    for (int i = 0; i < 3; i++) {
+        uint16_t v = clampu16(rgb[i]);
+        regs[0x50 + 2 * i] = (uint8_t) v;
+        regs[0x51 + 2 * i] = (uint8_t) (v >> 8);
+    }
+    uint16_t clear = clampu16(rgb[0] + rgb[1] + rgb[2]);
+    regs[0x56] = (uint8_t) clear;
+    regs[0x57] = (uint8_t) (clear >> 8);
+}
+
+/****************************************************************************************************
+// KX022-1020
+ ****************************************************************************************************/
+#define KX022_CNTL1             0x18
+#define KX022_PC1               0x80
+#define KX022_ODCNTL            0x1B
+#define KX022_INC1              0x1C
+#define KX022_IEN1              0x20
+#define KX022_INC4              0x1F
+#define KX022_WMI1              0x20
+#define KX022_BUF_CNTL1         0x3A
+#define KX022_BUF_CNTL2         0x3B
+#define KX022_BUFE              0x80
+#define KX022_BUF_STATUS_1      0x3C
+#define KX022_BUF_CLEAR         0x3E
+#define KX022_BUF_READ          0x3F
+
+static const double kx022_lsb_per_g = 16384;
+
+Kx022Model::Kx022Model(const SimWorld& world, int int1_pin)
+    : RegisterModel(world), buffer(252, 6), interrupts(0), int1_pin(int1_pin), irq_event(0), above(false)
+{
+    regs[0x0F] = 0x14;                          // WHO_AM_I
+}
+
+void Kx022Model::encode(double t, uint8_t* out)
+{
+    double a[3];
+    world.accel_g(t, a);
+    for (int i = 0; i < 3; i++) {
+        int16_t v = clamp16(a[i] * kx022_lsb_per_g);
+        out[2 * i] = (uint8_t) v;
+        out[2 * i + 1] = (uint8_t) ((uint16_t) v >> 8);
+    }
+}
+
+void Kx022Model::update()
+{
+    uint64_t now = sim::now_us();
+    if (regs[KX022_CNTL1] & KX022_PC1)
+        encode(now / 1e6, regs + 0x06);
+    buffer.fill(now, [this](uint64_t t_us, uint8_t* out) { encode(t_us / 1e6, out); });
+    regs[KX022_BUF_STATUS_1] = (uint8_t) buffer.level();
+}
+
+void Kx022Model::configure()
+{
+    bool on = (regs[KX022_CNTL1] & KX022_PC1) && (regs[KX022_BUF_CNTL2] & KX022_BUFE);
+    if (on && ! buffer.running())
+        buffer.start(sim::now_us(), odr_period_us(regs[KX022_ODCNTL] & 0x0F));
+    else if (! on)
+        buffer.stop();
+}
+
+void Kx022Model::written(uint8_t reg)
+{
+    if (reg == KX022_CNTL1 || reg == KX022_ODCNTL || reg == KX022_BUF_CNTL2)
+        configure();
+    else if (reg == KX022_BUF_CLEAR)
+        buffer.clear();
+}
+
+bool Kx022Model::isPort(uint8_t reg)
+{
+    return reg == KX022_BUF_READ;
+}
+
+uint8_t Kx022Model::readPort(uint8_t)
+{
+    return buffer.pop();
+}
+
+void Kx022Model::accessed()
+{
+    regs[KX022_BUF_STATUS_1] = (uint8_t) buffer.level();
+    armInterrupt();
+}
+
+// schedule the INT1 pulse for the sample that brings the buffer up to the watermark
+void Kx022Model::armInterrupt()
+{
+    if (irq_event)
+        sim::cancel(irq_event);
+    irq_event = 0;
+
+    int watermark = regs[KX022_BUF_CNTL1];
+    bool enabled = (regs[KX022_INC1] & KX022_IEN1) && (regs[KX022_INC4] & KX022_WMI1) && buffer.running();
+    if (! enabled || watermark == 0)
+        return;
+    if (buffer.level() < watermark * buffer.sample_bytes)
+        above = false;
+    if (above)
+        return;
+    irq_event = sim::schedule(buffer.timeOfLevel(watermark), [this]() { irq_event = 0; interrupt(); });
+}
+
+void Kx022Model::interrupt()
+{
+    update();
+    if (buffer.level() >= regs[KX022_BUF_CNTL1] * buffer.sample_bytes) {
+        above = true;
+        interrupts++;
+        sim::pin_pulse(int1_pin);
+    }
+    armInterrupt();
+}
+
+/****************************************************************************************************
+// BM1383GLV
+ ****************************************************************************************************/
+#define BM1383_POWER_DOWN       0x12
+#define BM1383_SLEEP            0x13
+
+Bm1383Model::Bm1383Model(const SimWorld& world) : RegisterModel(world)
+{
+    regs[0x0F] = 0xE0;                          // MANUFACTURER_ID
+    regs[0x10] = 0x32;                          // PART_ID
+}
+
+void Bm1383Model::update()
+{
+    if (! ((regs[BM1383_POWER_DOWN] & 0x01) && (regs[BM1383_SLEEP] & 0x01)))
+        return;
+    double t = now_s();
+    int16_t temp = clamp16(world.temp_c(t) * 32);
+    uint32_t press = (uint32_t) floor(world.pressure_hpa(t) * 2048 + 0.5) & 0x3FFFFF;
+    regs[0x1A] = (uint8_t) ((uint16_t) temp >> 8);
+    regs[0x1B] = (uint8_t) temp;
+    regs[0x1C] = (uint8_t) (press >> 14);
+    regs[0x1D] = (uint8_t) (press >> 6);
+    regs[0x1E] = (uint8_t) (press << 2);
+}
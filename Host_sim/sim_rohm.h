@@ -0,0 +1,162 @@
+/****************************************************************************************************
+ * sim_rohm.h
+ *
+ * Register models of the I2C chips on the ROHM Multi-sensor Shield.
+ *
+ * Each model has the chip's register file: a write sets the register pointer and stores the
+ * following bytes with auto-increment, a read returns bytes from the pointer on.  Output registers
+ * are refreshed from the SimWorld when they are read, and only while the chip's enable bits are
+ * set, in the chip's own encoding (little endian 16 bit, the BM1383 big endian temperature and
+ * 22-bit pressure, ...).  KX022 and KMX62 also model their sample buffers: samples are taken at the
+ * configured output data rate, the level/read/clear registers work as on the chip, and the KX022
+ * pulses INT1 at the watermark.
+ ****************************************************************************************************/
+#ifndef SIM_ROHM_H
+#define SIM_ROHM_H
+
+#include "sim_hal.h"
+#include "sim_world.h"
+#include <deque>
+
+class RegisterModel : public sim::I2CDevice
+{
+public:
+    RegisterModel(const SimWorld& world);
+
+    virtual bool write(const uint8_t* data, int len);
+    virtual bool read(uint8_t* data, int len);
+
+    uint8_t     regs[256];
+
+protected:
+    // refresh the outputs for the current time
+    virtual void update() {}
+    // a register was written
+    virtual void written(uint8_t reg) { (void) reg; }
+    // registers read without advancing the pointer (buffer read ports)
+    virtual bool isPort(uint8_t reg) { (void) reg; return false; }
+    virtual uint8_t readPort(uint8_t reg) { (void) reg; return 0; }
+    // after every transaction
+    virtual void accessed() {}
+
+    double now_s() const;
+    void put16le(uint8_t reg, double value);
+
+    const SimWorld& world;
+    uint8_t         pointer;
+};
+
+// sample buffer filled at an output data rate
+class SampleBuffer
+{
+public:
+    SampleBuffer(int capacity_bytes, int sample_bytes);
+
+    void start(uint64_t now_us, uint32_t period_us);
+    void stop();
+    void clear();
+    bool running() const { return period_us != 0; }
+
+    // take the samples due up to now_us, take(t_us, out) encodes one sample; FIFO mode keeps the
+    // oldest samples when full
+    template<typename F> void fill(uint64_t now_us, F take)
+    {
+        if (! period_us)
+            return;
+        while (t0_us + (taken + 1) * period_us <= now_us) {
+            taken++;
+            if ((int) data.size() + sample_bytes > capacity) {
+                overflowed++;
+                continue;
+            }
+            uint8_t s[16];
+            take(t0_us + taken * period_us, s);
+            data.insert(data.end(), s, s + sample_bytes);
+        }
+    }
+
+    // time of the sample that brings the level to samples samples
+    uint64_t timeOfLevel(int samples) const;
+
+    int level() const { return (int) data.size(); }
+    uint8_t pop();
+
+    int         capacity;
+    int         sample_bytes;
+    uint64_t    overflowed;
+
+private:
+    std::deque<uint8_t> data;
+    uint64_t            t0_us;
+    uint32_t            period_us;
+    uint64_t            taken;
+};
+
+// RPR-0521RS ambient light / proximity
+class Rpr0521Model : public RegisterModel
+{
+public:
+    Rpr0521Model(const SimWorld& world);
+protected:
+    virtual void update();
+};
+
+// KMX62 accelerometer / magnetometer with sample buffer
+class Kmx62Model : public RegisterModel
+{
+public:
+    Kmx62Model(const SimWorld& world);
+    SampleBuffer buffer;
+protected:
+    virtual void update();
+    virtual void written(uint8_t reg);
+    virtual bool isPort(uint8_t reg);
+    virtual uint8_t readPort(uint8_t reg);
+private:
+    void encode(double t, uint8_t* out);
+    void configure();
+};
+
+// BH1745NUC color
+class Bh1745Model : public RegisterModel
+{
+public:
+    Bh1745Model(const SimWorld& world);
+protected:
+    virtual void update();
+};
+
+// KX022-1020 accelerometer with sample buffer and INT1 watermark pulse
+class Kx022Model : public RegisterModel
+{
+public:
+    Kx022Model(const SimWorld& world, int int1_pin);
+    SampleBuffer buffer;
+    uint64_t     interrupts;
+protected:
+    virtual void update();
+    virtual void written(uint8_t reg);
+    virtual bool isPort(uint8_t reg);
+    virtual uint8_t readPort(uint8_t reg);
+    virtual void accessed();
+private:
+    void encode(double t, uint8_t* out);
+    void configure();
+    void armInterrupt();
+    void interrupt();
+
+    int             int1_pin;
+    sim::EventId    irq_event;
+    bool            above;              // level was at or above the watermark
+};
+
+// BM1383GLV pressure
+class Bm1383Model : public RegisterModel
+{
+public:
+    Bm1383Model(const SimWorld& world);
+protected:
+    virtual void update();
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "sim_world.h"
+#include <math.h>
+
+static const double day_s = 86400;
+
+SimWorld::SimWorld(uint32_t seed, double noise_scale) : seed(seed), noise_scale(noise_scale)
+{
+}
+
+double SimWorld::noise(double t, int channel) const
+{
+    if (noise_scale == 0)
+        return 0;
+    // splitmix64 of the microsecond and the channel
+    uint64_t x = (uint64_t) (t * 1e6) ^ ((uint64_t) channel << 48) ^ ((uint64_t) seed << 32);
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return noise_scale * ((double) (x >> 11) / (double) (1ULL << 52) - 1);
+}
+
+// daylight 0..1, the simulation starts at 06:00
+static double daylight(double t)
+{
+    double s = sin(2 * M_PI * t / day_s);
+    return s > 0 ? s : 0;
+}
+
+double SimWorld::temp_c(double t) const
+{
+    return 21 + 4 * sin(2 * M_PI * (t - 3 * 3600) / day_s) + 0.05 * noise(t, 1);
+}
+
+double SimWorld::pressure_hpa(double t) const
+{
+    return 1013.25 + 2.5 * sin(2 * M_PI * t / (2 * day_s)) + 0.6 * sin(2 * M_PI * t / (day_s / 2)) +
+           0.02 * noise(t, 2);
+}
+
+double SimWorld::lux(double t) const
+{
+    return 15 + 600 * daylight(t) + 2 * noise(t, 3);
+}
+
+double SimWorld::uv_mw_cm2(double t) const
+{
+    return 3 * daylight(t) + 0.05 * noise(t, 4);
+}
+
+double SimWorld::proximity(double t) const
+{
+    // something passes for 20 s every 10 minutes
+    return fmod(t, 600) < 20 ? 800 + 50 * noise(t, 5) : 5 + 2 * noise(t, 5);
+}
+
+void SimWorld::rgb(double t, double out[3]) const
+{
+    double l = lux(t);
+    out[0] = l * 1.10 + 3 * noise(t, 6);
+    out[1] = l * 1.45 + 3 * noise(t, 7);
+    out[2] = l * 0.80 + 3 * noise(t, 8);
+}
+
+bool SimWorld::machine_running(double t) const
+{
+    return fmod(t, 3600) >= 1800 && fmod(t, 3600) < 3000;
+}
+
+void SimWorld::accel_g(double t, double out[3]) const
+{
+    // board lying flat and slightly tilted, plus the machine's 25 Hz vibration
+    double v = machine_running(t) ? 0.05 * sin(2 * M_PI * 25 * t) : 0;
+    out[0] = 0.02 + v + 0.002 * noise(t, 9);
+    out[1] = -0.01 + 0.4 * v + 0.002 * noise(t, 10);
+    out[2] = 0.9997 + 0.002 * noise(t, 11);
+}
+
+void SimWorld::mag_ut(double t, double out[3]) const
+{
+    out[0] = 18 + 0.2 * noise(t, 12);
+    out[1] = -4 + 0.2 * noise(t, 13);
+    out[2] = 42 + 0.2 * noise(t, 14);
+    if (hall_south(t) || hall_north(t))
+        out[0] += 150;
+}
+
+bool SimWorld::hall_south(double t) const
+{
+    return fmod(t, 900) >= 300 && fmod(t, 900) < 330;
+}
+
+bool SimWorld::hall_north(double t) const
+{
+    return fmod(t, 900) >= 600 && fmod(t, 900) < 615;
+}
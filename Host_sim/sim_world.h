@@ -0,0 +1,42 @@
+/****************************************************************************************************
+ * sim_world.h
+ *
+ * The physical surroundings of the simulated board, as functions of virtual time (seconds).
+ *
+ * A slow day/night cycle drives temperature, pressure, light and UV; a machine next to the board
+ * runs for 20 minutes every hour and shakes it at 25 Hz; a magnet passes the hall sensor now and
+ * then and something comes near the proximity sensor.  Noise is a hash of time and channel, so a
+ * value does not depend on when or how often it is looked at.
+ ****************************************************************************************************/
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <stdint.h>
+
+class SimWorld
+{
+public:
+    // noise_scale 0 gives the noise-free values the checks compare against
+    SimWorld(uint32_t seed = 1, double noise_scale = 1);
+
+    double temp_c(double t) const;
+    double pressure_hpa(double t) const;
+    double lux(double t) const;
+    double uv_mw_cm2(double t) const;
+    double proximity(double t) const;           // RPR0521 PS counts
+    void rgb(double t, double out[3]) const;    // BH1745 counts
+    void accel_g(double t, double out[3]) const;
+    void mag_ut(double t, double out[3]) const;
+    bool hall_south(double t) const;
+    bool hall_north(double t) const;
+    bool machine_running(double t) const;
+
+    // deterministic noise in -1..1
+    double noise(double t, int channel) const;
+
+private:
+    uint32_t    seed;
+    double      noise_scale;
+};
+
+#endif
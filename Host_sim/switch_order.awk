@@ -0,0 +1,22 @@
+# Usage: awk -f switch_order.awk main.cpp main.cpp
+#
+# Fails when an #if reads one of main.cpp's #define switches (a "#define Name //comment" line,
+# commented out or not) above the switch itself: there the switch is never set, so the #if quietly
+# takes its #else branch in every configuration.
+FNR == NR {
+    if ($0 ~ /^(\/\/)?#define [A-Za-z]+[ \t]+\/\//) {
+        name = $0
+        sub(/^(\/\/)?#define /, "", name)
+        sub(/[ \t].*/, "", name)
+        switch_line[name] = FNR
+    }
+    next
+}
+/^[ \t]*#[ \t]*(if|ifdef|ifndef|elif)[ \t]/ {
+    for (name in switch_line)
+        if (FNR < switch_line[name] && $0 ~ ("[^A-Za-z_0-9]" name "([^A-Za-z_0-9]|$)")) {
+            print FILENAME ":" FNR ": " name " is read above its switch at line " switch_line[name]
+            bad = 1
+        }
+}
+END { exit bad }
@@ -0,0 +1,246 @@
+/****************************************************************************************************
+ * uplink_bench.cpp
+ *
+ * Bytes on air and latency of one device's uploads over the Project_5 uplinks: the firmware's
+ * LinkManager (HTTP/1.1) and CoapLink (CoAP/UDP) built for the host (mtsas.h), posting the same
+ * batches of a virtual Dragonfly (fleet_device.h) to the local stand-ins.  The radio is modelled
+ * on the virtual clock (round trip, bit rate, see mtsas.h), so latencies are those of a cellular
+ * link and repeatable, while every byte really goes through the stand-in's checks.
+ *
+ *   uplink_bench [options]
+ *      -H http stand-in host:port (127.0.0.1:8080)     -C coap stand-in host:port (127.0.0.1:5683)
+ *      -m modes (http-new,http-keepalive,coap-con,coap-burst)
+ *      -n posts per mode (100)     -c samples per post (16)    -s sample interval ms (1000)
+ *      -f tsc|frames (tsc)         -r round trip ms (300)      -b bit rate (64000)
+ *      -B coap block size (256)    -L link setup ms (2000)     -k api key
+ *
+ *   http-new         a new TCP connection for every post (the old connect/post/disconnect)
+ *   http-keepalive   LinkManager as in main.cpp, one connection for all posts
+ *   coap-con         CoapLink, a confirmable block at a time (2.31 Continue in between)
+ *   coap-burst       CoapLink with the Block-Bitmap: all blocks at once, the missing ones again
+ *
+ * Run m2x_standin and coap_standin first.  Their -d differ: m2x_standin drops whole responses,
+ * coap_standin single datagrams.  BENCH_DEBUG=1 in the environment prints the links' debug log.
+ *
+ * Build: make uplink (in Host_sim)
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "mbed.h"
+#include "mtsas.h"
+#include "link_manager.h"
+#include "coap_link.h"
+#include "fleet_device.h"
+
+struct BenchConfig {
+    std::string http_host;
+    int         http_port;
+    std::string coap_host;
+    int         coap_port;
+    std::string modes;
+    int         posts;
+    int         samples;
+    int         sample_ms;
+    FleetFormat format;
+    int         block_size;
+    std::string api_key;
+};
+
+static BenchConfig config;
+
+struct BenchResult {
+    int                 ok;
+    int                 failed;
+    int                 samples;
+    uint64_t            body_bytes;
+    simnet::Stats       net;
+    std::vector<int>    latency_ms;
+    int                 retransmits;
+};
+
+static void split_address(const char* arg, std::string& host, int& port)
+{
+    const char* colon = strrchr(arg, ':');
+    if (colon) {
+        host.assign(arg, colon - arg);
+        port = atoi(colon + 1);
+    } else {
+        host = arg;
+    }
+}
+
+static simnet::Stats difference(const simnet::Stats& a, const simnet::Stats& b)
+{
+    simnet::Stats d;
+    d.packets_up = a.packets_up - b.packets_up;
+    d.packets_down = a.packets_down - b.packets_down;
+    d.bytes_up = a.bytes_up - b.bytes_up;
+    d.bytes_down = a.bytes_down - b.bytes_down;
+    d.link_connects = a.link_connects - b.link_connects;
+    d.tcp_connects = a.tcp_connects - b.tcp_connects;
+    return d;
+}
+
+// every mode posts the same batches: a new device with the same id and clock
+static bool run_mode(const std::string& mode, BenchResult& r)
+{
+    Cellular radio;
+    FleetDevice device(1, config.sample_ms, 0);
+    std::string path = "/v2/devices/dragonfly-bench/updates";
+    std::string header = "X-M2X-KEY: " + config.api_key + "\r\n";
+    std::string query = config.api_key.empty() ? "" : "key=" + config.api_key;
+    char response[256];
+    LinkManager* http = NULL;
+    CoapLink* coap = NULL;
+
+    if (mode == "http-new" || mode == "http-keepalive") {
+        http = new LinkManager(&radio, config.http_host.c_str(), config.http_port);
+        http->setHeader(header.c_str());
+        http->setIdleTimeout(0);
+    } else if (mode == "coap-con" || mode == "coap-burst") {
+        coap = new CoapLink(&radio, config.coap_host.c_str(), config.coap_port);
+        coap->setQuery(query.c_str());
+        coap->setBlockSize(config.block_size);
+        coap->setAckBitmap(mode == "coap-burst");
+        coap->setIdleTimeout(0);
+    } else {
+        return false;
+    }
+
+    r = BenchResult();
+    simnet::Stats before = simnet::stats();
+    int64_t now_ms = (int64_t) (config.samples - 1) * config.sample_ms;
+    std::string body;
+    for (int i = 0; i < config.posts; i++, now_ms += (int64_t) config.samples * config.sample_ms) {
+        int n = device.buildBody(now_ms, config.format, body);
+        BufferBodyOut out(body.data(), body.size(), FleetDevice::contentType(config.format));
+        HTTPResult ret;
+        // the whole request on the virtual clock, connect included, the data session set-up not
+        uint64_t start_us = sim::now_us(), connects = simnet::stats().link_connects;
+        if (http) {
+            ret = http->post(path.c_str(), out, response, sizeof(response));
+            if (mode == "http-new")
+                http->closeSocket();
+        } else {
+            ret = coap->post(path.c_str(), out, response, sizeof(response));
+        }
+        int latency = (int) ((sim::now_us() - start_us) / 1000) -
+                      (int) (simnet::stats().link_connects - connects) * simnet::config().link_setup_ms;
+        if (ret == HTTP_OK) {
+            r.ok++;
+            r.samples += n;
+            r.body_bytes += body.size();
+            r.latency_ms.push_back(latency);
+        } else {
+            r.failed++;
+        }
+    }
+
+    if (http) {
+        http->shutdown();
+        delete http;
+    } else {
+        r.retransmits = coap->retransmits + coap->block_resends;
+        coap->shutdown();
+        delete coap;
+    }
+    r.net = difference(simnet::stats(), before);
+    return true;
+}
+
+static int percentile(std::vector<int> v, double p)
+{
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t) (p * v.size()))];
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: uplink_bench [-H host:port] [-C host:port] [-m modes] [-n posts] [-c samples] [-s sample_ms]\n"
+                    "                    [-f tsc|frames] [-r rtt_ms] [-b bps] [-B block_size] [-L link_setup_ms] [-k api_key]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    config.http_host = config.coap_host = "127.0.0.1";
+    config.http_port = 8080;
+    config.coap_port = 5683;
+    config.modes = "http-new,http-keepalive,coap-con,coap-burst";
+    config.posts = 100;
+    config.samples = 16;
+    config.sample_ms = 1000;
+    config.format = FLEET_TSC;
+    config.block_size = 256;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:C:m:n:c:s:f:r:b:B:L:k:")) != -1) {
+        switch (opt) {
+        case 'H': split_address(optarg, config.http_host, config.http_port); break;
+        case 'C': split_address(optarg, config.coap_host, config.coap_port); break;
+        case 'm': config.modes = optarg; break;
+        case 'n': config.posts = atoi(optarg); break;
+        case 'c': config.samples = atoi(optarg); break;
+        case 's': config.sample_ms = atoi(optarg); break;
+        case 'f':
+            if (strcmp(optarg, "tsc") == 0)
+                config.format = FLEET_TSC;
+            else if (strcmp(optarg, "frames") == 0)
+                config.format = FLEET_FRAMES;
+            else
+                usage();
+            break;
+        case 'r': simnet::config().rtt_ms = atoi(optarg); break;
+        case 'b': simnet::config().bps = atoi(optarg); break;
+        case 'B': config.block_size = atoi(optarg); break;
+        case 'L': simnet::config().link_setup_ms = atoi(optarg); break;
+        case 'k': config.api_key = optarg; break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || config.posts <= 0 || config.samples <= 0 || config.sample_ms <= 0 ||
+        simnet::config().bps <= 0)
+        usage();
+    mts::MTSLog::setLogLevel(getenv("BENCH_DEBUG") ? mts::MTSLog::DEBUG_LEVEL : mts::MTSLog::WARNING_LEVEL);
+
+    printf("%d posts of %d samples (%s), round trip %d ms, %d bit/s, link setup %d ms, CoAP blocks of %d\n",
+           config.posts, config.samples, config.format == FLEET_TSC ? "tsc" : "frames", simnet::config().rtt_ms,
+           simnet::config().bps, simnet::config().link_setup_ms, config.block_size);
+    printf("%-15s %5s %5s %9s %9s %9s %8s %8s %8s %8s %8s %7s\n", "mode", "ok", "fail", "body B", "up B",
+           "down B", "pkts", "mean ms", "p50 ms", "p95 ms", "max ms", "resend");
+
+    size_t start = 0;
+    while (start <= config.modes.size()) {
+        size_t comma = config.modes.find(',', start);
+        if (comma == std::string::npos)
+            comma = config.modes.size();
+        std::string mode = config.modes.substr(start, comma - start);
+        start = comma + 1;
+
+        BenchResult r;
+        if (! run_mode(mode, r)) {
+            fprintf(stderr, "unknown mode %s\n", mode.c_str());
+            usage();
+        }
+        // per accepted post
+        double posts = std::max(1, r.ok);
+        double mean = 0;
+        for (size_t i = 0; i < r.latency_ms.size(); i++)
+            mean += r.latency_ms[i];
+        mean /= std::max<size_t>(1, r.latency_ms.size());
+        printf("%-15s %5d %5d %9.1f %9.1f %9.1f %8.1f %8.0f %8d %8d %8d %7d\n", mode.c_str(), r.ok, r.failed,
+               r.body_bytes / posts, r.net.bytes_up / posts, r.net.bytes_down / posts,
+               (r.net.packets_up + r.net.packets_down) / posts, mean, percentile(r.latency_ms, 0.5),
+               percentile(r.latency_ms, 0.95), percentile(r.latency_ms, 1.0), r.retransmits);
+        fflush(stdout);
+    }
+    return 0;
+}
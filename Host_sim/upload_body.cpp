@@ -0,0 +1,192 @@
+#include "upload_body.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+
+int upload_route(const std::string& method, const std::string& full_path, std::string& device, std::string& endpoint)
+{
+    std::string path = full_path.substr(0, full_path.find('?'));
+    if (path.compare(0, 4, "/v2/") == 0)
+        path.erase(0, 3);
+    if (path.compare(0, 9, "/devices/") != 0)
+        return 404;
+    size_t slash = path.find('/', 9);
+    if (slash == std::string::npos || slash == 9)
+        return 404;
+    std::string name = path.substr(slash + 1);
+    if (name != "update" && name != "updates")
+        return 404;
+    device = path.substr(9, slash - 9);
+    endpoint = name;
+    if (name == "update")
+        return method == "POST" || method == "PUT" ? 0 : 405;
+    return method == "POST" ? 0 : 405;
+}
+
+bool parse_iso_time(const char* s, int64_t& ms)
+{
+    struct tm tm;
+    int millis = 0, n = 0;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min,
+               &tm.tm_sec, &n) != 6)
+        return false;
+    if (s[n] == '.')
+        millis = atoi(s + n + 1);
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    ms = (int64_t) timegm(&tm) * 1000 + millis;
+    return true;
+}
+
+int upload_check(const std::string& content_type, const std::string& body, std::vector<int64_t>& times)
+{
+    std::string type = content_type.substr(0, content_type.find(';'));
+    for (size_t i = 0; i < type.size(); i++)
+        type[i] = tolower(type[i]);
+    const uint8_t* buf = (const uint8_t*) body.data();
+    int len = body.size();
+    SensorSample sample;
+
+    times.clear();
+    if (type == "application/x-dragonfly-telemetry" || type == "application/x-dragonfly-tsc") {
+        for (int pos = 0; pos < len; ) {
+            if (buf[pos] == TSC_MAGIC) {
+                TsDecompressor block;
+                if (! block.begin(buf + pos, len - pos))
+                    return 422;
+                while (block.remaining()) {
+                    if (! block.next(sample))
+                        return 422;
+                    times.push_back((int64_t) sample.timestamp * 1000 + sample.millis);
+                }
+                pos += block.blockSize();
+                continue;
+            }
+            int n = telemetry_decode(buf + pos, len - pos, sample);
+            if (n < 0)
+                return 422;
+            times.push_back((int64_t) sample.timestamp * 1000 + sample.millis);
+            pos += n;
+        }
+        return times.empty() ? 422 : 0;
+    }
+    if (type == "application/json" || type.empty()) {
+        if (body.find("\"values\"") == std::string::npos)
+            return 422;
+        // a batch lists every stream with its own timestamps, a sample is one distinct timestamp
+        for (size_t pos = body.find("\"timestamp\""); pos != std::string::npos;
+             pos = body.find("\"timestamp\"", pos + 11)) {
+            size_t quote = body.find('"', body.find(':', pos + 11));
+            int64_t ms;
+            if (quote == std::string::npos || ! parse_iso_time(body.c_str() + quote + 1, ms))
+                return 422;
+            times.push_back(ms);
+        }
+        if (times.empty())
+            times.push_back(INT64_MIN);
+        return 0;
+    }
+    return 415;
+}
+
+/****************************************************************************************************
+// HTTP requests
+ ****************************************************************************************************/
+static std::string lower(std::string s)
+{
+    for (size_t i = 0; i < s.size(); i++)
+        s[i] = tolower(s[i]);
+    return s;
+}
+
+int http_parse_request(std::string& in, HttpRequest& req)
+{
+    size_t end = in.find("\r\n\r\n");
+    if (end == std::string::npos)
+        return in.size() > HTTP_MAX_HEAD ? -1 : 0;
+
+    size_t eol = in.find("\r\n");
+    size_t sp1 = in.find(' ');
+    size_t sp2 = in.rfind(' ', eol);
+    if (sp1 >= eol || sp2 == sp1)
+        return -1;
+    req.method = in.substr(0, sp1);
+    req.path = in.substr(sp1 + 1, sp2 - sp1 - 1);
+    req.close = in.compare(sp2 + 1, eol - sp2 - 1, "HTTP/1.0") == 0;
+    req.content_type.clear();
+    req.api_key.clear();
+
+    long content_length = 0;
+    bool chunked = false;
+    for (size_t pos = eol + 2; pos < end; ) {
+        size_t next = in.find("\r\n", pos);
+        size_t colon = in.find(':', pos);
+        if (colon < next) {
+            std::string name = lower(in.substr(pos, colon - pos));
+            size_t v = colon + 1;
+            while (v < next && (in[v] == ' ' || in[v] == '\t'))
+                v++;
+            std::string value = in.substr(v, next - v);
+            while (! value.empty() && (value[value.size() - 1] == ' ' || value[value.size() - 1] == '\t'))
+                value.erase(value.size() - 1);
+            if (name == "content-length")
+                content_length = strtol(value.c_str(), NULL, 10);
+            else if (name == "transfer-encoding")
+                chunked = lower(value).find("chunked") != std::string::npos;
+            else if (name == "connection")
+                req.close = lower(value) == "close" || (req.close && lower(value) != "keep-alive");
+            else if (name == "content-type")
+                req.content_type = value;
+            else if (name == "x-m2x-key")
+                req.api_key = value;
+        }
+        pos = next + 2;
+    }
+
+    size_t pos = end + 4;
+    req.body.clear();
+    if (chunked) {
+        for (;;) {
+            size_t line_end = in.find("\r\n", pos);
+            if (line_end == std::string::npos)
+                return 0;
+            char* digits_end;
+            unsigned long n = strtoul(in.c_str() + pos, &digits_end, 16);
+            if (digits_end == in.c_str() + pos || req.body.size() + n > HTTP_MAX_BODY)
+                return -1;
+            pos = line_end + 2;
+            if (n == 0) {
+                // optional trailers up to an empty line
+                for (;;) {
+                    size_t t = in.find("\r\n", pos);
+                    if (t == std::string::npos)
+                        return 0;
+                    bool empty = t == pos;
+                    pos = t + 2;
+                    if (empty)
+                        break;
+                }
+                break;
+            }
+            if (in.size() < pos + n + 2)
+                return 0;
+            req.body.append(in, pos, n);
+            pos += n + 2;
+        }
+    } else {
+        if (content_length < 0 || content_length > HTTP_MAX_BODY)
+            return -1;
+        if (in.size() < pos + (size_t) content_length)
+            return 0;
+        req.body.assign(in, pos, content_length);
+        pos += content_length;
+    }
+    in.erase(0, pos);
+    return 1;
+}
+
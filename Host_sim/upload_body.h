@@ -0,0 +1,40 @@
+/****************************************************************************************************
+ * upload_body.h
+ *
+ * What the host stand-ins accept from Project_5: the M2X update paths and the checks of an upload
+ * body by its content type, shared by the HTTP (m2x_standin.cpp) and CoAP (coap_standin.cpp)
+ * stand-ins so both reject the same bodies the same way, and the HTTP/1.1 request parser of
+ * m2x_standin.cpp and the simulation's server (sim_main.cpp).
+ ****************************************************************************************************/
+#ifndef UPLOAD_BODY_H
+#define UPLOAD_BODY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define HTTP_MAX_HEAD           8192
+#define HTTP_MAX_BODY           (1 << 20)
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::string content_type;
+    std::string api_key;
+    std::string body;
+    bool        close;                  // no keep-alive after the response
+};
+
+// take one request off the front of in: 1 complete, 0 need more data, -1 malformed
+int http_parse_request(std::string& in, HttpRequest& req);
+
+// [/v2]/devices/<id>/update or /updates: 0 and the device and endpoint, or the HTTP status
+int upload_route(const std::string& method, const std::string& path, std::string& device, std::string& endpoint);
+
+// sample times of a body (INT64_MIN for one stamped by the server), 0 or the status of a bad body
+int upload_check(const std::string& content_type, const std::string& body, std::vector<int64_t>& times);
+
+// "2016-03-01T12:00:00.250Z" -> ms since 1970
+bool parse_iso_time(const char* s, int64_t& ms);
+
+#endif
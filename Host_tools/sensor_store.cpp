@@ -0,0 +1,426 @@
+#include "sensor_store.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t align_up(size_t n)
+{
+    return (n + STORE_ALIGN - 1) & ~(size_t) (STORE_ALIGN - 1);
+}
+
+static size_t data_offset()
+{
+    return align_up(sizeof(StoreFileHeader) + STORE_COLUMNS * sizeof(StoreColumnInfo));
+}
+
+static size_t type_size(StoreType type)
+{
+    switch (type) {
+    case STORE_INT64:   return 8;
+    case STORE_UINT16:  return 2;
+    default:            return 4;
+    }
+}
+
+static uint32_t fnv1a(const uint8_t* p, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t chunk_checksum(const StoreChunkHeader* h)
+{
+    size_t header = align_up(sizeof(StoreChunkHeader));
+    return fnv1a((const uint8_t*) h + header, h->size - header);
+}
+
+static bool write_all(int fd, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+StoreType store_column_type(int column)
+{
+    if (column == STORE_COL_TIME)
+        return STORE_INT64;
+    if (column == STORE_COL_FLAGS)
+        return STORE_UINT16;
+    return telemetry_schema[column - STORE_COL_CHANNEL].field == FIELD_INT32 ? STORE_INT32 : STORE_FLOAT;
+}
+
+int store_column(const char* name)
+{
+    if (strcmp(name, "time") == 0)
+        return STORE_COL_TIME;
+    if (strcmp(name, "flags") == 0)
+        return STORE_COL_FLAGS;
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        if (strcmp(name, telemetry_schema[i].name) == 0)
+            return STORE_COL_CHANNEL + i;
+    }
+    return -1;
+}
+
+// file header and column table of a new file
+static void make_file_header(uint32_t chunk_rows, std::vector<uint8_t>& out)
+{
+    out.assign(data_offset(), 0);
+    StoreFileHeader* h = (StoreFileHeader*) &out[0];
+    memcpy(h->magic, STORE_MAGIC, sizeof(h->magic));
+    h->version = STORE_VERSION;
+    h->columns = STORE_COLUMNS;
+    h->chunk_rows = chunk_rows;
+    h->data_offset = data_offset();
+
+    StoreColumnInfo* info = (StoreColumnInfo*) (h + 1);
+    strcpy(info[STORE_COL_TIME].name, "time");
+    info[STORE_COL_TIME].type = STORE_INT64;
+    strcpy(info[STORE_COL_FLAGS].name, "flags");
+    info[STORE_COL_FLAGS].type = STORE_UINT16;
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        StoreColumnInfo& c = info[STORE_COL_CHANNEL + i];
+        strncpy(c.name, telemetry_schema[i].name, sizeof(c.name) - 1);
+        c.type = store_column_type(STORE_COL_CHANNEL + i);
+        c.group = telemetry_schema[i].group;
+    }
+}
+
+static bool valid_file_header(const StoreFileHeader* h)
+{
+    return memcmp(h->magic, STORE_MAGIC, sizeof(h->magic)) == 0 && h->version == STORE_VERSION &&
+           h->columns == STORE_COLUMNS && h->data_offset == data_offset() && h->chunk_rows > 0;
+}
+
+// chunk header at offset plausible for a file of file_size bytes
+static bool valid_chunk_header(const StoreChunkHeader* h, size_t offset, size_t file_size)
+{
+    return h->magic == STORE_CHUNK_MAGIC && h->rows > 0 && h->size >= align_up(sizeof(StoreChunkHeader)) &&
+           h->size % STORE_ALIGN == 0 && h->size <= file_size - offset;
+}
+
+/****************************************************************************************************
+// writer
+ ****************************************************************************************************/
+SensorStoreWriter::SensorStoreWriter() : truncated(0), fd(-1), chunk_rows(STORE_CHUNK_ROWS), file_rows(0)
+{
+}
+
+SensorStoreWriter::~SensorStoreWriter()
+{
+    close();
+}
+
+bool SensorStoreWriter::open(const char* path, uint32_t rows_per_chunk)
+{
+    close();
+    fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    fstat(fd, &st);
+    size_t file_size = st.st_size;
+    file_rows = 0;
+    truncated = 0;
+
+    if (file_size == 0) {
+        std::vector<uint8_t> header;
+        chunk_rows = rows_per_chunk ? rows_per_chunk : STORE_CHUNK_ROWS;
+        make_file_header(chunk_rows, header);
+        if (! write_all(fd, &header[0], header.size())) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    StoreFileHeader fh;
+    if (file_size < data_offset() || pread(fd, &fh, sizeof(fh), 0) != (ssize_t) sizeof(fh) || ! valid_file_header(&fh)) {
+        close();
+        return false;
+    }
+    chunk_rows = fh.chunk_rows;
+
+    // walk the chunks, cut off a torn one at the end
+    size_t offset = data_offset();
+    while (offset < file_size) {
+        StoreChunkHeader h;
+        if (file_size - offset < sizeof(h) || pread(fd, &h, sizeof(h), offset) != (ssize_t) sizeof(h) ||
+            ! valid_chunk_header(&h, offset, file_size))
+            break;
+        if (offset + h.size == file_size) {
+            std::vector<uint8_t> last(h.size);
+            if (pread(fd, &last[0], h.size, offset) != (ssize_t) h.size ||
+                chunk_checksum((const StoreChunkHeader*) &last[0]) != h.checksum)
+                break;
+        }
+        file_rows += h.rows;
+        offset += h.size;
+    }
+    if (offset < file_size) {
+        truncated = file_size - offset;
+        if (ftruncate(fd, offset) != 0) {
+            close();
+            return false;
+        }
+    }
+    lseek(fd, offset, SEEK_SET);
+    return true;
+}
+
+bool SensorStoreWriter::append(const SensorSample& sample)
+{
+    if (fd < 0)
+        return false;
+    pending.push_back(sample);
+    if (pending.size() >= chunk_rows)
+        return writeChunk();
+    return true;
+}
+
+bool SensorStoreWriter::flush()
+{
+    if (fd < 0)
+        return false;
+    return pending.empty() || writeChunk();
+}
+
+bool SensorStoreWriter::close()
+{
+    if (fd < 0)
+        return true;
+    bool ok = flush();
+    ::close(fd);
+    fd = -1;
+    pending.clear();
+    return ok;
+}
+
+uint64_t SensorStoreWriter::rows()
+{
+    return file_rows + pending.size();
+}
+
+bool SensorStoreWriter::writeChunk()
+{
+    uint32_t rows = pending.size();
+
+    // layout
+    uint32_t offset[STORE_COLUMNS];
+    size_t size = align_up(sizeof(StoreChunkHeader));
+    for (int c = 0; c < STORE_COLUMNS; c++) {
+        offset[c] = size;
+        size += align_up(rows * type_size(store_column_type(c)));
+    }
+    chunk.assign(size, 0);
+
+    StoreChunkHeader* h = (StoreChunkHeader*) &chunk[0];
+    h->magic = STORE_CHUNK_MAGIC;
+    h->rows = rows;
+    h->size = size;
+    memcpy(h->offset, offset, sizeof(offset));
+
+    int64_t* time = (int64_t*) &chunk[offset[STORE_COL_TIME]];
+    uint16_t* flags = (uint16_t*) &chunk[offset[STORE_COL_FLAGS]];
+    for (uint32_t r = 0; r < rows; r++) {
+        const SensorSample& s = pending[r];
+        time[r] = (int64_t) s.timestamp * 1000 + s.millis;
+        flags[r] = s.flags;
+        if (r == 0 || time[r] < h->time_min_ms)
+            h->time_min_ms = time[r];
+        if (r == 0 || time[r] > h->time_max_ms)
+            h->time_max_ms = time[r];
+        h->flags |= s.flags;
+    }
+
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        const TelemetryChannel& ch = telemetry_schema[i];
+        StoreChannelStats& st = h->stats[i];
+        uint8_t* col = &chunk[offset[STORE_COL_CHANNEL + i]];
+        for (uint32_t r = 0; r < rows; r++) {
+            const SensorSample& s = pending[r];
+            memcpy(col + 4 * r, (const uint8_t*) &s + ch.offset, 4);
+            if (! (s.flags & ch.group))
+                continue;
+            float v;
+            if (ch.field == FIELD_INT32) {
+                int32_t iv;
+                memcpy(&iv, col + 4 * r, 4);
+                v = iv;
+            } else {
+                memcpy(&v, col + 4 * r, 4);
+            }
+            if (st.count == 0 || v < st.min)
+                st.min = v;
+            if (st.count == 0 || v > st.max)
+                st.max = v;
+            st.sum += v;
+            st.count++;
+        }
+    }
+    h->checksum = chunk_checksum(h);
+
+    if (! write_all(fd, &chunk[0], size))
+        return false;
+    file_rows += rows;
+    pending.clear();
+    return true;
+}
+
+/****************************************************************************************************
+// reader
+ ****************************************************************************************************/
+SensorStoreReader::SensorStoreReader() : fd(-1), base(NULL), size(0), next_chunk(0), total_rows(0)
+{
+}
+
+SensorStoreReader::~SensorStoreReader()
+{
+    close();
+}
+
+bool SensorStoreReader::open(const char* path)
+{
+    close();
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (! map() || size < data_offset() || ! valid_file_header((const StoreFileHeader*) base)) {
+        close();
+        return false;
+    }
+    next_chunk = data_offset();
+    return refresh();
+}
+
+void SensorStoreReader::close()
+{
+    if (base)
+        munmap((void*) base, size);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    base = NULL;
+    size = 0;
+    chunks.clear();
+    total_rows = 0;
+}
+
+bool SensorStoreReader::map()
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return false;
+    if ((size_t) st.st_size == size && base)
+        return true;
+    if (base)
+        munmap((void*) base, size);
+    base = NULL;
+    size = st.st_size;
+    if (size == 0)
+        return true;
+    void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        size = 0;
+        return false;
+    }
+    base = (const uint8_t*) p;
+    return true;
+}
+
+bool SensorStoreReader::refresh()
+{
+    if (fd < 0 || ! map())
+        return false;
+    while (next_chunk < size && size - next_chunk >= sizeof(StoreChunkHeader)) {
+        const StoreChunkHeader* h = (const StoreChunkHeader*) (base + next_chunk);
+        if (! valid_chunk_header(h, next_chunk, size))
+            break;
+        // only the last chunk can be torn
+        if (next_chunk + h->size == size && chunk_checksum(h) != h->checksum)
+            break;
+        chunks.push_back(next_chunk);
+        total_rows += h->rows;
+        next_chunk += h->size;
+    }
+    return true;
+}
+
+const StoreFileHeader& SensorStoreReader::header()
+{
+    return *(const StoreFileHeader*) base;
+}
+
+const StoreColumnInfo& SensorStoreReader::columnInfo(int column)
+{
+    return ((const StoreColumnInfo*) (base + sizeof(StoreFileHeader)))[column];
+}
+
+size_t SensorStoreReader::chunkCount()
+{
+    return chunks.size();
+}
+
+const StoreChunkHeader& SensorStoreReader::chunk(size_t i)
+{
+    return *(const StoreChunkHeader*) (base + chunks[i]);
+}
+
+uint64_t SensorStoreReader::rows()
+{
+    return total_rows;
+}
+
+bool SensorStoreReader::overlaps(size_t i, int64_t from_ms, int64_t to_ms)
+{
+    const StoreChunkHeader& h = chunk(i);
+    return h.time_max_ms >= from_ms && h.time_min_ms <= to_ms;
+}
+
+const uint8_t* SensorStoreReader::column(size_t i, int column, StoreType type)
+{
+    if (column < 0 || column >= STORE_COLUMNS || store_column_type(column) != type)
+        return NULL;
+    return base + chunks[i] + chunk(i).offset[column];
+}
+
+const int64_t* SensorStoreReader::timeColumn(size_t i)
+{
+    return (const int64_t*) column(i, STORE_COL_TIME, STORE_INT64);
+}
+
+const uint16_t* SensorStoreReader::flagsColumn(size_t i)
+{
+    return (const uint16_t*) column(i, STORE_COL_FLAGS, STORE_UINT16);
+}
+
+const float* SensorStoreReader::floatColumn(size_t i, int col)
+{
+    return (const float*) column(i, col, STORE_FLOAT);
+}
+
+const int32_t* SensorStoreReader::intColumn(size_t i, int col)
+{
+    return (const int32_t*) column(i, col, STORE_INT32);
+}
+
+double SensorStoreReader::value(size_t i, int col, uint32_t row)
+{
+    if (store_column_type(col) == STORE_INT32)
+        return intColumn(i, col)[row];
+    return floatColumn(i, col)[row];
+}
@@ -0,0 +1,169 @@
+/****************************************************************************************************
+ * sensor_store.h
+ *
+ * Append-only columnar file for ingested SensorSample streams ("DFSTORE"), read in place with mmap.
+ *
+ * File layout, little endian, every structure and column starts on a 64-byte boundary:
+ *
+ *      StoreFileHeader                 magic, version, column count, rows per chunk
+ *      StoreColumnInfo[columns]        name, value type and sensor group of every column
+ *      chunk, chunk, ...               appended in arrival order
+ *
+ * A chunk holds up to chunk_rows samples: a StoreChunkHeader with the time range, the OR of the
+ * sample flags and count/min/max/sum of every channel (over the rows whose sensor was read), then
+ * one array per column:  time (int64 ms since 1970), flags (uint16 SAMPLE_* bits), and the
+ * telemetry_schema channels in schema order (float, or int32 for FIELD_INT32).  A channel whose
+ * sensor was not read for a row holds 0 there; the flags column tells which rows are valid.
+ *
+ * Queries use the chunk headers as the index: chunks outside a time range are skipped and chunks
+ * entirely inside it are answered from their statistics without touching the columns.  The column
+ * arrays are returned as pointers into the mapping, so scans copy nothing.
+ *
+ * A chunk is written in one piece and carries a checksum.  Only the last chunk of a file can be
+ * torn by a crash: readers verify it and ignore it when it is incomplete, the next writer cuts it off.
+ * The format assumes a little-endian host.
+ ****************************************************************************************************/
+#ifndef SENSOR_STORE_H
+#define SENSOR_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "sensor_sample.h"
+#include "telemetry_codec.h"
+
+#define STORE_MAGIC         "DFSTORE1"
+#define STORE_VERSION       1
+#define STORE_CHUNK_MAGIC   0x4B434644          // "DFCK"
+#define STORE_CHUNK_ROWS    4096                // default rows per chunk
+#define STORE_ALIGN         64
+
+#define STORE_COL_TIME      0
+#define STORE_COL_FLAGS     1
+#define STORE_COL_CHANNEL   2                   // first channel column, + telemetry_schema index
+#define STORE_COLUMNS       (STORE_COL_CHANNEL + TELEMETRY_CHANNELS)
+
+enum StoreType {
+    STORE_INT64,
+    STORE_UINT16,
+    STORE_FLOAT,
+    STORE_INT32
+};
+
+struct StoreFileHeader {
+    char        magic[8];                       // STORE_MAGIC, no terminator
+    uint32_t    version;
+    uint32_t    columns;
+    uint32_t    chunk_rows;
+    uint32_t    data_offset;                    // first chunk
+    uint8_t     reserved[40];
+};
+
+struct StoreColumnInfo {
+    char        name[24];                       // zero padded
+    uint8_t     type;                           // StoreType
+    uint8_t     reserved;
+    uint16_t    group;                          // SAMPLE_* bit of the channel's sensor, 0 for time/flags
+    uint32_t    reserved2;
+};
+
+struct StoreChannelStats {
+    uint32_t    count;                          // rows with the channel's sensor read
+    float       min;
+    float       max;
+    float       reserved;
+    double      sum;
+};
+
+struct StoreChunkHeader {
+    uint32_t    magic;                          // STORE_CHUNK_MAGIC
+    uint32_t    rows;
+    uint64_t    size;                           // whole chunk including this header
+    int64_t     time_min_ms;
+    int64_t     time_max_ms;
+    uint32_t    flags;                          // OR of the SAMPLE_* flags of all rows
+    uint32_t    checksum;                       // FNV-1a of the column data
+    uint32_t    offset[STORE_COLUMNS];          // column arrays, from the start of the chunk
+    StoreChannelStats stats[TELEMETRY_CHANNELS];
+};
+
+// index of the column called name, -1 if there is none
+int store_column(const char* name);
+
+StoreType store_column_type(int column);
+
+class SensorStoreWriter
+{
+public:
+    SensorStoreWriter();
+    ~SensorStoreWriter();
+
+    // create path, or open it to append; chunk_rows only applies to a new file
+    bool open(const char* path, uint32_t chunk_rows = STORE_CHUNK_ROWS);
+
+    // buffer one sample, a full chunk is written out
+    bool append(const SensorSample& sample);
+
+    // write the buffered samples as a (possibly short) chunk
+    bool flush();
+
+    // flush and close
+    bool close();
+
+    uint64_t rows();                            // in the file, including buffered ones
+    uint32_t truncated;                         // bytes of a torn chunk cut off by open()
+
+private:
+    bool writeChunk();
+
+    int         fd;
+    uint32_t    chunk_rows;
+    uint64_t    file_rows;
+    std::vector<SensorSample> pending;
+    std::vector<uint8_t> chunk;
+};
+
+class SensorStoreReader
+{
+public:
+    SensorStoreReader();
+    ~SensorStoreReader();
+
+    bool open(const char* path);
+    void close();
+
+    // map chunks appended since open() or the last refresh(); earlier column pointers become invalid
+    bool refresh();
+
+    const StoreFileHeader& header();
+    const StoreColumnInfo& columnInfo(int column);
+
+    size_t chunkCount();
+    const StoreChunkHeader& chunk(size_t i);
+    uint64_t rows();
+
+    // true if chunk i has rows in [from_ms, to_ms]
+    bool overlaps(size_t i, int64_t from_ms, int64_t to_ms);
+
+    // column arrays of chunk i, rows values each, NULL if the column has another type
+    const int64_t* timeColumn(size_t i);
+    const uint16_t* flagsColumn(size_t i);
+    const float* floatColumn(size_t i, int column);
+    const int32_t* intColumn(size_t i, int column);
+
+    // channel column value of row as a double, either type
+    double value(size_t i, int column, uint32_t row);
+
+private:
+    bool map();
+    const uint8_t* column(size_t i, int column, StoreType type);
+
+    int         fd;
+    const uint8_t* base;
+    size_t      size;
+    size_t      next_chunk;                     // where the chunk walk continues
+    std::vector<size_t> chunks;                 // chunk offsets
+    uint64_t    total_rows;
+};
+
+#endif
@@ -0,0 +1,289 @@
+/****************************************************************************************************
+ * sensor_store_tool.cpp
+ *
+ * Command line front end of the columnar sample store (sensor_store.h).
+ *
+ *   sensor_store append <store> [-r rows] [file...]     append the samples of upload bodies
+ *                                                       (frames and/or compressed blocks, default
+ *                                                       stdin); -r sets the rows per chunk of a new store
+ *   sensor_store info <store>                           chunks, rows, time range, per-channel statistics
+ *   sensor_store scan <store> <channel> [from to]       count/min/max/mean of a channel, optionally in
+ *                                                       [from, to] (seconds since 1970)
+ *   sensor_store csv <store> [from to]                  the rows as CSV, columns as telemetry_decode
+ *
+ * Build:
+ *   g++ -O2 -I../Project_5_send_sensor_sms -o sensor_store sensor_store_tool.cpp sensor_store.cpp \
+ *       ../Project_5_send_sensor_sms/telemetry_codec.cpp ../Project_5_send_sensor_sms/ts_compress.cpp
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "sensor_store.h"
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+
+static int usage()
+{
+    fprintf(stderr, "usage: sensor_store append <store> [-r rows] [file...]\n"
+                    "       sensor_store info <store>\n"
+                    "       sensor_store scan <store> <channel> [from to]\n"
+                    "       sensor_store csv <store> [from to]\n");
+    return 2;
+}
+
+static bool read_file(const char* path, std::vector<uint8_t>& data)
+{
+    FILE* f = path ? fopen(path, "rb") : stdin;
+    if (! f) {
+        perror(path);
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    data.clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    if (f != stdin)
+        fclose(f);
+    return true;
+}
+
+// append all frames and blocks in buf, returns false on bad data
+static bool append_body(SensorStoreWriter& store, const uint8_t* buf, int len)
+{
+    SensorSample sample;
+    int pos = 0;
+    while (pos < len) {
+        if (buf[pos] == TSC_MAGIC) {
+            TsDecompressor block;
+            if (! block.begin(buf + pos, len - pos))
+                return false;
+            while (block.remaining()) {
+                if (! block.next(sample) || ! store.append(sample))
+                    return false;
+            }
+            pos += block.blockSize();
+            continue;
+        }
+        int n = telemetry_decode(buf + pos, len - pos, sample);
+        if (n < 0 || ! store.append(sample))
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+static int cmd_append(int argc, char** argv)
+{
+    uint32_t chunk_rows = STORE_CHUNK_ROWS;
+    std::vector<const char*> files;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            chunk_rows = strtoul(argv[++i], NULL, 0);
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.size() < 1)
+        return usage();
+
+    SensorStoreWriter store;
+    if (! store.open(files[0], chunk_rows)) {
+        fprintf(stderr, "%s: cannot open store\n", files[0]);
+        return 1;
+    }
+    if (store.truncated)
+        fprintf(stderr, "%s: cut off %u bytes of an incomplete chunk\n", files[0], store.truncated);
+
+    uint64_t before = store.rows();
+    std::vector<uint8_t> data;
+    for (size_t i = 1; i < files.size() || i == 1; i++) {
+        const char* path = i < files.size() ? files[i] : NULL;
+        if (! read_file(path, data))
+            return 1;
+        if (! append_body(store, data.empty() ? NULL : &data[0], data.size())) {
+            fprintf(stderr, "%s: bad frame or block\n", path ? path : "stdin");
+            return 1;
+        }
+    }
+    if (! store.close()) {
+        perror(files[0]);
+        return 1;
+    }
+    printf("%llu samples appended, %llu in the store\n", (unsigned long long) (store.rows() - before),
+           (unsigned long long) store.rows());
+    return 0;
+}
+
+static void print_time(int64_t ms)
+{
+    time_t t = ms / 1000;
+    struct tm* tm = gmtime(&t);
+    printf("%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+           tm->tm_hour, tm->tm_min, tm->tm_sec, (int) (ms % 1000));
+}
+
+static int cmd_info(SensorStoreReader& store)
+{
+    printf("%llu rows in %lu chunks of up to %u rows\n", (unsigned long long) store.rows(),
+           (unsigned long) store.chunkCount(), store.header().chunk_rows);
+    if (store.chunkCount() == 0)
+        return 0;
+
+    int64_t first = store.chunk(0).time_min_ms, last = store.chunk(0).time_max_ms;
+    StoreChannelStats total[TELEMETRY_CHANNELS];
+    memset(total, 0, sizeof(total));
+    for (size_t i = 0; i < store.chunkCount(); i++) {
+        const StoreChunkHeader& h = store.chunk(i);
+        if (h.time_min_ms < first)
+            first = h.time_min_ms;
+        if (h.time_max_ms > last)
+            last = h.time_max_ms;
+        for (int c = 0; c < TELEMETRY_CHANNELS; c++) {
+            const StoreChannelStats& s = h.stats[c];
+            if (s.count == 0)
+                continue;
+            if (total[c].count == 0 || s.min < total[c].min)
+                total[c].min = s.min;
+            if (total[c].count == 0 || s.max > total[c].max)
+                total[c].max = s.max;
+            total[c].count += s.count;
+            total[c].sum += s.sum;
+        }
+    }
+    printf("from ");
+    print_time(first);
+    printf(" to ");
+    print_time(last);
+    printf("\n");
+
+    printf("%-14s %10s %12s %12s %12s\n", "channel", "count", "min", "max", "mean");
+    for (int c = 0; c < TELEMETRY_CHANNELS; c++) {
+        const StoreChannelStats& s = total[c];
+        if (s.count)
+            printf("%-14s %10u %12.6g %12.6g %12.6g\n", telemetry_schema[c].name, s.count, s.min, s.max, s.sum / s.count);
+        else
+            printf("%-14s %10u\n", telemetry_schema[c].name, 0);
+    }
+    return 0;
+}
+
+// statistics of one channel in [from_ms, to_ms]: whole chunks from their headers, the others row by row
+static int cmd_scan(SensorStoreReader& store, const char* name, int64_t from_ms, int64_t to_ms)
+{
+    int col = store_column(name);
+    if (col < STORE_COL_CHANNEL) {
+        fprintf(stderr, "unknown channel %s\n", name);
+        return 1;
+    }
+    int c = col - STORE_COL_CHANNEL;
+    uint16_t group = telemetry_schema[c].group;
+
+    uint64_t count = 0;
+    double sum = 0, min = 0, max = 0;
+    unsigned long skipped = 0, from_stats = 0, scanned = 0;
+    for (size_t i = 0; i < store.chunkCount(); i++) {
+        const StoreChunkHeader& h = store.chunk(i);
+        if (! store.overlaps(i, from_ms, to_ms) || h.stats[c].count == 0) {
+            skipped++;
+            continue;
+        }
+        if (h.time_min_ms >= from_ms && h.time_max_ms <= to_ms) {
+            const StoreChannelStats& s = h.stats[c];
+            if (count == 0 || s.min < min)
+                min = s.min;
+            if (count == 0 || s.max > max)
+                max = s.max;
+            count += s.count;
+            sum += s.sum;
+            from_stats++;
+            continue;
+        }
+        const int64_t* time = store.timeColumn(i);
+        const uint16_t* flags = store.flagsColumn(i);
+        for (uint32_t r = 0; r < h.rows; r++) {
+            if (time[r] < from_ms || time[r] > to_ms || ! (flags[r] & group))
+                continue;
+            double v = store.value(i, col, r);
+            if (count == 0 || v < min)
+                min = v;
+            if (count == 0 || v > max)
+                max = v;
+            count++;
+            sum += v;
+        }
+        scanned++;
+    }
+    printf("%s: %llu values", name, (unsigned long long) count);
+    if (count)
+        printf(", min %.6g, max %.6g, mean %.6g", min, max, sum / count);
+    printf("\nchunks: %lu scanned, %lu from the index, %lu skipped\n", scanned, from_stats, skipped);
+    return 0;
+}
+
+static int cmd_csv(SensorStoreReader& store, int64_t from_ms, int64_t to_ms)
+{
+    printf("timestamp,millis,flags");
+    for (int c = 0; c < TELEMETRY_CHANNELS; c++)
+        printf(",%s", telemetry_schema[c].name);
+    printf("\n");
+
+    for (size_t i = 0; i < store.chunkCount(); i++) {
+        if (! store.overlaps(i, from_ms, to_ms))
+            continue;
+        const StoreChunkHeader& h = store.chunk(i);
+        const int64_t* time = store.timeColumn(i);
+        const uint16_t* flags = store.flagsColumn(i);
+        for (uint32_t r = 0; r < h.rows; r++) {
+            if (time[r] < from_ms || time[r] > to_ms)
+                continue;
+            printf("%lld,%d,0x%04x", (long long) (time[r] / 1000), (int) (time[r] % 1000), flags[r]);
+            for (int c = 0; c < TELEMETRY_CHANNELS; c++) {
+                int col = STORE_COL_CHANNEL + c;
+                if (! (flags[r] & telemetry_schema[c].group))
+                    printf(",");
+                else if (store_column_type(col) == STORE_INT32)
+                    printf(",%d", store.intColumn(i, col)[r]);
+                else
+                    printf(",%.6g", store.floatColumn(i, col)[r]);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+        return usage();
+    const char* cmd = argv[1];
+    if (strcmp(cmd, "append") == 0)
+        return cmd_append(argc - 2, argv + 2);
+
+    SensorStoreReader store;
+    if (! store.open(argv[2])) {
+        fprintf(stderr, "%s: not a sensor store\n", argv[2]);
+        return 1;
+    }
+
+    if (strcmp(cmd, "info") == 0)
+        return cmd_info(store);
+
+    // optional time range in seconds
+    int range = strcmp(cmd, "scan") == 0 ? 4 : 3;
+    int64_t from_ms = INT64_MIN, to_ms = INT64_MAX;
+    if (argc == range + 2) {
+        from_ms = strtoll(argv[range], NULL, 0) * 1000;
+        to_ms = strtoll(argv[range + 1], NULL, 0) * 1000 + 999;
+    } else if (argc != range) {
+        return usage();
+    }
+
+    if (strcmp(cmd, "scan") == 0)
+        return cmd_scan(store, argv[3], from_ms, to_ms);
+    if (strcmp(cmd, "csv") == 0)
+        return cmd_csv(store, from_ms, to_ms);
+    return usage();
+}
@@ -0,0 +1,469 @@
+#include "shield_decode.h"
+#include "rohm_sensors.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHIELD_DECODE_X86
+#include <immintrin.h>
+#define SSE41_FN    __attribute__((target("sse4.1")))
+#define AVX2_FN     __attribute__((target("avx2")))
+#endif
+
+/****************************************************************************************************
+// scalar: the per-sample conversions, also used for the tails of the vector loops
+ ****************************************************************************************************/
+static void rpr0521_scalar(const uint8_t* frames, size_t i, size_t count, const Rpr0521Columns& out)
+{
+    RohmReading<Rpr0521> v;
+    for (; i < count; i++) {
+        rohm_convert<Rpr0521>(frames + i * Rpr0521::raw_len, v);
+        out.lux[i] = v.lux;
+        out.proximity[i] = v.proximity;
+        out.als_data0[i] = v.als_data0;
+        out.als_data1[i] = v.als_data1;
+    }
+}
+
+static void kmx62_scalar(const uint8_t* frames, size_t i, size_t count, const Kmx62Columns& out)
+{
+    RohmReading<Kmx62> v;
+    for (; i < count; i++) {
+        rohm_convert<Kmx62>(frames + i * Kmx62::raw_len, v);
+        for (int c = 0; c < 3; c++) {
+            out.accel[c][i] = v.accel[c];
+            out.mag[c][i] = v.mag[c];
+        }
+    }
+}
+
+static void bh1745_scalar(const uint8_t* frames, size_t i, size_t count, const Bh1745Columns& out)
+{
+    RohmReading<Bh1745> v;
+    for (; i < count; i++) {
+        rohm_convert<Bh1745>(frames + i * Bh1745::raw_len, v);
+        for (int c = 0; c < 3; c++)
+            out.rgb[c][i] = v.rgb[c];
+    }
+}
+
+static void kx022_scalar(const uint8_t* frames, size_t i, size_t count, const Kx022Columns& out)
+{
+    RohmReading<Kx022> v;
+    for (; i < count; i++) {
+        rohm_convert<Kx022>(frames + i * Kx022::raw_len, v);
+        for (int c = 0; c < 3; c++)
+            out.accel[c][i] = v.accel[c];
+    }
+}
+
+static void bm1383_scalar(const uint8_t* frames, size_t i, size_t count, const Bm1383Columns& out)
+{
+    RohmReading<Bm1383> v;
+    for (; i < count; i++) {
+        rohm_convert<Bm1383>(frames + i * Bm1383::raw_len, v);
+        out.temp_c[i] = v.temp_c;
+        out.pressure_hpa[i] = v.pressure_hpa;
+    }
+}
+
+#ifdef SHIELD_DECODE_X86
+/****************************************************************************************************
+// shuffles
+ ****************************************************************************************************/
+
+// pshufb masks that gather 16-bit word c of 8 frames of N words (8 * 2N bytes = N registers):
+// mask[c][r] moves the words c held by register r into their frame's slot of the result
+template<int N> struct WordGather {
+    uint8_t     mask[N][N][16];         // [component][register]
+    bool        used[N][N];
+
+    WordGather()
+    {
+        for (int c = 0; c < N; c++) {
+            for (int r = 0; r < N; r++) {
+                used[c][r] = false;
+                for (int b = 0; b < 16; b++)
+                    mask[c][r][b] = 0x80;
+            }
+            for (int j = 0; j < 8; j++) {
+                int offset = j * 2 * N + 2 * c;
+                int r = offset / 16;
+                mask[c][r][2 * j] = offset % 16;
+                mask[c][r][2 * j + 1] = offset % 16 + 1;
+                used[c][r] = true;
+            }
+        }
+    }
+};
+
+template<int N> static const WordGather<N>& word_gather()
+{
+    static const WordGather<N> gather;
+    return gather;
+}
+
+// 8 frames of N little-endian 16-bit words -> one register of 8 words per component
+template<int N> SSE41_FN static inline void load8_words(const uint8_t* p, const WordGather<N>& g, __m128i* words)
+{
+    __m128i in[N];
+    for (int r = 0; r < N; r++)
+        in[r] = _mm_loadu_si128((const __m128i*) (p + 16 * r));
+    for (int c = 0; c < N; c++) {
+        __m128i w = _mm_setzero_si128();
+        for (int r = 0; r < N; r++) {
+            if (g.used[c][r])
+                w = _mm_or_si128(w, _mm_shuffle_epi8(in[r], _mm_loadu_si128((const __m128i*) g.mask[c][r])));
+        }
+        words[c] = w;
+    }
+}
+
+// 8 KMX62 frames (6 words of 12 bytes) -> one register per word, an 8x8 transpose of 16-bit words.
+// Each frame is loaded with 16 bytes, so it reads 4 bytes past the 8th frame.
+SSE41_FN static inline void load8_kmx62(const uint8_t* p, __m128i* words)
+{
+    __m128i r[8], a[8], b[8];
+    for (int j = 0; j < 8; j++)
+        r[j] = _mm_loadu_si128((const __m128i*) (p + j * Kmx62::raw_len));
+    for (int j = 0; j < 8; j += 2) {
+        a[j] = _mm_unpacklo_epi16(r[j], r[j + 1]);
+        a[j + 1] = _mm_unpackhi_epi16(r[j], r[j + 1]);
+    }
+    for (int j = 0; j < 8; j += 4) {
+        b[j] = _mm_unpacklo_epi32(a[j], a[j + 2]);
+        b[j + 1] = _mm_unpackhi_epi32(a[j], a[j + 2]);
+        b[j + 2] = _mm_unpacklo_epi32(a[j + 1], a[j + 3]);
+        b[j + 3] = _mm_unpackhi_epi32(a[j + 1], a[j + 3]);
+    }
+    words[0] = _mm_unpacklo_epi64(b[0], b[4]);
+    words[1] = _mm_unpackhi_epi64(b[0], b[4]);
+    words[2] = _mm_unpacklo_epi64(b[1], b[5]);
+    words[3] = _mm_unpackhi_epi64(b[1], b[5]);
+    words[4] = _mm_unpacklo_epi64(b[2], b[6]);
+    words[5] = _mm_unpackhi_epi64(b[2], b[6]);
+}
+
+// BM1383 frames (TEMPS_OUT big endian, PRESS_OUT 22 bits), frames 0/1 of a 10-byte half -> lanes
+static const uint8_t bm1383_temp_lo[16] = { 0x80, 0x80, 1, 0, 0x80, 0x80, 6, 5,
+                                            0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+static const uint8_t bm1383_temp_hi[16] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+                                            0x80, 0x80, 1, 0, 0x80, 0x80, 6, 5 };
+static const uint8_t bm1383_press_lo[16] = { 4, 3, 2, 0x80, 9, 8, 7, 0x80,
+                                             0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+static const uint8_t bm1383_press_hi[16] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+                                             4, 3, 2, 0x80, 9, 8, 7, 0x80 };
+
+// 4 BM1383 frames -> temperature word << 16 (for the sign) and PRESS_OUT << 2 as int32 lanes.
+// Reads 26 bytes.
+SSE41_FN static inline void load4_bm1383(const uint8_t* p, __m128i& temp, __m128i& press)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i*) p);
+    __m128i hi = _mm_loadu_si128((const __m128i*) (p + 10));
+    temp = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_loadu_si128((const __m128i*) bm1383_temp_lo)),
+                        _mm_shuffle_epi8(hi, _mm_loadu_si128((const __m128i*) bm1383_temp_hi)));
+    press = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_loadu_si128((const __m128i*) bm1383_press_lo)),
+                         _mm_shuffle_epi8(hi, _mm_loadu_si128((const __m128i*) bm1383_press_hi)));
+}
+
+/****************************************************************************************************
+// SSE4.1: 4 floats per operation
+ ****************************************************************************************************/
+SSE41_FN static inline void sse_store_s16(__m128i words, __m128 scale, float* out)
+{
+    __m128 lo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(words));
+    __m128 hi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(words, 8)));
+    _mm_storeu_ps(out, _mm_mul_ps(lo, scale));
+    _mm_storeu_ps(out + 4, _mm_mul_ps(hi, scale));
+}
+
+SSE41_FN static inline __m128 sse_lux(__m128 d0, __m128 d1)
+{
+    __m128 ratio = _mm_div_ps(d1, d0);
+    __m128 lux = _mm_setzero_ps();
+    lux = _mm_blendv_ps(lux, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(0.766f), d0), _mm_mul_ps(_mm_set1_ps(0.25f), d1)),
+                        _mm_cmplt_ps(ratio, _mm_set1_ps(3.053f)));
+    lux = _mm_blendv_ps(lux, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(0.756f), d0), _mm_mul_ps(_mm_set1_ps(0.243f), d1)),
+                        _mm_cmplt_ps(ratio, _mm_set1_ps(1.352f)));
+    lux = _mm_blendv_ps(lux, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(0.644f), d0), _mm_mul_ps(_mm_set1_ps(0.132f), d1)),
+                        _mm_cmplt_ps(ratio, _mm_set1_ps(1.015f)));
+    lux = _mm_blendv_ps(lux, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(1.682f), d0), _mm_mul_ps(_mm_set1_ps(1.877f), d1)),
+                        _mm_cmplt_ps(ratio, _mm_set1_ps(0.595f)));
+    return lux;
+}
+
+SSE41_FN static size_t rpr0521_sse41(const uint8_t* frames, size_t count, const Rpr0521Columns& out)
+{
+    const WordGather<3>& g = word_gather<3>();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i w[3];
+        load8_words<3>(frames + i * Rpr0521::raw_len, g, w);
+        _mm_storeu_si128((__m128i*) (out.proximity + i), w[0]);
+        _mm_storeu_si128((__m128i*) (out.als_data0 + i), w[1]);
+        _mm_storeu_si128((__m128i*) (out.als_data1 + i), w[2]);
+        for (int h = 0; h < 2; h++) {
+            __m128 d0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(h ? _mm_srli_si128(w[1], 8) : w[1]));
+            __m128 d1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(h ? _mm_srli_si128(w[2], 8) : w[2]));
+            _mm_storeu_ps(out.lux + i + 4 * h, sse_lux(d0, d1));
+        }
+    }
+    return i;
+}
+
+SSE41_FN static size_t kmx62_sse41(const uint8_t* frames, size_t count, const Kmx62Columns& out)
+{
+    const __m128 accel_scale = _mm_set1_ps(1.0f / 8192);
+    const __m128 mag_word = _mm_set1_ps(1.0f / 4096);
+    const __m128 mag_scale = _mm_set1_ps(0.146f);
+    size_t i = 0;
+    for (; i + 9 <= count; i += 8) {
+        __m128i w[6];
+        load8_kmx62(frames + i * Kmx62::raw_len, w);
+        for (int c = 0; c < 3; c++) {
+            sse_store_s16(w[c], accel_scale, out.accel[c] + i);
+            for (int h = 0; h < 2; h++) {
+                __m128 m = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(h ? _mm_srli_si128(w[3 + c], 8) : w[3 + c]));
+                _mm_storeu_ps(out.mag[c] + i + 4 * h, _mm_mul_ps(_mm_mul_ps(m, mag_word), mag_scale));
+            }
+        }
+    }
+    return i;
+}
+
+SSE41_FN static size_t bh1745_sse41(const uint8_t* frames, size_t count, const Bh1745Columns& out)
+{
+    const WordGather<3>& g = word_gather<3>();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i w[3];
+        load8_words<3>(frames + i * Bh1745::raw_len, g, w);
+        for (int c = 0; c < 3; c++)
+            _mm_storeu_si128((__m128i*) (out.rgb[c] + i), w[c]);
+    }
+    return i;
+}
+
+SSE41_FN static size_t kx022_sse41(const uint8_t* frames, size_t count, const Kx022Columns& out)
+{
+    const WordGather<3>& g = word_gather<3>();
+    const __m128 scale = _mm_set1_ps(1.0f / 16384);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i w[3];
+        load8_words<3>(frames + i * Kx022::raw_len, g, w);
+        for (int c = 0; c < 3; c++)
+            sse_store_s16(w[c], scale, out.accel[c] + i);
+    }
+    return i;
+}
+
+SSE41_FN static size_t bm1383_sse41(const uint8_t* frames, size_t count, const Bm1383Columns& out)
+{
+    const __m128 temp_scale = _mm_set1_ps(1.0f / 32);
+    const __m128 press_scale = _mm_set1_ps(1.0f / 2048);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) {        // the loads of 4 frames read 26 bytes, 6 frames are 30
+        __m128i temp, press;
+        load4_bm1383(frames + i * Bm1383::raw_len, temp, press);
+        _mm_storeu_ps(out.temp_c + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(temp, 16)), temp_scale));
+        _mm_storeu_ps(out.pressure_hpa + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(press, 2)), press_scale));
+    }
+    return i;
+}
+
+/****************************************************************************************************
+// AVX2: 8 floats per operation, the frames are still gathered with 128-bit shuffles
+ ****************************************************************************************************/
+AVX2_FN static inline __m256 avx_s16_ps(__m128i words)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(words));
+}
+
+AVX2_FN static inline __m256 avx_u16_ps(__m128i words)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(words));
+}
+
+AVX2_FN static inline __m256 avx_lux(__m256 d0, __m256 d1)
+{
+    __m256 ratio = _mm256_div_ps(d1, d0);
+    __m256 lux = _mm256_setzero_ps();
+    lux = _mm256_blendv_ps(lux, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(0.766f), d0),
+                                              _mm256_mul_ps(_mm256_set1_ps(0.25f), d1)),
+                           _mm256_cmp_ps(ratio, _mm256_set1_ps(3.053f), _CMP_LT_OQ));
+    lux = _mm256_blendv_ps(lux, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(0.756f), d0),
+                                              _mm256_mul_ps(_mm256_set1_ps(0.243f), d1)),
+                           _mm256_cmp_ps(ratio, _mm256_set1_ps(1.352f), _CMP_LT_OQ));
+    lux = _mm256_blendv_ps(lux, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(0.644f), d0),
+                                              _mm256_mul_ps(_mm256_set1_ps(0.132f), d1)),
+                           _mm256_cmp_ps(ratio, _mm256_set1_ps(1.015f), _CMP_LT_OQ));
+    lux = _mm256_blendv_ps(lux, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(1.682f), d0),
+                                              _mm256_mul_ps(_mm256_set1_ps(1.877f), d1)),
+                           _mm256_cmp_ps(ratio, _mm256_set1_ps(0.595f), _CMP_LT_OQ));
+    return lux;
+}
+
+AVX2_FN static size_t rpr0521_avx2(const uint8_t* frames, size_t count, const Rpr0521Columns& out)
+{
+    const WordGather<3>& g = word_gather<3>();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i w[3];
+        load8_words<3>(frames + i * Rpr0521::raw_len, g, w);
+        _mm_storeu_si128((__m128i*) (out.proximity + i), w[0]);
+        _mm_storeu_si128((__m128i*) (out.als_data0 + i), w[1]);
+        _mm_storeu_si128((__m128i*) (out.als_data1 + i), w[2]);
+        _mm256_storeu_ps(out.lux + i, avx_lux(avx_u16_ps(w[1]), avx_u16_ps(w[2])));
+    }
+    return i;
+}
+
+AVX2_FN static size_t kmx62_avx2(const uint8_t* frames, size_t count, const Kmx62Columns& out)
+{
+    const __m256 accel_scale = _mm256_set1_ps(1.0f / 8192);
+    const __m256 mag_word = _mm256_set1_ps(1.0f / 4096);
+    const __m256 mag_scale = _mm256_set1_ps(0.146f);
+    size_t i = 0;
+    for (; i + 9 <= count; i += 8) {
+        __m128i w[6];
+        load8_kmx62(frames + i * Kmx62::raw_len, w);
+        for (int c = 0; c < 3; c++) {
+            _mm256_storeu_ps(out.accel[c] + i, _mm256_mul_ps(avx_s16_ps(w[c]), accel_scale));
+            _mm256_storeu_ps(out.mag[c] + i, _mm256_mul_ps(_mm256_mul_ps(avx_s16_ps(w[3 + c]), mag_word), mag_scale));
+        }
+    }
+    return i;
+}
+
+AVX2_FN static size_t kx022_avx2(const uint8_t* frames, size_t count, const Kx022Columns& out)
+{
+    const WordGather<3>& g = word_gather<3>();
+    const __m256 scale = _mm256_set1_ps(1.0f / 16384);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i w[3];
+        load8_words<3>(frames + i * Kx022::raw_len, g, w);
+        for (int c = 0; c < 3; c++)
+            _mm256_storeu_ps(out.accel[c] + i, _mm256_mul_ps(avx_s16_ps(w[c]), scale));
+    }
+    return i;
+}
+
+AVX2_FN static size_t bm1383_avx2(const uint8_t* frames, size_t count, const Bm1383Columns& out)
+{
+    const __m256 temp_scale = _mm256_set1_ps(1.0f / 32);
+    const __m256 press_scale = _mm256_set1_ps(1.0f / 2048);
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8) {       // the last loads read 26 bytes from frame 4
+        __m128i temp_lo, press_lo, temp_hi, press_hi;
+        load4_bm1383(frames + i * Bm1383::raw_len, temp_lo, press_lo);
+        load4_bm1383(frames + (i + 4) * Bm1383::raw_len, temp_hi, press_hi);
+        __m256i temp = _mm256_inserti128_si256(_mm256_castsi128_si256(temp_lo), temp_hi, 1);
+        __m256i press = _mm256_inserti128_si256(_mm256_castsi128_si256(press_lo), press_hi, 1);
+        _mm256_storeu_ps(out.temp_c + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(temp, 16)), temp_scale));
+        _mm256_storeu_ps(out.pressure_hpa + i,
+                         _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(press, 2)), press_scale));
+    }
+    return i;
+}
+#endif
+
+/****************************************************************************************************
+// dispatch
+ ****************************************************************************************************/
+static ShieldDecodeIsa detect()
+{
+#ifdef SHIELD_DECODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SHIELD_DECODE_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SHIELD_DECODE_SSE41;
+#endif
+    return SHIELD_DECODE_SCALAR;
+}
+
+static ShieldDecodeIsa best_isa = detect();
+static ShieldDecodeIsa current_isa = best_isa;
+
+ShieldDecodeIsa shield_decode_best()
+{
+    return best_isa;
+}
+
+ShieldDecodeIsa shield_decode_isa()
+{
+    return current_isa;
+}
+
+void shield_decode_use(ShieldDecodeIsa isa)
+{
+    current_isa = isa < best_isa ? isa : best_isa;
+}
+
+const char* shield_decode_isa_name(ShieldDecodeIsa isa)
+{
+    switch (isa) {
+    case SHIELD_DECODE_SSE41:   return "sse4.1";
+    case SHIELD_DECODE_AVX2:    return "avx2";
+    default:                    return "scalar";
+    }
+}
+
+void shield_decode_rpr0521(const uint8_t* frames, size_t count, const Rpr0521Columns& out)
+{
+    size_t done = 0;
+#ifdef SHIELD_DECODE_X86
+    if (current_isa == SHIELD_DECODE_AVX2)
+        done = rpr0521_avx2(frames, count, out);
+    else if (current_isa == SHIELD_DECODE_SSE41)
+        done = rpr0521_sse41(frames, count, out);
+#endif
+    rpr0521_scalar(frames, done, count, out);
+}
+
+void shield_decode_kmx62(const uint8_t* frames, size_t count, const Kmx62Columns& out)
+{
+    size_t done = 0;
+#ifdef SHIELD_DECODE_X86
+    if (current_isa == SHIELD_DECODE_AVX2)
+        done = kmx62_avx2(frames, count, out);
+    else if (current_isa == SHIELD_DECODE_SSE41)
+        done = kmx62_sse41(frames, count, out);
+#endif
+    kmx62_scalar(frames, done, count, out);
+}
+
+// plain 16-bit words, the AVX2 path would be the same shuffles
+void shield_decode_bh1745(const uint8_t* frames, size_t count, const Bh1745Columns& out)
+{
+    size_t done = 0;
+#ifdef SHIELD_DECODE_X86
+    if (current_isa >= SHIELD_DECODE_SSE41)
+        done = bh1745_sse41(frames, count, out);
+#endif
+    bh1745_scalar(frames, done, count, out);
+}
+
+void shield_decode_kx022(const uint8_t* frames, size_t count, const Kx022Columns& out)
+{
+    size_t done = 0;
+#ifdef SHIELD_DECODE_X86
+    if (current_isa == SHIELD_DECODE_AVX2)
+        done = kx022_avx2(frames, count, out);
+    else if (current_isa == SHIELD_DECODE_SSE41)
+        done = kx022_sse41(frames, count, out);
+#endif
+    kx022_scalar(frames, done, count, out);
+}
+
+void shield_decode_bm1383(const uint8_t* frames, size_t count, const Bm1383Columns& out)
+{
+    size_t done = 0;
+#ifdef SHIELD_DECODE_X86
+    if (current_isa == SHIELD_DECODE_AVX2)
+        done = bm1383_avx2(frames, count, out);
+    else if (current_isa == SHIELD_DECODE_SSE41)
+        done = bm1383_sse41(frames, count, out);
+#endif
+    bm1383_scalar(frames, done, count, out);
+}
@@ -0,0 +1,69 @@
+/****************************************************************************************************
+ * shield_decode.h
+ *
+ * Bulk decoder for raw ROHM shield readouts on the ingest side: arrays of register frames, each in
+ * the layout the chip's readout blocks produce (Chip::raw_len bytes, back to back), converted to
+ * one array per channel (structure of arrays).
+ *
+ * The results are bit-exact with rohm_convert<Chip>() of Common/rohm_sensors.h, which is also the
+ * scalar fallback and the tail of the vector loops.  On x86 the vector paths use SSE4.1 or AVX2,
+ * picked at run time from the CPU; the scalings are powers of two or the same float operations in
+ * the same order, so they round exactly like the scalar code.  Build the users without FMA
+ * contraction (-ffp-contract=off) so the compiler does not fuse the scalar lux formula.
+ ****************************************************************************************************/
+#ifndef SHIELD_DECODE_H
+#define SHIELD_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum ShieldDecodeIsa {
+    SHIELD_DECODE_SCALAR,
+    SHIELD_DECODE_SSE41,
+    SHIELD_DECODE_AVX2
+};
+
+// output columns, every array holds count values
+struct Rpr0521Columns {
+    float*      lux;
+    uint16_t*   proximity;
+    uint16_t*   als_data0;
+    uint16_t*   als_data1;
+};
+
+struct Kmx62Columns {
+    float*      accel[3];               // g
+    float*      mag[3];                 // uT
+};
+
+struct Bh1745Columns {
+    uint16_t*   rgb[3];
+};
+
+struct Kx022Columns {
+    float*      accel[3];               // g
+};
+
+struct Bm1383Columns {
+    float*      temp_c;
+    float*      pressure_hpa;
+};
+
+void shield_decode_rpr0521(const uint8_t* frames, size_t count, const Rpr0521Columns& out);
+void shield_decode_kmx62(const uint8_t* frames, size_t count, const Kmx62Columns& out);
+void shield_decode_bh1745(const uint8_t* frames, size_t count, const Bh1745Columns& out);
+void shield_decode_kx022(const uint8_t* frames, size_t count, const Kx022Columns& out);
+void shield_decode_bm1383(const uint8_t* frames, size_t count, const Bm1383Columns& out);
+
+// best instruction set of this CPU
+ShieldDecodeIsa shield_decode_best();
+
+// instruction set used by the decoders, the best one unless lowered with shield_decode_use()
+ShieldDecodeIsa shield_decode_isa();
+
+// use isa (clamped to the best one), for comparisons and benchmarks
+void shield_decode_use(ShieldDecodeIsa isa);
+
+const char* shield_decode_isa_name(ShieldDecodeIsa isa);
+
+#endif
@@ -0,0 +1,254 @@
+/****************************************************************************************************
+ * shield_decode_bench.cpp
+ *
+ * Checks the bulk decoder of shield_decode.h against the per-sample rohm_convert<Chip>() and times
+ * both.  The frames are random bytes (every branch of the lux formula, zero ALS counts, negative
+ * and extreme accel/mag words) behind a few fixed edge cases; the count is not a multiple of the
+ * vector width so the scalar tails are checked too.  Every instruction set this CPU supports is
+ * compared bit for bit, any difference makes the exit status 1.
+ *
+ *   shield_decode_bench [frames]           default 1000003
+ *
+ * Build:
+ *   g++ -O2 -ffp-contract=off -I../Common -I../Host_sim -o shield_decode_bench shield_decode_bench.cpp \
+ *       shield_decode.cpp
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "rohm_sensors.h"
+#include "shield_decode.h"
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int failures;
+
+// bitwise comparison, so -0.0 vs 0.0 or a different rounding counts
+template<typename T> static void check(const char* chip, const char* channel, ShieldDecodeIsa isa,
+                                       const std::vector<T>& got, const std::vector<T>& want)
+{
+    for (size_t i = 0; i < want.size(); i++) {
+        if (memcmp(&got[i], &want[i], sizeof(T)) != 0) {
+            printf("MISMATCH %s %s [%s] frame %lu: %.9g != %.9g\n", chip, channel, shield_decode_isa_name(isa),
+                   (unsigned long) i, (double) got[i], (double) want[i]);
+            failures++;
+            return;
+        }
+    }
+}
+
+static std::vector<uint8_t> make_frames(size_t count, int raw_len)
+{
+    std::vector<uint8_t> frames(count * raw_len);
+    for (size_t i = 0; i < frames.size(); i++)
+        frames[i] = rand() >> 7;
+    static const uint8_t edges[] = { 0x00, 0xFF, 0x80, 0x7F, 0x01 };
+    for (size_t e = 0; e < sizeof(edges) && e < count; e++)
+        memset(&frames[e * raw_len], edges[e], raw_len);
+    return frames;
+}
+
+// time fn over the frames, best of a few runs
+template<typename F> static double time_ns_per_frame(size_t count, F fn)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) {
+        double t0 = now_s();
+        fn();
+        double t = now_s() - t0;
+        if (t < best)
+            best = t;
+    }
+    return best * 1e9 / count;
+}
+
+static void report(const char* chip, const char* how, double ns, double reference_ns)
+{
+    printf("%-8s %-10s %8.2f ns/frame %9.1f Mframes/s %6.1fx\n", chip, how, ns, 1e3 / ns, reference_ns / ns);
+}
+
+/****************************************************************************************************
+// per chip: reference values, check and timing of every instruction set
+ ****************************************************************************************************/
+static void bench_rpr0521(size_t count)
+{
+    std::vector<uint8_t> frames = make_frames(count, Rpr0521::raw_len);
+    std::vector<RohmReading<Rpr0521> > aos(count);
+    std::vector<float> lux(count), want_lux(count);
+    std::vector<uint16_t> prox(count), d0(count), d1(count), want_prox(count), want_d0(count), want_d1(count);
+    Rpr0521Columns out = { &lux[0], &prox[0], &d0[0], &d1[0] };
+
+    double reference_ns = time_ns_per_frame(count, [&] {
+        for (size_t i = 0; i < count; i++)
+            rohm_convert<Rpr0521>(&frames[i * Rpr0521::raw_len], aos[i]);
+    });
+    report("RPR0521", "per-sample", reference_ns, reference_ns);
+    for (size_t i = 0; i < count; i++) {
+        want_lux[i] = aos[i].lux;
+        want_prox[i] = aos[i].proximity;
+        want_d0[i] = aos[i].als_data0;
+        want_d1[i] = aos[i].als_data1;
+    }
+
+    for (int isa = SHIELD_DECODE_SCALAR; isa <= shield_decode_best(); isa++) {
+        shield_decode_use((ShieldDecodeIsa) isa);
+        double ns = time_ns_per_frame(count, [&] { shield_decode_rpr0521(&frames[0], count, out); });
+        report("RPR0521", shield_decode_isa_name(shield_decode_isa()), ns, reference_ns);
+        check("RPR0521", "lux", shield_decode_isa(), lux, want_lux);
+        check("RPR0521", "proximity", shield_decode_isa(), prox, want_prox);
+        check("RPR0521", "als_data0", shield_decode_isa(), d0, want_d0);
+        check("RPR0521", "als_data1", shield_decode_isa(), d1, want_d1);
+    }
+}
+
+static void bench_kmx62(size_t count)
+{
+    std::vector<uint8_t> frames = make_frames(count, Kmx62::raw_len);
+    std::vector<RohmReading<Kmx62> > aos(count);
+    std::vector<float> cols[6], want[6];
+    for (int c = 0; c < 6; c++) {
+        cols[c].resize(count);
+        want[c].resize(count);
+    }
+    Kmx62Columns out = { { &cols[0][0], &cols[1][0], &cols[2][0] }, { &cols[3][0], &cols[4][0], &cols[5][0] } };
+
+    double reference_ns = time_ns_per_frame(count, [&] {
+        for (size_t i = 0; i < count; i++)
+            rohm_convert<Kmx62>(&frames[i * Kmx62::raw_len], aos[i]);
+    });
+    report("KMX62", "per-sample", reference_ns, reference_ns);
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < 3; c++) {
+            want[c][i] = aos[i].accel[c];
+            want[3 + c][i] = aos[i].mag[c];
+        }
+    }
+
+    static const char* names[6] = { "accel_x", "accel_y", "accel_z", "mag_x", "mag_y", "mag_z" };
+    for (int isa = SHIELD_DECODE_SCALAR; isa <= shield_decode_best(); isa++) {
+        shield_decode_use((ShieldDecodeIsa) isa);
+        double ns = time_ns_per_frame(count, [&] { shield_decode_kmx62(&frames[0], count, out); });
+        report("KMX62", shield_decode_isa_name(shield_decode_isa()), ns, reference_ns);
+        for (int c = 0; c < 6; c++)
+            check("KMX62", names[c], shield_decode_isa(), cols[c], want[c]);
+    }
+}
+
+static void bench_bh1745(size_t count)
+{
+    std::vector<uint8_t> frames = make_frames(count, Bh1745::raw_len);
+    std::vector<RohmReading<Bh1745> > aos(count);
+    std::vector<uint16_t> cols[3], want[3];
+    for (int c = 0; c < 3; c++) {
+        cols[c].resize(count);
+        want[c].resize(count);
+    }
+    Bh1745Columns out = { { &cols[0][0], &cols[1][0], &cols[2][0] } };
+
+    double reference_ns = time_ns_per_frame(count, [&] {
+        for (size_t i = 0; i < count; i++)
+            rohm_convert<Bh1745>(&frames[i * Bh1745::raw_len], aos[i]);
+    });
+    report("BH1745", "per-sample", reference_ns, reference_ns);
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < 3; c++)
+            want[c][i] = aos[i].rgb[c];
+    }
+
+    static const char* names[3] = { "red", "green", "blue" };
+    for (int isa = SHIELD_DECODE_SCALAR; isa <= shield_decode_best(); isa++) {
+        shield_decode_use((ShieldDecodeIsa) isa);
+        double ns = time_ns_per_frame(count, [&] { shield_decode_bh1745(&frames[0], count, out); });
+        report("BH1745", shield_decode_isa_name(shield_decode_isa()), ns, reference_ns);
+        for (int c = 0; c < 3; c++)
+            check("BH1745", names[c], shield_decode_isa(), cols[c], want[c]);
+    }
+}
+
+static void bench_kx022(size_t count)
+{
+    std::vector<uint8_t> frames = make_frames(count, Kx022::raw_len);
+    std::vector<RohmReading<Kx022> > aos(count);
+    std::vector<float> cols[3], want[3];
+    for (int c = 0; c < 3; c++) {
+        cols[c].resize(count);
+        want[c].resize(count);
+    }
+    Kx022Columns out = { { &cols[0][0], &cols[1][0], &cols[2][0] } };
+
+    double reference_ns = time_ns_per_frame(count, [&] {
+        for (size_t i = 0; i < count; i++)
+            rohm_convert<Kx022>(&frames[i * Kx022::raw_len], aos[i]);
+    });
+    report("KX022", "per-sample", reference_ns, reference_ns);
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < 3; c++)
+            want[c][i] = aos[i].accel[c];
+    }
+
+    static const char* names[3] = { "accel_x", "accel_y", "accel_z" };
+    for (int isa = SHIELD_DECODE_SCALAR; isa <= shield_decode_best(); isa++) {
+        shield_decode_use((ShieldDecodeIsa) isa);
+        double ns = time_ns_per_frame(count, [&] { shield_decode_kx022(&frames[0], count, out); });
+        report("KX022", shield_decode_isa_name(shield_decode_isa()), ns, reference_ns);
+        for (int c = 0; c < 3; c++)
+            check("KX022", names[c], shield_decode_isa(), cols[c], want[c]);
+    }
+}
+
+static void bench_bm1383(size_t count)
+{
+    std::vector<uint8_t> frames = make_frames(count, Bm1383::raw_len);
+    std::vector<RohmReading<Bm1383> > aos(count);
+    std::vector<float> temp(count), press(count), want_temp(count), want_press(count);
+    Bm1383Columns out = { &temp[0], &press[0] };
+
+    double reference_ns = time_ns_per_frame(count, [&] {
+        for (size_t i = 0; i < count; i++)
+            rohm_convert<Bm1383>(&frames[i * Bm1383::raw_len], aos[i]);
+    });
+    report("BM1383", "per-sample", reference_ns, reference_ns);
+    for (size_t i = 0; i < count; i++) {
+        want_temp[i] = aos[i].temp_c;
+        want_press[i] = aos[i].pressure_hpa;
+    }
+
+    for (int isa = SHIELD_DECODE_SCALAR; isa <= shield_decode_best(); isa++) {
+        shield_decode_use((ShieldDecodeIsa) isa);
+        double ns = time_ns_per_frame(count, [&] { shield_decode_bm1383(&frames[0], count, out); });
+        report("BM1383", shield_decode_isa_name(shield_decode_isa()), ns, reference_ns);
+        check("BM1383", "temp_c", shield_decode_isa(), temp, want_temp);
+        check("BM1383", "pressure_hpa", shield_decode_isa(), press, want_press);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000003;
+    if (count == 0) {
+        fprintf(stderr, "usage: shield_decode_bench [frames]\n");
+        return 2;
+    }
+    srand(1);
+
+    printf("%lu frames, best instruction set %s\n", (unsigned long) count, shield_decode_isa_name(shield_decode_best()));
+    bench_rpr0521(count);
+    bench_kmx62(count);
+    bench_bh1745(count);
+    bench_kx022(count);
+    bench_bm1383(count);
+
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    printf("all decoders bit-exact with rohm_convert<>()\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+/****************************************************************************************************
+ * telemetry_decode.cpp
+ *
+ * Host-side decoder for the binary telemetry frames of Project_5 (telemetry_codec.h) and the
+ * compressed batch blocks (ts_compress.h).  Prints one CSV line per sample, columns follow the
+ * frame schema.
+ *
+ *   telemetry_decode [file]            concatenated frames and/or compressed blocks, e.g. a captured
+ *                                      upload body (default stdin)
+ *   telemetry_decode -s "DF1:..."      frame received by SMS
+ *
+ * Build:
+ *   g++ -O2 -I../Project_5_send_sensor_sms -o telemetry_decode telemetry_decode.cpp \
+ *       ../Project_5_send_sensor_sms/telemetry_codec.cpp ../Project_5_send_sensor_sms/ts_compress.cpp
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+
+static void print_header()
+{
+    printf("timestamp,millis,flags");
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++)
+        printf(",%s", telemetry_schema[i].name);
+    printf("\n");
+}
+
+static void print_sample(const SensorSample& sample)
+{
+    const unsigned char* base = (const unsigned char*) &sample;
+
+    printf("%u,%u,0x%04x", sample.timestamp, sample.millis, sample.flags);
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        const TelemetryChannel& ch = telemetry_schema[i];
+        if (! (sample.flags & ch.group)) {
+            printf(",");
+        } else if (ch.field == FIELD_FLOAT) {
+            float v;
+            memcpy(&v, base + ch.offset, sizeof(v));
+            printf(",%.6g", v);
+        } else {
+            int32_t v;
+            memcpy(&v, base + ch.offset, sizeof(v));
+            printf(",%d", v);
+        }
+    }
+    printf("\n");
+}
+
+// decode one compressed block, returns its size or -1 if it is corrupt
+static int decode_block(const uint8_t* buf, int len)
+{
+    TsDecompressor block;
+    SensorSample sample;
+    if (! block.begin(buf, len))
+        return -1;
+    while (block.remaining()) {
+        if (! block.next(sample))
+            return -1;
+        print_sample(sample);
+    }
+    return block.blockSize();
+}
+
+// decode all frames and blocks in buf, returns false on bad data
+static bool decode_frames(const uint8_t* buf, int len)
+{
+    SensorSample sample;
+    int pos = 0;
+    while (pos < len) {
+        if (buf[pos] == TSC_MAGIC) {
+            int n = decode_block(buf + pos, len - pos);
+            if (n < 0) {
+                fprintf(stderr, "bad compressed block at offset %d\n", pos);
+                return false;
+            }
+            pos += n;
+            continue;
+        }
+        int n = telemetry_decode(buf + pos, len - pos, sample);
+        if (n < 0) {
+            fprintf(stderr, "bad frame at offset %d\n", pos);
+            return false;
+        }
+        print_sample(sample);
+        pos += n;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<uint8_t> data;
+
+    if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+        const char* text = argv[2];
+        if (strncmp(text, "DF1:", 4) == 0)
+            text += 4;
+        data.resize(strlen(text));
+        int n = telemetry_base64_decode(text, strlen(text), &data[0], data.size());
+        if (n < 0) {
+            fprintf(stderr, "bad base64 text\n");
+            return 1;
+        }
+        data.resize(n);
+    } else {
+        FILE* f = argc > 1 ? fopen(argv[1], "rb") : stdin;
+        if (! f) {
+            perror(argv[1]);
+            return 1;
+        }
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+            data.insert(data.end(), buf, buf + n);
+        if (f != stdin)
+            fclose(f);
+    }
+
+    print_header();
+    return decode_frames(data.empty() ? NULL : &data[0], data.size()) ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+/****************************************************************************************************
+ * ts_compress_bench.cpp
+ *
+ * Compression ratio and speed of the Project_5 batch encodings on a synthetic sensor stream.
+ *
+ * Samples are generated from raw register values with the same conversions as main.cpp (ADC
+ * temperature/UV, RPR0521 lux, KMX62/KX022 at rest with noise, BM1383 pressure drifting), one
+ * sample per second with occasional timer jitter and missed THPM reads.  Every encoding is
+ * round-tripped and checked against the input before it is measured.
+ *
+ *   ts_compress_bench [samples] [batch]        defaults: 100000 samples, batches of 16
+ *
+ * Build:
+ *   g++ -O2 -I../Project_5_send_sensor_sms -o ts_compress_bench ts_compress_bench.cpp \
+ *       ../Project_5_send_sensor_sms/telemetry_codec.cpp ../Project_5_send_sensor_sms/ts_compress.cpp
+ ****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <string>
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int noise(int amplitude)
+{
+    return rand() % (2 * amplitude + 1) - amplitude;
+}
+
+static void generate(std::vector<SensorSample>& samples, int count)
+{
+    uint64_t ms = 1500000000000ULL;
+    double temp_adc = 33000, uv_adc = 44000, pressure = 1013.25;
+    int als0 = 400, als1 = 120;
+
+    samples.resize(count);
+    for (int i = 0; i < count; i++) {
+        SensorSample& s = samples[i];
+        memset(&s, 0, sizeof(s));
+
+        ms += 1000 + (rand() % 20 == 0 ? noise(15) : 0);
+        s.timestamp = ms / 1000;
+        s.millis = ms % 1000;
+        s.flags = SAMPLE_MOTION | (rand() % 50 ? SAMPLE_THPM : 0);
+
+        temp_adc += noise(3) * 0.3;
+        uv_adc += noise(2) * 0.2;
+        s.temp_c = ((float) (uint16_t) temp_adc * 0.000050354f - 1.753f) / -0.01068f + 30;
+        s.uv = ((float) (uint16_t) uv_adc * 0.000050354f - 2.2f) / 0.129f + 10;
+        als0 += noise(2);
+        als1 += noise(1);
+        s.ambient_light = 0.644f * als0 - 0.132f * als1;
+        s.proximity = 20 + noise(2);
+        s.hall[0] = 1;
+        s.hall[1] = rand() % 500 == 0 ? 0 : 1;
+        s.color[0] = 300 + noise(3);
+        s.color[1] = 520 + noise(3);
+        s.color[2] = 210 + noise(3);
+
+        int ax = noise(20), ay = noise(20), az = 8192 + noise(20);
+        s.mems_accel[0] = (float) ax / 4096 / 2;
+        s.mems_accel[1] = (float) ay / 4096 / 2;
+        s.mems_accel[2] = (float) az / 4096 / 2;
+        s.mems_mag[0] = (float) (1200 + noise(8)) / 4096 * 0.146f;
+        s.mems_mag[1] = (float) (-800 + noise(8)) / 4096 * 0.146f;
+        s.mems_mag[2] = (float) (3100 + noise(8)) / 4096 * 0.146f;
+        s.kx022_accel[0] = (float) noise(30) / 16384;
+        s.kx022_accel[1] = (float) noise(30) / 16384;
+        s.kx022_accel[2] = (float) (16384 + noise(30)) / 16384;
+        s.bm1383_temp = (float) (800 + noise(1)) / 32;
+
+        pressure += noise(1) * 0.002;
+        uint32_t p = (uint32_t) (pressure * 2048 + 0.5);
+        s.pressure_hpa = (p >> 11) + (float) (p & 0x7FF) * 0.00048828125f;
+    }
+}
+
+// the M2X JSON body JournalUplink::upload() posts for the four uploaded streams
+static std::string json_batch(const SensorSample* samples, int n)
+{
+    static const char* names[] = { "temp_c", "uv", "amb_light", "prox" };
+    std::string body = "{\"values\":{";
+    char buf[96];
+    for (int i = 0; i < 4; i++) {
+        body += i ? ",\"" : "\"";
+        body += names[i];
+        body += "\":[";
+        bool first = true;
+        for (int j = 0; j < n; j++) {
+            const SensorSample& s = samples[j];
+            if (! (s.flags & SAMPLE_THPM))
+                continue;
+            float v = i == 0 ? s.temp_c : i == 1 ? s.uv : i == 2 ? s.ambient_light : s.proximity;
+            time_t t = s.timestamp;
+            struct tm* tm = gmtime(&t);
+            snprintf(buf, sizeof(buf), "%s{\"timestamp\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\",\"value\":%.6f}",
+                     first ? "" : ",", tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+                     tm->tm_hour, tm->tm_min, tm->tm_sec, s.millis, v);
+            body += buf;
+            first = false;
+        }
+        body += "]";
+    }
+    body += "}}";
+    return body;
+}
+
+// raw channels must match the frame decoding, float channels the original bits
+static bool same_sample(const SensorSample& decoded, const SensorSample& frame, const SensorSample& original)
+{
+    if (decoded.timestamp != original.timestamp || decoded.millis != original.millis || decoded.flags != original.flags)
+        return false;
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        const TelemetryChannel& ch = telemetry_schema[i];
+        const SensorSample& expected = ch.raw ? frame : original;
+        if ((original.flags & ch.group) &&
+            memcmp((const uint8_t*) &decoded + ch.offset, (const uint8_t*) &expected + ch.offset, 4) != 0)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    int batch = argc > 2 ? atoi(argv[2]) : 16;
+    if (count <= 0 || batch <= 0 || batch > 0xFFFF) {
+        fprintf(stderr, "usage: ts_compress_bench [samples] [batch]\n");
+        return 1;
+    }
+
+    std::vector<SensorSample> samples;
+    srand(1);
+    generate(samples, count);
+
+    // reference: what the frames decode to, the compressed path must give the same values
+    std::vector<SensorSample> reference(count);
+    std::vector<uint8_t> frames(count * TELEMETRY_MAX_FRAME);
+    size_t frames_len = 0;
+    double t0 = now_s();
+    for (int i = 0; i < count; i++)
+        frames_len += telemetry_encode(samples[i], &frames[frames_len], frames.size() - frames_len);
+    double t_frames = now_s() - t0;
+    for (size_t pos = 0, i = 0; pos < frames_len; i++)
+        pos += telemetry_decode(&frames[pos], frames_len - pos, reference[i]);
+
+    size_t json_len = 0;
+    for (int i = 0; i < count; i += batch)
+        json_len += json_batch(&samples[i], count - i < batch ? count - i : batch).size();
+
+    // compressed blocks of batch samples
+    // the first sample of a block carries full values and can be larger than its frame
+    std::vector<uint8_t> blocks(count * (TELEMETRY_MAX_FRAME + 32) + TSC_HEADER_SIZE * (count / batch + 1));
+    size_t blocks_len = 0;
+    TsCompressor compressor;
+    t0 = now_s();
+    for (int i = 0; i < count; ) {
+        compressor.begin(&blocks[blocks_len], blocks.size() - blocks_len);
+        for (int j = 0; j < batch && i < count; j++, i++) {
+            if (! compressor.add(samples[i])) {
+                fprintf(stderr, "block overflow\n");
+                return 1;
+            }
+        }
+        blocks_len += compressor.finish();
+    }
+    double t_compress = now_s() - t0;
+
+    SensorSample decoded;
+    TsDecompressor decompressor;
+    int n = 0;
+    t0 = now_s();
+    for (size_t pos = 0; pos < blocks_len; pos += decompressor.blockSize()) {
+        if (! decompressor.begin(&blocks[pos], blocks_len - pos)) {
+            fprintf(stderr, "bad block at %zu\n", pos);
+            return 1;
+        }
+        while (decompressor.next(decoded)) {
+            if (! same_sample(decoded, reference[n], samples[n])) {
+                fprintf(stderr, "sample %d does not round-trip\n", n);
+                return 1;
+            }
+            n++;
+        }
+    }
+    double t_decompress = now_s() - t0;
+    if (n != count) {
+        fprintf(stderr, "decoded %d of %d samples\n", n, count);
+        return 1;
+    }
+
+    size_t raw_len = count * sizeof(SensorSample);
+    printf("%d samples, batches of %d\n", count, batch);
+    printf("  %-28s %10zu bytes  %6.2f bytes/sample\n", "SensorSample structs", raw_len, (double) raw_len / count);
+    printf("  %-28s %10zu bytes  %6.2f bytes/sample  (4 streams only)\n", "M2X JSON batches", json_len, (double) json_len / count);
+    printf("  %-28s %10zu bytes  %6.2f bytes/sample\n", "telemetry frames", frames_len, (double) frames_len / count);
+    printf("  %-28s %10zu bytes  %6.2f bytes/sample  %.2fx vs frames\n", "compressed blocks", blocks_len,
+           (double) blocks_len / count, (double) frames_len / blocks_len);
+    printf("  frame encode   %8.1f ns/sample\n", t_frames * 1e9 / count);
+    printf("  compress       %8.1f ns/sample  %7.1f MB/s of structs\n", t_compress * 1e9 / count, raw_len / t_compress / 1e6);
+    printf("  decompress     %8.1f ns/sample  %7.1f MB/s of structs\n", t_decompress * 1e9 / count, raw_len / t_decompress / 1e6);
+    return 0;
+}
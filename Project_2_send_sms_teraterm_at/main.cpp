@@ -1,24 +1,54 @@
 #include "mbed.h"
+#include "uart_bridge.h"
+
+// the radio's UART can run faster than 115200: set the modem first with AT+IPR=<rate>
+// (AT+IPR=? lists the rates it takes), then change radio_baud to match and rebuild
+static const int ext_baud = 115200;     // can be changed to a higher rate, Windows is ok with 115200
+static const int radio_baud = 115200;   // already configured in multitech device
+
+static void print_direction(UartBridge& bridge, const char* name, const BridgeStats& s, int ring_size, const char* stall)
+{
+    char line[200];
+    snprintf(line, sizeof(line), "[bridge] %s: %lu B, %lu overruns, ring peak %lu/%d, %lu B/s now, %lu B/s best, "
+             "%lu B/s mean, %lu %s\r\n", name, s.bytes, s.overruns, s.peak_fill, ring_size, s.last_bps, s.peak_bps,
+             s.mean_bps, s.stalls, stall);
+    bridge.inject(line);
+}
 
 int main()
 {
     // external serial port
-  /* Serial ext(USBTX,USBRX ); */   //AT commands via USB port on Dragonfly  
-  /* Serial ext(dbgTX,dbgRX); */     //AT commands via debug port (same as below but bad reference text
-   Serial ext(PB_6, PB_7);           //AT commands via debug port that we use for jtag programming also.
-  /* Serial ext(PA_2, PA_3);  */     //AT commands not sure where they go yet.  
+  /* RawSerial ext(USBTX,USBRX ); */   //AT commands via USB port on Dragonfly
+  /* RawSerial ext(dbgTX,dbgRX); */     //AT commands via debug port (same as below but bad reference text
+   RawSerial ext(PB_6, PB_7);           //AT commands via debug port that we use for jtag programming also.
+  /* RawSerial ext(PA_2, PA_3);  */     //AT commands not sure where they go yet.
 
     // internal serial port to radio
-    Serial radio(RADIO_TX, RADIO_RX);  
+    RawSerial radio(RADIO_TX, RADIO_RX);
+
+    ext.baud(ext_baud);
+    radio.baud(radio_baud);
+
+    // bytes move in the serial interrupts, the main loop only prints the counters on Ctrl-R
+    UartBridge bridge(ext, radio, RADIO_RTS, RADIO_CTS);
+    Ticker seconds;
+    bridge.start();
+    seconds.attach(&bridge, &UartBridge::second, 1.0);
 
-    ext.baud(115200);   // can be changed to a higher rate, Windows is ok with 115200
-    radio.baud(115200);  // already configured in multitech device
+    while (true) {
+        // WFI sleep until the next interrupt; interrupts are off while checking, so a request that
+        // comes in between still wakes the core
+        __disable_irq();
+        bool report = bridge.statsRequested();
+        if (! report)
+            sleep();
+        __enable_irq();
 
-    while (true) {          // push in data to In radio
-        if (ext.readable())
-            radio.putc(ext.getc());
-        if (radio.readable())          //push jout data from radio to out radio
-            ext.putc(radio.getc());
+        if (report) {
+            bridge.inject("\r\n");
+            print_direction(bridge, "to radio", bridge.toRadio(), BRIDGE_TO_RADIO_SIZE, "CTS stalls");
+            print_direction(bridge, "to terminal", bridge.toExt(), BRIDGE_TO_EXT_SIZE, "RTS drops");
+        }
     }
 }
 
@@ -0,0 +1,188 @@
+#include "uart_bridge.h"
+#include <string.h>
+
+UartBridge::UartBridge(RawSerial& ext, RawSerial& radio, PinName radio_rts, PinName radio_cts)
+    : ext(ext), radio(radio), rts(radio_rts, 0), cts(radio_cts),
+      radio_tx_on(false), ext_tx_on(false), rts_held(false), stats_requested(false)
+{
+    memset(&radio_counters, 0, sizeof(radio_counters));
+    memset(&ext_counters, 0, sizeof(ext_counters));
+}
+
+void UartBridge::start()
+{
+    cts.fall(this, &UartBridge::ctsFall);
+    ext.attach(this, &UartBridge::extRx, SerialBase::RxIrq);
+    radio.attach(this, &UartBridge::radioRx, SerialBase::RxIrq);
+}
+
+/****************************************************************************************************
+// interrupt handlers
+ ****************************************************************************************************/
+// terminal -> radio
+void UartBridge::extRx()
+{
+    while (ext.readable()) {
+        uint8_t c = ext.getc();
+        if (c == BRIDGE_STATS_KEY) {
+            stats_requested = true;
+            continue;
+        }
+        if (! to_radio.push(c))
+            radio_counters.overruns++;
+    }
+    if (to_radio.count() > radio_counters.peak_fill)
+        radio_counters.peak_fill = to_radio.count();
+    kickRadio();
+}
+
+void UartBridge::radioTx()
+{
+    while (radio.writeable()) {
+        if (cts.read()) {
+            // the radio is full, ctsFall() restarts; CTS may have dropped again meanwhile
+            radio.attach(NULL, SerialBase::TxIrq);
+            radio_tx_on = false;
+            radio_counters.stalls++;
+            if (! cts.read())
+                kickRadio();
+            return;
+        }
+        uint8_t c;
+        if (! to_radio.pop(c)) {
+            radio.attach(NULL, SerialBase::TxIrq);
+            radio_tx_on = false;
+            return;
+        }
+        radio.putc(c);
+        radio_counters.bytes++;
+    }
+}
+
+void UartBridge::ctsFall()
+{
+    kickRadio();
+}
+
+// radio -> terminal
+void UartBridge::radioRx()
+{
+    while (radio.readable()) {
+        if (! to_ext.push(radio.getc()))
+            ext_counters.overruns++;
+    }
+    uint32_t fill = to_ext.count();
+    if (fill > ext_counters.peak_fill)
+        ext_counters.peak_fill = fill;
+    if (! rts_held && to_ext.space() <= BRIDGE_RTS_HEADROOM) {
+        rts = 1;
+        rts_held = true;
+        ext_counters.stalls++;
+    }
+    kickExt();
+}
+
+void UartBridge::extTx()
+{
+    while (ext.writeable()) {
+        uint8_t c;
+        if (! to_ext.pop(c)) {
+            ext.attach(NULL, SerialBase::TxIrq);
+            ext_tx_on = false;
+            break;
+        }
+        ext.putc(c);
+        ext_counters.bytes++;
+    }
+    if (rts_held && to_ext.count() <= BRIDGE_TO_EXT_SIZE / 2) {
+        rts = 0;
+        rts_held = false;
+    }
+}
+
+// enabling the transmit interrupt sends right away, the data register is empty
+void UartBridge::kickRadio()
+{
+    if (! radio_tx_on && to_radio.count()) {
+        radio_tx_on = true;
+        radio.attach(this, &UartBridge::radioTx, SerialBase::TxIrq);
+    }
+}
+
+void UartBridge::kickExt()
+{
+    if (! ext_tx_on && to_ext.count()) {
+        ext_tx_on = true;
+        ext.attach(this, &UartBridge::extTx, SerialBase::TxIrq);
+    }
+}
+
+/****************************************************************************************************
+// counters
+ ****************************************************************************************************/
+void UartBridge::countSecond(Counters& c)
+{
+    uint32_t bytes = c.bytes;
+    c.last_bps = bytes - c.second_start;
+    c.second_start = bytes;
+    if (c.last_bps > c.peak_bps)
+        c.peak_bps = c.last_bps;
+    if (c.last_bps) {
+        c.busy_bytes += c.last_bps;
+        c.busy_seconds++;
+    }
+}
+
+void UartBridge::second()
+{
+    countSecond(radio_counters);
+    countSecond(ext_counters);
+}
+
+BridgeStats UartBridge::snapshot(const Counters& c)
+{
+    BridgeStats s;
+    __disable_irq();
+    s.bytes = c.bytes;
+    s.overruns = c.overruns;
+    s.peak_fill = c.peak_fill;
+    s.last_bps = c.last_bps;
+    s.peak_bps = c.peak_bps;
+    s.mean_bps = c.busy_seconds ? c.busy_bytes / c.busy_seconds : 0;
+    s.stalls = c.stalls;
+    __enable_irq();
+    return s;
+}
+
+BridgeStats UartBridge::toRadio()
+{
+    return snapshot(radio_counters);
+}
+
+BridgeStats UartBridge::toExt()
+{
+    return snapshot(ext_counters);
+}
+
+bool UartBridge::statsRequested()
+{
+    bool ret = stats_requested;
+    stats_requested = false;
+    return ret;
+}
+
+bool UartBridge::inject(const char* text)
+{
+    bool ok = true;
+    // the ring's producer is radioRx(), keep it out while pushing
+    __disable_irq();
+    for (; *text; text++) {
+        if (! to_ext.push(*text)) {
+            ok = false;
+            break;
+        }
+    }
+    kickExt();
+    __enable_irq();
+    return ok;
+}
@@ -0,0 +1,146 @@
+/****************************************************************************************************
+ * uart_bridge.h
+ *
+ * Interrupt-driven passthrough between the terminal port and the radio UART.
+ *
+ * The old loop moved one byte at a time with readable()/getc()/putc(), so any byte arriving while
+ * it was busy writing to the other port was lost to an overrun; above 115200 baud, or when the
+ * modem dumps a long response, that happened all the time.  Here each port's receive interrupt
+ * empties the UART into a ring, and the other port's transmit interrupt feeds from that ring, so
+ * the bytes only wait in RAM and the main loop can sleep between bursts.
+ *
+ * Toward the radio the RTS/CTS lines are handled in software, as MTSSerialFlowControl does:
+ * RTS is dropped when the radio -> terminal ring fills up (a slower terminal port), and nothing is
+ * sent while the radio holds CTS high; its falling edge restarts the transmission.  The terminal
+ * has no flow control lines, so what does not fit a ring is dropped and counted as an overrun.
+ *
+ * Counters per direction: bytes, overruns, the fullest the ring got, throughput of the last
+ * second and the best second, and the mean over the seconds with traffic.
+ ****************************************************************************************************/
+#ifndef UART_BRIDGE_H
+#define UART_BRIDGE_H
+
+#include "mbed.h"
+
+#ifndef BRIDGE_TO_RADIO_SIZE
+#define BRIDGE_TO_RADIO_SIZE    256     // typed or pasted commands, must be a power of two
+#endif
+#ifndef BRIDGE_TO_EXT_SIZE
+#define BRIDGE_TO_EXT_SIZE      2048    // modem responses (message lists), must be a power of two
+#endif
+#define BRIDGE_RTS_HEADROOM     64      // RTS is dropped with this much room left, the modem may send a few more
+#define BRIDGE_STATS_KEY        0x12    // Ctrl-R on the terminal prints the counters, not passed to the radio
+
+// Single-producer/single-consumer byte ring between two interrupt handlers
+template <uint32_t Size>
+class ByteRing
+{
+    typedef char size_must_be_power_of_two[(Size & (Size - 1)) == 0 ? 1 : -1];
+
+public:
+    ByteRing() : head(0), tail(0) {}
+
+    bool push(uint8_t c) {
+        uint32_t h = head;
+        if (h - tail == Size)
+            return false;
+        slots[h & (Size - 1)] = c;
+        __DMB();
+        head = h + 1;
+        return true;
+    }
+
+    bool pop(uint8_t& c) {
+        uint32_t t = tail;
+        if (t == head)
+            return false;
+        __DMB();
+        c = slots[t & (Size - 1)];
+        __DMB();
+        tail = t + 1;
+        return true;
+    }
+
+    uint32_t count() const {
+        return head - tail;
+    }
+
+    uint32_t space() const {
+        return Size - count();
+    }
+
+private:
+    volatile uint32_t   head;
+    volatile uint32_t   tail;
+    uint8_t             slots[Size];
+};
+
+struct BridgeStats {
+    uint32_t    bytes;
+    uint32_t    overruns;           // bytes dropped because the ring was full
+    uint32_t    peak_fill;          // most bytes waiting in the ring
+    uint32_t    last_bps;           // bytes per second, last second
+    uint32_t    peak_bps;           // best second
+    uint32_t    mean_bps;           // over the seconds with traffic
+    uint32_t    stalls;             // to the radio: times the radio held CTS; to the terminal: times RTS was dropped
+};
+
+class UartBridge
+{
+public:
+    UartBridge(RawSerial& ext, RawSerial& radio, PinName radio_rts, PinName radio_cts);
+
+    // attach the interrupts, bytes flow from here on
+    void start();
+
+    // throughput bookkeeping, called once a second (from a Ticker)
+    void second();
+
+    BridgeStats toRadio();
+    BridgeStats toExt();
+
+    // BRIDGE_STATS_KEY was typed on the terminal since the last call
+    bool statsRequested();
+
+    // text to the terminal between the radio's bytes, from thread context; returns false if cut short
+    bool inject(const char* text);
+
+private:
+    struct Counters {
+        volatile uint32_t   bytes;
+        volatile uint32_t   overruns;
+        volatile uint32_t   peak_fill;
+        volatile uint32_t   stalls;
+        uint32_t            second_start;   // bytes at the start of the current second
+        uint32_t            last_bps;
+        uint32_t            peak_bps;
+        uint32_t            busy_bytes;     // bytes and seconds with traffic, for the mean
+        uint32_t            busy_seconds;
+    };
+
+    void extRx();
+    void extTx();
+    void radioRx();
+    void radioTx();
+    void ctsFall();
+
+    void kickRadio();
+    void kickExt();
+    static void countSecond(Counters& c);
+    static BridgeStats snapshot(const Counters& c);
+
+    RawSerial&                      ext;
+    RawSerial&                      radio;
+    DigitalOut                      rts;        // low: the radio may send
+    InterruptIn                     cts;        // low: the radio takes data
+    ByteRing<BRIDGE_TO_RADIO_SIZE>  to_radio;
+    ByteRing<BRIDGE_TO_EXT_SIZE>    to_ext;
+    Counters                        radio_counters;
+    Counters                        ext_counters;
+    volatile bool                   radio_tx_on;
+    volatile bool                   ext_tx_on;
+    volatile bool                   rts_held;
+    volatile bool                   stats_requested;
+};
+
+#endif
@@ -1,21 +1,31 @@
 /** Dragonfly Cellular SMS Example
  * Configures the cellular radio, sends a SMS message to the configured number, and displays any received messages.
  *
+ * Received messages are announced by the radio (+CMTI, see Common/sms_receiver.h) and read right away; nothing
+ * is sent to the radio while no message arrives.  The radio is driven through Common/at_engine.h, add the
+ * Common folder to the program.
+ *
  * NOTE: This example changes the baud rate of the debug port to 115200 baud!
  */
 
 #include "mbed.h"
 #include "mtsas.h"
+#include "at_engine.h"
+#include "sms_receiver.h"
 #include <string>
-#include <vector>
-#include <iterator>
 
 bool init_mtsas();
+AtResult run_command(const char* command, int timeout_ms = 1000, const char* payload = NULL);
+void store_result(AtResult result, int error, void* arg);
+void sms_received(const SmsMessage& msg, void* arg);
 
 // The MTSSerialFlowControl object represents the physical serial link between the processor and the cellular radio.
 mts::MTSSerialFlowControl* io;
-// The Cellular object represents the cellular radio.
-mts::Cellular* radio;
+// The AtEngine queues the AT commands to the radio and dispatches its answers; it owns the serial link, so there is
+// no mtsas Cellular object next to it (this example opens no sockets).
+AtEngine* at;
+// Reads, displays and deletes the received messages.
+SmsReceiver* sms;
 
 // An APN is required for GSM radios.
 static const char apn[] = "";
@@ -24,17 +34,24 @@ static const char apn[] = "";
 // The phone number must have the 1 in front of it (11 digits total).
 static std::string phone_number = "1xxxxxxxxxx";
 
+static const char message[] = "Hello from MultiTech Dragonfly!";
+
+// the radio has booted when it answers AT
+static const int radio_boot_tries = 20;
+// the serial buffer is checked this often, the radio is not involved
+static const int at_poll_ms = 10;
+
 bool radio_ok = false;
 
 int main() {
     // Change the baud rate of the debug port from the default 9600 to 115200.
     Serial debug(USBTX, USBRX);
     debug.baud(115200);
-    
+
     //Sets the log level to INFO, higher log levels produce more log output.
     //Possible levels: NONE, FATAL, ERROR, WARNING, INFO, DEBUG, TRACE
     mts::MTSLog::setLogLevel(mts::MTSLog::INFO_LEVEL);
-    
+
     logInfo("initializing cellular radio");
     radio_ok = init_mtsas();
     if (! radio_ok) {
@@ -43,46 +60,73 @@ int main() {
             wait(1);
         }
     }
-    
+
     logInfo("setting APN");
-    if (radio->setApn(apn) != MTS_SUCCESS)
+    char command[AT_MAX_COMMAND];
+    snprintf(command, sizeof(command), "AT+CGDCONT=1,\"IP\",\"%s\"", apn);
+    if (run_command(command) != AT_OK)
         logError("failed to set APN to \"%s\"", apn);
-        
+
+    // messages stored while the program was not running are displayed first
+    if (! sms->start(sms_received))
+        logError("failed to enable SMS indications");
+
     logInfo("sending SMS to %s", phone_number.c_str());
-    mts::Cellular::Sms msg;
-    msg.phoneNumber = phone_number;
-    msg.message = "Hello from MultiTech Dragonfly!";
-    if (radio->sendSMS(msg) != MTS_SUCCESS)
+    snprintf(command, sizeof(command), "AT+CMGS=\"+%s\",145", phone_number.c_str());
+    if (run_command(command, 30000, message) != AT_OK)
         logError("sending SMS failed");
-        
-    // Display any received SMS messages.
+
+    // Display received SMS messages as the radio announces them.
     while (true) {
-        std::vector<mts::Cellular::Sms> msgs = radio->getReceivedSms();
-        for (std::vector<mts::Cellular::Sms>::iterator it = msgs.begin(); it != msgs.end(); it++) {
-            logInfo("[%s][%s]\r\n%s\r\n", it->phoneNumber.c_str(), it->timestamp.c_str(), it->message.c_str());
-        }
-        
-        radio->deleteOnlyReceivedReadSms();
-        
-        wait(5);
+        at->poll();
+        sms->poll();
+        wait_ms(at_poll_ms);
     }
-    
+
     return 0;
 }
 
+void sms_received(const SmsMessage& msg, void* arg) {
+    logInfo("[%s][%s]\r\n%s\r\n", msg.number, msg.timestamp, msg.text);
+}
+
+struct CommandWait {
+    bool        done;
+    AtResult    result;
+};
+
+void store_result(AtResult result, int error, void* arg) {
+    CommandWait* state = (CommandWait*) arg;
+    state->result = result;
+    state->done = true;
+}
+
+// Queue a command and wait for its final result; indications and other answers are dispatched meanwhile.
+AtResult run_command(const char* command, int timeout_ms, const char* payload) {
+    CommandWait state = { false, AT_ERROR };
+    if (! at->submit(command, store_result, NULL, &state, timeout_ms, payload))
+        return AT_ERROR;
+    at->poll();
+    while (! state.done) {
+        wait_ms(at_poll_ms);
+        at->poll();
+    }
+    return state.result;
+}
+
 bool init_mtsas() {
     io = new mts::MTSSerialFlowControl(RADIO_TX, RADIO_RX, RADIO_RTS, RADIO_CTS);
     if (! io)
         return false;
-        
+
     // radio default baud rate is 115200
     io->baud(115200);
-    radio = mts::CellularFactory::create(io);
-    if (! radio)
-        return false;
-        
-    // Transport must be set properly before any TCPSocketConnection or UDPSocket objects are created
-    Transport::setTransport(radio);
-    
-    return true;
+    at = new AtEngine(io);
+    sms = new SmsReceiver(*at);
+
+    for (int i = 0; i < radio_boot_tries; i++) {
+        if (run_command("AT") == AT_OK)
+            return run_command("ATE0") == AT_OK;
+    }
+    return false;
 }
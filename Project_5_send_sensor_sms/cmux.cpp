@@ -0,0 +1,418 @@
+#include "cmux.h"
+#include "heap_arena.h"
+#include <string.h>
+#include <new>
+
+#define CMUX_FLAG               0xF9
+#define CMUX_EA                 0x01
+#define CMUX_CR                 0x02
+#define CMUX_FCS_GOOD           0xCF
+
+// control channel message types, EA set and C/R clear
+#define CMUX_MSG_PSC            0x41    // power saving
+#define CMUX_MSG_CLD            0xC1    // close down multiplexing
+#define CMUX_MSG_TEST           0x21
+#define CMUX_MSG_FCON           0xA1    // all channels may send again
+#define CMUX_MSG_FCOFF          0x61    // all channels hold off
+#define CMUX_MSG_MSC            0xE1    // modem status of one channel
+#define CMUX_MSG_NSC            0x11    // command not supported
+
+// MSC signal octet
+#define CMUX_MSC_FC             0x02
+#define CMUX_MSC_RTC            0x04
+#define CMUX_MSC_RTR            0x08
+
+/****************************************************************************************************
+// frame layer
+ ****************************************************************************************************/
+// CRC-8 of 07.10 (x^8 + x^2 + x + 1, reflected)
+static uint8_t fcs_update(uint8_t fcs, uint8_t c)
+{
+    fcs ^= c;
+    for (int i = 0; i < 8; i++)
+        fcs = (fcs & 1) ? (fcs >> 1) ^ 0xE0 : fcs >> 1;
+    return fcs;
+}
+
+int cmux_encode(uint8_t* out, int out_len, uint8_t dlci, uint8_t control, bool cr, const uint8_t* info, int len)
+{
+    if (len < 0 || len > 0x7FFF || out_len < len + CMUX_FRAME_OVERHEAD)
+        return 0;
+
+    int n = 0;
+    out[n++] = CMUX_FLAG;
+    out[n++] = (dlci << 2) | (cr ? CMUX_CR : 0) | CMUX_EA;
+    out[n++] = control;
+    if (len <= 127) {
+        out[n++] = (len << 1) | CMUX_EA;
+    } else {
+        out[n++] = len << 1;
+        out[n++] = len >> 7;
+    }
+    int header_end = n;
+    if (len)
+        memcpy(out + n, info, len);
+    n += len;
+
+    // UIH frames only protect the header
+    int fcs_end = (control & ~CMUX_PF) == CMUX_UIH ? header_end : n;
+    uint8_t fcs = 0xFF;
+    for (int i = 1; i < fcs_end; i++)
+        fcs = fcs_update(fcs, out[i]);
+    out[n++] = 0xFF - fcs;
+    out[n++] = CMUX_FLAG;
+    return n;
+}
+
+CmuxParser::CmuxParser() : fcs_errors(0), oversized(0), state(WAIT_FLAG), header_len(0), pos(0)
+{
+}
+
+bool CmuxParser::feed(uint8_t c, CmuxFrame& frame)
+{
+    switch (state) {
+    case WAIT_FLAG:
+        if (c == CMUX_FLAG)
+            state = ADDRESS;
+        return false;
+
+    case ADDRESS:
+        if (c == CMUX_FLAG)
+            return false;               // closing flag of the previous frame, or fill
+        if (! (c & CMUX_EA)) {
+            state = WAIT_FLAG;
+            return false;
+        }
+        header[0] = c;
+        header_len = 1;
+        frame.dlci = c >> 2;
+        frame.cr = (c & CMUX_CR) != 0;
+        state = CONTROL;
+        return false;
+
+    case CONTROL:
+        if (c == CMUX_FLAG) {
+            state = ADDRESS;            // noise was taken for an address, no control field is a flag
+            return false;
+        }
+        header[header_len++] = c;
+        frame.control = c & ~CMUX_PF;
+        frame.poll = (c & CMUX_PF) != 0;
+        state = LENGTH;
+        return false;
+
+    case LENGTH:
+    case LENGTH2:
+        header[header_len++] = c;
+        if (state == LENGTH) {
+            frame.len = c >> 1;
+            if (! (c & CMUX_EA)) {
+                state = LENGTH2;
+                return false;
+            }
+        } else {
+            frame.len |= c << 7;
+        }
+        if (frame.len > CMUX_MAX_INFO) {
+            oversized++;
+            state = WAIT_FLAG;
+            return false;
+        }
+        pos = 0;
+        state = frame.len ? INFO : FCS;
+        return false;
+
+    case INFO:
+        frame.info[pos++] = c;
+        if (pos == frame.len)
+            state = FCS;
+        return false;
+
+    case FCS: {
+        uint8_t fcs = 0xFF;
+        for (int i = 0; i < header_len; i++)
+            fcs = fcs_update(fcs, header[i]);
+        if (frame.control != CMUX_UIH) {
+            for (int i = 0; i < frame.len; i++)
+                fcs = fcs_update(fcs, frame.info[i]);
+        }
+        if (fcs_update(fcs, c) != CMUX_FCS_GOOD) {
+            fcs_errors++;
+            state = WAIT_FLAG;
+            return false;
+        }
+        state = END;
+        return false;
+    }
+
+    case END:
+        // the closing flag may open the next frame as well
+        state = c == CMUX_FLAG ? ADDRESS : WAIT_FLAG;
+        return c == CMUX_FLAG;
+    }
+    return false;
+}
+
+/****************************************************************************************************
+// channels
+ ****************************************************************************************************/
+CmuxChannel::CmuxChannel(Cmux& mux, uint8_t dlci, int tx_size, int rx_size)
+    : MTSBufferedIO(tx_size, rx_size), rx_overflows(0), mux(mux), channel_dlci(dlci), tx_chunk_len(0)
+{
+}
+
+// the mux thread fills the receive buffer, nothing to pull
+void CmuxChannel::handleRead()
+{
+}
+
+// MTSBufferedIO::write() calls this after buffering and drops what is left, so bytes held back
+// here are written again until the caller's timeout.  A chunk taken out of the buffer stays in
+// tx_chunk until its frame went out, the next call sends it first.
+void CmuxChannel::handleWrite()
+{
+    while (! mux.held(channel_dlci)) {
+        if (tx_chunk_len == 0) {
+            if (txBuffer.isEmpty())
+                return;
+            tx_chunk_len = txBuffer.read((char*) tx_chunk, sizeof(tx_chunk));
+        }
+        if (! mux.send(channel_dlci, CMUX_UIH, true, tx_chunk, tx_chunk_len))
+            return;
+        tx_chunk_len = 0;
+    }
+}
+
+void CmuxChannel::received(const uint8_t* data, int len)
+{
+    int n = rxBuffer.write((const char*) data, len);
+    if (n < len)
+        rx_overflows += len - n;
+}
+
+/****************************************************************************************************
+// multiplexer
+ ****************************************************************************************************/
+Cmux::Cmux()
+    : frames_in(0), frames_out(0), io(NULL), open_mask(0), refused_mask(0), hold_mask(0), bridge_dlci(-1),
+      bridge_port(NULL), thread(NULL)
+{
+    memset(channels, 0, sizeof(channels));
+}
+
+bool Cmux::start(MTSBufferedIO* io, int channels)
+{
+    if (channels < 1 || channels > CMUX_MAX_CHANNELS)
+        return false;
+    this->io = io;
+
+    // still plain AT: OK or ERROR
+    static const char command[] = "AT+CMUX=0\r";
+    char reply[16];
+    int reply_len = 0;
+    bool ok = false;
+    io->rxClear();
+    io->write(command, sizeof(command) - 1, 1000);
+    Timer timer;
+    timer.start();
+    while (! ok && timer.read_ms() < 2000) {
+        char c;
+        if (io->read(c, 10) != 1)
+            continue;
+        if (reply_len == (int) sizeof(reply) - 1)
+            memmove(reply, reply + 1, --reply_len);
+        reply[reply_len++] = c;
+        reply[reply_len] = '\0';
+        if (strstr(reply, "ERROR"))
+            break;
+        ok = strstr(reply, "OK\r") != NULL;
+    }
+    if (! ok) {
+        logError("CMUX: modem refused AT+CMUX=0");
+        return false;
+    }
+
+    thread = new (thread_storage) Thread(task, this, osPriorityAboveNormal, CMUX_STACK_SIZE, (unsigned char*) stack);
+    if (! open(0))
+        return false;
+    for (int dlci = 1; dlci <= channels; dlci++) {
+        this->channels[dlci] = new (channel_storage[dlci - 1]) CmuxChannel(*this, dlci);
+        if (! open(dlci))
+            return false;
+        // ready to send and receive (RTC, RTR)
+        uint8_t msc[4] = { CMUX_MSG_MSC | CMUX_CR, (2 << 1) | CMUX_EA, (uint8_t) ((dlci << 2) | CMUX_CR | CMUX_EA),
+                           CMUX_MSC_RTC | CMUX_MSC_RTR | CMUX_EA };
+        send(0, CMUX_UIH, true, msc, sizeof(msc));
+    }
+    logInfo("CMUX: %d channels open", channels);
+    return true;
+}
+
+// SABM until the modem answers UA or DM
+bool Cmux::open(uint8_t dlci)
+{
+    uint32_t bit = 1u << dlci;
+    for (int attempt = 0; attempt < 3; attempt++) {
+        send(dlci, CMUX_SABM | CMUX_PF, true, NULL, 0);
+        Timer timer;
+        timer.start();
+        while (timer.read_ms() < CMUX_OPEN_TIMEOUT_MS) {
+            if (open_mask & bit)
+                return true;
+            if (refused_mask & bit) {
+                logError("CMUX: DLCI %d refused", dlci);
+                return false;
+            }
+            Thread::wait(10);
+        }
+    }
+    logError("CMUX: no answer opening DLCI %d", dlci);
+    return false;
+}
+
+CmuxChannel* Cmux::channel(int dlci)
+{
+    return dlci >= 1 && dlci <= CMUX_MAX_CHANNELS ? channels[dlci] : NULL;
+}
+
+void Cmux::bridge(int dlci, Serial* port)
+{
+    bridge_port = port;
+    bridge_dlci = dlci;
+}
+
+bool Cmux::send(uint8_t dlci, uint8_t control, bool cr, const uint8_t* info, int len)
+{
+    write_lock.lock();
+    int n = cmux_encode(tx_frame, sizeof(tx_frame), dlci, control, cr, info, len);
+    bool ok = n && io->write((const char*) tx_frame, n, 1000) == n;
+    if (ok)
+        frames_out++;
+    write_lock.unlock();
+    return ok;
+}
+
+bool Cmux::isOpen(int dlci)
+{
+    return (open_mask & (1u << dlci)) != 0;
+}
+
+bool Cmux::held(int dlci)
+{
+    return (hold_mask & (1u | (1u << dlci))) != 0;
+}
+
+void Cmux::task(void const* argument)
+{
+    ((Cmux*) argument)->run();
+}
+
+void Cmux::run()
+{
+    heap_enter(HEAP_TRANSPORT);
+    while (true) {
+        int got = 0;
+        char c;
+        while (got < CMUX_MAX_INFO && io->readable() && io->read(c) == 1) {
+            got++;
+            if (parser.feed(c, frame))
+                handle(frame);
+        }
+        pumpBridge();
+        Thread::wait(got ? 1 : CMUX_IDLE_POLL_MS);
+    }
+}
+
+void Cmux::handle(CmuxFrame& frame)
+{
+    uint32_t bit = 1u << frame.dlci;
+    frames_in++;
+
+    switch (frame.control) {
+    case CMUX_UA:
+        open_mask |= bit;
+        break;
+    case CMUX_DM:
+        refused_mask |= bit;
+        open_mask &= ~bit;
+        break;
+    case CMUX_DISC:
+        open_mask &= ~bit;
+        send(frame.dlci, CMUX_UA | CMUX_PF, false, NULL, 0);
+        break;
+    case CMUX_SABM:
+        // the modem does not open channels of its own
+        send(frame.dlci, CMUX_DM | CMUX_PF, false, NULL, 0);
+        break;
+    case CMUX_UIH:
+        if (frame.dlci == 0) {
+            control(frame.info, frame.len);
+        } else if (frame.dlci == bridge_dlci) {
+            for (int i = 0; i < frame.len; i++)
+                bridge_port->putc(frame.info[i]);
+        } else if (frame.dlci <= CMUX_MAX_CHANNELS && channels[frame.dlci]) {
+            channels[frame.dlci]->received(frame.info, frame.len);
+        }
+        break;
+    }
+}
+
+// control channel message: type, length, values; commands are answered with their own values
+void Cmux::control(const uint8_t* msg, int len)
+{
+    if (len < 2)
+        return;
+    uint8_t type = msg[0] & ~CMUX_CR;
+    int values = msg[1] >> 1;
+    if (! (msg[0] & CMUX_CR) || len < 2 + values)
+        return;                         // answers to our MSC
+
+    switch (type) {
+    case CMUX_MSG_MSC:
+        if (values >= 2) {
+            uint32_t bit = 1u << (msg[2] >> 2);
+            if (msg[3] & CMUX_MSC_FC)
+                hold_mask |= bit;
+            else
+                hold_mask &= ~bit;
+        }
+        break;
+    case CMUX_MSG_FCOFF:
+        hold_mask |= 1;
+        break;
+    case CMUX_MSG_FCON:
+        hold_mask &= ~1u;
+        break;
+    case CMUX_MSG_CLD:
+        open_mask = 0;
+        logError("CMUX: modem closed multiplexing");
+        break;
+    case CMUX_MSG_PSC:
+    case CMUX_MSG_TEST:
+        break;
+    default: {
+        uint8_t nsc[3] = { CMUX_MSG_NSC, (1 << 1) | CMUX_EA, msg[0] };
+        send(0, CMUX_UIH, true, nsc, sizeof(nsc));
+        return;
+    }
+    }
+
+    uint8_t response[CMUX_N1];
+    int n = 2 + values < (int) sizeof(response) ? 2 + values : (int) sizeof(response);
+    memcpy(response, msg, n);
+    response[0] = type;
+    send(0, CMUX_UIH, true, response, n);
+}
+
+// bytes typed on the bridged port go out as soon as they are seen
+void Cmux::pumpBridge()
+{
+    if (! bridge_port || ! isOpen(bridge_dlci) || held(bridge_dlci))
+        return;
+    uint8_t typed[CMUX_N1];
+    int n = 0;
+    while (n < (int) sizeof(typed) && bridge_port->readable())
+        typed[n++] = bridge_port->getc();
+    if (n)
+        send(bridge_dlci, CMUX_UIH, true, typed, n);
+}
@@ -0,0 +1,159 @@
+/****************************************************************************************************
+ * cmux.h
+ *
+ * GSM 07.10 (3GPP TS 27.010) multiplexer over the radio UART, basic option.
+ *
+ * Without it the radio UART carries one thing at a time: while a socket is in data mode no AT
+ * command gets through, so every SMS, clock sync or signal check had to close the upload
+ * connection first, and the AT passthrough of Project_2 could not run next to the telemetry
+ * firmware at all.  After AT+CMUX=0 the UART carries frames for several data link connections
+ * (DLCIs), each behaving like a serial port of its own: DLCI 1 for the mtsas Cellular object and
+ * its sockets, DLCI 2 for control AT commands (SMS, +CSQ, +CREG, +CCLK), and optionally one more
+ * bridged to a local serial port for typing AT commands by hand.
+ *
+ * Each channel is an MTSBufferedIO, so CellularFactory::create() takes it like the raw serial
+ * link.  Writes go out as UIH frames under a mutex, in the writer's thread.  A mux thread above
+ * the network thread's priority reads the UART, checks each frame's FCS, puts the payload into
+ * the channel's receive buffer and answers the control channel (modem status, flow control, test).
+ * The mtsas reads wait for data by polling their buffer, which the mux thread fills by preempting.
+ ****************************************************************************************************/
+#ifndef CMUX_H
+#define CMUX_H
+
+#include "mbed.h"
+#include "rtos.h"
+#include "mtsas.h"
+
+#define CMUX_MAX_CHANNELS       3       // DLCI 1..3
+#ifndef CMUX_N1
+#define CMUX_N1                 121     // information field per frame, the Telit default of AT+CMUX=0
+#endif
+#define CMUX_MAX_INFO           256     // largest frame accepted from the modem
+#define CMUX_FRAME_OVERHEAD     7       // flag, address, control, 2 length, FCS, flag
+#define CMUX_STACK_SIZE         1536
+#define CMUX_IDLE_POLL_MS       10      // UART poll period without traffic, 115 bytes at 115200 baud
+#define CMUX_OPEN_TIMEOUT_MS    1000
+
+// frame types (control field, P/F bit clear)
+#define CMUX_SABM               0x2F
+#define CMUX_UA                 0x63
+#define CMUX_DM                 0x0F
+#define CMUX_DISC               0x43
+#define CMUX_UIH                0xEF
+#define CMUX_PF                 0x10
+
+// Frame layer, no I/O: encode one frame, or feed received bytes until a frame is complete
+struct CmuxFrame {
+    uint8_t     dlci;
+    uint8_t     control;        // P/F bit cleared, see poll
+    bool        cr;             // command/response bit of the address
+    bool        poll;
+    uint16_t    len;
+    uint8_t     info[CMUX_MAX_INFO];
+};
+
+// returns the frame length, 0 if out is too small
+int cmux_encode(uint8_t* out, int out_len, uint8_t dlci, uint8_t control, bool cr, const uint8_t* info, int len);
+
+class CmuxParser
+{
+public:
+    CmuxParser();
+
+    // true once frame holds a complete frame with a good FCS
+    bool feed(uint8_t c, CmuxFrame& frame);
+
+    uint32_t    fcs_errors;
+    uint32_t    oversized;
+
+private:
+    enum State { WAIT_FLAG, ADDRESS, CONTROL, LENGTH, LENGTH2, INFO, FCS, END };
+
+    State       state;
+    uint8_t     header[4];
+    int         header_len;
+    int         pos;
+};
+
+class Cmux;
+
+// One DLCI as a serial port for the mtsas layer
+class CmuxChannel : public MTSBufferedIO
+{
+public:
+    CmuxChannel(Cmux& mux, uint8_t dlci, int tx_size = 256, int rx_size = 1024);
+
+    uint8_t dlci() const { return channel_dlci; }
+
+    uint32_t    rx_overflows;   // payload bytes that did not fit the receive buffer
+
+protected:
+    friend class Cmux;
+
+    virtual void handleRead();
+    virtual void handleWrite();
+
+    // mux thread: payload of a UIH frame
+    void received(const uint8_t* data, int len);
+
+    Cmux&       mux;
+    uint8_t     channel_dlci;
+    uint8_t     tx_chunk[CMUX_N1];  // taken from txBuffer, its frame not sent yet
+    int         tx_chunk_len;
+};
+
+class Cmux
+{
+public:
+    Cmux();
+
+    // switch the modem on io to multiplexing (AT+CMUX=0) and open DLCI 1..channels; false if the
+    // modem refused (the UART is then still in plain AT mode) or did not open the channels
+    bool start(MTSBufferedIO* io, int channels);
+
+    // DLCI 1..channels after start()
+    CmuxChannel* channel(int dlci);
+
+    // carry DLCI dlci to and from a local serial port (AT commands by hand), pumped by the mux thread
+    void bridge(int dlci, Serial* port);
+
+    // one frame to the modem, from any thread
+    bool send(uint8_t dlci, uint8_t control, bool cr, const uint8_t* info, int len);
+
+    bool isOpen(int dlci);
+
+    // the modem asked us to hold off sending on dlci (MSC flow control or FCoff)
+    bool held(int dlci);
+
+    uint32_t    frames_in;
+    uint32_t    frames_out;
+
+    uint32_t fcsErrors() { return parser.fcs_errors; }
+
+private:
+    static void task(void const* argument);
+    void run();
+    void handle(CmuxFrame& frame);
+    void control(const uint8_t* msg, int len);
+    bool open(uint8_t dlci);
+    void pumpBridge();
+
+    MTSBufferedIO*      io;
+    CmuxParser          parser;
+    CmuxFrame           frame;
+    Mutex               write_lock;
+    uint8_t             tx_frame[CMUX_N1 + CMUX_FRAME_OVERHEAD];
+    CmuxChannel*        channels[CMUX_MAX_CHANNELS + 1];
+    uint64_t            channel_storage[CMUX_MAX_CHANNELS][(sizeof(CmuxChannel) + 7) / 8];
+    volatile uint32_t   open_mask;      // bit per DLCI answered with UA
+    volatile uint32_t   refused_mask;   // bit per DLCI answered with DM
+    volatile uint32_t   hold_mask;      // bit per DLCI the modem stopped with FC, bit 0 for all (FCoff)
+    int                 bridge_dlci;
+    Serial*             bridge_port;
+
+    Thread*             thread;
+    uint32_t            stack[CMUX_STACK_SIZE / sizeof(uint32_t)];
+    uint64_t            thread_storage[(sizeof(Thread) + 7) / 8];
+};
+
+#endif
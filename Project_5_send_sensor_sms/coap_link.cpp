@@ -0,0 +1,408 @@
+#include "coap_link.h"
+#include <stdlib.h>
+
+// RFC 7252 transmission parameters
+static const int coap_ack_timeout_ms = 2000;
+static const int coap_max_retransmit = 4;
+static const int coap_separate_timeout_ms = 10000;  // empty ACK received, waiting for the response
+
+CoapLink::CoapLink(Cellular* radio, const char* host, int port)
+    : link_connects(0), posts(0), datagrams(0), retransmits(0), block_resends(0), last_post_ms(0),
+      radio(radio), host(host), port(port), query(""), block_szx(4), ack_bitmap(false),
+      sock_open(false), link_up(false), response_code(0), message_id((uint16_t) rand()),
+      content_format(COAP_FORMAT_OCTETS), idle_timeout_ms(60000),
+      backoff_min_ms(1000), backoff_max_ms(60000), backoff_ms(0), body_len(0), tx_block(-1)
+{
+    token[0] = (uint8_t) rand();
+    token[1] = (uint8_t) rand();
+    idle_timer.start();
+    backoff_timer.start();
+}
+
+void CoapLink::setQuery(const char* query)
+{
+    this->query = query;
+}
+
+void CoapLink::setBlockSize(int bytes)
+{
+    block_szx = 0;
+    while (block_szx < 6 && (32 << block_szx) <= bytes && (32 << block_szx) <= COAP_MAX_BLOCK)
+        block_szx++;
+}
+
+void CoapLink::setAckBitmap(bool on)
+{
+    ack_bitmap = on;
+}
+
+void CoapLink::setIdleTimeout(int ms)
+{
+    idle_timeout_ms = ms;
+}
+
+void CoapLink::setBackoff(int min_ms, int max_ms)
+{
+    backoff_min_ms = min_ms;
+    backoff_max_ms = max_ms;
+}
+
+int CoapLink::getHTTPResponseCode()
+{
+    return response_code;
+}
+
+bool CoapLink::isLinkUp()
+{
+    return link_up;
+}
+
+/****************************************************************************************************
+// data session and socket
+ ****************************************************************************************************/
+void CoapLink::poll()
+{
+    if (link_up && idle_timeout_ms > 0 && idle_timer.read_ms() > idle_timeout_ms) {
+        logInfo("link idle for %d ms, shutting down", idle_timer.read_ms());
+        shutdown();
+    }
+}
+
+void CoapLink::closeSocket()
+{
+    if (sock_open) {
+        sock.close();
+        sock_open = false;
+    }
+}
+
+void CoapLink::shutdown()
+{
+    closeSocket();
+    if (link_up) {
+        radio->disconnect();
+        link_up = false;
+    }
+}
+
+// a failed attempt pushes the next one out by the current backoff delay
+void CoapLink::linkFailed()
+{
+    closeSocket();
+    if (backoff_ms == 0)
+        backoff_ms = backoff_min_ms;
+    else if ((backoff_ms *= 2) > backoff_max_ms)
+        backoff_ms = backoff_max_ms;
+    backoff_timer.reset();
+}
+
+bool CoapLink::ensureLink()
+{
+    if (link_up && radio->isConnected())
+        return true;
+
+    if (link_up) {
+        logWarning("data link dropped");
+        closeSocket();
+        link_up = false;
+    }
+    if (backoff_ms && backoff_timer.read_ms() < backoff_ms)
+        return false;
+
+    if (! radio->connect()) {
+        linkFailed();
+        logError("establishing PPP link failed, retry in %d ms", backoff_ms);
+        return false;
+    }
+    link_up = true;
+    link_connects++;
+    backoff_ms = 0;
+    return true;
+}
+
+bool CoapLink::ensureSocket()
+{
+    if (sock_open)
+        return true;
+
+    if (sock.init() != 0 || server.set_address(host, port) != 0) {
+        linkFailed();
+        logError("opening a UDP socket to %s:%d failed, retry in %d ms", host, port, backoff_ms);
+        return false;
+    }
+    sock_open = true;
+    backoff_ms = 0;
+    return true;
+}
+
+/****************************************************************************************************
+// requests
+ ****************************************************************************************************/
+HTTPResult CoapLink::post(const char* path, HTTPBodyOut& body, char* response, size_t response_len)
+{
+    if (response_len)
+        response[0] = '\0';
+    response_code = 0;
+
+    if (! ensureLink() || ! ensureSocket())
+        return HTTP_CONN;
+    if (readBody(body) < 0) {
+        logError("CoAP body bigger than %d bytes", COAP_MAX_BODY);
+        return HTTP_ERROR;
+    }
+
+    Timer post_time;
+    post_time.start();
+    idle_timer.reset();
+    if (++token[1] == 0)
+        token[0]++;
+
+    CoapMessage reply;
+    HTTPResult ret;
+    if (body_len <= (16 << block_szx)) {
+        int len = buildBlock(COAP_CON, path, 0, false);
+        ret = len < 0 ? HTTP_ERROR : exchange(len, reply);
+    } else if (ack_bitmap) {
+        ret = postBurst(path, reply);
+    } else {
+        ret = postBlocks(path, reply);
+    }
+    if (ret == HTTP_OK) {
+        response_code = COAP_CODE_NUMBER(reply.code);
+        storeResponse(reply, response, response_len);
+        if ((reply.code >> 5) != 2)
+            ret = HTTP_ERROR;
+    } else if (ret != HTTP_ERROR) {
+        linkFailed();               // no answer at all, the next request starts on a new socket
+    }
+
+    posts++;
+    last_post_ms = post_time.read_ms();
+    return ret;
+}
+
+HTTPResult CoapLink::send(const char* path, HTTPBodyOut& body)
+{
+    response_code = 0;
+    if (! ensureLink() || ! ensureSocket())
+        return HTTP_CONN;
+    if (readBody(body) < 0 || body_len > (16 << block_szx))
+        return HTTP_ERROR;
+
+    idle_timer.reset();
+    if (++token[1] == 0)
+        token[0]++;
+    int len = buildBlock(COAP_NON, path, 0, false);
+    if (len < 0)
+        return HTTP_ERROR;
+    posts++;
+    return sendMessage(len) ? HTTP_OK : HTTP_CONN;
+}
+
+// one block at a time, every block but the last is answered with 2.31 Continue
+HTTPResult CoapLink::postBlocks(const char* path, CoapMessage& reply)
+{
+    int blocks = (body_len + (16 << block_szx) - 1) / (16 << block_szx);
+    for (int num = 0; num < blocks; num++) {
+        int len = buildBlock(COAP_CON, path, num, true);
+        if (len < 0)
+            return HTTP_ERROR;
+        HTTPResult ret = exchange(len, reply);
+        if (ret != HTTP_OK)
+            return ret;
+        if (num < blocks - 1 && reply.code != COAP_CONTINUE)
+            return HTTP_OK;             // the server gave up on the body, its answer is final
+    }
+    return HTTP_OK;
+}
+
+// All blocks at once, the last one confirmable.  A 4.08 answer to it carries the bitmap of the
+// blocks the server holds, the missing ones are sent again until the body is complete.
+HTTPResult CoapLink::postBurst(const char* path, CoapMessage& reply)
+{
+    uint8_t missing[(COAP_MAX_BODY / 16 + 7) / 8];
+    int last = (body_len + (16 << block_szx) - 1) / (16 << block_szx) - 1;
+
+    memset(missing, 0xFF, sizeof(missing));
+    for (int round = 0; round <= coap_max_retransmit; round++) {
+        for (int num = 0; num < last; num++) {
+            if (! (missing[num / 8] & (1 << (num % 8))))
+                continue;
+            int len = buildBlock(COAP_NON, path, num, true);
+            if (len < 0 || ! sendMessage(len))
+                return HTTP_CONN;
+            if (round)
+                block_resends++;
+        }
+        int len = buildBlock(COAP_CON, path, last, true);
+        if (len < 0)
+            return HTTP_ERROR;
+        HTTPResult ret = exchange(len, reply);
+        if (ret != HTTP_OK)
+            return ret;
+
+        const CoapOption* bitmap = coap_find(reply, COAP_OPTION_BLOCK_BITMAP);
+        if (reply.code != COAP_INCOMPLETE || ! bitmap)
+            return HTTP_OK;
+        for (int num = 0; num < last; num++) {
+            bool held = num / 8 < bitmap->len && (bitmap->value[num / 8] & (1 << (num % 8)));
+            if (held)
+                missing[num / 8] &= ~(1 << (num % 8));
+            else
+                missing[num / 8] |= 1 << (num % 8);
+        }
+        logDebug("CoAP server is missing blocks of %d, round %d", last + 1, round + 1);
+    }
+    return HTTP_TIMEOUT;
+}
+
+// Send a confirmable message and wait for its response, retransmitting with exponential
+// backoff.  HTTP_OK once reply holds the response (piggybacked on the ACK or separate).
+HTTPResult CoapLink::exchange(int len, CoapMessage& reply)
+{
+    uint16_t mid = (uint16_t) ((tx_buf[2] << 8) | tx_buf[3]);
+    int timeout_ms = coap_ack_timeout_ms + rand() % (coap_ack_timeout_ms / 2);
+    bool acked = false;
+    Timer wait;
+
+    for (int attempt = 0; attempt <= coap_max_retransmit; attempt++) {
+        if (attempt)
+            retransmits++;
+        if (! sendMessage(len))
+            return HTTP_CONN;
+        wait.reset();
+        wait.start();
+        while (wait.read_ms() < timeout_ms) {
+            Endpoint from;
+            sock.set_blocking(false, timeout_ms - wait.read_ms());
+            int n = sock.receiveFrom(from, (char*) rx_buf, sizeof(rx_buf));
+            if (n <= 0 || ! coap_parse(rx_buf, n, reply))
+                continue;
+            if (reply.message_id == mid && reply.type == COAP_RST)
+                return HTTP_REFUSED;
+            if (reply.message_id == mid && reply.type == COAP_ACK) {
+                if (reply.code != COAP_EMPTY)
+                    return HTTP_OK;
+                acked = true;               // the response follows in its own message
+                break;
+            }
+            // a separate response, possibly ahead of its empty ACK
+            if (separateResponse(reply)) {
+                if (reply.type == COAP_CON) {
+                    uint8_t ack[COAP_HEADER_SIZE] = { (COAP_VERSION << 6) | (COAP_ACK << 4), COAP_EMPTY,
+                                                      (uint8_t) (reply.message_id >> 8), (uint8_t) reply.message_id };
+                    sock.sendTo(server, (char*) ack, sizeof(ack));
+                    datagrams++;
+                }
+                return HTTP_OK;
+            }
+        }
+        if (acked)
+            break;
+        timeout_ms *= 2;
+    }
+    if (! acked)
+        return HTTP_TIMEOUT;
+
+    wait.reset();
+    while (wait.read_ms() < coap_separate_timeout_ms) {
+        Endpoint from;
+        sock.set_blocking(false, coap_separate_timeout_ms - wait.read_ms());
+        int n = sock.receiveFrom(from, (char*) rx_buf, sizeof(rx_buf));
+        if (n <= 0 || ! coap_parse(rx_buf, n, reply) || ! separateResponse(reply))
+            continue;
+        if (reply.type == COAP_CON) {
+            uint8_t ack[COAP_HEADER_SIZE] = { (COAP_VERSION << 6) | (COAP_ACK << 4), COAP_EMPTY,
+                                              (uint8_t) (reply.message_id >> 8), (uint8_t) reply.message_id };
+            sock.sendTo(server, (char*) ack, sizeof(ack));
+            datagrams++;
+        }
+        return HTTP_OK;
+    }
+    return HTTP_TIMEOUT;
+}
+
+// The token stays the same for all blocks of a body (the server keys the transfer on it), so a late
+// separate response to an earlier block is told apart by the block number its Block1 echoes.
+bool CoapLink::separateResponse(const CoapMessage& reply)
+{
+    if ((reply.type != COAP_CON && reply.type != COAP_NON) || reply.token_len != sizeof(token) ||
+        memcmp(reply.token, token, sizeof(token)) != 0)
+        return false;
+    const CoapOption* block1 = coap_find(reply, COAP_OPTION_BLOCK1);
+    return ! block1 || tx_block < 0 || COAP_BLOCK_NUM(coap_uint(*block1)) == (uint32_t) tx_block;
+}
+
+bool CoapLink::sendMessage(int len)
+{
+    datagrams++;
+    return sock.sendTo(server, (char*) tx_buf, len) == len;
+}
+
+// the POST of one block (or of the whole body) in tx_buf, returns its length or -1
+int CoapLink::buildBlock(uint8_t type, const char* path, int num, bool blockwise)
+{
+    int size = 16 << block_szx;
+    int offset = blockwise ? num * size : 0;
+    int len = blockwise && body_len - offset < size ? body_len - offset : blockwise ? size : body_len;
+    bool more = blockwise && offset + len < body_len;
+    CoapWriter writer;
+
+    tx_block = blockwise ? num : -1;
+    writer.begin(tx_buf, sizeof(tx_buf), type, COAP_POST, ++message_id, token, sizeof(token));
+    for (const char* p = path; *p; ) {
+        const char* end = strchr(p, '/');
+        if (! end)
+            end = p + strlen(p);
+        if (end > p)
+            writer.option(COAP_OPTION_URI_PATH, p, end - p);
+        p = *end ? end + 1 : end;
+    }
+    writer.optionUint(COAP_OPTION_CONTENT_FORMAT, content_format);
+    for (const char* q = query; *q; ) {
+        const char* end = strchr(q, '&');
+        if (! end)
+            end = q + strlen(q);
+        if (end > q)
+            writer.option(COAP_OPTION_URI_QUERY, q, end - q);
+        q = *end ? end + 1 : end;
+    }
+    if (blockwise) {
+        writer.optionUint(COAP_OPTION_BLOCK1, COAP_BLOCK(num, more, block_szx));
+        if (num == 0)
+            writer.optionUint(COAP_OPTION_SIZE1, body_len);
+    }
+    writer.payload(body_buf + offset, len);
+    return writer.finish();
+}
+
+// the whole body into body_buf (blocks are cut from it and may be sent again), -1 if too big
+int CoapLink::readBody(HTTPBodyOut& body)
+{
+    char type[40];
+    size_t n;
+
+    body.readReset();
+    body.getDataType(type, sizeof(type));
+    content_format = coap_content_format(type);
+    body_len = 0;
+    do {
+        if (body.read((char*) body_buf + body_len, sizeof(body_buf) - body_len, &n) != HTTP_OK)
+            return -1;
+        body_len += n;
+    } while (n > 0 && body_len < (int) sizeof(body_buf));
+
+    char extra;
+    if (body_len == (int) sizeof(body_buf) && body.read(&extra, 1, &n) == HTTP_OK && n > 0)
+        return -1;
+    return body_len;
+}
+
+void CoapLink::storeResponse(const CoapMessage& reply, char* response, size_t response_len)
+{
+    if (response_len == 0)
+        return;
+    size_t n = reply.payload_len < (int) response_len - 1 ? reply.payload_len : response_len - 1;
+    memcpy(response, reply.payload, n);
+    response[n] = '\0';
+}
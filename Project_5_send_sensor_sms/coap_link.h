@@ -0,0 +1,123 @@
+/****************************************************************************************************
+ * coap_link.h
+ *
+ * CoAP over UDP uplink for battery sites: the same post() contract as LinkManager, without the
+ * TCP handshake, the HTTP headers and the connection teardown.
+ *
+ * A body that fits one block goes out as a single confirmable POST (4 bytes of header, the token
+ * and the URI options), retransmitted with the RFC 7252 exponential backoff until it is acked.
+ * Bigger batches use Block1 (RFC 7959), either one confirmable block at a time (each answered
+ * with 2.31 Continue), or with the ack bitmap on: all blocks back to back as non-confirmable
+ * messages and only the last one confirmable, so a batch costs one round trip and a lost block
+ * is sent again on its own (see coap_message.h).  send() is the non-confirmable fire-and-forget
+ * variant for values that are worthless once a newer one exists.
+ ****************************************************************************************************/
+#ifndef COAP_LINK_H
+#define COAP_LINK_H
+
+#include "mbed.h"
+#include "mtsas.h"
+#include "link_manager.h"
+#include "coap_message.h"
+
+#ifndef COAP_MAX_BODY
+#define COAP_MAX_BODY           1024    // a batch of 16 telemetry frames
+#endif
+#ifndef COAP_MAX_BLOCK
+#define COAP_MAX_BLOCK          512
+#endif
+#define COAP_MAX_MESSAGE        (COAP_MAX_BLOCK + 160)
+
+class CoapLink : public PostLink
+{
+public:
+    CoapLink(Cellular* radio, const char* host, int port = 5683);
+
+    // Uri-Query option sent with every request (e.g. "key=<M2X API key>"), "" for none
+    void setQuery(const char* query);
+
+    // block size of bigger bodies, a power of two from 16 to COAP_MAX_BLOCK
+    void setBlockSize(int bytes);
+
+    // send all blocks of a body at once and resend only the ones the server reports missing
+    void setAckBitmap(bool on);
+
+    // tear the data session down after this long without a request, 0 keeps it up forever
+    void setIdleTimeout(int ms);
+
+    // reconnect delay of the data session starts at min_ms and doubles up to max_ms
+    void setBackoff(int min_ms, int max_ms);
+
+    // confirmable POST of body to path.  response receives the (truncated, NUL terminated)
+    // payload of the final response; HTTP_OK for a 2.xx code.
+    HTTPResult post(const char* path, HTTPBodyOut& body, char* response, size_t response_len);
+
+    // non-confirmable POST, no response is waited for; the body must fit one block
+    HTTPResult send(const char* path, HTTPBodyOut& body);
+
+    // code of the last response as class * 100 + detail (2.04 -> 204)
+    int getHTTPResponseCode();
+
+    // call periodically from the network thread, handles the idle tear-down
+    void poll();
+
+    // close the socket (e.g. so the radio can take AT commands) but keep the data session
+    void closeSocket();
+
+    // close the socket and the data session
+    void shutdown();
+
+    bool isLinkUp();
+
+    // statistics
+    int         link_connects;      // data session bring-ups
+    int         posts;              // requests
+    int         datagrams;          // messages sent, retransmissions included
+    int         retransmits;        // confirmable messages sent again after a timeout
+    int         block_resends;      // blocks sent again after a Block-Bitmap
+    int         last_post_ms;       // duration of the last request
+
+private:
+    bool ensureLink();
+    bool ensureSocket();
+    void linkFailed();
+    int readBody(HTTPBodyOut& body);
+    int buildBlock(uint8_t type, const char* path, int num, bool blockwise);
+    bool sendMessage(int len);
+    HTTPResult exchange(int len, CoapMessage& reply);
+    bool separateResponse(const CoapMessage& reply);
+    HTTPResult postBlocks(const char* path, CoapMessage& reply);
+    HTTPResult postBurst(const char* path, CoapMessage& reply);
+    void storeResponse(const CoapMessage& reply, char* response, size_t response_len);
+
+    Cellular*           radio;
+    const char*         host;
+    int                 port;
+    const char*         query;
+    int                 block_szx;          // block size 16 << block_szx
+    bool                ack_bitmap;
+
+    UDPSocket           sock;
+    Endpoint            server;
+    bool                sock_open;
+    bool                link_up;
+    int                 response_code;
+    uint16_t            message_id;
+    uint8_t             token[2];
+    uint16_t            content_format;
+
+    int                 idle_timeout_ms;
+    Timer               idle_timer;
+    int                 backoff_min_ms;
+    int                 backoff_max_ms;
+    int                 backoff_ms;
+    Timer               backoff_timer;
+
+    uint8_t             body_buf[COAP_MAX_BODY];
+    int                 body_len;
+    uint8_t             tx_buf[COAP_MAX_MESSAGE];
+    int                 tx_block;           // Block1 number of the request in tx_buf, -1 for a whole body
+    uint8_t             rx_buf[COAP_MAX_MESSAGE];
+};
+
+#endif
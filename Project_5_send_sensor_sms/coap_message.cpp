@@ -0,0 +1,201 @@
+#include "coap_message.h"
+#include <string.h>
+
+/****************************************************************************************************
+// writer
+ ****************************************************************************************************/
+void CoapWriter::begin(uint8_t* buf, int max_len, uint8_t type, uint8_t code, uint16_t message_id,
+                       const uint8_t* token, int token_len)
+{
+    this->buf = buf;
+    this->max_len = max_len;
+    last_option = 0;
+    overflow = token_len > COAP_MAX_TOKEN || max_len < COAP_HEADER_SIZE + token_len;
+    if (overflow) {
+        len = 0;
+        return;
+    }
+    buf[0] = (uint8_t) ((COAP_VERSION << 6) | (type << 4) | token_len);
+    buf[1] = code;
+    buf[2] = (uint8_t) (message_id >> 8);
+    buf[3] = (uint8_t) message_id;
+    memcpy(buf + COAP_HEADER_SIZE, token, token_len);
+    len = COAP_HEADER_SIZE + token_len;
+}
+
+// 4 bit nibble of an option delta or length, plus its extension bytes
+static int option_nibble(uint32_t v, uint8_t* ext, int& ext_len)
+{
+    if (v < 13) {
+        ext_len = 0;
+        return v;
+    }
+    if (v < 269) {
+        ext[0] = (uint8_t) (v - 13);
+        ext_len = 1;
+        return 13;
+    }
+    ext[0] = (uint8_t) ((v - 269) >> 8);
+    ext[1] = (uint8_t) (v - 269);
+    ext_len = 2;
+    return 14;
+}
+
+bool CoapWriter::option(uint16_t number, const void* value, int value_len)
+{
+    uint8_t delta_ext[2], len_ext[2];
+    int delta_ext_len, len_ext_len;
+
+    if (overflow || number < last_option || value_len > 65535 - 269) {
+        overflow = true;
+        return false;
+    }
+    int delta = option_nibble(number - last_option, delta_ext, delta_ext_len);
+    int length = option_nibble(value_len, len_ext, len_ext_len);
+    if (len + 1 + delta_ext_len + len_ext_len + value_len > max_len) {
+        overflow = true;
+        return false;
+    }
+    buf[len++] = (uint8_t) ((delta << 4) | length);
+    memcpy(buf + len, delta_ext, delta_ext_len);
+    len += delta_ext_len;
+    memcpy(buf + len, len_ext, len_ext_len);
+    len += len_ext_len;
+    memcpy(buf + len, value, value_len);
+    len += value_len;
+    last_option = number;
+    return true;
+}
+
+// shortest big endian form, 0 is the empty value
+bool CoapWriter::optionUint(uint16_t number, uint32_t value)
+{
+    uint8_t bytes[4];
+    int n = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (n || (value >> shift) & 0xFF)
+            bytes[n++] = (uint8_t) (value >> shift);
+    }
+    return option(number, bytes, n);
+}
+
+bool CoapWriter::optionString(uint16_t number, const char* value)
+{
+    return option(number, value, strlen(value));
+}
+
+bool CoapWriter::payload(const void* data, int data_len)
+{
+    if (data_len == 0)
+        return ! overflow;
+    if (overflow || len + 1 + data_len > max_len) {
+        overflow = true;
+        return false;
+    }
+    buf[len++] = 0xFF;
+    memcpy(buf + len, data, data_len);
+    len += data_len;
+    return true;
+}
+
+int CoapWriter::finish()
+{
+    return overflow ? -1 : len;
+}
+
+/****************************************************************************************************
+// parser
+ ****************************************************************************************************/
+// extension bytes of a delta or length nibble, -1 if malformed
+static int option_value(int nibble, const uint8_t*& p, const uint8_t* end)
+{
+    if (nibble < 13)
+        return nibble;
+    if (nibble == 13) {
+        if (p + 1 > end)
+            return -1;
+        return 13 + *p++;
+    }
+    if (nibble == 14) {
+        if (p + 2 > end)
+            return -1;
+        int v = 269 + ((p[0] << 8) | p[1]);
+        p += 2;
+        return v;
+    }
+    return -1;
+}
+
+bool coap_parse(const uint8_t* buf, int len, CoapMessage& msg)
+{
+    if (len < COAP_HEADER_SIZE || (buf[0] >> 6) != COAP_VERSION)
+        return false;
+    msg.type = (buf[0] >> 4) & 0x03;
+    msg.token_len = buf[0] & 0x0F;
+    msg.code = buf[1];
+    msg.message_id = (uint16_t) ((buf[2] << 8) | buf[3]);
+    if (msg.token_len > COAP_MAX_TOKEN || COAP_HEADER_SIZE + msg.token_len > len)
+        return false;
+    memcpy(msg.token, buf + COAP_HEADER_SIZE, msg.token_len);
+
+    const uint8_t* p = buf + COAP_HEADER_SIZE + msg.token_len;
+    const uint8_t* end = buf + len;
+    uint32_t number = 0;
+    msg.option_count = 0;
+    msg.payload = NULL;
+    msg.payload_len = 0;
+    while (p < end) {
+        if (*p == 0xFF) {
+            p++;
+            if (p == end)
+                return false;           // a payload marker needs a payload
+            msg.payload = p;
+            msg.payload_len = end - p;
+            break;
+        }
+        int head = *p++;
+        int delta = option_value(head >> 4, p, end);
+        int option_len = option_value(head & 0x0F, p, end);
+        if (delta < 0 || option_len < 0 || p + option_len > end)
+            return false;
+        number += delta;
+        if (number > 65535)
+            return false;
+        if (msg.option_count < COAP_MAX_OPTIONS) {
+            CoapOption& o = msg.options[msg.option_count++];
+            o.number = (uint16_t) number;
+            o.len = (uint16_t) option_len;
+            o.value = p;
+        }
+        p += option_len;
+    }
+    return true;
+}
+
+const CoapOption* coap_find(const CoapMessage& msg, uint16_t number, int index)
+{
+    for (int i = 0; i < msg.option_count; i++) {
+        if (msg.options[i].number == number && index-- == 0)
+            return &msg.options[i];
+    }
+    return NULL;
+}
+
+uint32_t coap_uint(const CoapOption& option)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < option.len && i < 4; i++)
+        v = (v << 8) | option.value[i];
+    return v;
+}
+
+uint16_t coap_content_format(const char* type)
+{
+    if (strncmp(type, "application/json", 16) == 0)
+        return COAP_FORMAT_JSON;
+    if (strncmp(type, "application/x-dragonfly-telemetry", 33) == 0)
+        return COAP_FORMAT_TELEMETRY;
+    if (strncmp(type, "application/x-dragonfly-tsc", 27) == 0)
+        return COAP_FORMAT_TSC;
+    return COAP_FORMAT_OCTETS;
+}
@@ -0,0 +1,124 @@
+/****************************************************************************************************
+ * coap_message.h
+ *
+ * CoAP (RFC 7252) message encoding and parsing for the UDP uplink, with the Block1 option of
+ * RFC 7959 for bodies bigger than one datagram.
+ *
+ *      u8      version (2 bits, 1), type (2 bits), token length (4 bits)
+ *      u8      code            class << 5 | detail, e.g. 0.02 POST, 2.04 Changed
+ *      u16     message id      big endian
+ *      ...     token, options in ascending number (delta encoded), 0xFF and the payload
+ *
+ * Block-Bitmap (COAP_OPTION_BLOCK_BITMAP, an experimental-range option of this project) lets the
+ * device send the blocks of a batch back to back as non-confirmable messages and only the last
+ * one confirmable.  If some never arrived the server answers that one with 4.08 Request Entity
+ * Incomplete and the bitmap of the blocks it holds (bit i of byte i / 8 set = block i received),
+ * and only the missing blocks are sent again.
+ *
+ * Writing and parsing work on caller-provided buffers and never allocate.  This file has no mbed
+ * dependencies, the host stand-in server (Host_sim/coap_standin.cpp) builds it unchanged.
+ ****************************************************************************************************/
+#ifndef COAP_MESSAGE_H
+#define COAP_MESSAGE_H
+
+#include <stdint.h>
+
+#define COAP_VERSION                1
+#define COAP_HEADER_SIZE            4
+#define COAP_MAX_TOKEN              8
+#define COAP_MAX_OPTIONS            16
+
+enum CoapType {
+    COAP_CON = 0,                   // confirmable: acked, retransmitted until it is
+    COAP_NON = 1,                   // non-confirmable: fire and forget
+    COAP_ACK = 2,
+    COAP_RST = 3
+};
+
+#define COAP_CODE(c, d)             (((c) << 5) | (d))
+#define COAP_EMPTY                  COAP_CODE(0, 0)
+#define COAP_POST                   COAP_CODE(0, 2)
+#define COAP_CHANGED                COAP_CODE(2, 4)
+#define COAP_CONTINUE               COAP_CODE(2, 31)
+#define COAP_BAD_REQUEST            COAP_CODE(4, 0)
+#define COAP_UNAUTHORIZED           COAP_CODE(4, 1)
+#define COAP_NOT_FOUND              COAP_CODE(4, 4)
+#define COAP_METHOD_NOT_ALLOWED     COAP_CODE(4, 5)
+#define COAP_INCOMPLETE             COAP_CODE(4, 8)
+#define COAP_TOO_LARGE              COAP_CODE(4, 13)
+#define COAP_UNSUPPORTED_FORMAT     COAP_CODE(4, 15)
+#define COAP_UNAVAILABLE            COAP_CODE(5, 3)
+
+// code as the HTTP-like number class * 100 + detail (2.04 -> 204)
+#define COAP_CODE_NUMBER(code)      (((code) >> 5) * 100 + ((code) & 0x1F))
+
+#define COAP_OPTION_URI_PATH        11
+#define COAP_OPTION_CONTENT_FORMAT  12
+#define COAP_OPTION_URI_QUERY       15
+#define COAP_OPTION_BLOCK1          27
+#define COAP_OPTION_SIZE1           60
+#define COAP_OPTION_BLOCK_BITMAP    65002
+
+#define COAP_FORMAT_OCTETS          42
+#define COAP_FORMAT_JSON            50
+#define COAP_FORMAT_TELEMETRY       65100   // application/x-dragonfly-telemetry
+#define COAP_FORMAT_TSC             65101   // application/x-dragonfly-tsc
+
+// Block1 value: block number, more flag, size exponent (size = 16 << szx, szx 0..6)
+#define COAP_BLOCK(num, more, szx)  (((uint32_t) (num) << 4) | ((more) ? 0x08 : 0) | (szx))
+#define COAP_BLOCK_NUM(v)           ((v) >> 4)
+#define COAP_BLOCK_MORE(v)          (((v) & 0x08) != 0)
+#define COAP_BLOCK_SIZE(v)          (16 << ((v) & 0x07))
+
+struct CoapOption {
+    uint16_t        number;
+    uint16_t        len;
+    const uint8_t*  value;
+};
+
+struct CoapMessage {
+    uint8_t         type;           // CoapType
+    uint8_t         code;
+    uint16_t        message_id;
+    uint8_t         token_len;
+    uint8_t         token[COAP_MAX_TOKEN];
+    int             option_count;
+    CoapOption      options[COAP_MAX_OPTIONS];
+    const uint8_t*  payload;
+    int             payload_len;
+};
+
+// Builds one message in a caller buffer.  Options must be added in ascending number order;
+// every call returns false once the buffer is too small, finish() then returns -1.
+class CoapWriter
+{
+public:
+    void begin(uint8_t* buf, int max_len, uint8_t type, uint8_t code, uint16_t message_id,
+               const uint8_t* token, int token_len);
+    bool option(uint16_t number, const void* value, int len);
+    bool optionUint(uint16_t number, uint32_t value);
+    bool optionString(uint16_t number, const char* value);
+    bool payload(const void* data, int len);
+    int finish();
+
+private:
+    uint8_t*    buf;
+    int         max_len;
+    int         len;
+    uint16_t    last_option;
+    bool        overflow;
+};
+
+// parse a datagram, false if it is not a well-formed CoAP message
+bool coap_parse(const uint8_t* buf, int len, CoapMessage& msg);
+
+// index-th occurrence of an option, NULL if there is none
+const CoapOption* coap_find(const CoapMessage& msg, uint16_t number, int index = 0);
+
+// value of an unsigned integer option (0 to 4 bytes, big endian)
+uint32_t coap_uint(const CoapOption& option);
+
+// CoAP content format of a MIME type ("application/json", ...), COAP_FORMAT_OCTETS if unknown
+uint16_t coap_content_format(const char* type);
+
+#endif
@@ -0,0 +1,117 @@
+#include "event_scheduler.h"
+#include "sample_clock.h"
+
+EventScheduler::EventScheduler() : count(0), thread(NULL)
+{
+}
+
+int EventScheduler::add(const char* name, SchedulerJob job, void* arg, uint32_t period_ms, uint32_t phase_ms)
+{
+    if (count == SCHEDULER_MAX_JOBS || period_ms == 0)
+        return -1;
+
+    Job& j = jobs[count];
+    j.job = job;
+    j.arg = arg;
+    j.deadline_us = clock_uptime_us() + (uint64_t) phase_ms * 1000;
+    j.stats.name = name;
+    j.stats.period_ms = period_ms;
+    j.stats.runs = 0;
+    j.stats.misses = 0;
+    j.stats.late_max_us = 0;
+    j.stats.run_max_us = 0;
+    return count++;
+}
+
+void EventScheduler::setPeriod(int id, uint32_t period_ms)
+{
+    if (id >= 0 && id < count && period_ms)
+        jobs[id].stats.period_ms = period_ms;
+}
+
+int EventScheduler::runDue()
+{
+    int ran = 0;
+
+    for (int i = 0; i < count; i++) {
+        Job& j = jobs[i];
+        uint64_t now = clock_uptime_us();
+        if (now < j.deadline_us)
+            continue;
+
+        uint64_t period_us = (uint64_t) j.stats.period_ms * 1000;
+        uint64_t late_us = now - j.deadline_us;
+        if (late_us > j.stats.late_max_us)
+            j.stats.late_max_us = late_us > 0xFFFFFFFF ? 0xFFFFFFFF : late_us;
+
+        // deadlines that already went by are skipped, the next run stays on the original grid
+        uint64_t missed = late_us / period_us;
+        j.stats.misses += missed;
+        j.deadline_us += (missed + 1) * period_us;
+
+        j.job(j.arg);
+        j.stats.runs++;
+        ran++;
+
+        uint64_t run_us = clock_uptime_us() - now;
+        if (run_us > j.stats.run_max_us)
+            j.stats.run_max_us = run_us;
+    }
+    return ran;
+}
+
+void EventScheduler::wake()
+{
+    if (thread)
+        osSignalSet(thread, SCHEDULER_WAKE_SIGNAL);
+}
+
+void EventScheduler::waitNext()
+{
+    if (count == 0)
+        return;
+
+    uint64_t next = jobs[0].deadline_us;
+    for (int i = 1; i < count; i++) {
+        if (jobs[i].deadline_us < next)
+            next = jobs[i].deadline_us;
+    }
+
+    uint64_t now = clock_uptime_us();
+    if (now >= next)
+        return;
+
+    // the Timeout wakes this thread exactly at the deadline, not on the next 1 ms RTOS tick
+    thread = osThreadGetId();
+    uint64_t wait_us = next - now;
+    if (wait_us > 0x7FFFFFFF)
+        wait_us = 0x7FFFFFFF;
+    wake_timeout.attach_us(this, &EventScheduler::wake, (uint32_t) wait_us);
+    Thread::signal_wait(SCHEDULER_WAKE_SIGNAL);
+}
+
+int EventScheduler::jobCount()
+{
+    return count;
+}
+
+SchedulerStats EventScheduler::stats(int id)
+{
+    return jobs[id].stats;
+}
+
+void EventScheduler::clearStats()
+{
+    for (int i = 0; i < count; i++) {
+        jobs[i].stats.runs = 0;
+        jobs[i].stats.misses = 0;
+        jobs[i].stats.late_max_us = 0;
+        jobs[i].stats.run_max_us = 0;
+    }
+}
+
+void scheduler_idle_sleep()
+{
+    // WFI sleep: the core stops, peripherals and the us ticker keep running
+    sleep();
+}
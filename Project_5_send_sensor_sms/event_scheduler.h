@@ -0,0 +1,75 @@
+/****************************************************************************************************
+ * event_scheduler.h
+ *
+ * Deadline scheduler for the periodic work of the sampling thread.
+ *
+ * Every job has its own period and runs at absolute deadlines (first + n * period) on the 64-bit
+ * uptime of sample_clock.h, so the time a job takes never shifts the following runs.  Between
+ * deadlines the thread blocks on a signal raised by a Timeout armed for the next deadline; with
+ * all threads blocked the RTOS idle hook puts the MCU to sleep until the next interrupt.
+ *
+ * A job that starts after its following deadline has already passed missed that deadline: the
+ * missed runs are skipped (never run in a burst to catch up) and counted per job.
+ ****************************************************************************************************/
+#ifndef EVENT_SCHEDULER_H
+#define EVENT_SCHEDULER_H
+
+#include "mbed.h"
+#include "rtos.h"
+
+#define SCHEDULER_MAX_JOBS      12
+#define SCHEDULER_WAKE_SIGNAL   0x02
+
+typedef void (*SchedulerJob)(void* arg);
+
+struct SchedulerStats {
+    const char* name;
+    uint32_t    period_ms;
+    uint32_t    runs;
+    uint32_t    misses;             // deadlines skipped because the job ran too late
+    uint32_t    late_max_us;        // worst start time after the deadline
+    uint32_t    run_max_us;         // worst execution time
+};
+
+class EventScheduler
+{
+public:
+    EventScheduler();
+
+    // add a job running every period_ms, the first time phase_ms from now.
+    // Returns the job id, or -1 when the table is full.
+    int add(const char* name, SchedulerJob job, void* arg, uint32_t period_ms, uint32_t phase_ms = 0);
+
+    void setPeriod(int id, uint32_t period_ms);
+
+    // run every job whose deadline has passed, returns the number of jobs run
+    int runDue();
+
+    // block the calling thread until the earliest deadline
+    void waitNext();
+
+    // end the wait of waitNext() early, also from an interrupt
+    void wake();
+
+    int jobCount();
+    SchedulerStats stats(int id);
+    void clearStats();
+
+private:
+    struct Job {
+        SchedulerJob    job;
+        void*           arg;
+        uint64_t        deadline_us;
+        SchedulerStats  stats;
+    };
+
+    Job         jobs[SCHEDULER_MAX_JOBS];
+    int         count;
+    osThreadId  thread;
+    Timeout     wake_timeout;
+};
+
+// RTOS idle hook: sleep until the next interrupt
+void scheduler_idle_sleep();
+
+#endif
@@ -0,0 +1,337 @@
+#include "mbed.h"
+#include "rtos.h"
+#include "MTSLog.h"
+#include "heap_arena.h"
+#include <stdlib.h>
+#include <new>
+#if defined(__NEWLIB__)
+#include <malloc.h>
+#endif
+
+#define BLOCK_FREE          0
+#define BLOCK_ARENA         1
+#define BLOCK_MALLOC        2           // overflow, from the newlib heap
+#define MIN_SPLIT           16          // smaller remainders stay with the allocated block
+
+// in front of every allocation, keeps the 8 byte alignment of the arena
+struct HeapBlock {
+    uint32_t    size;
+    uint8_t     kind;
+    uint8_t     subsystem;
+    uint16_t    reserved;
+};
+
+// all plain data: operator new is already called by static constructors
+static uint64_t arena[HEAP_ARENA_SIZE / 8];
+static bool arena_ready;
+static uint32_t in_use;
+static uint32_t high_water;
+static uint32_t overflows;
+static uint32_t arena_changes;          // bumped whenever a block boundary moves
+static HeapSubsystemStats counters[HEAP_SUBSYSTEMS];
+
+static osThreadId slot_thread[HEAP_THREAD_SLOTS];
+static uint8_t slot_subsystem[HEAP_THREAD_SLOTS];
+
+static const char* const subsystem_names[HEAP_SUBSYSTEMS] = {
+    "other", "startup", "sampling", "serialize", "transport", "sms"
+};
+
+/****************************************************************************************************
+// subsystem of the calling thread
+ ****************************************************************************************************/
+static int thread_slot(osThreadId thread)
+{
+    for (int i = 0; i < HEAP_THREAD_SLOTS; i++) {
+        if (slot_thread[i] == thread)
+            return i;
+    }
+    return -1;
+}
+
+static uint8_t current_subsystem()
+{
+    osThreadId thread = osThreadGetId();
+    int slot = thread ? thread_slot(thread) : -1;
+    return slot < 0 ? HEAP_OTHER : slot_subsystem[slot];
+}
+
+HeapSubsystem heap_enter(HeapSubsystem subsystem)
+{
+    osThreadId thread = osThreadGetId();
+    if (! thread)
+        return HEAP_OTHER;
+
+    __disable_irq();
+    int slot = thread_slot(thread);
+    if (slot < 0 && (slot = thread_slot(NULL)) >= 0)
+        slot_thread[slot] = thread;
+    HeapSubsystem previous = HEAP_OTHER;
+    if (slot >= 0) {
+        previous = (HeapSubsystem) slot_subsystem[slot];
+        slot_subsystem[slot] = subsystem;
+    }
+    __enable_irq();
+    return previous;
+}
+
+const char* heap_subsystem_name(HeapSubsystem subsystem)
+{
+    return subsystem < HEAP_SUBSYSTEMS ? subsystem_names[subsystem] : "?";
+}
+
+/****************************************************************************************************
+// arena, all called with interrupts disabled
+// The walks of arena_alloc() and heap_stats() let the interrupts in every HEAP_WALK_STEPS blocks;
+// when another thread split or merged blocks in between, the walk starts over.
+ ****************************************************************************************************/
+static HeapBlock* block_at(uint32_t offset)
+{
+    return (HeapBlock*) ((uint8_t*) arena + offset);
+}
+
+static void arena_init()
+{
+    HeapBlock* b = block_at(0);
+    b->size = sizeof(arena);
+    b->kind = BLOCK_FREE;
+    arena_ready = true;
+}
+
+static bool in_arena(const void* p)
+{
+    return p >= (const void*) arena && p < (const void*) (arena + HEAP_ARENA_SIZE / 8);
+}
+
+// absorb the free blocks following a free block
+static void merge_following(uint32_t offset)
+{
+    HeapBlock* b = block_at(offset);
+    while (offset + b->size < sizeof(arena)) {
+        HeapBlock* next = block_at(offset + b->size);
+        if (next->kind != BLOCK_FREE)
+            break;
+        b->size += next->size;
+        arena_changes++;
+    }
+}
+
+// count one more block of a walk, every HEAP_WALK_STEPS blocks the interrupts are let in;
+// false if the arena changed meanwhile and offset may no longer be a block
+static bool walk_step(int& steps, uint32_t& changes)
+{
+    if (++steps < HEAP_WALK_STEPS)
+        return true;
+    steps = 0;
+    __enable_irq();
+    __disable_irq();
+    if (arena_changes == changes)
+        return true;
+    changes = arena_changes;
+    return false;
+}
+
+// first fit
+static HeapBlock* arena_alloc(uint32_t size)
+{
+    uint32_t changes = arena_changes;
+    int steps = 0;
+    for (uint32_t offset = 0; offset < sizeof(arena); ) {
+        HeapBlock* b = block_at(offset);
+        if (b->kind == BLOCK_FREE) {
+            merge_following(offset);
+            changes = arena_changes;
+            if (b->size >= size) {
+                if (b->size - size >= MIN_SPLIT) {
+                    HeapBlock* rest = block_at(offset + size);
+                    rest->size = b->size - size;
+                    rest->kind = BLOCK_FREE;
+                    b->size = size;
+                    arena_changes++;
+                }
+                return b;
+            }
+        }
+        offset += b->size;
+        if (! walk_step(steps, changes))
+            offset = 0;
+    }
+    return NULL;
+}
+
+static void charge(HeapBlock* b, uint8_t subsystem)
+{
+    HeapSubsystemStats& s = counters[subsystem];
+    b->subsystem = subsystem;
+    s.allocs++;
+    s.live_bytes += b->size;
+    if (s.live_bytes > s.peak_bytes)
+        s.peak_bytes = s.live_bytes;
+}
+
+static void release(HeapBlock* b)
+{
+    HeapSubsystemStats& s = counters[b->subsystem];
+    s.frees++;
+    s.live_bytes -= b->size;
+}
+
+/****************************************************************************************************
+// operator new and delete
+ ****************************************************************************************************/
+#if __cplusplus >= 201103L
+#define HEAP_NEW_THROWS
+#else
+#define HEAP_NEW_THROWS     throw(std::bad_alloc)
+#endif
+
+// the nothrow forms return NULL when malloc is out of memory too, the others stop the device
+static void* allocate(size_t size, bool nothrow)
+{
+    uint8_t subsystem = current_subsystem();
+    uint32_t block_size = (sizeof(HeapBlock) + size + 7) & ~7u;
+
+    __disable_irq();
+    if (! arena_ready)
+        arena_init();
+    HeapBlock* b = arena_alloc(block_size);
+    if (b) {
+        b->kind = BLOCK_ARENA;
+        charge(b, subsystem);
+        in_use += b->size;
+        if (in_use > high_water)
+            high_water = in_use;
+    }
+    __enable_irq();
+
+    if (! b) {
+        b = (HeapBlock*) malloc(block_size);
+        if (! b && nothrow)
+            return NULL;
+        if (! b)
+            error("out of memory allocating %u bytes\r\n", (unsigned) size);
+        b->size = block_size;
+        b->kind = BLOCK_MALLOC;
+        __disable_irq();
+        charge(b, subsystem);
+        overflows++;
+        __enable_irq();
+    }
+    return b + 1;
+}
+
+void* operator new(size_t size) HEAP_NEW_THROWS
+{
+    return allocate(size, false);
+}
+
+void* operator new[](size_t size) HEAP_NEW_THROWS
+{
+    return allocate(size, false);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+    return allocate(size, true);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+    return allocate(size, true);
+}
+
+void operator delete(void* p) throw()
+{
+    if (! p)
+        return;
+    HeapBlock* b = (HeapBlock*) p - 1;
+
+    __disable_irq();
+    release(b);
+    if (in_arena(b)) {
+        in_use -= b->size;
+        b->kind = BLOCK_FREE;
+        merge_following((uint8_t*) b - (uint8_t*) arena);
+    }
+    __enable_irq();
+
+    if (! in_arena(b))
+        free(b);
+}
+
+void operator delete[](void* p) throw()
+{
+    operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+    operator delete(p);
+}
+
+/****************************************************************************************************
+// report
+ ****************************************************************************************************/
+HeapStats heap_stats()
+{
+    HeapStats stats;
+    stats.arena_size = sizeof(arena);
+    stats.largest_free = 0;
+    stats.free_blocks = 0;
+
+    __disable_irq();
+    if (! arena_ready)
+        arena_init();
+    uint32_t changes = arena_changes;
+    int steps = 0;
+    for (uint32_t offset = 0; offset < sizeof(arena); ) {
+        HeapBlock* b = block_at(offset);
+        if (b->kind == BLOCK_FREE) {
+            merge_following(offset);
+            changes = arena_changes;
+            stats.free_blocks++;
+            if (b->size > stats.largest_free)
+                stats.largest_free = b->size;
+        }
+        offset += b->size;
+        if (! walk_step(steps, changes)) {
+            offset = 0;
+            stats.largest_free = 0;
+            stats.free_blocks = 0;
+        }
+    }
+    stats.in_use = in_use;
+    stats.high_water = high_water;
+    stats.overflows = overflows;
+    for (int i = 0; i < HEAP_SUBSYSTEMS; i++)
+        stats.subsystem[i] = counters[i];
+    __enable_irq();
+
+    // what a single allocation can still get, less its header
+    if (stats.largest_free >= sizeof(HeapBlock))
+        stats.largest_free -= sizeof(HeapBlock);
+    return stats;
+}
+
+void heap_report()
+{
+    HeapStats stats = heap_stats();
+
+    logInfo("heap arena: %lu B, in use %lu B, high water %lu B, largest free %lu B in %lu free blocks, %lu overflows",
+            stats.arena_size, stats.in_use, stats.high_water, stats.largest_free, stats.free_blocks, stats.overflows);
+    for (int i = 0; i < HEAP_SUBSYSTEMS; i++) {
+        const HeapSubsystemStats& s = stats.subsystem[i];
+        logInfo("heap %-9s allocs %lu, frees %lu, live %lu B, peak %lu B", subsystem_names[i], s.allocs, s.frees,
+                s.live_bytes, s.peak_bytes);
+    }
+#if defined(__NEWLIB__)
+    // malloc heap, only grows: its size is the high-water mark of the C allocations
+    struct mallinfo mi = mallinfo();
+    logInfo("heap malloc: %d B, in use %d B, free %d B", mi.arena, mi.uordblks, mi.fordblks);
+#endif
+}
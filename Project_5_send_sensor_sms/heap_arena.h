@@ -0,0 +1,89 @@
+/****************************************************************************************************
+ * heap_arena.h
+ *
+ * Fixed arena for operator new, with allocation statistics per subsystem.
+ *
+ * Everything the firmware allocates with new (the mtsas objects, the std::string temporaries of
+ * the AT command layer and HTTP client) used to come from the newlib heap, which only grows, so
+ * fragmentation after days of uptime was invisible until a post failed.  operator new and delete
+ * are replaced here by a first-fit allocator over a static array of HEAP_ARENA_SIZE bytes, sized
+ * at compile time.  Free neighbours are merged, and the arena can always be walked to report what
+ * is in use, its high-water mark and the largest free block.  Should the arena ever run out, the
+ * allocation falls back to malloc and is counted as an overflow, so an undersized arena shows up
+ * in the report instead of stopping the device.  C code calling malloc directly is not affected.
+ *
+ * The arena is shared by all threads and guarded by disabling interrupts, so a first-fit walk
+ * over many small blocks would hold off the radio UART (one character every 87 us at 115200 baud,
+ * the CMUX frames of cmux.h) for as long as it takes.  The walks of new and heap_stats() let the
+ * interrupts in every HEAP_WALK_STEPS blocks instead, a few microseconds at a time; operator new
+ * must not be called from interrupt handlers.
+ *
+ * Each allocation is charged to the subsystem of the thread doing it: heap_enter() sets a
+ * thread's subsystem, a HeapScope changes it for a block.  The sampling, serialization and
+ * transport paths of main.cpp work from static buffers and should show no allocations after
+ * start-up; heap_report() prints the figures to the debug port.
+ ****************************************************************************************************/
+#ifndef HEAP_ARENA_H
+#define HEAP_ARENA_H
+
+#include <stdint.h>
+
+#ifndef HEAP_ARENA_SIZE
+#define HEAP_ARENA_SIZE         16384   // bytes, a multiple of 8
+#endif
+#define HEAP_THREAD_SLOTS       4       // threads that can set a subsystem
+#ifndef HEAP_WALK_STEPS
+#define HEAP_WALK_STEPS         8       // blocks looked at per interrupts-off stretch of a walk
+#endif
+
+enum HeapSubsystem {
+    HEAP_OTHER,                         // threads that never set one, static constructors
+    HEAP_STARTUP,
+    HEAP_SAMPLING,
+    HEAP_SERIALIZE,
+    HEAP_TRANSPORT,
+    HEAP_SMS,
+    HEAP_SUBSYSTEMS
+};
+
+// sizes are whole blocks, the 8 byte block header included
+struct HeapSubsystemStats {
+    uint32_t    allocs;
+    uint32_t    frees;
+    uint32_t    live_bytes;
+    uint32_t    peak_bytes;
+};
+
+struct HeapStats {
+    uint32_t            arena_size;
+    uint32_t            in_use;
+    uint32_t            high_water;
+    uint32_t            largest_free;
+    uint32_t            free_blocks;
+    uint32_t            overflows;              // allocations that did not fit and went to malloc
+    HeapSubsystemStats  subsystem[HEAP_SUBSYSTEMS];
+};
+
+// charge the calling thread's allocations to subsystem from now on, returns the previous one
+HeapSubsystem heap_enter(HeapSubsystem subsystem);
+
+// the calling thread's subsystem for the lifetime of the scope
+class HeapScope
+{
+public:
+    HeapScope(HeapSubsystem subsystem) : previous(heap_enter(subsystem)) {}
+    ~HeapScope() { heap_enter(previous); }
+
+private:
+    HeapSubsystem previous;
+};
+
+const char* heap_subsystem_name(HeapSubsystem subsystem);
+
+// snapshot of the counters, walks the arena (see HEAP_WALK_STEPS)
+HeapStats heap_stats();
+
+// heap_stats() and the newlib heap to the debug port
+void heap_report();
+
+#endif
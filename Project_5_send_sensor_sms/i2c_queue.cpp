@@ -0,0 +1,141 @@
+#include "i2c_queue.h"
+
+I2CQueue::I2CQueue(I2C& i2c)
+    : cycle_us(0), cycle_max_us(0), cpu_us(0), transfers(0), errors(0),
+      i2c(i2c), head(0), next(0), tail(0), running(false), blocking(false), group_ok(true), thread(NULL), start_us(0)
+{
+#if DEVICE_I2C_ASYNCH
+    callback.attach(this, &I2CQueue::transferDone);
+#endif
+}
+
+int I2CQueue::space()
+{
+    return I2C_QUEUE_SIZE - (head - tail);
+}
+
+bool I2CQueue::submit(const I2CTransaction& t)
+{
+    if (head - tail == I2C_QUEUE_SIZE)
+        return false;
+    Entry& e = entries[head % I2C_QUEUE_SIZE];
+    e.t = t;
+    e.ok = false;
+    __DMB();
+    head++;
+    return true;
+}
+
+void I2CQueue::setBlocking(bool blocking)
+{
+    this->blocking = blocking;
+}
+
+bool I2CQueue::busy()
+{
+    return running;
+}
+
+void I2CQueue::runBlocking()
+{
+    while (next != head) {
+        Entry& e = entries[next % I2C_QUEUE_SIZE];
+        char reg = e.t.reg;
+        e.ok = i2c.write(e.t.address, &reg, 1, true) == 0 &&
+               i2c.read(e.t.address | 1, (char*) e.t.rx, e.t.len) == 0;
+        transfers++;
+        next++;
+    }
+    finish();
+}
+
+#if DEVICE_I2C_ASYNCH
+// put the next transaction on the bus, from start() or the completion interrupt
+bool I2CQueue::startTransfer()
+{
+    while (next != head) {
+        Entry& e = entries[next % I2C_QUEUE_SIZE];
+        if (i2c.transfer(e.t.address, (const char*) &e.t.reg, 1, (char*) e.t.rx, e.t.len, callback,
+                         I2C_EVENT_ALL, false) == 0)
+            return true;
+        e.ok = false;           // bus refused the transfer, carry on with the next one
+        next++;
+    }
+    return false;
+}
+
+// completion interrupt
+void I2CQueue::transferDone(int event)
+{
+    entries[next % I2C_QUEUE_SIZE].ok = (event & I2C_EVENT_TRANSFER_COMPLETE) &&
+                                        ! (event & (I2C_EVENT_ERROR | I2C_EVENT_ERROR_NO_SLAVE | I2C_EVENT_TRANSFER_EARLY_NACK));
+    transfers++;
+    next++;
+    if (! startTransfer())
+        finish();
+}
+#endif
+
+void I2CQueue::finish()
+{
+    cycle_us = us_ticker_read() - start_us;
+    if (cycle_us > cycle_max_us)
+        cycle_max_us = cycle_us;
+    running = false;
+    if (thread)
+        osSignalSet(thread, I2C_QUEUE_DONE_SIGNAL);
+}
+
+void I2CQueue::start()
+{
+    if (running || next == head)
+        return;
+    thread = osThreadGetId();
+    start_us = us_ticker_read();
+    running = true;
+#if DEVICE_I2C_ASYNCH
+    if (! blocking) {
+        if (! startTransfer())
+            finish();
+        return;
+    }
+#endif
+    runBlocking();
+}
+
+// a signal left over from a run that finished before wait() only causes one extra loop
+void I2CQueue::wait()
+{
+    while (running)
+        Thread::signal_wait(I2C_QUEUE_DONE_SIGNAL);
+}
+
+void I2CQueue::run()
+{
+    // a run with nothing queued (or one already on the bus) keeps the statistics of the last cycle
+    if (! running && next != head) {
+        uint32_t t0 = us_ticker_read();
+        start();
+        cpu_us = us_ticker_read() - t0;
+    }
+    wait();
+}
+
+int I2CQueue::dispatch()
+{
+    int failed = 0;
+    while (tail != next) {
+        Entry& e = entries[tail % I2C_QUEUE_SIZE];
+        if (! e.ok) {
+            failed++;
+            errors++;
+            group_ok = false;
+        }
+        if (e.t.done) {
+            e.t.done(e.t.arg, group_ok);
+            group_ok = true;
+        }
+        tail++;
+    }
+    return failed;
+}
@@ -0,0 +1,97 @@
+/****************************************************************************************************
+ * i2c_queue.h
+ *
+ * Queue of I2C register reads (register pointer write + repeated start + burst read) that runs
+ * them back to back without the CPU waiting on the bus.
+ *
+ * Jobs submit() the reads of a sampling cycle, start() chains them through I2C::transfer(), each
+ * completion interrupt starting the next transfer, and the submitting thread sleeps on a signal
+ * until the whole chain is done.  dispatch() then runs the completion callbacks in thread context,
+ * where the raw bytes are converted.  Several transactions can form one group (e.g. the readout
+ * blocks of one chip): only the last one carries the callback and it gets ok == false if any
+ * transaction of the group failed.
+ *
+ * Without DEVICE_I2C_ASYNCH (or with setBlocking(true)) start() performs the same transactions
+ * with the blocking write/read calls, so both ways can be timed against each other.
+ ****************************************************************************************************/
+#ifndef I2C_QUEUE_H
+#define I2C_QUEUE_H
+
+#include "mbed.h"
+#include "rtos.h"
+
+#define I2C_QUEUE_SIZE          16              // power of two
+#define I2C_QUEUE_DONE_SIGNAL   0x04
+
+struct I2CTransaction {
+    uint8_t     address;                        // 8-bit bus address
+    uint8_t     reg;                            // first register to read
+    uint8_t     len;
+    uint8_t*    rx;                             // receives len bytes
+    void        (*done)(void* arg, bool ok);    // NULL for all but the last transaction of a group
+    void*       arg;
+};
+
+class I2CQueue
+{
+public:
+    I2CQueue(I2C& i2c);
+
+    // number of transactions that can still be submitted
+    int space();
+
+    // queue a transaction, returns false when the queue is full
+    bool submit(const I2CTransaction& t);
+
+    // run all submitted transactions and wait until they are done
+    void run();
+
+    // start the submitted transactions without waiting
+    void start();
+
+    bool busy();
+
+    // block the calling thread until the started transactions are done
+    void wait();
+
+    // run the callbacks of the completed transactions, returns the number of failed transactions
+    int dispatch();
+
+    // force the blocking write/read calls even when the target supports asynchronous transfers
+    void setBlocking(bool blocking);
+
+    // statistics of the last run(): bus time from the first start to the last completion, and the
+    // part of it the calling thread was busy rather than asleep
+    uint32_t    cycle_us;
+    uint32_t    cycle_max_us;
+    uint32_t    cpu_us;
+    uint32_t    transfers;
+    uint32_t    errors;
+
+private:
+    struct Entry {
+        I2CTransaction  t;
+        bool            ok;
+    };
+
+    void runBlocking();
+#if DEVICE_I2C_ASYNCH
+    bool startTransfer();
+    void transferDone(int event);
+    event_callback_t    callback;
+#endif
+    void finish();
+
+    I2C&                i2c;
+    Entry               entries[I2C_QUEUE_SIZE];
+    volatile uint32_t   head;                   // next free slot
+    volatile uint32_t   next;                   // next transaction to put on the bus
+    uint32_t            tail;                   // next transaction to dispatch
+    volatile bool       running;
+    bool                blocking;
+    bool                group_ok;
+    osThreadId          thread;
+    uint32_t            start_us;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "journal_body.h"
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+#include "heap_arena.h"
+#include <time.h>
+
+JournalBodyOut::JournalBodyOut(SampleJournal& journal, JournalBodyFormat format, SensorSample* samples, int window_len,
+                               uint8_t* scratch, int scratch_len, const UploadStream* streams, int stream_count)
+    : journal(journal), format(format), window(samples), window_len(window_len), window_start(0), window_count(0),
+      scratch(scratch), scratch_len(scratch_len), streams(streams), stream_count(stream_count), count(0), values(0)
+{
+    readReset();
+}
+
+int JournalBodyOut::begin(int max_samples)
+{
+    int pending = journal.pending();
+    count = max_samples < pending ? max_samples : pending;
+    window_count = 0;
+
+    values = count;
+    if (format == JOURNAL_BODY_JSON) {
+        // the body lists the samples once per stream, so it is one window, peeked once and
+        // walked in place by every stream
+        if (count > window_len)
+            count = window_len;
+        window_start = 0;
+        count = window_count = journal.peek(window, count);
+        values = 0;
+        for (int i = 0; i < count; i++) {
+            for (int j = 0; j < stream_count; j++) {
+                if (window[i].flags & streams[j].group)
+                    values++;
+            }
+        }
+    }
+    readReset();
+    return count;
+}
+
+int JournalBodyOut::points()
+{
+    return values;
+}
+
+void JournalBodyOut::readReset()
+{
+    next = 0;
+    out_pos = out_len = 0;
+    stream = 0;
+    json_state = JSON_OPEN;
+    stream_open = false;
+    any_stream = false;
+}
+
+int JournalBodyOut::read(char* buf, size_t len, size_t* pReadLen)
+{
+    size_t n = 0;
+    while (n < len) {
+        if (out_pos == out_len) {
+            int piece = fill();
+            if (piece < 0)
+                return HTTP_ERROR;
+            if (piece == 0)
+                break;
+            out_pos = 0;
+            out_len = piece;
+        }
+        size_t take = out_len - out_pos;
+        if (take > len - n)
+            take = len - n;
+        memcpy(buf + n, scratch + out_pos, take);
+        out_pos += take;
+        n += take;
+    }
+    *pReadLen = n;
+    return HTTP_OK;
+}
+
+int JournalBodyOut::getDataType(char* type, size_t maxTypeLen)
+{
+    const char* name = format == JOURNAL_BODY_TSC ? "application/x-dragonfly-tsc" :
+                       format == JOURNAL_BODY_FRAMES ? "application/x-dragonfly-telemetry" : "application/json";
+    strncpy(type, name, maxTypeLen - 1);
+    type[maxTypeLen - 1] = '\0';
+    return HTTP_OK;
+}
+
+bool JournalBodyOut::getIsChunked()
+{
+    return true;
+}
+
+size_t JournalBodyOut::getDataLen()
+{
+    return 0;
+}
+
+// sample index of the body, peeking the next window from the journal when needed
+const SensorSample* JournalBodyOut::sample(int index)
+{
+    if (index < window_start || index >= window_start + window_count) {
+        window_start = index;
+        window_count = journal.peek(window, window_len, index);
+        if (window_count == 0)
+            return NULL;
+    }
+    return &window[index - window_start];
+}
+
+// encode the next piece of the body into scratch, returns its length, 0 at the end, -1 on error
+int JournalBodyOut::fill()
+{
+    HeapScope heap_scope(HEAP_SERIALIZE);
+    if (format == JOURNAL_BODY_JSON)
+        return fillJson();
+    if (next >= count)
+        return 0;
+
+    if (format == JOURNAL_BODY_TSC) {
+        // one block per window of samples, like the fixed-size batches before
+        TsCompressor compressor;
+        compressor.begin(scratch, scratch_len);
+        for (int j = 0; j < window_len && next < count; j++, next++) {
+            const SensorSample* s = sample(next);
+            if (! s)
+                return -1;
+            if (! compressor.add(*s))
+                break;
+        }
+        return compressor.count() ? compressor.finish() : -1;
+    }
+
+    int len = 0;
+    while (next < count && scratch_len - len >= TELEMETRY_MAX_FRAME) {
+        const SensorSample* s = sample(next++);
+        if (! s)
+            return -1;
+        len += telemetry_encode(*s, scratch + len, scratch_len - len);
+    }
+    return len ? len : -1;
+}
+
+// {"values":{"<stream>":[{"timestamp":"...","value":...},...],...}}, one value per piece
+int JournalBodyOut::fillJson()
+{
+    char* out = (char*) scratch;
+    int len = 0;
+
+    switch (json_state) {
+    case JSON_OPEN:
+        json_state = JSON_VALUES;
+        return snprintf(out, scratch_len, "{\"values\":{");
+
+    case JSON_VALUES:
+        while (stream < stream_count) {
+            const UploadStream& st = streams[stream];
+            while (next < count && ! (window[next].flags & st.group))
+                next++;
+            if (next == count) {
+                // streams without a value are left out
+                bool was_open = stream_open;
+                stream++;
+                next = 0;
+                stream_open = false;
+                if (was_open)
+                    return snprintf(out, scratch_len, "]");
+                continue;
+            }
+            const SensorSample* s = &window[next++];
+
+            if (! stream_open)
+                len = snprintf(out, scratch_len, "%s\"%s\":[", any_stream ? "," : "", st.name);
+            else
+                len = snprintf(out, scratch_len, ",");
+            stream_open = any_stream = true;
+            time_t t = s->timestamp;
+            struct tm* tm = gmtime(&t);
+            len += snprintf(out + len, scratch_len - len,
+                            "{\"timestamp\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\",\"value\":%g}",
+                            tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec,
+                            s->millis, (double) st.value(*s));
+            return len < scratch_len ? len : -1;
+        }
+        json_state = JSON_CLOSE;
+        // fall through
+    case JSON_CLOSE:
+        json_state = JSON_DONE;
+        return snprintf(out, scratch_len, "}}");
+
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,87 @@
+/****************************************************************************************************
+ * journal_body.h
+ *
+ * Upload body that streams the oldest journaled samples straight into the socket.
+ *
+ * The batch upload used to build every batch in full before posting it (the M2X JSON as an
+ * MbedJSONValue and a std::string, a few kB of heap per batch), so the batch size was bounded by
+ * free heap.  JournalBodyOut encodes the samples piece by piece as the link reads the body, with
+ * chunked transfer encoding since the length is not known up front, and only needs the fixed
+ * scratch it is given: a window of samples peeked from the journal and a buffer holding the piece
+ * being sent (one JSON value, a few telemetry frames or one compressed block).  A post of frames
+ * or blocks can then carry as many samples as the link moves in reasonable time; a JSON body lists
+ * the samples once per stream, so it holds one window of them, peeked once.
+ *
+ * The journal must not change while a body is read; it is only touched by the network thread,
+ * which is busy in the post.
+ ****************************************************************************************************/
+#ifndef JOURNAL_BODY_H
+#define JOURNAL_BODY_H
+
+#include "link_manager.h"
+#include "sample_journal.h"
+
+// M2X stream uploaded from each sample, a value is only sent if its sensor was read
+struct UploadStream {
+    const char* name;
+    uint16_t    group;
+    float       (*value)(const SensorSample& sample);
+};
+
+enum JournalBodyFormat {
+    JOURNAL_BODY_JSON,              // M2X multi-value update, application/json
+    JOURNAL_BODY_FRAMES,            // telemetry frames back to back (telemetry_codec.h)
+    JOURNAL_BODY_TSC                // compressed blocks (ts_compress.h)
+};
+
+class JournalBodyOut : public HTTPBodyOut
+{
+public:
+    // samples: window of window_len samples peeked at a time, also the samples per TSC block and
+    // the most a JSON body holds;
+    // scratch: encoding buffer, at least a TSC block of one sample or one JSON value (~100 bytes)
+    JournalBodyOut(SampleJournal& journal, JournalBodyFormat format, SensorSample* samples, int window_len,
+                   uint8_t* scratch, int scratch_len, const UploadStream* streams = NULL, int stream_count = 0);
+
+    // make the body of the oldest max_samples pending samples, returns how many it holds
+    int begin(int max_samples);
+
+    // values in the body (JSON counts stream values), 0 when the samples carry nothing to post
+    int points();
+
+    virtual void readReset();
+    virtual int read(char* buf, size_t len, size_t* pReadLen);
+    virtual int getDataType(char* type, size_t maxTypeLen);
+    virtual bool getIsChunked();
+    virtual size_t getDataLen();
+
+private:
+    enum JsonState { JSON_OPEN, JSON_VALUES, JSON_CLOSE, JSON_DONE };
+
+    const SensorSample* sample(int index);
+    int fill();
+    int fillJson();
+
+    SampleJournal&          journal;
+    JournalBodyFormat       format;
+    SensorSample*           window;
+    int                     window_len;
+    int                     window_start;       // journal index of window[0]
+    int                     window_count;
+    uint8_t*                scratch;
+    int                     scratch_len;
+    const UploadStream*     streams;
+    int                     stream_count;
+
+    int                     count;
+    int                     values;
+    int                     next;               // next sample to encode
+    int                     out_pos;
+    int                     out_len;
+    int                     stream;             // JSON: current stream
+    JsonState               json_state;
+    bool                    stream_open;        // JSON: the current stream's array was started
+    bool                    any_stream;         // JSON: a stream was written
+};
+
+#endif
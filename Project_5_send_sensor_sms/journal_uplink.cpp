@@ -0,0 +1,51 @@
+#include "journal_uplink.h"
+#include "sample_clock.h"
+
+JournalUplink::JournalUplink(SampleJournal& journal, JournalBodyOut& body, const char* path, int post_samples,
+                             int batches_per_post)
+    : rejected(0), journal(journal), body(body), path(path), post_samples(post_samples),
+      batches_per_post(batches_per_post)
+{
+}
+
+void JournalUplink::add(SensorSample sample)
+{
+    if ((sample.flags & SAMPLE_UNSYNCED) && clock_synced()) {
+        sample_shift_time(sample, clock_sync_offset_ms());
+        sample.flags &= ~SAMPLE_UNSYNCED;
+    }
+    journal.append(sample);
+}
+
+void JournalUplink::clockSet()
+{
+    journal.fixUnsynced(clock_sync_offset_ms());
+}
+
+void JournalUplink::upload(PostLink& link)
+{
+    char http_response_buf[256];
+
+    for (int batch = 0; batch < batches_per_post && journal.pending(); batch++) {
+        int n = body.begin(post_samples);
+        if (body.points() == 0) {
+            journal.discard(n);     // nothing in these samples is uploaded
+            continue;
+        }
+
+        int ret = link.post(path, body, http_response_buf, sizeof(http_response_buf));
+        int code = link.getHTTPResponseCode();
+        if (ret == HTTP_ERROR && code >= 400 && code < 500 && code != 408 && code != 429) {
+            rejected += n;
+            logError("server refused %d samples, dropped: [%d][%s]", n, code, http_response_buf);
+            journal.discard(n);
+            continue;
+        }
+        if (ret != HTTP_OK) {
+            logError("posting %d samples to cloud failed: [%d][%s]", n, ret, http_response_buf);
+            break;
+        }
+        journal.ack(n);
+        logDebug("posted %d samples [%d]", n, code);
+    }
+}
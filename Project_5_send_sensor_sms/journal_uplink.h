@@ -0,0 +1,51 @@
+/****************************************************************************************************
+ * journal_uplink.h
+ *
+ * Network thread side of the store-and-forward journal: the samples handed over by the sampling
+ * thread are journaled, and the oldest pending ones are posted in batches over a PostLink.
+ *
+ * Samples taken before the clock was set are flagged SAMPLE_UNSYNCED; add() moves the ones that
+ * arrive after the sync onto the real time line, clockSet() the ones already journaled.  A batch
+ * is only acked once the server accepted it, so after a transport error or a 5xx answer it is
+ * sent again next time.  A 4xx answer will not change on a retry, that batch is dropped and
+ * counted so it does not hold up the rest of the journal (but 408/429, and CoAP's 4.08 when
+ * blocks are still missing, ask for a retry).  Re-sending a batch whose response got lost is
+ * harmless: M2X keys values by timestamp.
+ *
+ * This is the code main.cpp's network_task() runs for the HTTP and CoAP transports, and the one
+ * the host simulation (Host_sim/sim_main.cpp) runs over its simulated link.
+ ****************************************************************************************************/
+#ifndef JOURNAL_UPLINK_H
+#define JOURNAL_UPLINK_H
+
+#include "journal_body.h"
+
+class JournalUplink
+{
+public:
+    // path: the M2X multi-value endpoint; every upload() posts up to batches_per_post bodies of
+    // up to post_samples samples
+    JournalUplink(SampleJournal& journal, JournalBodyOut& body, const char* path, int post_samples,
+                  int batches_per_post);
+
+    // journal a sample from the sampling thread
+    void add(SensorSample sample);
+
+    // the clock was just set, move the journaled samples taken before onto the synced time line
+    void clockSet();
+
+    // post the oldest pending samples, needs the clock set
+    void upload(PostLink& link);
+
+    // statistics
+    uint32_t    rejected;           // samples dropped because the server refused them (4xx)
+
+private:
+    SampleJournal&  journal;
+    JournalBodyOut& body;
+    const char*     path;
+    int             post_samples;
+    int             batches_per_post;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "kmx62_buffer.h"
+#include "rohm_sensors.h"
+#include "sample_clock.h"
+
+// KMX62 registers
+#define KMX62_ODCNTL        0x38                // OSM (mag) in the high, OSA (accel) in the low nibble
+#define KMX62_CNTL2         0x3A
+#define KMX62_BUF_CTRL_3    0x79                // mode and buffered channels
+#define KMX62_BUF_CLEAR     0x7A
+#define KMX62_BUF_STATUS_1  0x7B                // level in bytes, low byte
+#define KMX62_BUF_READ      0x7E
+
+#define KMX62_CNTL2_STANDBY 0x00
+#define KMX62_BUF_ACCEL_MAG 0x7E                // FIFO mode, accel and mag XYZ buffered
+
+#define KMX62_BUF_BYTES     384
+#define KMX62_SAMPLE_BYTES  12
+
+// output data rates (OSA / OSM codes)
+static const struct {
+    uint16_t    hz;
+    uint8_t     code;
+} kmx62_rates[] = {
+    { 400, 0x05 }, { 200, 0x04 }, { 100, 0x03 }, { 50, 0x02 }, { 25, 0x01 },
+};
+
+Kmx62Buffer::Kmx62Buffer(I2C& i2c, I2CQueue& queue)
+    : rate_hz(0), samples(0), transfers(0), bus_bytes(0), overflows(0), errors(0),
+      i2c(i2c), queue(queue), period_us(0), next_us(0), timed(false), gap(false), pending(false),
+      burst(false), level(0), consumer_count(0)
+{
+}
+
+bool Kmx62Buffer::addConsumer(MotionConsumer consumer, void* arg)
+{
+    if (consumer_count == KMX62_BUFFER_MAX_CONSUMERS)
+        return false;
+    consumers[consumer_count].fn = consumer;
+    consumers[consumer_count].arg = arg;
+    consumer_count++;
+    return true;
+}
+
+bool Kmx62Buffer::writeReg(uint8_t reg, uint8_t value)
+{
+    char cmd[2] = { (char) reg, (char) value };
+    return i2c.write(Kmx62::address, cmd, 2) == 0;
+}
+
+bool Kmx62Buffer::start(uint16_t rate_hz, EventScheduler& scheduler)
+{
+    int r = 0;
+    while (r < (int) (sizeof(kmx62_rates) / sizeof(kmx62_rates[0])) - 1 && kmx62_rates[r].hz > rate_hz)
+        r++;
+    this->rate_hz = kmx62_rates[r].hz;
+    period_us = 1000000 / this->rate_hz;
+    timed = false;
+    gap = false;
+
+    // configuration changes need the sensors in stand-by, CNTL2 is restored from the init table
+    const RegWrite& run = Kmx62::init()[0];
+    bool ok = writeReg(KMX62_CNTL2, KMX62_CNTL2_STANDBY) &&
+              writeReg(KMX62_ODCNTL, (kmx62_rates[r].code << 4) | kmx62_rates[r].code) &&
+              writeReg(KMX62_BUF_CTRL_3, KMX62_BUF_ACCEL_MAG) &&
+              writeReg(KMX62_BUF_CLEAR, 0) &&
+              writeReg(run.reg, run.value);
+    if (! ok)
+        return false;
+
+    // check the level twice per block so the buffer never holds more than two blocks
+    uint32_t block_ms = KMX62_BUFFER_BLOCK * 1000 / this->rate_hz;
+    return scheduler.add("kmx62buf", job, this, block_ms / 2 ? block_ms / 2 : 1) >= 0;
+}
+
+void Kmx62Buffer::job(void* arg)
+{
+    ((Kmx62Buffer*) arg)->drain();
+}
+
+// scheduler job: queue a burst when a block is waiting, and the level read in any case
+void Kmx62Buffer::drain()
+{
+    if (pending || queue.space() < 2)
+        return;
+
+    burst = level >= KMX62_BUFFER_BLOCK * KMX62_SAMPLE_BYTES;
+    if (burst) {
+        I2CTransaction t = { Kmx62::address, KMX62_BUF_READ, KMX62_BUFFER_BLOCK * KMX62_SAMPLE_BYTES, raw,
+                             NULL, NULL };
+        queue.submit(t);
+        transfers++;
+        bus_bytes += 3 + KMX62_BUFFER_BLOCK * KMX62_SAMPLE_BYTES;
+    }
+    I2CTransaction s = { Kmx62::address, KMX62_BUF_STATUS_1, 2, status, readDone, this };
+    queue.submit(s);
+    transfers++;
+    bus_bytes += 3 + 2;
+    pending = true;
+}
+
+void Kmx62Buffer::readDone(void* arg, bool ok)
+{
+    ((Kmx62Buffer*) arg)->drained(ok);
+}
+
+// runs in the sampling thread from I2CQueue::dispatch()
+void Kmx62Buffer::drained(bool ok)
+{
+    pending = false;
+    if (! ok) {
+        errors++;
+        level = 0;
+        timed = false;
+        gap = true;
+        return;
+    }
+    level = status[0] | ((status[1] & 0x03) << 8);
+
+    // the newest buffered sample was taken about now, the ones still in the buffer come after the block
+    uint64_t now = clock_uptime_us();
+    uint32_t left = level / KMX62_SAMPLE_BYTES;
+    if (burst) {
+        uint64_t first = now - (uint64_t) (left + KMX62_BUFFER_BLOCK - 1) * period_us;
+        if (! timed) {
+            next_us = first;
+            timed = true;
+        } else {
+            // a quarter of the way towards the level-based estimate, samples are up to a period old
+            int32_t err = (int32_t) (int64_t) (first - next_us);
+            next_us += err / 4;
+        }
+
+        for (int i = 0; i < KMX62_BUFFER_BLOCK; i++) {
+            for (int axis = 0; axis < 6; axis++)
+                axes[i][axis] = rohm_le16(raw + KMX62_SAMPLE_BYTES * i + 2 * axis);
+        }
+
+        MotionBlock block;
+        block.first_us = next_us;
+        block.period_us = period_us;
+        block.count = KMX62_BUFFER_BLOCK;
+        block.gap = gap;
+        block.axes = axes;
+        for (int i = 0; i < consumer_count; i++)
+            consumers[i].fn(block, consumers[i].arg);
+
+        next_us += (uint64_t) KMX62_BUFFER_BLOCK * period_us;
+        samples += KMX62_BUFFER_BLOCK;
+        gap = false;
+    }
+
+    // a full buffer stops taking samples: start over with an empty one
+    if (level > KMX62_BUF_BYTES - KMX62_SAMPLE_BYTES) {
+        overflows++;
+        writeReg(KMX62_BUF_CLEAR, 0);
+        level = 0;
+        timed = false;
+        gap = true;
+    }
+}
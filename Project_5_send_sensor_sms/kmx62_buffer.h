@@ -0,0 +1,84 @@
+/****************************************************************************************************
+ * kmx62_buffer.h
+ *
+ * Buffered 6-axis capture from the KMX62 accelerometer / magnetometer.
+ *
+ * The chip stores accel and mag XYZ (12 bytes per sample) in its 384 byte sample buffer at the
+ * output data rate.  A scheduler job reads the buffer level and, once a block of samples is
+ * waiting, drains it with one burst read of BUF_READ on the I2C queue, so a block costs two
+ * transactions instead of one (or two, with KMX62_SPLIT_READOUT) per sample.  Blocks are handed to
+ * the consumers with the same time line handling as the KX022 stream: contiguous sample times,
+ * trimmed towards the buffer level seen at every read, restarted after a gap.
+ ****************************************************************************************************/
+#ifndef KMX62_BUFFER_H
+#define KMX62_BUFFER_H
+
+#include "mbed.h"
+#include "i2c_queue.h"
+#include "event_scheduler.h"
+
+#define KMX62_BUFFER_BLOCK          20          // samples per burst, one transaction can move 255 bytes
+#define KMX62_BUFFER_MAX_CONSUMERS  4
+#define KMX62_ACCEL_COUNTS_PER_G    8192.0f     // same scales as rohm_convert<Kmx62>()
+#define KMX62_MAG_COUNTS_PER_UT     (4096.0f / 0.146f)
+
+struct MotionBlock {
+    uint64_t        first_us;                   // uptime (clock_uptime_us) of axes[0]
+    uint32_t        period_us;
+    uint16_t        count;
+    bool            gap;                        // samples were lost right before this block
+    const int16_t   (*axes)[6];                 // accel XYZ, mag XYZ in counts
+};
+
+typedef void (*MotionConsumer)(const MotionBlock& block, void* arg);
+
+class Kmx62Buffer
+{
+public:
+    Kmx62Buffer(I2C& i2c, I2CQueue& queue);
+
+    bool addConsumer(MotionConsumer consumer, void* arg);
+
+    // configure accel and mag for rate_hz (25..400, rounded down), start buffering and add the
+    // drain job to the scheduler.  Uses blocking I2C writes, call it while the I2C queue is idle.
+    bool start(uint16_t rate_hz, EventScheduler& scheduler);
+
+    // statistics
+    uint16_t    rate_hz;
+    uint32_t    samples;
+    uint32_t    transfers;                      // I2C transactions issued for the buffer
+    uint32_t    bus_bytes;                      // bytes on the bus incl. address and register bytes
+    uint32_t    overflows;
+    uint32_t    errors;
+
+private:
+    static void job(void* arg);
+    static void readDone(void* arg, bool ok);
+    void drain();
+    void drained(bool ok);
+    bool writeReg(uint8_t reg, uint8_t value);
+
+    I2C&                i2c;
+    I2CQueue&           queue;
+
+    uint32_t            period_us;
+    uint64_t            next_us;
+    bool                timed;
+    bool                gap;
+    bool                pending;                // a read is queued
+    bool                burst;                  // ... and it includes a burst
+    uint16_t            level;                  // buffered bytes at the last status read
+
+    uint8_t             raw[KMX62_BUFFER_BLOCK * 12];
+    uint8_t             status[2];              // BUF_STATUS_1, BUF_STATUS_2
+    int16_t             axes[KMX62_BUFFER_BLOCK][6];
+
+    struct Consumer {
+        MotionConsumer  fn;
+        void*           arg;
+    };
+    Consumer            consumers[KMX62_BUFFER_MAX_CONSUMERS];
+    int                 consumer_count;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "kx022_stream.h"
+#include "rohm_sensors.h"
+#include "sample_clock.h"
+
+// KX022-1020 registers
+#define KX022_CNTL1         0x18
+#define KX022_ODCNTL        0x1B
+#define KX022_INC1          0x1C
+#define KX022_INC4          0x1F
+#define KX022_BUF_CNTL1     0x3A
+#define KX022_BUF_CNTL2     0x3B
+#define KX022_BUF_STATUS_1  0x3C
+#define KX022_BUF_CLEAR     0x3E
+#define KX022_BUF_READ      0x3F
+
+#define KX022_CNTL1_STANDBY 0x40                // PC1 off, high resolution
+#define KX022_CNTL1_RUN     0xC0                // PC1 on, high resolution, +-2 g
+#define KX022_INC1_INT1     0x38                // IEN1, active high, pulsed
+#define KX022_INC4_WMI1     0x20                // watermark interrupt on INT1
+#define KX022_BUF_ON        0xC0                // BUFE, 16 bit samples, FIFO mode
+
+#define KX022_BUF_BYTES     252
+
+// output data rates (ODCNTL OSA codes)
+static const struct {
+    uint16_t    hz;
+    uint8_t     osa;
+} kx022_rates[] = {
+    { 1600, 0x07 }, { 800, 0x06 }, { 400, 0x05 }, { 200, 0x04 }, { 100, 0x03 }, { 50, 0x02 }, { 25, 0x01 },
+};
+
+Kx022Stream::Kx022Stream(I2C& i2c, I2CQueue& queue, PinName int1)
+    : rate_hz(0), samples(0), blocks(0), overflows(0), errors(0),
+      i2c(i2c), queue(queue), int1(int1), scheduler(NULL), watermark(0), period_us(0), next_us(0),
+      timed(false), backlog(false), gap(false), draining(false), drain_irq(false), drain_irq_us(0),
+      irq_pending(false), irq_us(0), level(0), consumer_count(0)
+{
+}
+
+bool Kx022Stream::addConsumer(AccelConsumer consumer, void* arg)
+{
+    if (consumer_count == KX022_STREAM_MAX_CONSUMERS)
+        return false;
+    consumers[consumer_count].fn = consumer;
+    consumers[consumer_count].arg = arg;
+    consumer_count++;
+    return true;
+}
+
+bool Kx022Stream::writeReg(uint8_t reg, uint8_t value)
+{
+    char cmd[2] = { (char) reg, (char) value };
+    return i2c.write(Kx022::address, cmd, 2) == 0;
+}
+
+bool Kx022Stream::start(uint16_t rate_hz, uint8_t watermark, EventScheduler* scheduler)
+{
+    int r = 0;
+    while (r < (int) (sizeof(kx022_rates) / sizeof(kx022_rates[0])) - 1 && kx022_rates[r].hz > rate_hz)
+        r++;
+    if (watermark == 0 || watermark > KX022_STREAM_MAX_SAMPLES)
+        watermark = KX022_STREAM_MAX_SAMPLES;
+
+    this->watermark = watermark;
+    this->scheduler = scheduler;
+    rate_hz = kx022_rates[r].hz;
+    period_us = 1000000 / kx022_rates[r].hz;
+    timed = false;
+    gap = false;
+
+    // the chip only takes configuration changes in stand-by
+    bool ok = writeReg(KX022_CNTL1, KX022_CNTL1_STANDBY) &&
+              writeReg(KX022_ODCNTL, kx022_rates[r].osa) &&
+              writeReg(KX022_INC1, KX022_INC1_INT1) &&
+              writeReg(KX022_INC4, KX022_INC4_WMI1) &&
+              writeReg(KX022_BUF_CNTL1, watermark) &&
+              writeReg(KX022_BUF_CNTL2, KX022_BUF_ON) &&
+              writeReg(KX022_BUF_CLEAR, 0) &&
+              writeReg(KX022_CNTL1, KX022_CNTL1_RUN);
+    if (! ok)
+        return false;
+    int1.rise(this, &Kx022Stream::interrupt);
+    return true;
+}
+
+// INT1 interrupt: the buffer reached the watermark
+void Kx022Stream::interrupt()
+{
+    irq_us = clock_uptime_us();
+    irq_pending = true;
+    if (scheduler)
+        scheduler->wake();
+}
+
+void Kx022Stream::service()
+{
+    // a buffer still above the watermark after the last drain raises no new interrupt
+    bool more = level >= watermark * 6;
+    if (draining || ! (irq_pending || more))
+        return;
+    if (queue.space() < 2)
+        return;
+
+    __disable_irq();
+    drain_irq = irq_pending;
+    drain_irq_us = irq_us;
+    irq_pending = false;
+    __enable_irq();
+
+    backlog = more;
+    level = 0;
+    I2CTransaction burst = { Kx022::address, KX022_BUF_READ, (uint8_t) (watermark * 6), raw, NULL, NULL };
+    I2CTransaction status = { Kx022::address, KX022_BUF_STATUS_1, 1, &level, readDone, this };
+    queue.submit(burst);
+    queue.submit(status);
+    draining = true;
+}
+
+void Kx022Stream::readDone(void* arg, bool ok)
+{
+    ((Kx022Stream*) arg)->drained(ok);
+}
+
+// runs in the sampling thread from I2CQueue::dispatch()
+void Kx022Stream::drained(bool ok)
+{
+    draining = false;
+    if (! ok) {
+        errors++;
+        level = 0;
+        timed = false;
+        gap = true;
+        return;
+    }
+
+    if (! timed) {
+        if (! drain_irq) {
+            // no time reference yet, drop the block and wait for the next interrupt
+            level = 0;
+            gap = true;
+            return;
+        }
+        // the last sample of the block completed the watermark
+        next_us = drain_irq_us - (uint64_t) (watermark - 1) * period_us;
+        timed = true;
+    } else if (drain_irq && ! backlog) {
+        // pull the time line a quarter of the way towards the interrupt, and the period by as much
+        // as the error spread over the block
+        int32_t err = (int32_t) (int64_t) (drain_irq_us - (next_us + (uint64_t) (watermark - 1) * period_us));
+        next_us += err / 4;
+        period_us += err / (16 * watermark);
+    }
+
+    for (int i = 0; i < watermark; i++) {
+        for (int axis = 0; axis < 3; axis++)
+            xyz[i][axis] = rohm_le16(raw + 6 * i + 2 * axis);
+    }
+
+    AccelBlock block;
+    block.first_us = next_us;
+    block.period_us = period_us;
+    block.count = watermark;
+    block.gap = gap;
+    block.xyz = xyz;
+    for (int i = 0; i < consumer_count; i++)
+        consumers[i].fn(block, consumers[i].arg);
+
+    next_us += (uint64_t) watermark * period_us;
+    samples += watermark;
+    blocks++;
+    gap = false;
+
+    // a full buffer stops taking samples: start over with an empty one
+    if (level >= KX022_BUF_BYTES) {
+        overflows++;
+        writeReg(KX022_BUF_CLEAR, 0);
+        level = 0;
+        timed = false;
+        gap = true;
+    }
+}
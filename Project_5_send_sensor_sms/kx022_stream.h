@@ -0,0 +1,97 @@
+/****************************************************************************************************
+ * kx022_stream.h
+ *
+ * Streaming capture from the KX022 accelerometer through its sample buffer.
+ *
+ * The chip samples at the output data rate into its 252 byte buffer (42 XYZ samples at 16 bit) and
+ * pulses INT1 when the buffer holds the watermark number of samples.  The interrupt only records
+ * the time and wakes the sampling thread; service() then queues one burst read of the buffer on
+ * the I2C queue, so the buffer is drained in bulk without anybody polling the chip.  Every drained
+ * burst is handed to the consumers as a block of contiguous, timestamped samples.
+ *
+ * Sample times follow the chip's own clock: a block starts where the previous one ended and the
+ * time line is trimmed a little towards every watermark interrupt, so it neither jumps nor drifts.
+ * When the buffer overflowed (the thread fell too far behind) or a read failed, the next block is
+ * flagged as following a gap and the time line restarts from the next interrupt.
+ ****************************************************************************************************/
+#ifndef KX022_STREAM_H
+#define KX022_STREAM_H
+
+#include "mbed.h"
+#include "i2c_queue.h"
+#include "event_scheduler.h"
+
+#define KX022_STREAM_MAX_SAMPLES    41          // largest watermark, one sample below a full buffer
+#define KX022_STREAM_MAX_CONSUMERS  4
+#define KX022_COUNTS_PER_G          16384       // +-2 g, 16 bit
+
+struct AccelBlock {
+    uint64_t        first_us;                   // uptime (clock_uptime_us) of xyz[0]
+    uint32_t        period_us;                  // time between samples
+    uint16_t        count;
+    bool            gap;                        // samples were lost right before this block
+    const int16_t   (*xyz)[3];                  // KX022_COUNTS_PER_G counts per g
+};
+
+typedef void (*AccelConsumer)(const AccelBlock& block, void* arg);
+
+class Kx022Stream
+{
+public:
+    Kx022Stream(I2C& i2c, I2CQueue& queue, PinName int1);
+
+    // consumers are called in the sampling thread, in the order they were added
+    bool addConsumer(AccelConsumer consumer, void* arg);
+
+    // configure the chip for rate_hz (25..1600, rounded down to a supported rate) and a watermark of
+    // watermark samples, and start streaming.  The scheduler is woken on every watermark interrupt.
+    // Uses blocking I2C writes, call it while the I2C queue is idle.
+    bool start(uint16_t rate_hz, uint8_t watermark, EventScheduler* scheduler);
+
+    // queue the buffer read when a watermark was reached, call it before the queue is run
+    void service();
+
+    // statistics
+    uint16_t    rate_hz;                        // output data rate actually configured
+    uint32_t    samples;
+    uint32_t    blocks;
+    uint32_t    overflows;
+    uint32_t    errors;
+
+private:
+    static void readDone(void* arg, bool ok);
+    void drained(bool ok);
+    void interrupt();
+    bool writeReg(uint8_t reg, uint8_t value);
+
+    I2C&                i2c;
+    I2CQueue&           queue;
+    InterruptIn         int1;
+    EventScheduler*     scheduler;
+
+    uint8_t             watermark;
+    uint32_t            period_us;
+    uint64_t            next_us;                // time of the next sample to be drained
+    bool                timed;                  // next_us is valid
+    bool                backlog;                // the buffer held more than one watermark before this drain
+    bool                gap;
+    bool                draining;
+    bool                drain_irq;              // the drain in progress was started by an interrupt
+    uint64_t            drain_irq_us;
+
+    volatile bool       irq_pending;
+    volatile uint64_t   irq_us;
+
+    uint8_t             raw[KX022_STREAM_MAX_SAMPLES * 6];
+    uint8_t             level;                  // BUF_STATUS_1 read after the burst: bytes left
+    int16_t             xyz[KX022_STREAM_MAX_SAMPLES][3];
+
+    struct Consumer {
+        AccelConsumer   fn;
+        void*           arg;
+    };
+    Consumer            consumers[KX022_STREAM_MAX_CONSUMERS];
+    int                 consumer_count;
+};
+
+#endif
@@ -0,0 +1,392 @@
+#include "link_manager.h"
+#include <stdlib.h>
+#include <strings.h>
+
+static const int socket_timeout_ms = 5000;
+
+/****************************************************************************************************
+// BufferBodyOut
+ ****************************************************************************************************/
+BufferBodyOut::BufferBodyOut(const void* data, size_t len, const char* type)
+    : data((const char*) data), data_len(len), type(type), pos(0)
+{
+}
+
+void BufferBodyOut::readReset()
+{
+    pos = 0;
+}
+
+int BufferBodyOut::read(char* buf, size_t len, size_t* pReadLen)
+{
+    size_t n = data_len - pos;
+    if (n > len)
+        n = len;
+    memcpy(buf, data + pos, n);
+    pos += n;
+    *pReadLen = n;
+    return HTTP_OK;
+}
+
+int BufferBodyOut::getDataType(char* type, size_t maxTypeLen)
+{
+    strncpy(type, this->type, maxTypeLen - 1);
+    type[maxTypeLen - 1] = '\0';
+    return HTTP_OK;
+}
+
+bool BufferBodyOut::getIsChunked()
+{
+    return false;
+}
+
+size_t BufferBodyOut::getDataLen()
+{
+    return data_len;
+}
+
+/****************************************************************************************************
+// LinkManager
+ ****************************************************************************************************/
+LinkManager::LinkManager(Cellular* radio, const char* host, int port)
+    : link_connects(0), socket_connects(0), posts(0), last_post_ms(0),
+      radio(radio), host(host), port(port), header(""),
+      sock_open(false), link_up(false), server_close(false), response_code(0),
+      idle_timeout_ms(60000), backoff_min_ms(1000), backoff_max_ms(60000), backoff_ms(0),
+      rx_len(0), rx_pos(0)
+{
+    idle_timer.start();
+    backoff_timer.start();
+}
+
+void LinkManager::setHeader(const char* header)
+{
+    this->header = header;
+}
+
+void LinkManager::setIdleTimeout(int ms)
+{
+    idle_timeout_ms = ms;
+}
+
+void LinkManager::setBackoff(int min_ms, int max_ms)
+{
+    backoff_min_ms = min_ms;
+    backoff_max_ms = max_ms;
+}
+
+int LinkManager::getHTTPResponseCode()
+{
+    return response_code;
+}
+
+bool LinkManager::isLinkUp()
+{
+    return link_up;
+}
+
+void LinkManager::poll()
+{
+    if (link_up && idle_timeout_ms > 0 && idle_timer.read_ms() > idle_timeout_ms) {
+        logInfo("link idle for %d ms, shutting down", idle_timer.read_ms());
+        shutdown();
+    }
+}
+
+void LinkManager::closeSocket()
+{
+    if (sock_open) {
+        sock.close();
+        sock_open = false;
+    }
+    rx_len = rx_pos = 0;
+}
+
+void LinkManager::shutdown()
+{
+    closeSocket();
+    if (link_up) {
+        radio->disconnect();
+        link_up = false;
+    }
+}
+
+// a failed attempt pushes the next one out by the current backoff delay
+void LinkManager::linkFailed()
+{
+    closeSocket();
+    if (backoff_ms == 0)
+        backoff_ms = backoff_min_ms;
+    else if ((backoff_ms *= 2) > backoff_max_ms)
+        backoff_ms = backoff_max_ms;
+    backoff_timer.reset();
+}
+
+// the connection failed, the server may or may not have the request
+bool LinkManager::transportFailed(HTTPResult ret)
+{
+    return ret == HTTP_CONN || ret == HTTP_TIMEOUT || ret == HTTP_CLOSED;
+}
+
+// the request cannot have been processed: it was not sent in full, or the socket closed without a
+// byte of response (a kept-alive socket the server had dropped).  A slow response (HTTP_TIMEOUT)
+// is not resent, the server may still process it and the batch would be uploaded twice.
+bool LinkManager::retryable(HTTPResult ret)
+{
+    return ret == HTTP_CONN || ret == HTTP_CLOSED;
+}
+
+bool LinkManager::ensureLink()
+{
+    if (link_up && radio->isConnected())
+        return true;
+
+    if (link_up) {
+        logWarning("data link dropped");
+        closeSocket();
+        link_up = false;
+    }
+    if (backoff_ms && backoff_timer.read_ms() < backoff_ms)
+        return false;
+
+    if (! radio->connect()) {
+        linkFailed();
+        logError("establishing PPP link failed, retry in %d ms", backoff_ms);
+        return false;
+    }
+    link_up = true;
+    link_connects++;
+    return true;
+}
+
+bool LinkManager::ensureSocket()
+{
+    if (sock_open && sock.is_connected())
+        return true;
+
+    closeSocket();
+    if (backoff_ms && backoff_timer.read_ms() < backoff_ms)
+        return false;
+    if (sock.connect(host, port) != 0) {
+        linkFailed();
+        logError("connecting to %s:%d failed, retry in %d ms", host, port, backoff_ms);
+        return false;
+    }
+    sock.set_blocking(false, socket_timeout_ms);
+    sock_open = true;
+    server_close = false;
+    socket_connects++;
+    return true;
+}
+
+HTTPResult LinkManager::post(const char* path, HTTPBodyOut& body, char* response, size_t response_len)
+{
+    if (response_len)
+        response[0] = '\0';
+    response_code = 0;
+
+    if (! ensureLink())
+        return HTTP_CONN;
+    // a kept-alive socket may have been closed by the server since the last request,
+    // in that case the send fails or the socket closes unanswered and the request is retried once
+    // on a new socket
+    bool reused = sock_open;
+    if (! ensureSocket())
+        return HTTP_CONN;
+
+    Timer post_time;
+    post_time.start();
+    idle_timer.reset();
+
+    HTTPResult ret = request(path, body, response, response_len);
+    if (retryable(ret) && reused) {
+        closeSocket();
+        if (! ensureLink() || ! ensureSocket())
+            return HTTP_CONN;
+        ret = request(path, body, response, response_len);
+    }
+    if (transportFailed(ret)) {
+        linkFailed();
+    } else {
+        // the server answered (a 4xx/5xx status too), the link works and the socket stays usable
+        backoff_ms = 0;
+        if (ret == HTTP_PRTCL || server_close)
+            closeSocket();
+    }
+
+    posts++;
+    last_post_ms = post_time.read_ms();
+    return ret;
+}
+
+HTTPResult LinkManager::request(const char* path, HTTPBodyOut& body, char* response, size_t response_len)
+{
+    char line[160];
+    char type[40];
+    int n;
+
+    body.readReset();
+    body.getDataType(type, sizeof(type));
+
+    n = snprintf(line, sizeof(line), "POST %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\nContent-Type: %s\r\n",
+                 path, host, type);
+    if (! sendAll(line, n))
+        return HTTP_CONN;
+    if (body.getIsChunked())
+        n = snprintf(line, sizeof(line), "Transfer-Encoding: chunked\r\n");
+    else
+        n = snprintf(line, sizeof(line), "Content-Length: %u\r\n", (unsigned) body.getDataLen());
+    if (! sendAll(line, n) || ! sendAll(header, strlen(header)) || ! sendAll("\r\n", 2))
+        return HTTP_CONN;
+    if (! sendBody(body))
+        return HTTP_CONN;
+
+    return readResponse(response, response_len);
+}
+
+bool LinkManager::sendAll(const char* data, int len)
+{
+    while (len > 0) {
+        int n = sock.send_all((char*) data, len);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool LinkManager::sendBody(HTTPBodyOut& body)
+{
+    char chunk[128];
+    char size_line[8];
+    bool chunked = body.getIsChunked();
+
+    // like HTTPClient, the body only hands out data and the chunk framing is added here
+    while (true) {
+        size_t n = 0;
+        if (body.read(chunk, sizeof(chunk), &n) != HTTP_OK)
+            return false;
+        if (n == 0)
+            return chunked ? sendAll("0\r\n\r\n", 5) : true;
+        if (chunked && ! sendAll(size_line, snprintf(size_line, sizeof(size_line), "%X\r\n", (unsigned) n)))
+            return false;
+        if (! sendAll(chunk, n))
+            return false;
+        if (chunked && ! sendAll("\r\n", 2))
+            return false;
+    }
+}
+
+// buffered single byte reader, -1 on timeout or closed socket
+int LinkManager::readByte()
+{
+    if (rx_pos == rx_len) {
+        int n = sock.receive(rx_buf, sizeof(rx_buf));
+        if (n <= 0)
+            return -1;
+        rx_len = n;
+        rx_pos = 0;
+    }
+    return (unsigned char) rx_buf[rx_pos++];
+}
+
+// reads one CRLF terminated line without the terminator, -1 on error
+int LinkManager::readLine(char* line, int max_len)
+{
+    int len = 0;
+    while (true) {
+        int c = readByte();
+        if (c < 0)
+            return -1;
+        if (c == '\n')
+            break;
+        if (c != '\r' && len < max_len - 1)
+            line[len++] = c;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+HTTPResult LinkManager::readResponse(char* response, size_t response_len)
+{
+    char line[96];
+    int content_len;
+    bool chunked;
+    size_t stored = 0;
+
+    // no byte of the status line: closed unanswered, or still waiting for it
+    if (readByte() < 0)
+        return sock.is_connected() ? HTTP_TIMEOUT : HTTP_CLOSED;
+    rx_pos--;
+
+    // an interim 1xx response (100 Continue) is only a status line and headers, the final one follows
+    do {
+        if (readLine(line, sizeof(line)) < 0)
+            return HTTP_TIMEOUT;
+        if (sscanf(line, "HTTP/%*d.%*d %d", &response_code) != 1)
+            return HTTP_PRTCL;
+
+        // headers
+        content_len = -1;
+        chunked = false;
+        while (true) {
+            int n = readLine(line, sizeof(line));
+            if (n < 0)
+                return HTTP_TIMEOUT;
+            if (n == 0)
+                break;
+            if (strncasecmp(line, "Content-Length:", 15) == 0)
+                content_len = atoi(line + 15);
+            else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line + 18, "chunked"))
+                chunked = true;
+            else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close"))
+                server_close = true;
+        }
+    } while (response_code >= 100 && response_code < 200);
+
+    // 204 No Content and 304 Not Modified end with the headers, they are not read until the close
+    if (response_code == 204 || response_code == 304) {
+        content_len = 0;
+        chunked = false;
+    }
+
+    // body, whatever does not fit in the response buffer is read and dropped
+    while (true) {
+        int remaining;
+        if (chunked) {
+            if (readLine(line, sizeof(line)) < 0)
+                return HTTP_TIMEOUT;
+            remaining = strtol(line, NULL, 16);
+            if (remaining == 0) {
+                readLine(line, sizeof(line));       // trailing CRLF
+                break;
+            }
+        } else if (content_len >= 0) {
+            remaining = content_len;
+        } else {
+            remaining = -1;                         // until the server closes
+            server_close = true;
+        }
+
+        while (remaining != 0) {
+            int c = readByte();
+            if (c < 0) {
+                if (remaining < 0)
+                    break;
+                return HTTP_TIMEOUT;
+            }
+            if (stored + 1 < response_len)
+                response[stored++] = c;
+            if (remaining > 0)
+                remaining--;
+        }
+        if (! chunked)
+            break;
+        readLine(line, sizeof(line));               // CRLF after the chunk data
+    }
+    if (response_len)
+        response[stored] = '\0';
+
+    return (response_code >= 200 && response_code < 300) ? HTTP_OK : HTTP_ERROR;
+}
@@ -0,0 +1,135 @@
+/****************************************************************************************************
+ * link_manager.h
+ *
+ * Keeps the cellular data session and one HTTP/1.1 keep-alive connection up between posts.
+ *
+ * The old Web block did connect -> post -> disconnect every post_interval_ms, paying the data
+ * session set-up and a TCP handshake for ~100 bytes of JSON.  LinkManager brings the link up on
+ * the first post, reuses the same socket for every following request, notices a dropped link or
+ * socket and reconnects with exponential backoff, and only tears everything down after the link
+ * has been idle for idle_timeout_ms.
+ ****************************************************************************************************/
+#ifndef LINK_MANAGER_H
+#define LINK_MANAGER_H
+
+#include "mbed.h"
+#include "mtsas.h"
+
+// Request body for LinkManager::post().
+// Same contract as HTTPClient's IHTTPDataOut, with the methods made public so the link manager
+// can drive the body over its own socket.  Every HTTPBodyOut can still be handed to HTTPClient.
+class HTTPBodyOut : public IHTTPDataOut
+{
+public:
+    virtual void readReset() = 0;
+    virtual int read(char* buf, size_t len, size_t* pReadLen) = 0;
+    virtual int getDataType(char* type, size_t maxTypeLen) = 0;
+    virtual bool getIsChunked() = 0;
+    virtual size_t getDataLen() = 0;
+};
+
+// Body made of an already serialized document (JSON text or binary telemetry frames)
+class BufferBodyOut : public HTTPBodyOut
+{
+public:
+    BufferBodyOut(const void* data, size_t len, const char* type = "application/json");
+
+    virtual void readReset();
+    virtual int read(char* buf, size_t len, size_t* pReadLen);
+    virtual int getDataType(char* type, size_t maxTypeLen);
+    virtual bool getIsChunked();
+    virtual size_t getDataLen();
+
+private:
+    const char* data;
+    size_t      data_len;
+    const char* type;
+    size_t      pos;
+};
+
+// What a journal upload needs from a link (journal_uplink.h), LinkManager and CoapLink post alike
+class PostLink
+{
+public:
+    virtual HTTPResult post(const char* path, HTTPBodyOut& body, char* response, size_t response_len) = 0;
+    virtual int getHTTPResponseCode() = 0;
+
+protected:
+    virtual ~PostLink() {}
+};
+
+class LinkManager : public PostLink
+{
+public:
+    LinkManager(Cellular* radio, const char* host, int port = 80);
+
+    // extra request header lines, each terminated by "\r\n" (e.g. the X-M2X-KEY header)
+    void setHeader(const char* header);
+
+    // tear the link down after this long without a request, 0 keeps it up forever
+    void setIdleTimeout(int ms);
+
+    // reconnect delay starts at min_ms and doubles after each failure up to max_ms
+    void setBackoff(int min_ms, int max_ms);
+
+    // POST body to path on the configured host over the kept-alive connection.
+    // response receives the (truncated, NUL terminated) response body.  HTTP_TIMEOUT means the
+    // request went out but no complete answer came back: the server may have taken it.
+    HTTPResult post(const char* path, HTTPBodyOut& body, char* response, size_t response_len);
+
+    int getHTTPResponseCode();
+
+    // call periodically from the network thread, handles the idle tear-down
+    void poll();
+
+    // close the socket (e.g. so the radio can take AT commands) but keep the data session
+    void closeSocket();
+
+    // close the socket and the data session
+    void shutdown();
+
+    bool isLinkUp();
+
+    // statistics
+    int         link_connects;      // data session bring-ups
+    int         socket_connects;    // TCP connects
+    int         posts;              // requests sent
+    int         last_post_ms;       // duration of the last request
+
+private:
+    bool ensureLink();
+    bool ensureSocket();
+    void linkFailed();
+    static bool transportFailed(HTTPResult ret);
+    static bool retryable(HTTPResult ret);
+    HTTPResult request(const char* path, HTTPBodyOut& body, char* response, size_t response_len);
+    bool sendAll(const char* data, int len);
+    bool sendBody(HTTPBodyOut& body);
+    int readByte();
+    int readLine(char* line, int max_len);
+    HTTPResult readResponse(char* response, size_t response_len);
+
+    Cellular*           radio;
+    const char*         host;
+    int                 port;
+    const char*         header;
+
+    TCPSocketConnection sock;
+    bool                sock_open;
+    bool                link_up;
+    bool                server_close;       // server answered "Connection: close"
+    int                 response_code;
+
+    int                 idle_timeout_ms;
+    Timer               idle_timer;         // time since the last request
+    int                 backoff_min_ms;
+    int                 backoff_max_ms;
+    int                 backoff_ms;         // current reconnect delay, 0 when not backing off
+    Timer               backoff_timer;      // time since the last failed attempt
+
+    char                rx_buf[128];
+    int                 rx_len;
+    int                 rx_pos;
+};
+
+#endif
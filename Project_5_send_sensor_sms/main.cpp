@@ -61,15 +61,35 @@ Additional Resources:
 
 
 #include "mbed.h"
+#include "rtos.h"
 #include "mtsas.h"
-#include "MbedJSONValue.h"
-#include "HTTPJson.h"
+#include "sensor_sample.h"
+#include "sample_queue.h"
+#include "link_manager.h"
+#include "mqtt_link.h"
+#include "coap_link.h"
+#include "cmux.h"
+#include "at_engine.h"
+#include "sms_receiver.h"
+#include "journal_body.h"
+#include "journal_uplink.h"
+#include "sample_clock.h"
+#include "sample_journal.h"
+#include "telemetry_codec.h"
+#include "ts_compress.h"
+#include "event_scheduler.h"
+#include "rtos_idle.h"
+#include "sensor_sampler.h"
+#include "heap_arena.h"
+#include <new>
 #include <string>
+#include <time.h>
 
 // Debug serial port
 static Serial debug(USBTX, USBRX);
 
-// MTSSerialFlowControl - serial link between processor and radio
+// MTSSerialFlowControl - serial link between processor and radio, constructed in init_mtsas()
+static uint64_t io_storage[(sizeof(MTSSerialFlowControl) + 7) / 8];
 static MTSSerialFlowControl* io;
 
 // Cellular - radio object for cellular operations (SMS, TCP, etc)
@@ -97,7 +117,21 @@ static const std::string m2x_api_key = "";
 //bool do_cloud_post = false;
 bool do_cloud_post = true;
 
-std::string url = "http://api-m2x.att.com/v2/devices/" + m2x_device_id + "/update";
+static const char m2x_host[] = "api-m2x.att.com";
+std::string url = "/v2/devices/" + m2x_device_id + "/update";
+std::string batch_url = "/v2/devices/" + m2x_device_id + "/updates";
+
+// MQTT broker for MqttTransport (M2X took the API key as user name), one topic per device
+static const char mqtt_host[] = "api-m2x.att.com";
+static const int mqtt_port = 1883;
+static const int mqtt_keep_alive_s = 60;
+std::string mqtt_topic = "dragonfly/" + m2x_device_id + "/telemetry";
+
+// CoAP endpoint for CoapTransport, same paths as the HTTP API, the key goes in a Uri-Query
+static const char coap_host[] = "api-m2x.att.com";
+static const int coap_port = 5683;
+static const int coap_block_size = 256;
+std::string coap_query = "key=" + m2x_api_key;
 
 
 // variables for sensor data
@@ -112,176 +146,139 @@ int32_t gyro_mdps[3];
 // misc variables
 static char wall_of_dash[] = "--------------------------------------------------";
 bool radio_ok = false;
-static int thpm_interval_ms = 5000;
-static int motion_interval_ms = 5000;
 static int print_interval_ms = 5000;
 static int sms_interval_ms = 30000;
 static int post_interval_ms = 10000;
+static int link_idle_timeout_ms = 60000;       // data session is torn down after this long without a post
+static int heap_report_interval_ms = 600000;
 int debug_baud = 115200;
 
-
-
-
 /****************************************************************************************************
 
  ****************************************************************************************************/
 
-//Macros for checking each of the different Sensor Devices
-#define AnalogTemp  //BDE0600
-#define AnalogUV    //ML8511
-#define HallSensor  //BU52011
-#define RPR0521     //RPR0521
-#define KMX62       //KMX61, Accel/Mag         
-#define COLOR       //BH1745
-#define KX022       //KX022, Accel Only
-#define Pressure    //BM1383
+// the sensors are chosen in sensor_sampler.h
 //#define SMS         //allow SMS messaging
 #define Web         //allow M2X communication
-
-
-//Define Pins for I2C Interface
-I2C i2c(I2C_SDA, I2C_SCL);
-bool        RepStart = true;
-bool        NoRepStart = false;
-
-//Define Sensor Variables
-#ifdef AnalogTemp
-AnalogIn    BDE0600_Temp(PC_4); //Mapped to A2
-uint16_t    BDE0600_Temp_value;
-float       BDE0600_output;
-#endif
-
-#ifdef AnalogUV
-AnalogIn    ML8511_UV(PC_1);    //Mapped to A4
-uint16_t    ML8511_UV_value;
-float       ML8511_output;
-#endif
-
-#ifdef HallSensor
-DigitalIn   Hall_GPIO0(PC_8);
-DigitalIn   Hall_GPIO1(PB_5);
-int         Hall_Return1;
-int         Hall_Return0;
-int32_t     Hall_Return[2];
-#endif
-
-#ifdef RPR0521
-int         RPR0521_addr_w = 0x70;          //7bit addr = 0x38, with write bit 0
-int         RPR0521_addr_r = 0x71;          //7bit addr = 0x38, with read bit 1
-char        RPR0521_ModeControl[2] = {0x41, 0xE6};
-char        RPR0521_ALSPSControl[2] = {0x42, 0x03};
-char        RPR0521_Persist[2] = {0x43, 0x20};
-char        RPR0521_Addr_ReadData = 0x44;
-char        RPR0521_Content_ReadData[6];
-int         RPR0521_PS_RAWOUT = 0;                  //this is an output
-float       RPR0521_PS_OUT = 0;
-int         RPR0521_ALS_D0_RAWOUT = 0;
-int         RPR0521_ALS_D1_RAWOUT = 0;
-float       RPR0521_ALS_DataRatio = 0;
-float       RPR0521_ALS_OUT = 0;                    //this is an output
-float       RPR0521_ALS[2];                         // is this ok taking an int to the [0] value and float to [1]???????????
-#endif
-
-#ifdef KMX62
-int         KMX62_addr_w = 0x1C;          //7bit addr = 0x38, with write bit 0
-int         KMX62_addr_r = 0x1D;          //7bit addr = 0x38, with read bit 1
-char        KMX62_CNTL2[2] = {0x3A, 0x5F};
-char        KMX62_Addr_Accel_ReadData = 0x0A;
-char        KMX62_Content_Accel_ReadData[6];
-char        KMX62_Addr_Mag_ReadData = 0x10;
-char        KMX62_Content_Mag_ReadData[6];
-short int   MEMS_Accel_Xout = 0;
-short int   MEMS_Accel_Yout = 0;
-short int   MEMS_Accel_Zout = 0;
-double      MEMS_Accel_Conv_Xout = 0;
-double      MEMS_Accel_Conv_Yout = 0;
-double      MEMS_Accel_Conv_Zout = 0;
-
-short int   MEMS_Mag_Xout = 0;
-short int   MEMS_Mag_Yout = 0;
-short int   MEMS_Mag_Zout = 0;
-float       MEMS_Mag_Conv_Xout = 0;
-float       MEMS_Mag_Conv_Yout = 0;
-float       MEMS_Mag_Conv_Zout = 0;
-
-double      MEMS_Accel[3];
-float       MEMS_Mag[3];
-#endif
-
-#ifdef COLOR
-int         BH1745_addr_w = 0x72;   //write
-int         BH1745_addr_r = 0x73;   //read
-char        BH1745_persistence[2] = {0x61, 0x03};
-char        BH1745_mode1[2] = {0x41, 0x00};
-char        BH1745_mode2[2] = {0x42, 0x92};
-char        BH1745_mode3[2] = {0x43, 0x02};
-char        BH1745_Content_ReadData[6];
-char        BH1745_Addr_color_ReadData = 0x50;
-int         BH1745_Red;
-int         BH1745_Blue;
-int         BH1745_Green;
-int32_t     BH1745[3];  //Red, Blue Green matrix
-#endif
-
-#ifdef KX022
-int         KX022_addr_w = 0x3C;   //write
-int         KX022_addr_r = 0x3D;   //read
-char        KX022_Accel_CNTL1[2] = {0x18, 0x41};
-char        KX022_Accel_ODCNTL[2] = {0x1B, 0x02};
-char        KX022_Accel_CNTL3[2] = {0x1A, 0xD8};
-char        KX022_Accel_TILT_TIMER[2] = {0x22, 0x01};
-char        KX022_Accel_CNTL2[2] = {0x18, 0xC1};
-char        KX022_Content_ReadData[6];
-char        KX022_Addr_Accel_ReadData = 0x06;
-float       KX022_Accel_X;
-float       KX022_Accel_Y;
-float       KX022_Accel_Z;
-short int   KX022_Accel_X_RawOUT = 0;
-short int   KX022_Accel_Y_RawOUT = 0;
-short int   KX022_Accel_Z_RawOUT = 0;
-int         KX022_Accel_X_LB = 0;
-int         KX022_Accel_X_HB = 0;
-int         KX022_Accel_Y_LB = 0;
-int         KX022_Accel_Y_HB = 0;
-int         KX022_Accel_Z_LB = 0;
-int         KX022_Accel_Z_HB = 0;
-float       KX022_Accel[3];
+#define BinaryTelemetry //post/SMS compact binary frames (telemetry_codec.h) instead of M2X JSON
+#define CompressedBatches //post journal batches delta/XOR compressed (ts_compress.h), needs BinaryTelemetry
+//#define MqttTransport //publish journal batches over MQTT QoS 1 (mqtt_link.h) instead of HTTP posts, needs BinaryTelemetry
+//#define CoapTransport //post over CoAP/UDP (coap_link.h) instead of HTTP, needs BinaryTelemetry
+//#define CmuxChannels //multiplex the radio UART (cmux.h): SMS, clock sync and signal checks no longer close the upload socket
+//#define CmuxDebugBridge //AT commands typed on the debug port go to the radio on a third CMUX channel, needs CmuxChannels
+
+// sampling/network thread split
+// The main thread only samples; all radio work (SMS, PPP, HTTP) runs in network_thread so a
+// slow cellular link can never stall the sensor timers.
+#define SAMPLE_READY_SIGNAL     0x01
+static const int network_stack_size = 4096;
+static const int network_poll_ms = 100;                     // wake-up period when no samples arrive
+static SampleQueue<SensorSample, 16> sample_queue;          // sampling thread -> network thread
+static uint32_t network_stack[network_stack_size / sizeof(uint32_t)];
+static uint64_t network_thread_storage[(sizeof(Thread) + 7) / 8];
+static Thread* network_thread;
+
+// store-and-forward journal, owned by the network thread
+// Every sample is journaled and uploaded in batches with its own timestamp; samples stay in the
+// journal until the server accepted them.  Build with JOURNAL_SPI_FLASH defined as a project
+// macro (sample_journal.cpp needs it too) to spill to the Dragonfly SPI flash through the
+// SpiFlash25 library instead of dropping samples when the RAM ring is full.
+static const int upload_batch_samples = 16;                 // samples per batch (MQTT message, TSC block)
+static const int upload_batches_per_post = 4;               // batch posts per post_interval_ms
+static const int clock_sync_interval_ms = 60000;            // retry period until the clock is set
+#ifdef JOURNAL_SPI_FLASH
+static const uint32_t journal_flash_base = 0;
+static const uint32_t journal_flash_size = 256 * 1024;
+static SpiFlash25 spi_flash(SPI3_MOSI, SPI3_MISO, SPI3_SCK, SPI3_CS);
+static SpiFlashJournal journal_flash(spi_flash);
+static FlashSegment journal_segment(journal_flash, journal_flash_base, journal_flash_size);
+static SampleJournal journal(&journal_segment);
+#else
+static SampleJournal journal;
+#endif
+static SensorSample upload_batch[upload_batch_samples];
+static uint8_t upload_frames[upload_batch_samples * TELEMETRY_MAX_FRAME];
+static const char telemetry_content_type[] = "application/x-dragonfly-telemetry";
+static uint32_t mqtt_sent_position;                         // journal position up to which batches are in flight
+
+// M2X streams uploaded from each sample, a value is only sent if its sensor was read
+static float stream_temp_c (const SensorSample& sample) { return sample.temp_c; }
+static float stream_uv (const SensorSample& sample) { return sample.uv; }
+static float stream_amb_light (const SensorSample& sample) { return sample.ambient_light; }
+static float stream_prox (const SensorSample& sample) { return sample.proximity; }
+static const UploadStream upload_streams[] = {
+    { "temp_c",     SAMPLE_TEMP,    stream_temp_c },
+    { "uv",         SAMPLE_UV,      stream_uv },
+    { "amb_light",  SAMPLE_LIGHT,   stream_amb_light },
+    { "prox",       SAMPLE_LIGHT,   stream_prox },
+};
+
+// Batch posts stream the journal through upload_batch and upload_frames instead of building the
+// body first, so their size is bounded by the link and not by free heap (journal_body.h).
+// A CoAP body is still held whole by CoapLink (COAP_MAX_BODY).
+#ifdef CoapTransport
+static const int upload_post_samples = upload_batch_samples;
+#else
+static const int upload_post_samples = 256;
+#endif
+#if defined(BinaryTelemetry) && defined(CompressedBatches)
+static JournalBodyOut upload_body(journal, JOURNAL_BODY_TSC, upload_batch, upload_batch_samples,
+                                  upload_frames, sizeof(upload_frames));
+#elif defined(BinaryTelemetry)
+static JournalBodyOut upload_body(journal, JOURNAL_BODY_FRAMES, upload_batch, upload_batch_samples,
+                                  upload_frames, sizeof(upload_frames));
+#else
+static JournalBodyOut upload_body(journal, JOURNAL_BODY_JSON, upload_batch, upload_batch_samples,
+                                  upload_frames, sizeof(upload_frames),
+                                  upload_streams, sizeof(upload_streams) / sizeof(upload_streams[0]));
+#endif
+static JournalUplink uplink(journal, upload_body, batch_url.c_str(), upload_post_samples, upload_batches_per_post);
+
+
+#ifdef CoapTransport
+typedef CoapLink UplinkLink;
+#else
+typedef LinkManager UplinkLink;
+#endif
+
+#ifdef CmuxChannels
+// DLCI 1: data sessions and sockets, DLCI 2: control AT commands, DLCI 3: debug port bridge
+static Cmux cmux;
+#ifdef CmuxDebugBridge
+static const int cmux_channels = 3;
+#else
+static const int cmux_channels = 2;
+#endif
+static int signal_check_interval_ms = 60000;
+static int sms_timeout_ms = 30000;
+// queued AT commands on DLCI 2, owned by the network thread
+static uint64_t control_at_storage[(sizeof(AtEngine) + 7) / 8];
+static AtEngine* control_at;
+// received SMS, read and deleted as the radio announces them
+static uint64_t sms_receiver_storage[(sizeof(SmsReceiver) + 7) / 8];
+static SmsReceiver* sms_receiver;
 #endif
 
-#ifdef Pressure
-int         Press_addr_w = 0xBA;   //write
-int         Press_addr_r = 0xBB;   //read
-char        PWR_DOWN[2] = {0x12, 0x01};
-char        SLEEP[2] = {0x13, 0x01};
-char        Mode_Control[2] = {0x14, 0xC4};
-char        Press_Content_ReadData[6];
-char        Press_Addr_ReadData =0x1A;
-int         BM1383_Temp_highByte;
-int         BM1383_Temp_lowByte;
-int         BM1383_Pres_highByte;
-int         BM1383_Pres_lowByte;
-int         BM1383_Pres_leastByte;
-short int   BM1383_Temp_Out;
-float       BM1383_Temp_Conv_Out;
-float       BM1383_Pres_Conv_Out;
-float_t       BM1383[2];   // Temp is 0 and Pressure is 1
-float       BM1383_Var;
-float       BM1383_Deci;
-#endif
 
 /****************************************************************************************************
 // function prototypes
  ****************************************************************************************************/
 bool init_mtsas();
-void ReadAnalogTemp();
-void ReadAnalogUV ();
-void ReadHallSensor ();
-void ReadCOLOR ();
-void ReadRPR0521_ALS ();
-void ReadKMX62_Accel ();
-void ReadKMX62_Mag ();
-void ReadPressure ();
-void ReadKX022();
+void PrintSensorData (void* arg);
+void HeapReport (void* arg);
+void network_task (void const* argument);
+bool sync_clock_from_radio ();
+bool set_clock_from_cclk (const char* reply);
+#ifdef CmuxChannels
+void control_start ();
+void on_cclk (const char* line, int len, void* arg);
+void on_csq (const char* line, int len, void* arg);
+void on_sms_sent (AtResult result, int error, void* arg);
+#endif
+void post_latest (UplinkLink& link, const SensorSample& latest);
+void publish_journal (MqttLink& mqtt, bool partial);
+void publish_latest (MqttLink& mqtt, const SensorSample& latest);
+
 
 /****************************************************************************************************
 // main
@@ -291,42 +288,14 @@ int main()
     mts::MTSLog::setLogLevel(mts::MTSLog::TRACE_LEVEL);
     debug.baud(debug_baud);
     logInfo("starting...");
+    heap_enter(HEAP_STARTUP);
 
 
     /****************************************************************************************************
           Initialize I2C Devices ************
      ****************************************************************************************************/
 
-#ifdef RPR0521
-    i2c.write(RPR0521_addr_w, &RPR0521_ModeControl[0], 2, false);
-    i2c.write(RPR0521_addr_w, &RPR0521_ALSPSControl[0], 2, false);
-    i2c.write(RPR0521_addr_w, &RPR0521_Persist[0], 2, false);
-#endif
-
-#ifdef KMX62
-    i2c.write(KMX62_addr_w, &KMX62_CNTL2[0], 2, false);
-#endif
-
-#ifdef COLOR
-    i2c.write(BH1745_addr_w, &BH1745_persistence[0], 2, false);
-    i2c.write(BH1745_addr_w, &BH1745_mode1[0], 2, false);
-    i2c.write(BH1745_addr_w, &BH1745_mode2[0], 2, false);
-    i2c.write(BH1745_addr_w, &BH1745_mode3[0], 2, false);
-#endif
-
-#ifdef KX022
-    i2c.write(KX022_addr_w, &KX022_Accel_CNTL1[0], 2, false);
-    i2c.write(KX022_addr_w, &KX022_Accel_ODCNTL[0], 2, false);
-    i2c.write(KX022_addr_w, &KX022_Accel_CNTL3[0], 2, false);
-    i2c.write(KX022_addr_w, &KX022_Accel_TILT_TIMER[0], 2, false);
-    i2c.write(KX022_addr_w, &KX022_Accel_CNTL2[0], 2, false);
-#endif
-
-#ifdef Pressure
-    i2c.write(Press_addr_w, &PWR_DOWN[0], 2, false);
-    i2c.write(Press_addr_w, &SLEEP[0], 2, false);
-    i2c.write(Press_addr_w, &Mode_Control[0], 2, false);
-#endif
+    sampler_init();
 //End I2C Initialization Section **********************************************************
 
 
@@ -343,13 +312,64 @@ int main()
 //    button.fall(&button_irq);
 
 
-    Timer thpm_timer;
-    thpm_timer.start();         // Timer data is set in the Variable seciton see misc variables    Timer motion_timer;
-    Timer print_timer;
-    print_timer.start();
-    Timer motion_timer;
-    motion_timer.start();
+    EventScheduler scheduler;
+    sampler_start(scheduler);
+    scheduler.add("print", PrintSensorData, &scheduler, print_interval_ms);
+    scheduler.add("heap", HeapReport, NULL, heap_report_interval_ms);
+
+    // radio work is only started when the radio came up; sampling runs regardless
+    if (radio_ok)
+        network_thread = new (network_thread_storage) Thread(network_task, NULL, osPriorityBelowNormal,
+                                                             network_stack_size, (unsigned char*) network_stack);
+    heap_enter(HEAP_SAMPLING);
+
+    // the MCU sleeps whenever both threads are waiting
+    rtos_attach_idle_hook(scheduler_idle_sleep);
+
+    while (true) {
+        scheduler.waitNext();
+        scheduler.runDue();
+
+        SensorSample sample;
+        if (sampler_collect(sample)) {
+            sample_queue.push(sample);
+            if (network_thread)
+                network_thread->signal_set(SAMPLE_READY_SIGNAL);
+        }
+    }
+}
+
+// scheduler job: sensor values, queue and schedule statistics to the debug port
+void PrintSensorData (void* arg)
+{
+    EventScheduler* scheduler = (EventScheduler*) arg;
+
+    logDebug("%s", wall_of_dash);
+    sampler_print(print_interval_ms);
+    logDebug("sample queue: queued %lu, dropped %lu", sample_queue.count(), sample_queue.overflows());
+    for (int i = 0; i < scheduler->jobCount(); i++) {
+        SchedulerStats stats = scheduler->stats(i);
+        logDebug("job %-8s every %lu ms: runs %lu, missed %lu, max late %lu us, max run %lu us", stats.name,
+                 stats.period_ms, stats.runs, stats.misses, stats.late_max_us, stats.run_max_us);
+    }
+    logDebug("%s", wall_of_dash);
+}
+
+// scheduler job: arena use per subsystem to the debug port, also on an 'h' typed there
+void HeapReport (void* arg)
+{
+    heap_report();
+}
+
+// network thread
+// Drains the sample queue into the journal and does all the radio work.  The SMS still carries
+// the newest sample only.
+void network_task (void const* argument)
+{
+    SensorSample latest;
+    bool have_sample = false;
 
+    heap_enter(HEAP_TRANSPORT);
 #ifdef SMS
     Timer sms_timer;
     sms_timer.start();
@@ -358,64 +378,87 @@ int main()
     Timer post_timer;
     post_timer.start();
 #endif
-    
-    while (true) {
-        if (thpm_timer.read_ms() > thpm_interval_ms) {
-#ifdef AnalogTemp
-            ReadAnalogTemp ();
+#ifdef CoapTransport
+    // the data session stays up between posts, batches go out block-wise in one round trip
+    CoapLink link(radio, coap_host, coap_port);
+    link.setQuery(coap_query.c_str());
+    link.setBlockSize(coap_block_size);
+    link.setAckBitmap(true);
+#else
+    // the data session and the HTTP connection stay up between posts
+    std::string m2x_header = "X-M2X-KEY: " + m2x_api_key + "\r\n";
+    LinkManager link(radio, m2x_host);
+    link.setHeader(m2x_header.c_str());
+#endif
+    link.setIdleTimeout(link_idle_timeout_ms);
+#ifdef MqttTransport
+    // one broker session for the life of the program, batches go out as soon as they are full
+    MqttLink mqtt(radio, mqtt_host, mqtt_port);
+    mqtt.setClient(m2x_device_id.c_str(), m2x_api_key.c_str(), "");
+    mqtt.setKeepAlive(mqtt_keep_alive_s);
+    mqtt_sent_position = journal.position();
+#endif
+
+#ifdef JOURNAL_SPI_FLASH
+    logInfo("journal: %d samples pending in flash", journal_segment.mount());
+#endif
+    Timer clock_sync_timer;
+    clock_sync_timer.start();
+#ifdef CmuxChannels
+    Timer signal_timer;
+    signal_timer.start();
+    control_start();
+#else
+    if (sync_clock_from_radio())
+        logInfo("clock set from network time");
 #endif
 
-#ifdef AnalogUV
-            ReadAnalogUV ();
-#endif
-
-#ifdef HallSensor
-            ReadHallSensor ();
+    while (true) {
+        Thread::signal_wait(SAMPLE_READY_SIGNAL, network_poll_ms);
+#ifdef CmuxChannels
+        control_at->poll();
+        sms_receiver->poll();
 #endif
 
-#ifdef COLOR
-            ReadCOLOR ();
+#ifndef CmuxDebugBridge
+        if (debug.readable() && debug.getc() == 'h')
+            heap_report();
 #endif
 
-#ifdef RPR0521       //als digital
-            ReadRPR0521_ALS ();
+        if (! clock_synced() && clock_sync_timer.read_ms() > clock_sync_interval_ms) {
+            clock_sync_timer.reset();
+#ifdef CmuxChannels
+            control_at->submit("AT+CCLK?", NULL, on_cclk);
+#else
+            link.closeSocket();         // AT commands need the radio out of socket data mode
+#ifdef MqttTransport
+            mqtt.closeSocket();
 #endif
-
-#ifdef Pressure
-            ReadPressure();
+            if (sync_clock_from_radio()) {
+                logInfo("clock set from network time");
+                uplink.clockSet();
+            }
 #endif
-            thpm_timer.reset();
         }
-
-        if (motion_timer.read_ms() > motion_interval_ms) {
-#ifdef KMX62
-            ReadKMX62_Accel ();
-            ReadKMX62_Mag ();
-#endif
-
-#ifdef KX022
-            ReadKX022 ();
-#endif
-            motion_timer.reset();
+#ifdef CmuxChannels
+        // the control channel answers while the upload socket stays open, in a later poll()
+        if (signal_timer.read_ms() > signal_check_interval_ms) {
+            signal_timer.reset();
+            control_at->submit("AT+CSQ", NULL, on_csq);
+            logInfo("radio: CMUX %lu frames in, %lu out, %lu FCS errors, AT %lu commands, %lu timeouts, %lu errors",
+                    cmux.frames_in, cmux.frames_out, cmux.fcsErrors(), control_at->commands, control_at->timeouts,
+                    control_at->errors);
         }
+#endif
 
-        if (print_timer.read_ms() > print_interval_ms) {
-            logDebug("%s", wall_of_dash);
-            logDebug("SENSOR DATA");
-            logDebug("temperature: %0.2f C", BM1383[0]);
-            logDebug("analog uv: %.1f mW/cm2", ML8511_output);
-            logDebug("ambient Light  %0.3f", RPR0521_ALS[0]);
-            logDebug("proximity count  %0.3f", RPR0521_ALS[1]);
-            logDebug("hall effect: South %d\t North %d",  Hall_Return[0],Hall_Return[1]);
-            logDebug("pressure: %0.2f hPa", BM1383[1]);
-            logDebug("magnetometer:\r\n\tx: %0.3f\ty: %0.3f\tz: %0.3f\tuT", MEMS_Mag[0], MEMS_Mag[1], MEMS_Mag[2]);
-            logDebug("accelerometer:\r\n\tx: %0.3f\ty: %0.3f\tz: %0.3f\tg", MEMS_Accel[0], MEMS_Accel[1], MEMS_Accel[2]);
-            logDebug("color:\r\n\tred: %ld\tgrn: %ld\tblu: %ld\t", BH1745[0], BH1745[1], BH1745[2]);
-            logDebug("%s", wall_of_dash);
-            print_timer.reset();
+        SensorSample sample;
+        while (sample_queue.pop(sample)) {
+            uplink.add(sample);
+            latest = sample;
+            have_sample = true;
         }
-
-
+        if (! have_sample)
+            continue;
 
 #ifdef SMS
         if (sms_timer.read_ms() > sms_interval_ms) {
@@ -423,341 +466,258 @@ int main()
             logInfo("SMS Send Routine");
 printf("  In sms routine \r\n");
             if (radio_ok) {
-                MbedJSONValue sms_json;
-                string sms_str;
-
-//                sms_json["temp_C"] = BDE0600_output;
-//                sms_json["UV"] = ML8511_output;
-                sms_json["Ambient Light"] = RPR0521_ALS[0];
-                sms_json["Prox"]      = RPR0521_ALS[1];
-//                sms_json["pressure_hPa"] = BM1383[1];
-//                sms_json["mag_mgauss"]["x"] = MEMS_Mag[0];
-//                sms_json["mag_mgauss"]["y"] = MEMS_Mag[1];
-//                sms_json["mag_mgauss"]["z"] = MEMS_Mag[2];
-//                sms_json["acc_mg"]["x"] = MEMS_Accel[0];
-//                sms_json["acc_mg"]["y"] = MEMS_Accel[1];
-//                sms_json["acc_mg"]["z"] = MEMS_Accel[2];
-//                sms_json["Red"]   = BH1745[0];
-//                sms_json["Green"] = BH1745[1];
-//                sms_json["Blue"]  = BH1745[2];
-
-                sms_str = "SENSOR DATA:\n";
-                sms_str += sms_json.serialize();
-
-                logDebug("sending SMS to %s:\r\n%s", phone_number.c_str(), sms_str.c_str());
+                HeapScope heap_scope(HEAP_SMS);
+#ifdef BinaryTelemetry
+                // one telemetry frame in base64 fits a single SMS
+                uint8_t frame[TELEMETRY_MAX_FRAME];
+                char sms_text[(TELEMETRY_MAX_FRAME + 2) / 3 * 4 + 8] = "DF1:";
+                int frame_len = telemetry_encode(latest, frame, sizeof(frame));
+                telemetry_base64_encode(frame, frame_len, sms_text + 4, sizeof(sms_text) - 4);
+#else
+                // add fields to the format to send more values, an SMS holds 160 characters
+                char sms_text[161];
+                snprintf(sms_text, sizeof(sms_text), "SENSOR DATA:\n{\"Ambient Light\":%g,\"Prox\":%g}",
+                         (double) latest.ambient_light, (double) latest.proximity);
+#endif
+                logDebug("sending SMS to %s:\r\n%s", phone_number.c_str(), sms_text);
+#ifdef CmuxChannels
+                // the engine sends the text at the "> " prompt, later: it has to outlive this block
+                static char sms_payload[sizeof(sms_text)];
+                char sms_command[32];
+                strcpy(sms_payload, sms_text);
+                snprintf(sms_command, sizeof(sms_command), "AT+CMGS=\"+%s\",145", phone_number.c_str());
+                if (! control_at->submit(sms_command, on_sms_sent, NULL, NULL, sms_timeout_ms, sms_payload))
+                    logError("sending SMS failed, AT queue full");
+#else
+                // the only copy made, sendSMS takes a std::string
+                std::string sms_str = sms_text;
+
+                link.closeSocket();         // radio has to leave socket data mode to take the SMS commands
+#ifdef MqttTransport
+                mqtt.closeSocket();
+#endif
                 Code ret = radio->sendSMS(phone_number, sms_str);
                 if (ret != MTS_SUCCESS)
                     logError("sending SMS failed");
+#endif
             }
         }
 #endif
-#ifdef Web
+#if defined(Web) && defined(MqttTransport)
+        if (do_cloud_post) {
+            // full batches are published right away, the rest once per post interval
+            bool interval = post_timer.read_ms() > post_interval_ms;
+            if (interval)
+                post_timer.reset();
+            if (clock_synced())
+                publish_journal(mqtt, interval);
+            else if (interval)
+                publish_latest(mqtt, latest);
+            mqtt.poll();
+
+            uint32_t tag;
+            while (mqtt.acked(tag)) {
+                int n = (int) (tag - journal.position());
+                if (n > 0)
+                    journal.ack(n);
+            }
+            if (interval)
+                logDebug("journal: %d pending, %lu uploaded, %lu spilled, %lu dropped, mqtt %d in flight, %d resends",
+                         journal.pending(), journal.uploaded, journal.spilled, journal.dropped, mqtt.inFlight(),
+                         mqtt.resends);
+        }
+#elif defined(Web)
         if (post_timer.read_ms() > post_interval_ms && do_cloud_post) {
     printf("in web\n\r");
-            if (radio->connect()) {
-                logDebug("posting sensor data");
-
-                HTTPClient http;
-                MbedJSONValue http_json_data;
-                std::string http_json_str;
-                std::string m2x_header = "X-M2X-KEY: " + m2x_api_key + "\r\n";
-                int ret;
-                char http_response_buf[256];
-                HTTPText http_response(http_response_buf, sizeof(http_response_buf));
-
-                // temp_c, temp_f, humidity, pressure, and moisture are all stream IDs for my device in M2X
-                // modify these to match your streams or give your streams the same name
-                http_json_data["values"]["temp_c"] = BDE0600_output;
-                http_json_data["values"]["uv"] = ML8511_output;
-                http_json_data["values"]["amb_light"] = RPR0521_ALS[0];
-                http_json_data["values"]["prox"] = RPR0521_ALS[1];
-                http_json_str = http_json_data.serialize();
-
-                // add extra header with M2X API key
-                http.setHeader(m2x_header.c_str());
-
-                HTTPJson http_json((char*)  http_json_str.c_str());
-                ret = http.post(url.c_str(), http_json, &http_response);
-                if (ret != HTTP_OK)
-                    logError("posting data to cloud failed: [%d][%s]", ret, http_response_buf);
-                else
-                    logDebug("post result [%d][%s]", http.getHTTPResponseCode(), http_response_buf);
-
-                radio->disconnect();
-            } else {
-                logError("establishing PPP link failed");
-            }
-
             post_timer.reset();
+            // batches need real timestamps, until the clock is set only the newest values are posted
+            if (clock_synced())
+                uplink.upload(link);
+            else
+                post_latest(link, latest);
+            logDebug("journal: %d pending, %lu uploaded, %lu spilled, %lu dropped, %lu refused",
+                     journal.pending(), journal.uploaded, journal.spilled, journal.dropped, uplink.rejected);
         }
+        link.poll();
 #endif
-        wait_ms(10);
     }
 }
 
-// init functions
-bool init_mtsas()
+// Single-value update with the newest sample, timestamped by the server
+void post_latest (UplinkLink& link, const SensorSample& latest)
 {
-    io = new MTSSerialFlowControl(RADIO_TX, RADIO_RX, RADIO_RTS, RADIO_CTS);
-    if (! io)
-        return false;
-
-    io->baud(115200);
-    radio = CellularFactory::create(io);
-    if (! radio)
-        return false;
-////////////////////////////////-------------------/////////////////
-//    Code ret = radio->setApn(apn);
-//    if (ret != MTS_SUCCESS)
-//        return false;
-
-//    Transport::setTransport(radio);
-
-//    return true;
+    logDebug("posting sensor data");
+
+    int ret;
+#ifndef CoapTransport
+    char http_response_buf[256];
+#endif
+
+#ifdef BinaryTelemetry
+    int frame_len = telemetry_encode(latest, upload_frames, sizeof(upload_frames));
+    BufferBodyOut http_body(upload_frames, frame_len, telemetry_content_type);
+#else
+    // temp_c, temp_f, humidity, pressure, and moisture are all stream IDs for my device in M2X
+    // modify these to match your streams or give your streams the same name
+    char* json = (char*) upload_frames;
+    int json_len = snprintf(json, sizeof(upload_frames), "{\"values\":{");
+    for (unsigned i = 0; i < sizeof(upload_streams) / sizeof(upload_streams[0]); i++)
+        json_len += snprintf(json + json_len, sizeof(upload_frames) - json_len, "%s\"%s\":%g", i ? "," : "",
+                             upload_streams[i].name, (double) upload_streams[i].value(latest));
+    json_len += snprintf(json + json_len, sizeof(upload_frames) - json_len, "}}");
+    BufferBodyOut http_body(json, json_len);
+#endif
+
+#ifdef CoapTransport
+    // a newer value follows next interval, not worth a round trip
+    ret = link.send(url.c_str(), http_body);
+    if (ret != HTTP_OK)
+        logError("sending data to cloud failed: [%d]", ret);
+#else
+    ret = link.post(url.c_str(), http_body, http_response_buf, sizeof(http_response_buf));
+    if (ret != HTTP_OK)
+        logError("posting data to cloud failed: [%d][%s]", ret, http_response_buf);
+    else
+        logDebug("post result [%d][%s] in %d ms", link.getHTTPResponseCode(), http_response_buf, link.last_post_ms);
+#endif
 }
 
-
-// Sensor data acquisition functions
-/************************************************************************************************/
-#ifdef AnalogTemp
-void ReadAnalogTemp ()
+// Publish journal batches over MQTT while the in-flight window has room.
+// Batches in flight stay in the journal and are skipped over; the network task acks them once the
+// broker's PUBACK arrived, every publish is tagged with the journal position of its last sample.
+// Unless partial is set only full batches go out, so a fast stream is not cut into small messages.
+void publish_journal (MqttLink& mqtt, bool partial)
 {
-    BDE0600_Temp_value = BDE0600_Temp.read_u16();
-
-    BDE0600_output = (float)BDE0600_Temp_value * (float)0.000050354; //(value * (3.3V/65535))
-    BDE0600_output = (BDE0600_output-(float)1.753)/((float)-0.01068) + (float)30;
-
-//    printf("BDE0600 Analog Temp Sensor Data:\r\n");
-//    printf(" Temp = %.2f C\r\n", BDE0600_output);
+    while (! mqtt.windowFull()) {
+        // samples lost at the front of a full journal may have overtaken what was sent
+        if ((int) (mqtt_sent_position - journal.position()) < 0)
+            mqtt_sent_position = journal.position();
+        int skip = mqtt_sent_position - journal.position();
+        int n = journal.peek(upload_batch, upload_batch_samples, skip);
+        if (n == 0 || (n < upload_batch_samples && ! partial))
+            return;
+
+#ifdef CompressedBatches
+        TsCompressor compressor;
+        compressor.begin(upload_frames, sizeof(upload_frames));
+        for (int j = 0; j < n && compressor.add(upload_batch[j]); j++)
+            ;
+        n = compressor.count();
+        int len = compressor.finish();
+#else
+        int len = 0;
+        for (int j = 0; j < n; j++)
+            len += telemetry_encode(upload_batch[j], upload_frames + len, sizeof(upload_frames) - len);
+#endif
+        if (! mqtt.publish(mqtt_topic.c_str(), upload_frames, len, mqtt_sent_position + n)) {
+            logError("publishing %d samples failed", n);
+            return;
+        }
+        mqtt_sent_position += n;
+    }
 }
-#endif
 
-#ifdef AnalogUV
-void ReadAnalogUV ()
+// Newest sample only, until the clock is set; tagged with the current position it acks nothing
+void publish_latest (MqttLink& mqtt, const SensorSample& latest)
 {
-    ML8511_UV_value = ML8511_UV.read_u16();
-    ML8511_output = (float)ML8511_UV_value * (float)0.000050354; //(value * (3.3V/65535))   //Note to self: when playing with this, a negative value is seen... Honestly, I think this has to do with my ADC converstion...
-    ML8511_output = (ML8511_output-(float)2.2)/((float)0.129) + 10;                           // Added +5 to the offset so when inside (aka, no UV, readings show 0)... this is the wrong approach... and the readings don't make sense... Fix this.
-
-//    printf("ML8511 Analog UV Sensor Data:\r\n");
-//    printf(" UV = %.1f mW/cm2\r\n", ML8511_output);
-
+    int frame_len = telemetry_encode(latest, upload_frames, sizeof(upload_frames));
+    if (! mqtt.publish(mqtt_topic.c_str(), upload_frames, frame_len, journal.position()))
+        logDebug("MQTT window full, newest sample not published");
 }
-#endif
-
 
-#ifdef HallSensor
-void ReadHallSensor ()
+// Set the clock from the modem's network time, +CCLK: "yy/MM/dd,hh:mm:ss+zz" (zz in quarter hours)
+bool sync_clock_from_radio ()
 {
-
-    Hall_Return[0] = Hall_GPIO0;
-    Hall_Return[1] = Hall_GPIO1;
-
-//    printf("BU52011 Hall Switch Sensor Data:\r\n");
-//    printf(" South Detect = %d\r\n", Hall_Return[0]);
-//    printf(" North Detect = %d\r\n", Hall_Return[1]);
-
-    
+    std::string reply = radio->sendCommand("AT+CCLK?", 1000);
+    size_t pos = reply.find("+CCLK:");
+    if (pos == std::string::npos)
+        return false;
+    return set_clock_from_cclk(reply.c_str() + pos);
 }
-#endif
 
-#ifdef COLOR
-void ReadCOLOR ()
+bool set_clock_from_cclk (const char* reply)
 {
-
-    //Read color data from the IC
-    i2c.write(BH1745_addr_w, &BH1745_Addr_color_ReadData, 1, RepStart);
-    i2c.read(BH1745_addr_r, &BH1745_Content_ReadData[0], 6, NoRepStart);
-
-    //separate all data read into colors
-    BH1745[0] = (BH1745_Content_ReadData[1]<<8) | (BH1745_Content_ReadData[0]);
-    BH1745[1] = (BH1745_Content_ReadData[3]<<8) | (BH1745_Content_ReadData[2]);
-    BH1745[2] = (BH1745_Content_ReadData[5]<<8) | (BH1745_Content_ReadData[4]);
-
-    //Output Data into UART
-//    printf("BH1745 COLOR Sensor Data:\r\n");
-//    printf(" Red   = %d ADC Counts\r\n",BH1745[0]);
-//    printf(" Green = %d ADC Counts\r\n",BH1745[1]);
-//    printf(" Blue  = %d ADC Counts\r\n",BH1745[2]);
-
+    int yy, MM, dd, hh, mm, ss, tz;
+    if (sscanf(reply, "+CCLK: \"%d/%d/%d,%d:%d:%d%d", &yy, &MM, &dd, &hh, &mm, &ss, &tz) != 7)
+        return false;
+    if (yy < 15)
+        return false;               // modem has not received network time yet
+    clock_set(clock_make_epoch(2000 + yy, MM, dd, hh, mm, ss) - tz * 15 * 60);
+    return true;
 }
-#endif
 
-#ifdef RPR0521       //als digital
-void ReadRPR0521_ALS ()
+#ifdef CmuxChannels
+/****************************************************************************************************
+// control channel: AT commands queued on DLCI 2, answered in the network thread's poll()
+ ****************************************************************************************************/
+void on_registration (const char* line, int len, void* arg)
 {
-    i2c.write(RPR0521_addr_w, &RPR0521_Addr_ReadData, 1, RepStart);
-    i2c.read(RPR0521_addr_r, &RPR0521_Content_ReadData[0], 6, NoRepStart);
-
-    RPR0521_ALS[1] = (RPR0521_Content_ReadData[1]<<8) | (RPR0521_Content_ReadData[0]);
-    RPR0521_ALS_D0_RAWOUT = (RPR0521_Content_ReadData[3]<<8) | (RPR0521_Content_ReadData[2]);
-    RPR0521_ALS_D1_RAWOUT = (RPR0521_Content_ReadData[5]<<8) | (RPR0521_Content_ReadData[4]);
-    RPR0521_ALS_DataRatio = (float)RPR0521_ALS_D1_RAWOUT / (float)RPR0521_ALS_D0_RAWOUT;
-
-    if(RPR0521_ALS_DataRatio < (float)0.595) {
-        RPR0521_ALS[0] = ((float)1.682*(float)RPR0521_ALS_D0_RAWOUT - (float)1.877*(float)RPR0521_ALS_D1_RAWOUT);
-    } else if(RPR0521_ALS_DataRatio < (float)1.015) {
-        RPR0521_ALS[0] = ((float)0.644*(float)RPR0521_ALS_D0_RAWOUT - (float)0.132*(float)RPR0521_ALS_D1_RAWOUT);
-    } else if(RPR0521_ALS_DataRatio < (float)1.352) {
-        RPR0521_ALS[0] = ((float)0.756*(float)RPR0521_ALS_D0_RAWOUT - (float)0.243*(float)RPR0521_ALS_D1_RAWOUT);
-    } else if(RPR0521_ALS_DataRatio < (float)3.053) {
-        RPR0521_ALS[0] = ((float)0.766*(float)RPR0521_ALS_D0_RAWOUT - (float)0.25*(float)RPR0521_ALS_D1_RAWOUT);
-    } else {
-        RPR0521_ALS[0] = 0;
-    }
-//    printf("RPR-0521 ALS/PROX Sensor Data:\r\n");
-//    printf(" ALS = %0.2f lx\r\n", RPR0521_ALS[0]);
-//    printf(" PROX= %0.2f ADC Counts\r\n", RPR0521_ALS[1]);     //defined as a float but is an unsigned.
-
+    logInfo("radio: %s", line);
 }
-#endif
 
-#ifdef KMX62
-void ReadKMX62_Accel ()
+void on_sms_received (const SmsMessage& msg, void* arg)
 {
-    //Read Accel Portion from the IC
-    i2c.write(KMX62_addr_w, &KMX62_Addr_Accel_ReadData, 1, RepStart);
-    i2c.read(KMX62_addr_r, &KMX62_Content_Accel_ReadData[0], 6, NoRepStart);
-
-    //Note: The highbyte and low byte return a 14bit value, dropping the two LSB in the Low byte.
-    //      However, because we need the signed value, we will adjust the value when converting to "g"
-    MEMS_Accel_Xout = (KMX62_Content_Accel_ReadData[1]<<8) | (KMX62_Content_Accel_ReadData[0]);
-    MEMS_Accel_Yout = (KMX62_Content_Accel_ReadData[3]<<8) | (KMX62_Content_Accel_ReadData[2]);
-    MEMS_Accel_Zout = (KMX62_Content_Accel_ReadData[5]<<8) | (KMX62_Content_Accel_ReadData[4]);
-
-    //Note: Conversion to G is as follows:
-    //      Axis_ValueInG = MEMS_Accel_axis / 1024
-    //      However, since we did not remove the LSB previously, we need to divide by 4 again
-    //      Thus, we will divide the output by 4096 (1024*4) to convert and cancel out the LSB
-    MEMS_Accel[0] = ((float)MEMS_Accel_Xout/4096/2);
-    MEMS_Accel[1] = ((float)MEMS_Accel_Yout/4096/2);
-    MEMS_Accel[2] = ((float)MEMS_Accel_Zout/4096/2);
-
-    // Return Data to UART
-//    printf("KMX62 Accel+Mag Sensor Data:\r\n");
-//    printf(" AccX= %0.2f g\r\n", MEMS_Accel[0]);
-//    printf(" AccY= %0.2f g\r\n", MEMS_Accel[1]);
-//    printf(" AccZ= %0.2f g\r\n", MEMS_Accel[2]);
-
+    logInfo("SMS from %s at %s: %s", msg.number, msg.timestamp, msg.text);
 }
 
-void ReadKMX62_Mag ()
+void control_start ()
 {
-
-    //Read Mag portion from the IC
-    i2c.write(KMX62_addr_w, &KMX62_Addr_Mag_ReadData, 1, RepStart);
-    i2c.read(KMX62_addr_r, &KMX62_Content_Mag_ReadData[0], 6, NoRepStart);
-
-    //Note: The highbyte and low byte return a 14bit value, dropping the two LSB in the Low byte.
-    //      However, because we need the signed value, we will adjust the value when converting to "g"
-    MEMS_Mag_Xout = (KMX62_Content_Mag_ReadData[1]<<8) | (KMX62_Content_Mag_ReadData[0]);
-    MEMS_Mag_Yout = (KMX62_Content_Mag_ReadData[3]<<8) | (KMX62_Content_Mag_ReadData[2]);
-    MEMS_Mag_Zout = (KMX62_Content_Mag_ReadData[5]<<8) | (KMX62_Content_Mag_ReadData[4]);
-
-    //Note: Conversion to G is as follows:
-    //      Axis_ValueInG = MEMS_Accel_axis / 1024
-    //      However, since we did not remove the LSB previously, we need to divide by 4 again
-    //      Thus, we will divide the output by 4095 (1024*4) to convert and cancel out the LSB
-    MEMS_Mag[0] = (float)MEMS_Mag_Xout/4096*(float)0.146;
-    MEMS_Mag[1] = (float)MEMS_Mag_Yout/4096*(float)0.146;
-    MEMS_Mag[2] = (float)MEMS_Mag_Zout/4096*(float)0.146;
-
-    // Return Data to UART
-//    printf(" MagX= %0.2f uT\r\n", MEMS_Mag[0]);
-//    printf(" MagY= %0.2f uT\r\n", MEMS_Mag[1]);
-//    printf(" MagZ= %0.2f uT\r\n", MEMS_Mag[2]);
-
+    // registration changes and new messages come as URCs, in between the command responses
+    control_at->onUrc("+CREG:", on_registration);
+    control_at->submit("ATE0");
+    if (! sms_receiver->start(on_sms_received))      // text mode for sending too
+        logError("SMS indications not enabled");
+    control_at->submit("AT+CREG=1");
+    control_at->submit("AT+CREG?", NULL, on_registration);
+    control_at->submit("AT+CCLK?", NULL, on_cclk);
 }
-#endif
 
-#ifdef KX022
-void ReadKX022 ()
+void on_cclk (const char* line, int len, void* arg)
 {
-    
-    //Read KX022 Portion from the IC
-    i2c.write(KX022_addr_w, &KX022_Addr_Accel_ReadData, 1, RepStart);
-    i2c.read(KX022_addr_r, &KX022_Content_ReadData[0], 6, NoRepStart);
-
-    //Format Data
-    KX022_Accel_X_RawOUT = (KX022_Content_ReadData[1]<<8) | (KX022_Content_ReadData[0]);
-    KX022_Accel_Y_RawOUT = (KX022_Content_ReadData[3]<<8) | (KX022_Content_ReadData[2]);
-    KX022_Accel_Z_RawOUT = (KX022_Content_ReadData[5]<<8) | (KX022_Content_ReadData[4]);
-
-    //Scale Data
-    KX022_Accel[0] = (float)KX022_Accel_X_RawOUT / 16384;
-    KX022_Accel[1] = (float)KX022_Accel_Y_RawOUT / 16384;
-    KX022_Accel[2] = (float)KX022_Accel_Z_RawOUT / 16384;
-
-    //Return Data through UART
-//    printf("KX022 Accelerometer Sensor Data: \r\n");
-//    printf(" AccX= %0.2f g\r\n", KX022_Accel[0]);
-//    printf(" AccY= %0.2f g\r\n", KX022_Accel[1]);
-//    printf(" AccZ= %0.2f g\r\n", KX022_Accel[2]);
-
+    if (set_clock_from_cclk(line)) {
+        logInfo("clock set from network time");
+        uplink.clockSet();
+    }
 }
-#endif
-
 
-#ifdef Pressure
-void ReadPressure ()
+void on_csq (const char* line, int len, void* arg)
 {
+    logInfo("radio: %s", line);
+}
 
-    i2c.write(Press_addr_w, &Press_Addr_ReadData, 1, RepStart);
-    i2c.read(Press_addr_r, &Press_Content_ReadData[0], 6, NoRepStart);
-
-    BM1383_Temp_Out = (Press_Content_ReadData[0]<<8) | (Press_Content_ReadData[1]);
-    BM1383[0] = (float)BM1383_Temp_Out/32;
-
-    BM1383_Var  = (Press_Content_ReadData[2]<<3) | (Press_Content_ReadData[3] >> 5);
-    BM1383_Deci = ((Press_Content_ReadData[3] & 0x1f) << 6 | ((Press_Content_ReadData[4] >> 2)));
-    BM1383_Deci = (float)BM1383_Deci* (float)0.00048828125;  //0.00048828125 = 2^-11
-    BM1383[1] = (BM1383_Var + BM1383_Deci);   //question pending here...
-
-//    printf("BM1383 Pressure Sensor Data:\r\n");
-//    printf(" Temperature= %0.2f C\r\n", BM1383[0]);
-//    printf(" Pressure   = %0.2f hPa\r\n", BM1383[1]);
-
+void on_sms_sent (AtResult result, int error, void* arg)
+{
+    if (result != AT_OK)
+        logError("sending SMS failed (%d, error %d)", result, error);
 }
 #endif
 
+// init functions
+bool init_mtsas()
+{
+    io = new (io_storage) MTSSerialFlowControl(RADIO_TX, RADIO_RX, RADIO_RTS, RADIO_CTS);
+    io->baud(115200);
+#ifdef CmuxChannels
+    if (! cmux.start(io, cmux_channels))
+        return false;
+    radio = CellularFactory::create(cmux.channel(1));
+    control_at = new (control_at_storage) AtEngine(cmux.channel(2));
+    sms_receiver = new (sms_receiver_storage) SmsReceiver(*control_at);
+#ifdef CmuxDebugBridge
+    cmux.bridge(3, &debug);
+#endif
+#else
+    radio = CellularFactory::create(io);
+#endif
+    if (! radio)
+        return false;
+////////////////////////////////-------------------/////////////////
+//    Code ret = radio->setApn(apn);
+//    if (ret != MTS_SUCCESS)
+//        return false;
 
-/************************************************************************************
-//  reference only to remember what the names and fuctions are without finding them above.
- ************************************************************************************
-    (" Temp = %.2f C\r\n", BDE0600_output);
-    printf(" UV = %.1f mW/cm2\r\n", ML8511_output);
-
-    printf("BH1745 COLOR Sensor Data:\r\n");
-    printf(" Red   = %d ADC Counts\r\n",BH1745[0]);
-    printf(" Green = %d ADC Counts\r\n",BH1745[1]);
-    printf(" Blue  = %d ADC Counts\r\n",BH1745[2]);
-
-    printf(" ALS = %0.2f lx\r\n", RPR0521_ALS[0]);
-    printf(" PROX= %u ADC Counts\r\n", RPR0521_ALS[1]);     //defined as a float but is an unsigned, bad coding on my part.
-
-    printf("KMX62 Accel+Mag Sensor Data:\r\n");
-    printf(" AccX= %0.2f g\r\n", MEMS_Accel[0]);
-    printf(" AccY= %0.2f g\r\n", MEMS_Accel[1]);
-    printf(" AccZ= %0.2f g\r\n", MEMS_Accel[2]);
-
-    printf(" MagX= %0.2f uT\r\n", MEMS_Mag[0]);
-    printf(" MagY= %0.2f uT\r\n", MEMS_Mag[1]);
-    printf(" MagZ= %0.2f uT\r\n", MEMS_Mag[2]);
-
-    printf("KX022 Accelerometer Sensor Data: \r\n");
-    printf(" AccX= %0.2f g\r\n", KX022_Accel[0]);
-    printf(" AccY= %0.2f g\r\n", KX022_Accel[1]);
-    printf(" AccZ= %0.2f g\r\n", KX022_Accel[2]);
-
-    printf("BM1383 Pressure Sensor Data:\r\n");
-    printf(" Temperature= %0.2f C\r\n", BM1383[0]);
-    printf(" Pressure   = %0.2f hPa\r\n", BM1383[1]);
-
- **********************************************************************************/
-
-
-
-
-
-
+    // Transport must be set before any TCPSocketConnection is created
+    Transport::setTransport(radio);
 
+    return true;
+}
@@ -0,0 +1,427 @@
+#include "mqtt_link.h"
+
+static const int socket_timeout_ms = 5000;
+static const int poll_timeout_ms = 1;           // how long poll() waits for an incoming packet
+static const int reply_timeout_ms = 30000;      // PUBACK or PINGRESP overdue, the connection is dead
+
+// MQTT 3.1.1 control packets, type in the upper nibble of the first byte
+#define MQTT_CONNECT            0x10
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_PUBACK             0x40
+#define MQTT_PINGREQ            0xC0
+#define MQTT_PINGRESP           0xD0
+#define MQTT_DISCONNECT         0xE0
+
+#define MQTT_PUBLISH_DUP        0x08
+#define MQTT_PUBLISH_QOS1       0x02
+#define MQTT_CONNECT_USER       0x80
+#define MQTT_CONNECT_PASSWORD   0x40
+#define MQTT_CONNECT_CLEAN      0x02
+
+// UTF-8 string: u16 length (big endian) and the bytes
+static int put_string(uint8_t* p, const char* s)
+{
+    int len = strlen(s);
+    p[0] = (uint8_t) (len >> 8);
+    p[1] = (uint8_t) len;
+    memcpy(p + 2, s, len);
+    return len + 2;
+}
+
+// remaining length: 7 bits per byte, least significant first, high bit set when more follow
+static int put_length(uint8_t* p, int len)
+{
+    int n = 0;
+    do {
+        uint8_t b = len & 0x7F;
+        len >>= 7;
+        p[n++] = len ? b | 0x80 : b;
+    } while (len);
+    return n;
+}
+
+MqttLink::MqttLink(Cellular* radio, const char* host, int port)
+    : link_connects(0), socket_connects(0), publishes(0), resends(0), acks(0), last_ack_ms(0),
+      radio(radio), host(host), port(port), client_id(""), user(""), password(""), keep_alive_s(60),
+      sock_open(false), link_up(false), connected(false), ping_pending(false),
+      backoff_min_ms(1000), backoff_max_ms(60000), backoff_ms(0),
+      window_head(0), window_count(0), next_packet_id(0), rx_len(0), rx_pos(0)
+{
+    tx_timer.start();
+    reply_timer.start();
+    backoff_timer.start();
+}
+
+void MqttLink::setClient(const char* client_id, const char* user, const char* password)
+{
+    this->client_id = client_id;
+    this->user = user;
+    this->password = password;
+}
+
+void MqttLink::setKeepAlive(int seconds)
+{
+    keep_alive_s = seconds;
+}
+
+void MqttLink::setBackoff(int min_ms, int max_ms)
+{
+    backoff_min_ms = min_ms;
+    backoff_max_ms = max_ms;
+}
+
+int MqttLink::inFlight()
+{
+    return window_count;
+}
+
+bool MqttLink::windowFull()
+{
+    return window_count == MQTT_WINDOW;
+}
+
+bool MqttLink::isConnected()
+{
+    return connected;
+}
+
+/****************************************************************************************************
+// connection
+ ****************************************************************************************************/
+void MqttLink::closeSocket()
+{
+    if (sock_open) {
+        sock.close();
+        sock_open = false;
+    }
+    connected = false;
+    rx_len = rx_pos = 0;
+}
+
+void MqttLink::shutdown()
+{
+    if (connected)
+        sendPacket(MQTT_DISCONNECT, NULL, 0);
+    closeSocket();
+    if (link_up) {
+        radio->disconnect();
+        link_up = false;
+    }
+}
+
+// a failed attempt pushes the next one out by the current backoff delay
+void MqttLink::linkFailed()
+{
+    closeSocket();
+    if (backoff_ms == 0)
+        backoff_ms = backoff_min_ms;
+    else if ((backoff_ms *= 2) > backoff_max_ms)
+        backoff_ms = backoff_max_ms;
+    backoff_timer.reset();
+}
+
+bool MqttLink::ensureLink()
+{
+    if (link_up && radio->isConnected())
+        return true;
+
+    if (link_up) {
+        logWarning("data link dropped");
+        closeSocket();
+        link_up = false;
+    }
+    if (backoff_ms && backoff_timer.read_ms() < backoff_ms)
+        return false;
+
+    if (! radio->connect()) {
+        linkFailed();
+        logError("establishing PPP link failed, retry in %d ms", backoff_ms);
+        return false;
+    }
+    link_up = true;
+    link_connects++;
+    return true;
+}
+
+bool MqttLink::ensureConnected()
+{
+    if (connected && sock.is_connected())
+        return true;
+
+    if (connected) {
+        logWarning("MQTT connection to %s lost", host);
+        closeSocket();
+    }
+    if (! ensureLink())
+        return false;
+    if (backoff_ms && backoff_timer.read_ms() < backoff_ms)
+        return false;
+
+    if (sock.connect(host, port) != 0) {
+        linkFailed();
+        logError("connecting to %s:%d failed, retry in %d ms", host, port, backoff_ms);
+        return false;
+    }
+    sock.set_blocking(false, socket_timeout_ms);
+    sock_open = true;
+    rx_len = rx_pos = 0;
+
+    uint8_t body[4];
+    int len = 0;
+    int type = sendConnect() ? readPacket(body, sizeof(body), len, socket_timeout_ms) : -1;
+    if ((type & 0xF0) != MQTT_CONNACK || len != 2 || body[1] != 0) {
+        linkFailed();
+        logError("MQTT connect to %s failed [%d], retry in %d ms", host, (type & 0xF0) == MQTT_CONNACK ? body[1] : -1,
+                 backoff_ms);
+        return false;
+    }
+    connected = true;
+    socket_connects++;
+    backoff_ms = 0;
+    ping_pending = false;
+    tx_timer.reset();
+    reply_timer.reset();
+    logInfo("MQTT connected to %s:%d, %s session", host, port, (body[0] & 1) ? "resumed" : "new");
+
+    // whatever is unacked goes again, the broker may or may not have got it
+    for (int i = 0; i < window_count; i++)
+        window[(window_head + i) % MQTT_WINDOW].sent = false;
+    return true;
+}
+
+bool MqttLink::sendConnect()
+{
+    uint8_t body[256];
+    int n;
+
+    if (10 + 6 + strlen(client_id) + strlen(user) + strlen(password) > sizeof(body)) {
+        logError("MQTT client id and credentials too long");
+        return false;
+    }
+    n = put_string(body, "MQTT");
+    body[n++] = 4;                              // protocol level 3.1.1
+    // the broker keeps the session of a named client, an empty id only gets a clean one
+    uint8_t flags = *client_id ? 0 : MQTT_CONNECT_CLEAN;
+    if (*user)
+        flags |= *password ? MQTT_CONNECT_USER | MQTT_CONNECT_PASSWORD : MQTT_CONNECT_USER;
+    body[n++] = flags;
+    body[n++] = (uint8_t) (keep_alive_s >> 8);
+    body[n++] = (uint8_t) keep_alive_s;
+    n += put_string(body + n, client_id);
+    if (*user)
+        n += put_string(body + n, user);
+    if (*user && *password)
+        n += put_string(body + n, password);
+    return sendPacket(MQTT_CONNECT, body, n);
+}
+
+/****************************************************************************************************
+// publishing
+ ****************************************************************************************************/
+bool MqttLink::publish(const char* topic, const void* payload, int len, uint32_t tag)
+{
+    if (window_count == MQTT_WINDOW || len > MQTT_MAX_PAYLOAD || strlen(topic) >= MQTT_MAX_TOPIC)
+        return false;
+
+    InFlight& msg = window[(window_head + window_count) % MQTT_WINDOW];
+    window_count++;
+    if (++next_packet_id == 0)
+        next_packet_id = 1;                     // 0 is not a valid packet id
+    msg.packet_id = next_packet_id;
+    msg.sent = msg.dup = msg.acked = false;
+    msg.tag = tag;
+    msg.len = len;
+    strcpy(msg.topic, topic);
+    memcpy(msg.payload, payload, len);
+
+    // not connected: poll() sends it once the broker session is up
+    if (connected && ! sendPublish(msg))
+        linkFailed();
+    return true;
+}
+
+bool MqttLink::acked(uint32_t& tag)
+{
+    if (window_count == 0 || ! window[window_head].acked)
+        return false;
+    tag = window[window_head].tag;
+    window_head = (window_head + 1) % MQTT_WINDOW;
+    window_count--;
+    return true;
+}
+
+bool MqttLink::awaitingReply()
+{
+    if (ping_pending)
+        return true;
+    for (int i = 0; i < window_count; i++) {
+        const InFlight& msg = window[(window_head + i) % MQTT_WINDOW];
+        if (msg.sent && ! msg.acked)
+            return true;
+    }
+    return false;
+}
+
+bool MqttLink::sendPublish(InFlight& msg)
+{
+    uint8_t head[5 + 2 + MQTT_MAX_TOPIC + 2];
+    int n;
+
+    if (! awaitingReply())
+        reply_timer.reset();
+    head[0] = MQTT_PUBLISH | MQTT_PUBLISH_QOS1 | (msg.dup ? MQTT_PUBLISH_DUP : 0);
+    n = 1 + put_length(head + 1, 2 + strlen(msg.topic) + 2 + msg.len);
+    n += put_string(head + n, msg.topic);
+    head[n++] = (uint8_t) (msg.packet_id >> 8);
+    head[n++] = (uint8_t) msg.packet_id;
+    if (! sendAll((const char*) head, n) || ! sendAll((const char*) msg.payload, msg.len))
+        return false;
+
+    if (msg.dup) {
+        resends++;
+    } else {
+        msg.age.reset();
+        msg.age.start();
+    }
+    msg.sent = msg.dup = true;
+    publishes++;
+    tx_timer.reset();
+    return true;
+}
+
+bool MqttLink::sendPacket(uint8_t type, const uint8_t* data, int len)
+{
+    uint8_t head[5];
+    int n;
+
+    head[0] = type;
+    n = 1 + put_length(head + 1, len);
+    if (! sendAll((const char*) head, n) || (len && ! sendAll((const char*) data, len)))
+        return false;
+    tx_timer.reset();
+    return true;
+}
+
+bool MqttLink::sendAll(const char* data, int len)
+{
+    while (len > 0) {
+        int n = sock.send_all((char*) data, len);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/****************************************************************************************************
+// receiving
+ ****************************************************************************************************/
+void MqttLink::poll()
+{
+    if (! ensureConnected())
+        return;
+
+    // publishes queued while the connection was down, or the window after a reconnect
+    for (int i = 0; i < window_count; i++) {
+        InFlight& msg = window[(window_head + i) % MQTT_WINDOW];
+        if (! msg.sent && ! msg.acked && ! sendPublish(msg)) {
+            linkFailed();
+            return;
+        }
+    }
+
+    uint8_t body[4];
+    int len, type;
+    while ((type = readPacket(body, sizeof(body), len, poll_timeout_ms)) > 0)
+        handlePacket(type, body, len);
+    if (type < 0) {
+        logWarning("MQTT connection to %s closed", host);
+        linkFailed();
+        return;
+    }
+
+    if (awaitingReply() && reply_timer.read_ms() > reply_timeout_ms) {
+        logError("no answer from MQTT broker %s for %d ms", host, reply_timer.read_ms());
+        linkFailed();
+        return;
+    }
+    if (keep_alive_s && ! ping_pending && tx_timer.read_ms() > keep_alive_s * 1000 / 2) {
+        if (! awaitingReply())
+            reply_timer.reset();
+        if (! sendPacket(MQTT_PINGREQ, NULL, 0)) {
+            linkFailed();
+            return;
+        }
+        ping_pending = true;
+    }
+}
+
+void MqttLink::handlePacket(int type, const uint8_t* body, int len)
+{
+    reply_timer.reset();
+    switch (type & 0xF0) {
+    case MQTT_PUBACK:
+        if (len < 2)
+            break;
+        for (int i = 0; i < window_count; i++) {
+            InFlight& msg = window[(window_head + i) % MQTT_WINDOW];
+            if (msg.packet_id == ((body[0] << 8) | body[1]) && ! msg.acked) {
+                msg.acked = true;
+                acks++;
+                last_ack_ms = msg.age.read_ms();
+                break;
+            }
+        }
+        break;
+    case MQTT_PINGRESP:
+        ping_pending = false;
+        break;
+    default:
+        break;                                  // nothing is subscribed, anything else is ignored
+    }
+}
+
+// buffered single byte reader, -1 on timeout or closed socket
+int MqttLink::readByte()
+{
+    if (rx_pos == rx_len) {
+        int n = sock.receive(rx_buf, sizeof(rx_buf));
+        if (n <= 0)
+            return -1;
+        rx_len = n;
+        rx_pos = 0;
+    }
+    return (unsigned char) rx_buf[rx_pos++];
+}
+
+// One control packet: its first byte, 0 if none started within timeout_ms, -1 on a broken
+// connection.  len is the body length, bytes beyond max_len are read and dropped.
+int MqttLink::readPacket(uint8_t* body, int max_len, int& len, int timeout_ms)
+{
+    sock.set_blocking(false, timeout_ms);
+    int type = readByte();
+    sock.set_blocking(false, socket_timeout_ms);
+    if (type < 0)
+        return sock.is_connected() ? 0 : -1;
+
+    int remaining = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        int c = readByte();
+        if (c < 0)
+            return -1;
+        remaining |= (c & 0x7F) << shift;
+        if (! (c & 0x80))
+            break;
+    }
+    for (int i = 0; i < remaining; i++) {
+        int c = readByte();
+        if (c < 0)
+            return -1;
+        if (i < max_len)
+            body[i] = c;
+    }
+    len = remaining < max_len ? remaining : max_len;
+    return type;
+}
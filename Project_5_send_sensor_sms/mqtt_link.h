@@ -0,0 +1,128 @@
+/****************************************************************************************************
+ * mqtt_link.h
+ *
+ * MQTT 3.1.1 publisher over one long-lived connection, the alternative to LinkManager's HTTP posts.
+ *
+ * A POST carries a request line and headers and waits for its response before the next one can
+ * go.  A QoS 1 PUBLISH costs a few bytes of header plus the topic, and the device does not wait:
+ * up to MQTT_WINDOW publishes stay in the in-flight window until the broker's PUBACK arrives
+ * (brokers ack in order).  The session is persistent (clean session 0), so after a reconnect all
+ * unacked publishes are sent again with the DUP flag.  The data session handling (bring-up,
+ * reconnect backoff) is the same as LinkManager's, keep-alive pings hold the connection open.
+ *
+ * Every publish carries a caller tag that comes back through acked(), the uploader uses the
+ * journal position of the batch end so it knows what to ack in the journal.
+ ****************************************************************************************************/
+#ifndef MQTT_LINK_H
+#define MQTT_LINK_H
+
+#include "mbed.h"
+#include "mtsas.h"
+
+#ifndef MQTT_WINDOW
+#define MQTT_WINDOW             4       // unacked QoS 1 publishes
+#endif
+#ifndef MQTT_MAX_PAYLOAD
+#define MQTT_MAX_PAYLOAD        896     // a batch of 16 telemetry frames
+#endif
+#define MQTT_MAX_TOPIC          64
+
+class MqttLink
+{
+public:
+    MqttLink(Cellular* radio, const char* host, int port = 1883);
+
+    // client id (the session key on the broker), user name and password may be empty
+    void setClient(const char* client_id, const char* user, const char* password);
+
+    // PINGREQ after this long without a packet sent, 0 disables keep-alive
+    void setKeepAlive(int seconds);
+
+    // reconnect delay starts at min_ms and doubles after each failure up to max_ms
+    void setBackoff(int min_ms, int max_ms);
+
+    // queue a QoS 1 publish and send it if the connection is up; false if the window is full
+    // or the message is too big.  The message is copied, tag comes back from acked().
+    bool publish(const char* topic, const void* payload, int len, uint32_t tag);
+
+    // tag of the oldest publish the broker acked since the last call, false if there is none
+    bool acked(uint32_t& tag);
+
+    // call periodically from the network thread: connects and resends, reads PUBACKs, pings
+    void poll();
+
+    int inFlight();
+    bool windowFull();
+    bool isConnected();
+
+    // close the socket (e.g. so the radio can take AT commands), the window is kept
+    void closeSocket();
+
+    // disconnect from the broker and close the data session
+    void shutdown();
+
+    // statistics
+    int         link_connects;      // data session bring-ups
+    int         socket_connects;    // broker sessions
+    int         publishes;          // PUBLISH packets sent, resends included
+    int         resends;
+    int         acks;
+    int         last_ack_ms;        // first send of the last acked message to its PUBACK
+
+private:
+    struct InFlight {
+        uint16_t    packet_id;
+        bool        sent;           // sent on the current connection
+        bool        dup;            // sent before, a resend carries the DUP flag
+        bool        acked;          // PUBACK received, waiting for acked() to take the tag
+        uint32_t    tag;
+        Timer       age;            // since the first send
+        int         len;
+        char        topic[MQTT_MAX_TOPIC];
+        uint8_t     payload[MQTT_MAX_PAYLOAD];
+    };
+
+    bool ensureLink();
+    bool ensureConnected();
+    void linkFailed();
+    bool sendConnect();
+    bool sendPublish(InFlight& msg);
+    bool sendPacket(uint8_t type, const uint8_t* data, int len);
+    bool sendAll(const char* data, int len);
+    bool awaitingReply();
+    int readByte();
+    int readPacket(uint8_t* body, int max_len, int& len, int timeout_ms);
+    void handlePacket(int type, const uint8_t* body, int len);
+
+    Cellular*           radio;
+    const char*         host;
+    int                 port;
+    const char*         client_id;
+    const char*         user;
+    const char*         password;
+    int                 keep_alive_s;
+
+    TCPSocketConnection sock;
+    bool                sock_open;
+    bool                link_up;
+    bool                connected;          // CONNACK accepted
+    Timer               tx_timer;           // since the last packet sent
+    Timer               reply_timer;        // since the last packet received or the wait started
+    bool                ping_pending;
+
+    int                 backoff_min_ms;
+    int                 backoff_max_ms;
+    int                 backoff_ms;
+    Timer               backoff_timer;
+
+    InFlight            window[MQTT_WINDOW];
+    int                 window_head;        // oldest entry
+    int                 window_count;
+    uint16_t            next_packet_id;
+
+    char                rx_buf[64];
+    int                 rx_len;
+    int                 rx_pos;
+};
+
+#endif
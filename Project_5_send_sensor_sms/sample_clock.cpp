@@ -0,0 +1,70 @@
+#include "mbed.h"
+#include "sample_clock.h"
+
+static uint32_t last_ticks;
+static uint64_t uptime_us;
+static uint64_t epoch_offset_ms;        // wall clock - uptime, 0 until synced
+static bool     synced;
+
+// callers hold the IRQs off
+static uint64_t read_uptime_us()
+{
+    uint32_t now = us_ticker_read();
+    uptime_us += (uint32_t) (now - last_ticks);
+    last_ticks = now;
+    return uptime_us;
+}
+
+uint64_t clock_uptime_us()
+{
+    __disable_irq();
+    uint64_t ret = read_uptime_us();
+    __enable_irq();
+    return ret;
+}
+
+// the 64-bit offset is written by the network thread and read by the sampler, so it is only
+// touched with the IRQs off, together with the synced flag
+uint64_t clock_now_ms(bool* is_synced)
+{
+    __disable_irq();
+    uint64_t ret = read_uptime_us() / 1000 + epoch_offset_ms;
+    if (is_synced)
+        *is_synced = synced;
+    __enable_irq();
+    return ret;
+}
+
+void clock_set(uint32_t epoch_s)
+{
+    __disable_irq();
+    epoch_offset_ms = (uint64_t) epoch_s * 1000 - read_uptime_us() / 1000;
+    synced = true;
+    __enable_irq();
+    set_time(epoch_s);
+}
+
+bool clock_synced()
+{
+    return synced;
+}
+
+uint64_t clock_sync_offset_ms()
+{
+    __disable_irq();
+    uint64_t ret = epoch_offset_ms;
+    __enable_irq();
+    return ret;
+}
+
+// civil date to days since 1970-01-01 (H. Hinnant's days_from_civil), valid for years >= 0
+uint32_t clock_make_epoch(int year, int month, int day, int hour, int min, int sec)
+{
+    year -= month <= 2;
+    int era = year / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    uint32_t days = era * 146097 + doe - 719468;
+    return days * 86400 + hour * 3600 + min * 60 + sec;
+}
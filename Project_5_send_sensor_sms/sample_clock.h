@@ -0,0 +1,35 @@
+/****************************************************************************************************
+ * sample_clock.h
+ *
+ * Wall clock for sample timestamps.
+ *
+ * Uptime is kept in 64 bits by extending the 32-bit microsecond ticker, so unlike Timer::read_ms()
+ * it does not wrap after ~35 minutes (clock_uptime_us() has to be called at least once every
+ * ~71 minutes, the event scheduler does that on every wake-up).  Until the clock is set from the network
+ * the wall clock is just the uptime, samples taken in that window are flagged SAMPLE_UNSYNCED and
+ * moved onto the real time line with clock_sync_offset_ms() once the clock is set.
+ ****************************************************************************************************/
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t clock_uptime_us();
+
+// milliseconds since 1970 once synced, milliseconds since boot before;
+// is_synced receives clock_synced() for that same instant
+uint64_t clock_now_ms(bool* is_synced = NULL);
+
+// set the wall clock (and the RTC) to epoch_s seconds since 1970
+void clock_set(uint32_t epoch_s);
+
+bool clock_synced();
+
+// amount to add to a pre-sync timestamp to move it onto the synced time line
+uint64_t clock_sync_offset_ms();
+
+// convert a calendar date/time (UTC) to seconds since 1970
+uint32_t clock_make_epoch(int year, int month, int day, int hour, int min, int sec);
+
+#endif
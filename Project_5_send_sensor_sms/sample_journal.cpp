@@ -0,0 +1,378 @@
+#include "sample_journal.h"
+#include <string.h>
+#include <stddef.h>
+
+// one flash record, padded so records never straddle a 256 byte flash page
+struct JournalRecord {
+    uint32_t        seq;                // 0xFFFFFFFF in an erased slot
+    uint32_t        acked;              // 0xFFFFFFFF until uploaded, then 0
+    SensorSample    sample;
+    uint32_t        crc;                // over seq and sample
+};
+
+static const uint32_t record_slot = 128;
+static const uint32_t erased = 0xFFFFFFFF;
+
+typedef char record_must_fit_slot[sizeof(JournalRecord) <= record_slot ? 1 : -1];
+
+static uint32_t crc32(uint32_t crc, const void* data, uint32_t len)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(const JournalRecord& rec)
+{
+    uint32_t crc = crc32(0, &rec.seq, sizeof(rec.seq));
+    return crc32(crc, &rec.sample, sizeof(rec.sample));
+}
+
+void sample_shift_time(SensorSample& sample, uint64_t offset_ms)
+{
+    uint64_t ms = (uint64_t) sample.timestamp * 1000 + sample.millis + offset_ms;
+    sample.timestamp = ms / 1000;
+    sample.millis = ms % 1000;
+}
+
+/****************************************************************************************************
+// FileJournalFlash
+ ****************************************************************************************************/
+FileJournalFlash::FileJournalFlash(const char* path, uint32_t size, uint32_t sector_size)
+    : size(size), sector_size(sector_size)
+{
+    file = fopen(path, "r+b");
+    if (! file) {
+        // new file starts out erased
+        file = fopen(path, "w+b");
+        if (file) {
+            for (uint32_t addr = 0; addr < size; addr += sector_size)
+                erase(addr);
+        }
+    }
+}
+
+FileJournalFlash::~FileJournalFlash()
+{
+    if (file)
+        fclose(file);
+}
+
+bool FileJournalFlash::isOpen()
+{
+    return file != NULL;
+}
+
+uint32_t FileJournalFlash::sectorSize()
+{
+    return sector_size;
+}
+
+bool FileJournalFlash::read(uint32_t addr, void* data, uint32_t len)
+{
+    if (! file || addr + len > size || fseek(file, addr, SEEK_SET) != 0)
+        return false;
+    return fread(data, 1, len, file) == len;
+}
+
+bool FileJournalFlash::program(uint32_t addr, const void* data, uint32_t len)
+{
+    uint8_t buf[64];
+    const uint8_t* src = (const uint8_t*) data;
+
+    // like NOR flash, programming can only clear bits
+    while (len) {
+        uint32_t n = len < sizeof(buf) ? len : sizeof(buf);
+        if (! read(addr, buf, n))
+            return false;
+        for (uint32_t i = 0; i < n; i++)
+            buf[i] &= src[i];
+        if (fseek(file, addr, SEEK_SET) != 0 || fwrite(buf, 1, n, file) != n)
+            return false;
+        addr += n;
+        src += n;
+        len -= n;
+    }
+    return fflush(file) == 0;
+}
+
+bool FileJournalFlash::erase(uint32_t addr)
+{
+    uint8_t buf[64];
+    memset(buf, 0xFF, sizeof(buf));
+
+    addr -= addr % sector_size;
+    if (! file || addr >= size || fseek(file, addr, SEEK_SET) != 0)
+        return false;
+    for (uint32_t n = 0; n < sector_size; n += sizeof(buf)) {
+        if (fwrite(buf, 1, sizeof(buf), file) != sizeof(buf))
+            return false;
+    }
+    return fflush(file) == 0;
+}
+
+/****************************************************************************************************
+// SpiFlashJournal
+ ****************************************************************************************************/
+#ifdef JOURNAL_SPI_FLASH
+SpiFlashJournal::SpiFlashJournal(SpiFlash25& flash) : flash(flash)
+{
+}
+
+uint32_t SpiFlashJournal::sectorSize()
+{
+    return 4096;
+}
+
+bool SpiFlashJournal::read(uint32_t addr, void* data, uint32_t len)
+{
+    return flash.read(addr, len, (char*) data);
+}
+
+bool SpiFlashJournal::program(uint32_t addr, const void* data, uint32_t len)
+{
+    return flash.write(addr, len, (const char*) data);
+}
+
+bool SpiFlashJournal::erase(uint32_t addr)
+{
+    return flash.clear_sector(addr);
+}
+#endif
+
+/****************************************************************************************************
+// FlashSegment
+ ****************************************************************************************************/
+FlashSegment::FlashSegment(JournalFlash& flash, uint32_t base, uint32_t size)
+    : lost(0), flash(flash), base(base), head(0), tail(0), count(0), next_seq(0)
+{
+    slots_per_sector = flash.sectorSize() / record_slot;
+    slots = size / flash.sectorSize() * slots_per_sector;
+}
+
+uint32_t FlashSegment::slotAddr(uint32_t slot)
+{
+    return base + slot * record_slot;
+}
+
+bool FlashSegment::readHeader(uint32_t slot, uint32_t& seq, uint32_t& acked)
+{
+    JournalRecord rec;
+    if (! flash.read(slotAddr(slot), &rec, sizeof(rec)) || rec.seq == erased || record_crc(rec) != rec.crc)
+        return false;
+    seq = rec.seq;
+    acked = rec.acked;
+    return true;
+}
+
+int FlashSegment::mount()
+{
+    uint32_t newest_slot = 0;
+    bool found = false;
+    uint32_t seq, acked;
+
+    head = tail = count = 0;
+    next_seq = 0;
+
+    // the slot with the highest sequence number was written last
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        if (readHeader(slot, seq, acked) && (! found || seq >= next_seq)) {
+            next_seq = seq + 1;
+            newest_slot = slot;
+            found = true;
+        }
+    }
+    if (! found)
+        return 0;
+    head = (newest_slot + 1) % slots;
+
+    // records are acked in order, so the pending ones are a run ending at the newest record
+    uint32_t slot = newest_slot;
+    uint32_t expected = next_seq - 1;
+    while (count < slots && readHeader(slot, seq, acked) && seq == expected && acked == erased) {
+        tail = slot;
+        count++;
+        slot = (slot + slots - 1) % slots;
+        expected--;
+    }
+    if (count == 0)
+        tail = head;
+    return count;
+}
+
+bool FlashSegment::append(const SensorSample& sample)
+{
+    JournalRecord rec;
+
+    if (slots == 0)
+        return false;
+
+    // entering a new sector: erase it, dropping whatever pending records it still held
+    if (head % slots_per_sector == 0) {
+        while (count && tail / slots_per_sector == head / slots_per_sector) {
+            tail = (tail + 1) % slots;
+            count--;
+            lost++;
+        }
+        if (! flash.erase(slotAddr(head)))
+            return false;
+    }
+
+    memset(&rec, 0xFF, sizeof(rec));
+    rec.seq = next_seq++;
+    rec.sample = sample;
+    rec.crc = record_crc(rec);
+    if (! flash.program(slotAddr(head), &rec, sizeof(rec)))
+        return false;
+
+    if (count == 0)
+        tail = head;
+    head = (head + 1) % slots;
+    count++;
+    return true;
+}
+
+bool FlashSegment::read(int index, SensorSample& sample)
+{
+    JournalRecord rec;
+    if (index < 0 || (uint32_t) index >= count)
+        return false;
+    if (! flash.read(slotAddr((tail + index) % slots), &rec, sizeof(rec)) || record_crc(rec) != rec.crc)
+        return false;
+    sample = rec.sample;
+    return true;
+}
+
+void FlashSegment::ack(int n)
+{
+    static const uint32_t zero = 0;
+
+    while (n-- > 0 && count) {
+        flash.program(slotAddr(tail) + offsetof(JournalRecord, acked), &zero, sizeof(zero));
+        tail = (tail + 1) % slots;
+        count--;
+    }
+}
+
+int FlashSegment::pending()
+{
+    return count;
+}
+
+int FlashSegment::capacity()
+{
+    return slots;
+}
+
+/****************************************************************************************************
+// SampleJournal
+ ****************************************************************************************************/
+SampleJournal::SampleJournal(FlashSegment* flash)
+    : appended(0), uploaded(0), spilled(0), dropped(0), flash(flash), head(0), tail(0), front(0)
+{
+}
+
+void SampleJournal::append(const SensorSample& sample)
+{
+    if (head - tail == JOURNAL_RAM_SAMPLES) {
+        // RAM is full: the oldest sample moves to flash, or is lost without one.
+        // Samples without a real timestamp are never persisted, they could not be fixed after a reset.
+        SensorSample& oldest = ram[tail % JOURNAL_RAM_SAMPLES];
+        int lost = flash ? flash->lost : 0;
+        if (flash && ! (oldest.flags & SAMPLE_UNSYNCED) && flash->append(oldest)) {
+            spilled++;
+            front += flash->lost - lost;        // a full flash ring overwrote its oldest record
+        } else if (flash && flash->pending() > 0) {
+            // the oldest RAM sample sits behind the flash ones: dropping it would move every later
+            // sample one position down under batches in flight, so the new sample is lost instead
+            dropped++;
+            return;
+        } else {
+            dropped++;
+            front++;
+        }
+        tail++;
+    }
+    ram[head % JOURNAL_RAM_SAMPLES] = sample;
+    head++;
+    appended++;
+}
+
+int SampleJournal::pending()
+{
+    return (flash ? flash->pending() : 0) + (head - tail);
+}
+
+// flash holds the older samples, so they go first
+int SampleJournal::peek(SensorSample* samples, int max, int skip)
+{
+    int n = 0;
+    int in_flash = 0;
+    if (flash) {
+        while (n < max && skip + n < flash->pending()) {
+            if (flash->read(skip + n, samples[n])) {
+                n++;
+                continue;
+            }
+            if (n > 0 || skip > 0)
+                return n;           // upload what we have, the bad record is at the front later
+            flash->ack(1);          // an unreadable record at the front is skipped
+            dropped++;
+            front++;
+        }
+        in_flash = flash->pending();
+        if (skip + n < in_flash)
+            return n;
+    }
+    uint32_t ram_skip = skip > in_flash ? skip - in_flash : 0;
+    if (ram_skip >= head - tail)
+        return n;
+    for (uint32_t i = tail + ram_skip; n < max && i != head; i++)
+        samples[n++] = ram[i % JOURNAL_RAM_SAMPLES];
+    return n;
+}
+
+void SampleJournal::ack(int count)
+{
+    uploaded += count;
+    remove(count);
+}
+
+void SampleJournal::discard(int count)
+{
+    dropped += count;
+    remove(count);
+}
+
+void SampleJournal::remove(int count)
+{
+    front += count;
+    if (flash) {
+        int n = count < flash->pending() ? count : flash->pending();
+        flash->ack(n);
+        count -= n;
+    }
+    while (count-- > 0 && tail != head)
+        tail++;
+}
+
+uint32_t SampleJournal::position()
+{
+    return front;
+}
+
+void SampleJournal::fixUnsynced(uint64_t offset_ms)
+{
+    for (uint32_t i = tail; i != head; i++) {
+        SensorSample& sample = ram[i % JOURNAL_RAM_SAMPLES];
+        if (sample.flags & SAMPLE_UNSYNCED) {
+            sample_shift_time(sample, offset_ms);
+            sample.flags &= ~SAMPLE_UNSYNCED;
+        }
+    }
+}
@@ -0,0 +1,159 @@
+/****************************************************************************************************
+ * sample_journal.h
+ *
+ * Store-and-forward journal of timestamped SensorSample records.
+ *
+ * Every sample the sampling thread produces is appended here by the network thread.  The uploader
+ * peeks at the oldest pending samples, posts them as one batch and only acks them once the server
+ * accepted the batch, so a failed post is simply retried with the same samples the next time.
+ *
+ * Samples live in a RAM ring.  When a FlashSegment is attached, the oldest RAM samples are spilled
+ * to it instead of being dropped when the ring fills up, and anything still pending in flash is
+ * uploaded after a reset.  The flash side only needs NOR semantics (sector erase, programming can
+ * only clear bits) through the JournalFlash interface: SpiFlashJournal drives the Dragonfly SPI
+ * flash, FileJournalFlash emulates it with a plain file so the journal can be exercised on Linux.
+ ****************************************************************************************************/
+#ifndef SAMPLE_JOURNAL_H
+#define SAMPLE_JOURNAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sensor_sample.h"
+
+#ifndef JOURNAL_RAM_SAMPLES
+#define JOURNAL_RAM_SAMPLES     64      // must be a power of two
+#endif
+
+// raw NOR-like storage for the flash segment
+class JournalFlash
+{
+public:
+    virtual ~JournalFlash() {}
+    virtual uint32_t sectorSize() = 0;
+    virtual bool read(uint32_t addr, void* data, uint32_t len) = 0;
+    virtual bool program(uint32_t addr, const void* data, uint32_t len) = 0;   // can only clear bits
+    virtual bool erase(uint32_t addr) = 0;                                      // sector containing addr
+};
+
+// flash emulated by a file, for Linux builds and tests
+class FileJournalFlash : public JournalFlash
+{
+public:
+    FileJournalFlash(const char* path, uint32_t size, uint32_t sector_size = 4096);
+    virtual ~FileJournalFlash();
+
+    bool isOpen();
+
+    virtual uint32_t sectorSize();
+    virtual bool read(uint32_t addr, void* data, uint32_t len);
+    virtual bool program(uint32_t addr, const void* data, uint32_t len);
+    virtual bool erase(uint32_t addr);
+
+private:
+    FILE*       file;
+    uint32_t    size;
+    uint32_t    sector_size;
+};
+
+#ifdef JOURNAL_SPI_FLASH
+#include "SpiFlash25.h"
+
+// Dragonfly on-board SPI flash
+class SpiFlashJournal : public JournalFlash
+{
+public:
+    SpiFlashJournal(SpiFlash25& flash);
+
+    virtual uint32_t sectorSize();
+    virtual bool read(uint32_t addr, void* data, uint32_t len);
+    virtual bool program(uint32_t addr, const void* data, uint32_t len);
+    virtual bool erase(uint32_t addr);
+
+private:
+    SpiFlash25& flash;
+};
+#endif
+
+// Ring of fixed-size sample records in a region of a JournalFlash.
+// Each record carries a sequence number and a CRC so the ring is rebuilt by mount() after a reset,
+// and an ack word that is programmed to 0 once the record was uploaded.
+class FlashSegment
+{
+public:
+    FlashSegment(JournalFlash& flash, uint32_t base, uint32_t size);
+
+    // scan the region and recover the pending records, returns the number found
+    int mount();
+
+    bool append(const SensorSample& sample);
+    bool read(int index, SensorSample& sample);     // index 0 is the oldest pending record
+    void ack(int count);
+    int pending();
+    int capacity();
+
+    int         lost;                               // pending records overwritten by wrap-around
+
+private:
+    bool readHeader(uint32_t slot, uint32_t& seq, uint32_t& acked);
+    uint32_t slotAddr(uint32_t slot);
+
+    JournalFlash&   flash;
+    uint32_t        base;
+    uint32_t        slots;
+    uint32_t        slots_per_sector;
+    uint32_t        head;                           // next slot to write
+    uint32_t        tail;                           // oldest pending slot
+    uint32_t        count;                          // pending records
+    uint32_t        next_seq;
+};
+
+class SampleJournal
+{
+public:
+    SampleJournal(FlashSegment* flash = NULL);
+
+    void append(const SensorSample& sample);
+
+    // number of samples waiting for upload
+    int pending();
+
+    // copy up to max of the oldest pending samples, skipping the first skip of them
+    // (e.g. samples still in flight), returns the number copied
+    int peek(SensorSample* samples, int max, int skip = 0);
+
+    // drop the count oldest samples after they were uploaded
+    void ack(int count);
+
+    // drop the count oldest samples without uploading them (e.g. a batch the server refused)
+    void discard(int count);
+
+    // position of the oldest pending sample in the stream of appended samples; it advances with
+    // every ack, discard and sample lost at the front, so an uploader with several batches in flight
+    // can tell how many samples of an acked batch are still pending.  Samples are only ever lost at
+    // the front (or not taken at all), so a pending sample keeps its position until it is acked.
+    uint32_t position();
+
+    // move samples taken before the clock was set onto the synced time line
+    void fixUnsynced(uint64_t offset_ms);
+
+    // statistics
+    uint32_t    appended;
+    uint32_t    uploaded;
+    uint32_t    spilled;                            // moved from RAM to flash
+    uint32_t    dropped;                            // lost, or not taken, because RAM (and flash) were full,
+                                                    // or discarded
+
+private:
+    void remove(int count);
+
+    FlashSegment*   flash;
+    SensorSample    ram[JOURNAL_RAM_SAMPLES];
+    uint32_t        head;
+    uint32_t        tail;
+    uint32_t        front;                          // position()
+};
+
+// add offset_ms to a sample timestamp
+void sample_shift_time(SensorSample& sample, uint64_t offset_ms);
+
+#endif
@@ -0,0 +1,65 @@
+/****************************************************************************************************
+ * sample_queue.h
+ *
+ * Bounded single-producer/single-consumer ring of fixed-size records.
+ *
+ * push() is only called from the sampling thread and pop() only from the network thread, so no
+ * lock is needed: each index is written by exactly one side, and a memory barrier orders the
+ * slot copy against the index update.  When the ring is full the newest record is dropped and
+ * counted, the sampling side never waits on the consumer.
+ ****************************************************************************************************/
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include "mbed.h"
+
+template <typename T, uint32_t Size>
+class SampleQueue
+{
+    // Size must be a power of two so the free-running indices can be masked
+    typedef char size_must_be_power_of_two[(Size & (Size - 1)) == 0 ? 1 : -1];
+
+public:
+    SampleQueue() : head(0), tail(0), dropped(0) {}
+
+    // producer side
+    bool push(const T& item) {
+        uint32_t h = head;
+        if (h - tail == Size) {
+            dropped++;
+            return false;
+        }
+        slots[h & (Size - 1)] = item;
+        __DMB();                    // slot must be visible before the new head
+        head = h + 1;
+        return true;
+    }
+
+    // consumer side
+    bool pop(T& item) {
+        uint32_t t = tail;
+        if (t == head)
+            return false;
+        __DMB();                    // read the slot only after seeing the head
+        item = slots[t & (Size - 1)];
+        __DMB();                    // finish the copy before releasing the slot
+        tail = t + 1;
+        return true;
+    }
+
+    uint32_t count() const {
+        return head - tail;
+    }
+
+    uint32_t overflows() const {
+        return dropped;
+    }
+
+private:
+    volatile uint32_t   head;       // written by producer only
+    volatile uint32_t   tail;       // written by consumer only
+    uint32_t            dropped;    // written by producer only
+    T                   slots[Size];
+};
+
+#endif
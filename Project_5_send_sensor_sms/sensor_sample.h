@@ -0,0 +1,45 @@
+/****************************************************************************************************
+ * sensor_sample.h
+ *
+ * Fixed-size record holding one snapshot of every channel on the ROHM Multi-sensor Shield.
+ * The sampling code fills one of these after each read cycle and hands it to the network side,
+ * so the upload path never touches the sensor globals directly.
+ ****************************************************************************************************/
+#ifndef SENSOR_SAMPLE_H
+#define SENSOR_SAMPLE_H
+
+#include <stdint.h>
+
+// which sensors were freshly read when the sample was taken, every sensor runs at its own rate
+#define SAMPLE_TEMP     0x0001      // BDE0600
+#define SAMPLE_UV       0x0002      // ML8511
+#define SAMPLE_HALL     0x0004      // BU52011
+#define SAMPLE_LIGHT    0x0008      // RPR0521
+#define SAMPLE_COLOR    0x0010      // BH1745
+#define SAMPLE_PRESSURE 0x0020      // BM1383
+#define SAMPLE_KMX62    0x0040      // KMX62 accel/mag
+#define SAMPLE_UNSYNCED 0x0080      // timestamp is still uptime, the clock was not set yet
+#define SAMPLE_KX022    0x0100      // KX022
+
+// the two sensor groups of the original sampling loop
+#define SAMPLE_THPM     (SAMPLE_TEMP | SAMPLE_UV | SAMPLE_HALL | SAMPLE_LIGHT | SAMPLE_COLOR | SAMPLE_PRESSURE)
+#define SAMPLE_MOTION   (SAMPLE_KMX62 | SAMPLE_KX022)
+
+struct SensorSample {
+    uint32_t    timestamp;          // seconds since 1970 when the sample was taken (see sample_clock.h)
+    uint16_t    millis;             // sub-second part of timestamp
+    uint16_t    flags;              // SAMPLE_* sensor bits / SAMPLE_UNSYNCED
+    float       temp_c;             // BDE0600
+    float       uv;                 // ML8511
+    float       ambient_light;      // RPR0521 ALS (lx)
+    float       proximity;          // RPR0521 PS (ADC counts)
+    int32_t     hall[2];            // BU52011 south, north
+    int32_t     color[3];           // BH1745 red, green, blue
+    float       mems_accel[3];      // KMX62 accel (g)
+    float       mems_mag[3];        // KMX62 mag (uT)
+    float       kx022_accel[3];     // KX022 accel (g)
+    float       bm1383_temp;        // BM1383 temperature (C)
+    float       pressure_hpa;       // BM1383 pressure (hPa)
+};
+
+#endif
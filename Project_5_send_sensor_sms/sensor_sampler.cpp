@@ -0,0 +1,412 @@
+#include "mbed.h"
+#include "MTSLog.h"
+#include "sensor_sampler.h"
+#include "sample_clock.h"
+#include "rohm_sensors.h"
+#include "i2c_queue.h"
+#include "kx022_stream.h"
+#include "kmx62_buffer.h"
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+//Define Pins for I2C Interface
+I2C i2c(I2C_SDA, I2C_SCL);
+
+// I2C sensors on the shield (Common/rohm_sensors.h), drop a chip from the list to leave it out
+typedef SensorSet<Rpr0521,
+        SensorSet<Kmx62,
+        SensorSet<Bh1745,
+        SensorSet<Kx022,
+        SensorSet<Bm1383> > > > > ShieldSensors;
+static ShieldSensors shield;
+static I2CQueue i2c_queue(i2c);                 // the reads of a sampling cycle run back to back
+
+#ifdef AccelStream
+static const uint16_t accel_rate_hz = 400;
+static const uint8_t accel_watermark = 20;      // samples per block, half the buffer is slack for a busy bus
+static Kx022Stream accel_stream(i2c, i2c_queue, D2);    // KX022 INT1 on the shield header
+
+// vibration statistics of the streamed samples between two debug prints
+struct VibrationStats {
+    uint32_t    samples;
+    uint32_t    gaps;
+    float       sum[3];
+    float       sum_sq[3];
+    float       peak_g;                         // largest magnitude
+};
+static VibrationStats vibration;
+
+void AccumulateVibration (const AccelBlock& block, void* arg);
+#endif
+
+#ifdef MotionBuffer
+static const uint16_t motion_rate_hz = 100;
+static Kmx62Buffer motion_buffer(i2c, i2c_queue);
+
+// range of the magnetic field strength between two debug prints
+struct FieldRange {
+    uint32_t    samples;
+    float       min_ut;
+    float       max_ut;
+};
+static FieldRange field_range;
+
+void TrackFieldRange (const MotionBlock& block, void* arg);
+#endif
+
+//Define Sensor Variables
+#ifdef AnalogTemp
+AnalogIn    BDE0600_Temp(PC_4); //Mapped to A2
+uint16_t    BDE0600_Temp_value;
+float       BDE0600_output;
+#endif
+
+#ifdef AnalogUV
+AnalogIn    ML8511_UV(PC_1);    //Mapped to A4
+uint16_t    ML8511_UV_value;
+float       ML8511_output;
+#endif
+
+#ifdef HallSensor
+DigitalIn   Hall_GPIO0(PC_8);
+DigitalIn   Hall_GPIO1(PB_5);
+int         Hall_Return1;
+int         Hall_Return0;
+int32_t     Hall_Return[2];
+#endif
+
+/****************************************************************************************************
+// function prototypes
+ ****************************************************************************************************/
+void ReadAnalogTemp();
+void ReadAnalogUV ();
+void ReadHallSensor ();
+static void FillSample (SensorSample& sample, uint32_t flags);
+
+// sampling schedule: every sensor driver is read at its own rate by the event scheduler.
+// Reads that fall on the same deadline end up in one sample.
+// analog and GPIO sensors
+struct SensorJob {
+    const char* name;
+    void        (*read)();
+    uint16_t    flag;               // SAMPLE_* bit marking the sensor's channels fresh
+    uint32_t    period_ms;
+};
+static const SensorJob sensor_jobs[] = {
+#ifdef AnalogTemp
+    { "BDE0600",    ReadAnalogTemp,     SAMPLE_TEMP,        5000 },
+#endif
+#ifdef AnalogUV
+    { "ML8511",     ReadAnalogUV,       SAMPLE_UV,          5000 },
+#endif
+#ifdef HallSensor
+    { "BU52011",    ReadHallSensor,     SAMPLE_HALL,        5000 },
+#endif
+};
+static const int sensor_job_count = sizeof(sensor_jobs) / sizeof(sensor_jobs[0]);
+static uint32_t sample_flags;                               // sensors read since the last sample
+
+static void run_sensor_job (void* arg)
+{
+    const SensorJob* job = (const SensorJob*) arg;
+    job->read();
+    sample_flags |= job->flag;
+}
+
+// I2C sensors: SAMPLE_* bit, read period and the SensorSample channels of each driver
+template<typename Chip> struct SampleChannel;
+template<> struct SampleChannel<Rpr0521> {
+    enum { flag = SAMPLE_LIGHT, period_ms = 5000 };
+    static void fill(const RohmReading<Rpr0521>& v, SensorSample& sample)
+    {
+        sample.ambient_light = v.lux;
+        sample.proximity = v.proximity;
+    }
+};
+template<> struct SampleChannel<Kmx62> {
+    enum { flag = SAMPLE_KMX62, period_ms = 5000 };
+    static void fill(const RohmReading<Kmx62>& v, SensorSample& sample)
+    {
+        for (int i = 0; i < 3; i++) {
+            sample.mems_accel[i] = v.accel[i];
+            sample.mems_mag[i] = v.mag[i];
+        }
+    }
+};
+template<> struct SampleChannel<Bh1745> {
+    enum { flag = SAMPLE_COLOR, period_ms = 5000 };
+    static void fill(const RohmReading<Bh1745>& v, SensorSample& sample)
+    {
+        for (int i = 0; i < 3; i++)
+            sample.color[i] = v.rgb[i];
+    }
+};
+template<> struct SampleChannel<Kx022> {
+    enum { flag = SAMPLE_KX022, period_ms = 5000 };
+    static void fill(const RohmReading<Kx022>& v, SensorSample& sample)
+    {
+        for (int i = 0; i < 3; i++)
+            sample.kx022_accel[i] = v.accel[i];
+    }
+};
+template<> struct SampleChannel<Bm1383> {
+    enum { flag = SAMPLE_PRESSURE, period_ms = 5000 };
+    static void fill(const RohmReading<Bm1383>& v, SensorSample& sample)
+    {
+        sample.bm1383_temp = v.temp_c;
+        sample.pressure_hpa = v.pressure_hpa;
+    }
+};
+
+// completion of a queued sensor read, runs in the sampling thread from i2c_queue.dispatch()
+template<typename Chip> void shield_read_done (void* arg, bool ok)
+{
+    RohmSensor<Chip>* sensor = (RohmSensor<Chip>*) arg;
+    if (ok) {
+        sensor->convert();
+        sample_flags |= SampleChannel<Chip>::flag;
+    }
+}
+
+// scheduler job: queue the readout blocks of a sensor, the bus work happens after runDue()
+template<typename Chip> void read_shield_sensor (void* arg)
+{
+    RohmSensor<Chip>* sensor = (RohmSensor<Chip>*) arg;
+    const RegBlock* blocks = Chip::blocks();
+    uint8_t* rx = sensor->raw;
+
+    if (i2c_queue.space() < Chip::block_count)
+        return;
+    for (int i = 0; i < Chip::block_count; i++) {
+        bool last = i == Chip::block_count - 1;
+        I2CTransaction t = { Chip::address, blocks[i].reg, blocks[i].len, rx,
+                             last ? shield_read_done<Chip> : NULL, last ? (void*) sensor : NULL };
+        i2c_queue.submit(t);
+        rx += blocks[i].len;
+    }
+}
+
+// ShieldSensors::each() visitors
+struct AddShieldJob {
+    EventScheduler* scheduler;
+    template<typename Chip> void operator()(RohmSensor<Chip>& sensor)
+    {
+        scheduler->add(Chip::name(), read_shield_sensor<Chip>, &sensor, SampleChannel<Chip>::period_ms);
+    }
+};
+struct FillShieldChannels {
+    SensorSample* sample;
+    template<typename Chip> void operator()(RohmSensor<Chip>& sensor)
+    {
+        SampleChannel<Chip>::fill(sensor.value, *sample);
+    }
+};
+
+static SensorSample last_sample;                            // newest sample, for the debug print
+
+void sampler_init()
+{
+    if (! shield.initAll(i2c))
+        logError("shield sensor init failed");
+}
+
+void sampler_start(EventScheduler& scheduler)
+{
+    for (int i = 0; i < sensor_job_count; i++)
+        scheduler.add(sensor_jobs[i].name, run_sensor_job, (void*) &sensor_jobs[i], sensor_jobs[i].period_ms);
+    AddShieldJob add_shield_job = { &scheduler };
+    shield.each(add_shield_job);
+#ifdef BlockingI2C
+    i2c_queue.setBlocking(true);
+#endif
+#ifdef MotionBuffer
+    motion_buffer.addConsumer(TrackFieldRange, &field_range);
+    if (! motion_buffer.start(motion_rate_hz, scheduler))
+        logError("KMX62 buffer setup failed");
+#endif
+#ifdef AccelStream
+    accel_stream.addConsumer(AccumulateVibration, &vibration);
+    if (! accel_stream.start(accel_rate_hz, accel_watermark, &scheduler))
+        logError("KX022 stream setup failed");
+#endif
+}
+
+bool sampler_collect(SensorSample& sample)
+{
+#ifdef AccelStream
+    accel_stream.service();
+#endif
+
+    // the thread sleeps while the queued reads run on the bus
+    i2c_queue.run();
+    i2c_queue.dispatch();
+
+    if (! sample_flags)
+        return false;
+    bool synced;
+    uint64_t now_ms = clock_now_ms(&synced);
+    sample.timestamp = now_ms / 1000;
+    sample.millis = now_ms % 1000;
+    FillSample(sample, sample_flags | (synced ? 0 : SAMPLE_UNSYNCED));
+    sample_flags = 0;
+    last_sample = sample;
+    return true;
+}
+
+void sampler_print(uint32_t interval_ms)
+{
+    logDebug("SENSOR DATA");
+    logDebug("temperature: %0.2f C", last_sample.bm1383_temp);
+    logDebug("analog uv: %.1f mW/cm2", last_sample.uv);
+    logDebug("ambient Light  %0.3f", last_sample.ambient_light);
+    logDebug("proximity count  %0.3f", last_sample.proximity);
+    logDebug("hall effect: South %d\t North %d",  last_sample.hall[0], last_sample.hall[1]);
+    logDebug("pressure: %0.2f hPa", last_sample.pressure_hpa);
+    logDebug("magnetometer:\r\n\tx: %0.3f\ty: %0.3f\tz: %0.3f\tuT", last_sample.mems_mag[0], last_sample.mems_mag[1], last_sample.mems_mag[2]);
+    logDebug("accelerometer:\r\n\tx: %0.3f\ty: %0.3f\tz: %0.3f\tg", last_sample.mems_accel[0], last_sample.mems_accel[1], last_sample.mems_accel[2]);
+    logDebug("color:\r\n\tred: %ld\tgrn: %ld\tblu: %ld\t", last_sample.color[0], last_sample.color[1], last_sample.color[2]);
+    logDebug("i2c cycle: %lu us bus (max %lu), %lu us cpu, %lu transfers, %lu errors", i2c_queue.cycle_us,
+             i2c_queue.cycle_max_us, i2c_queue.cpu_us, i2c_queue.transfers, i2c_queue.errors);
+#ifdef AccelStream
+    VibrationStats& v = vibration;
+    if (v.samples) {
+        float rms[3];
+        for (int i = 0; i < 3; i++) {
+            float mean = v.sum[i] / v.samples;
+            rms[i] = sqrtf(fabsf(v.sum_sq[i] / v.samples - mean * mean));
+        }
+        logDebug("vibration: %lu samples at %u Hz, rms x %0.4f y %0.4f z %0.4f g, peak %0.3f g, %lu gaps", v.samples,
+                 accel_stream.rate_hz, rms[0], rms[1], rms[2], v.peak_g, v.gaps);
+    }
+    logDebug("accel stream: %lu blocks, %lu overflows, %lu errors", accel_stream.blocks, accel_stream.overflows,
+             accel_stream.errors);
+    memset(&vibration, 0, sizeof(vibration));
+#endif
+#ifdef MotionBuffer
+    // bus cost per 6-axis sample against reading the output registers for every sample
+    // (address + register + address + data bytes, one transaction per readout block)
+    static uint32_t motion_samples;
+    uint32_t motion_new = motion_buffer.samples - motion_samples;
+    motion_samples = motion_buffer.samples;
+    if (motion_buffer.samples) {
+        logDebug("kmx62 buffer: %lu samples/s at %u Hz, %lu transfers, %lu bus bytes/100 samples "
+                 "(direct readout: %d transfers, %d bytes per sample)", motion_new * 1000 / interval_ms,
+                 motion_buffer.rate_hz, motion_buffer.transfers, motion_buffer.bus_bytes * 100 / motion_buffer.samples,
+                 (int) Kmx62::block_count, (int) (3 * Kmx62::block_count + Kmx62::raw_len));
+    }
+    if (field_range.samples)
+        logDebug("magnetic field: %0.1f .. %0.1f uT over %lu samples", field_range.min_ut, field_range.max_ut,
+                 field_range.samples);
+    logDebug("kmx62 buffer: %lu overflows, %lu errors", motion_buffer.overflows, motion_buffer.errors);
+    field_range.samples = 0;
+#endif
+}
+
+// Copy the current sensor globals into a queue record
+static void FillSample (SensorSample& sample, uint32_t flags)
+{
+    memset(&sample.temp_c, 0, sizeof(SensorSample) - offsetof(SensorSample, temp_c));
+    sample.flags = flags;
+#ifdef AnalogTemp
+    sample.temp_c = BDE0600_output;
+#endif
+#ifdef AnalogUV
+    sample.uv = ML8511_output;
+#endif
+#ifdef HallSensor
+    sample.hall[0] = Hall_Return[0];
+    sample.hall[1] = Hall_Return[1];
+#endif
+    FillShieldChannels fill = { &sample };
+    shield.each(fill);
+}
+
+// Sensor data acquisition functions
+/************************************************************************************************/
+#ifdef AnalogTemp
+void ReadAnalogTemp ()
+{
+    BDE0600_Temp_value = BDE0600_Temp.read_u16();
+
+    BDE0600_output = (float)BDE0600_Temp_value * (float)0.000050354; //(value * (3.3V/65535))
+    BDE0600_output = (BDE0600_output-(float)1.753)/((float)-0.01068) + (float)30;
+
+//    printf("BDE0600 Analog Temp Sensor Data:\r\n");
+//    printf(" Temp = %.2f C\r\n", BDE0600_output);
+}
+#endif
+
+#ifdef AnalogUV
+void ReadAnalogUV ()
+{
+    ML8511_UV_value = ML8511_UV.read_u16();
+    ML8511_output = (float)ML8511_UV_value * (float)0.000050354; //(value * (3.3V/65535))   //Note to self: when playing with this, a negative value is seen... Honestly, I think this has to do with my ADC converstion...
+    ML8511_output = (ML8511_output-(float)2.2)/((float)0.129) + 10;                           // Added +5 to the offset so when inside (aka, no UV, readings show 0)... this is the wrong approach... and the readings don't make sense... Fix this.
+
+//    printf("ML8511 Analog UV Sensor Data:\r\n");
+//    printf(" UV = %.1f mW/cm2\r\n", ML8511_output);
+
+}
+#endif
+
+
+#ifdef HallSensor
+void ReadHallSensor ()
+{
+
+    Hall_Return[0] = Hall_GPIO0;
+    Hall_Return[1] = Hall_GPIO1;
+
+//    printf("BU52011 Hall Switch Sensor Data:\r\n");
+//    printf(" South Detect = %d\r\n", Hall_Return[0]);
+//    printf(" North Detect = %d\r\n", Hall_Return[1]);
+
+    
+}
+#endif
+
+#ifdef AccelStream
+// accel stream consumer: sums for the per-axis RMS and the peak magnitude
+void AccumulateVibration (const AccelBlock& block, void* arg)
+{
+    VibrationStats* v = (VibrationStats*) arg;
+
+    if (block.gap)
+        v->gaps++;
+    for (int n = 0; n < block.count; n++) {
+        float mag_sq = 0;
+        for (int i = 0; i < 3; i++) {
+            float g = (float) block.xyz[n][i] / KX022_COUNTS_PER_G;
+            v->sum[i] += g;
+            v->sum_sq[i] += g * g;
+            mag_sq += g * g;
+        }
+        if (mag_sq > v->peak_g * v->peak_g)
+            v->peak_g = sqrtf(mag_sq);
+    }
+    v->samples += block.count;
+}
+#endif
+
+#ifdef MotionBuffer
+// motion buffer consumer: smallest and largest magnetic field strength
+void TrackFieldRange (const MotionBlock& block, void* arg)
+{
+    FieldRange* r = (FieldRange*) arg;
+
+    for (int n = 0; n < block.count; n++) {
+        float sq = 0;
+        for (int i = 3; i < 6; i++) {
+            float ut = block.axes[n][i] / KMX62_MAG_COUNTS_PER_UT;
+            sq += ut * ut;
+        }
+        float ut = sqrtf(sq);
+        if (r->samples == 0 || ut < r->min_ut)
+            r->min_ut = ut;
+        if (r->samples == 0 || ut > r->max_ut)
+            r->max_ut = ut;
+        r->samples++;
+    }
+}
+#endif
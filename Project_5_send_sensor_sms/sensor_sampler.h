@@ -0,0 +1,41 @@
+/****************************************************************************************************
+ * sensor_sampler.h
+ *
+ * Sampling side of Project_5: the shield sensors, their scheduler jobs and the sample records they
+ * fill.
+ *
+ * Every analog, GPIO and I2C sensor is read by its own scheduler job at its own rate; the I2C reads
+ * of a scheduler pass run through the I2C queue, and the KX022/KMX62 sample buffers stream into
+ * their consumers.  main.cpp keeps the loop and the network side, so this file and the modules it
+ * uses build unchanged on the host against the simulated HAL in Host_sim.
+ ****************************************************************************************************/
+#ifndef SENSOR_SAMPLER_H
+#define SENSOR_SAMPLER_H
+
+#include "sensor_sample.h"
+#include "event_scheduler.h"
+
+//Macros for checking each of the different Sensor Devices
+#define AnalogTemp  //BDE0600
+#define AnalogUV    //ML8511
+#define HallSensor  //BU52011
+// the I2C sensors (RPR0521, KMX62, BH1745, KX022, BM1383) are chosen in the ShieldSensors list
+//#define BlockingI2C //read the I2C sensors with blocking calls (to compare the bus cycle time)
+#define MotionBuffer //drain the KMX62 sample buffer in bursts (kmx62_buffer.h) into the magnetic field range
+#define AccelStream //stream the KX022 sample buffer (kx022_stream.h) into the vibration statistics
+
+// init the I2C chips
+void sampler_init();
+
+// add the sensor jobs to the scheduler and start the sample buffer streams
+void sampler_start(EventScheduler& scheduler);
+
+// call after every scheduler.runDue(): runs the queued bus work, then fills sample and returns
+// true when any sensor was read in this pass
+bool sampler_collect(SensorSample& sample);
+
+// newest values and bus/stream statistics to the debug port, interval_ms is the time since the
+// last call
+void sampler_print(uint32_t interval_ms);
+
+#endif
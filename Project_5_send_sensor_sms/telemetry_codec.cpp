@@ -0,0 +1,231 @@
+#include "telemetry_codec.h"
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#define SAMPLE_FIELD(member)            offsetof(SensorSample, member)
+#define SAMPLE_ELEMENT(member, index)   (offsetof(SensorSample, member) + (index) * 4)
+
+// Schema v1.  Scales follow the conversions in main.cpp so the raw register value is kept (raw = 1):
+// KMX62 accel raw/8192 g, KMX62 mag raw/4096*0.146 uT, KX022 raw/16384 g, BM1383 temp raw/32 C,
+// BM1383 pressure 11.11 fixed point hPa.
+const TelemetryChannel telemetry_schema[TELEMETRY_CHANNELS] = {
+    { "temp_c",         TELEMETRY_I16,  FIELD_FLOAT,    0,  SAMPLE_FIELD(temp_c),               SAMPLE_TEMP,      100.0f },
+    { "uv",             TELEMETRY_I16,  FIELD_FLOAT,    0,  SAMPLE_FIELD(uv),                   SAMPLE_UV,        100.0f },
+    { "amb_light",      TELEMETRY_F32,  FIELD_FLOAT,    0,  SAMPLE_FIELD(ambient_light),        SAMPLE_LIGHT,     1.0f },
+    { "prox",           TELEMETRY_U16,  FIELD_FLOAT,    1,  SAMPLE_FIELD(proximity),            SAMPLE_LIGHT,     1.0f },
+    { "hall_south",     TELEMETRY_U8,   FIELD_INT32,    1,  SAMPLE_ELEMENT(hall, 0),            SAMPLE_HALL,      1.0f },
+    { "hall_north",     TELEMETRY_U8,   FIELD_INT32,    1,  SAMPLE_ELEMENT(hall, 1),            SAMPLE_HALL,      1.0f },
+    { "red",            TELEMETRY_U16,  FIELD_INT32,    1,  SAMPLE_ELEMENT(color, 0),           SAMPLE_COLOR,     1.0f },
+    { "green",          TELEMETRY_U16,  FIELD_INT32,    1,  SAMPLE_ELEMENT(color, 1),           SAMPLE_COLOR,     1.0f },
+    { "blue",           TELEMETRY_U16,  FIELD_INT32,    1,  SAMPLE_ELEMENT(color, 2),           SAMPLE_COLOR,     1.0f },
+    { "accel_x",        TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(mems_accel, 0),      SAMPLE_KMX62,     8192.0f },
+    { "accel_y",        TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(mems_accel, 1),      SAMPLE_KMX62,     8192.0f },
+    { "accel_z",        TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(mems_accel, 2),      SAMPLE_KMX62,     8192.0f },
+    { "mag_x",          TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(mems_mag, 0),        SAMPLE_KMX62,     4096.0f / 0.146f },
+    { "mag_y",          TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(mems_mag, 1),        SAMPLE_KMX62,     4096.0f / 0.146f },
+    { "mag_z",          TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(mems_mag, 2),        SAMPLE_KMX62,     4096.0f / 0.146f },
+    { "kx022_x",        TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(kx022_accel, 0),     SAMPLE_KX022,     16384.0f },
+    { "kx022_y",        TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(kx022_accel, 1),     SAMPLE_KX022,     16384.0f },
+    { "kx022_z",        TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_ELEMENT(kx022_accel, 2),     SAMPLE_KX022,     16384.0f },
+    { "bm1383_temp",    TELEMETRY_I16,  FIELD_FLOAT,    1,  SAMPLE_FIELD(bm1383_temp),          SAMPLE_PRESSURE,  32.0f },
+    { "pressure_hpa",   TELEMETRY_U32,  FIELD_FLOAT,    1,  SAMPLE_FIELD(pressure_hpa),         SAMPLE_PRESSURE,  2048.0f },
+};
+
+static const int encoding_size[] = { 1, 2, 2, 4, 4 };
+
+static void put_u16(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_u16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// fixed-point value clamped to the range of the encoding
+static int32_t quantize(float value, float scale, int32_t min, int32_t max)
+{
+    float scaled = floorf(value * scale + 0.5f);
+    if (scaled < (float) min)
+        return min;
+    if (scaled > (float) max)
+        return max;
+    return (int32_t) scaled;
+}
+
+int telemetry_encode(const SensorSample& sample, uint8_t* buf, int buf_len)
+{
+    const uint8_t* base = (const uint8_t*) &sample;
+    uint32_t mask = 0;
+    int len = TELEMETRY_HEADER_SIZE;
+
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        if (sample.flags & telemetry_schema[i].group) {
+            mask |= 1UL << i;
+            len += encoding_size[telemetry_schema[i].encoding];
+        }
+    }
+    if (len > buf_len)
+        return -1;
+
+    buf[0] = TELEMETRY_VERSION;
+    put_u16(buf + 1, sample.flags);
+    put_u32(buf + 3, mask);
+    put_u32(buf + 7, sample.timestamp);
+    put_u16(buf + 11, sample.millis);
+
+    uint8_t* p = buf + TELEMETRY_HEADER_SIZE;
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        const TelemetryChannel& ch = telemetry_schema[i];
+        if (! (mask & (1UL << i)))
+            continue;
+
+        float value;
+        if (ch.field == FIELD_FLOAT) {
+            memcpy(&value, base + ch.offset, sizeof(value));
+        } else {
+            int32_t v;
+            memcpy(&v, base + ch.offset, sizeof(v));
+            value = (float) v;
+        }
+
+        switch (ch.encoding) {
+            case TELEMETRY_U8:
+                *p = quantize(value, ch.scale, 0, 0xFF);
+                break;
+            case TELEMETRY_U16:
+                put_u16(p, quantize(value, ch.scale, 0, 0xFFFF));
+                break;
+            case TELEMETRY_I16:
+                put_u16(p, quantize(value, ch.scale, -32768, 32767));
+                break;
+            case TELEMETRY_U32:
+                put_u32(p, quantize(value, ch.scale, 0, 0x7FFFFFFF));
+                break;
+            case TELEMETRY_F32: {
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                put_u32(p, bits);
+                break;
+            }
+        }
+        p += encoding_size[ch.encoding];
+    }
+    return len;
+}
+
+int telemetry_decode(const uint8_t* buf, int len, SensorSample& sample)
+{
+    uint8_t* base = (uint8_t*) &sample;
+
+    if (len < TELEMETRY_HEADER_SIZE || buf[0] != TELEMETRY_VERSION)
+        return -1;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.flags = get_u16(buf + 1);
+    uint32_t mask = get_u32(buf + 3);
+    sample.timestamp = get_u32(buf + 7);
+    sample.millis = get_u16(buf + 11);
+    if (mask >> TELEMETRY_CHANNELS)
+        return -1;                      // channels this decoder does not know about
+
+    const uint8_t* p = buf + TELEMETRY_HEADER_SIZE;
+    const uint8_t* end = buf + len;
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        const TelemetryChannel& ch = telemetry_schema[i];
+        if (! (mask & (1UL << i)))
+            continue;
+        if (p + encoding_size[ch.encoding] > end)
+            return -1;
+
+        float value = 0;
+        switch (ch.encoding) {
+            case TELEMETRY_U8:
+                value = *p / ch.scale;
+                break;
+            case TELEMETRY_U16:
+                value = get_u16(p) / ch.scale;
+                break;
+            case TELEMETRY_I16:
+                value = (int16_t) get_u16(p) / ch.scale;
+                break;
+            case TELEMETRY_U32:
+                value = get_u32(p) / ch.scale;
+                break;
+            case TELEMETRY_F32: {
+                uint32_t bits = get_u32(p);
+                memcpy(&value, &bits, sizeof(value));
+                break;
+            }
+        }
+        p += encoding_size[ch.encoding];
+
+        if (ch.field == FIELD_FLOAT) {
+            memcpy(base + ch.offset, &value, sizeof(value));
+        } else {
+            int32_t v = (int32_t) value;
+            memcpy(base + ch.offset, &v, sizeof(v));
+        }
+    }
+    return p - buf;
+}
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int telemetry_base64_encode(const uint8_t* data, int len, char* out, int out_len)
+{
+    int n = 0;
+    if ((len + 2) / 3 * 4 + 1 > out_len)
+        return -1;
+    for (int i = 0; i < len; i += 3) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < len)
+            v |= data[i + 1] << 8;
+        if (i + 2 < len)
+            v |= data[i + 2];
+        out[n++] = base64_chars[(v >> 18) & 0x3F];
+        out[n++] = base64_chars[(v >> 12) & 0x3F];
+        out[n++] = i + 1 < len ? base64_chars[(v >> 6) & 0x3F] : '=';
+        out[n++] = i + 2 < len ? base64_chars[v & 0x3F] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+int telemetry_base64_decode(const char* text, int len, uint8_t* out, int out_len)
+{
+    uint32_t v = 0;
+    int bits = 0;
+    int n = 0;
+
+    for (int i = 0; i < len && text[i] != '='; i++) {
+        const char* c = strchr(base64_chars, text[i]);
+        if (! c || ! text[i])
+            continue;                   // skip line breaks and other noise
+        v = (v << 6) | (c - base64_chars);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n == out_len)
+                return -1;
+            out[n++] = v >> bits;
+        }
+    }
+    return n;
+}
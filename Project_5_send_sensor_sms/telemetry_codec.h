@@ -0,0 +1,72 @@
+/****************************************************************************************************
+ * telemetry_codec.h
+ *
+ * Compact binary encoding of a SensorSample ("telemetry frame"), used instead of MbedJSONValue
+ * text on the upload and SMS paths.
+ *
+ * Frame layout, all fields little endian:
+ *
+ *      u8      version         TELEMETRY_VERSION
+ *      u16     flags           SensorSample::flags
+ *      u32     channel mask    bit i set = channel i of telemetry_schema follows
+ *      u32     timestamp       seconds since 1970
+ *      u16     millis
+ *      ...     channel values in schema order, each in its schema encoding
+ *
+ * A channel is present when its sensor was read for the sample (see SensorSample::flags),
+ * so frames are self-delimiting and batches are plain concatenations of frames.  Values are
+ * stored as fixed-point integers; most scales are the sensor's own LSB so the raw register value
+ * survives the round trip.  New channels may only be appended to the schema, together with a
+ * TELEMETRY_VERSION bump.
+ *
+ * Encoding and decoding work on caller-provided buffers and never allocate.  This file has no
+ * mbed dependencies, the host decoder (Host_tools/telemetry_decode.cpp) builds it unchanged.
+ ****************************************************************************************************/
+#ifndef TELEMETRY_CODEC_H
+#define TELEMETRY_CODEC_H
+
+#include <stdint.h>
+#include "sensor_sample.h"
+
+#define TELEMETRY_VERSION       1
+#define TELEMETRY_HEADER_SIZE   13
+#define TELEMETRY_CHANNELS      20
+#define TELEMETRY_MAX_FRAME     (TELEMETRY_HEADER_SIZE + 42)
+
+enum TelemetryEncoding {
+    TELEMETRY_U8,
+    TELEMETRY_U16,
+    TELEMETRY_I16,
+    TELEMETRY_U32,
+    TELEMETRY_F32
+};
+
+enum TelemetryField {
+    FIELD_FLOAT,                // SensorSample member is a float
+    FIELD_INT32                 // SensorSample member is an int32_t
+};
+
+struct TelemetryChannel {
+    const char* name;
+    uint8_t     encoding;       // TelemetryEncoding
+    uint8_t     field;          // TelemetryField
+    uint8_t     raw;            // 1 if value * scale is the sensor's raw register value
+    uint16_t    offset;         // offset of the value in SensorSample
+    uint16_t    group;          // SAMPLE_* bit of the sensor the channel comes from
+    float       scale;          // encoded = value * scale (ignored for TELEMETRY_F32)
+};
+
+extern const TelemetryChannel telemetry_schema[TELEMETRY_CHANNELS];
+
+// encode sample into buf, returns the frame size or -1 if buf is too small
+int telemetry_encode(const SensorSample& sample, uint8_t* buf, int buf_len);
+
+// decode one frame from buf, returns the number of bytes consumed or -1 on a bad frame.
+// Channels not present in the frame are left at 0.
+int telemetry_decode(const uint8_t* buf, int len, SensorSample& sample);
+
+// base64 for carrying frames in SMS text, both return the output length or -1 if out is too small
+int telemetry_base64_encode(const uint8_t* data, int len, char* out, int out_len);
+int telemetry_base64_decode(const char* text, int len, uint8_t* out, int out_len);
+
+#endif
@@ -0,0 +1,413 @@
+#include "ts_compress.h"
+#include <string.h>
+#include <math.h>
+
+// first timestamp of a block is stored in full: 48 bits of milliseconds since 1970
+static const int first_ms_bits = 48;
+static const uint8_t no_window = 0xFF;
+
+static uint32_t zigzag32(int32_t v)
+{
+    return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static int32_t unzigzag32(uint32_t v)
+{
+    return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+static uint64_t zigzag64(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag64(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static int leading_zeros(uint32_t v)
+{
+    int n = 0;
+    while (n < 32 && ! (v & 0x80000000UL)) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+}
+
+static int trailing_zeros(uint32_t v)
+{
+    int n = 0;
+    while (n < 32 && ! (v & 1)) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static uint64_t sample_ms(const SensorSample& sample)
+{
+    return (uint64_t) sample.timestamp * 1000 + sample.millis;
+}
+
+// raw register value of a raw == 1 channel
+static int32_t channel_raw(const TelemetryChannel& ch, const uint8_t* base)
+{
+    if (ch.field == FIELD_INT32) {
+        int32_t v;
+        memcpy(&v, base + ch.offset, sizeof(v));
+        return v;
+    }
+    float value;
+    memcpy(&value, base + ch.offset, sizeof(value));
+    float scaled = floorf(value * ch.scale + 0.5f);
+    if (scaled < -1073741824.0f)
+        return -1073741824;
+    if (scaled > 1073741824.0f)
+        return 1073741824;
+    return (int32_t) scaled;
+}
+
+static void reset_state(TscChannelState* state)
+{
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        state[i].last_raw = 0;
+        state[i].last_bits = 0;
+        state[i].lead = no_window;
+        state[i].trail = 0;
+    }
+}
+
+/****************************************************************************************************
+// TsCompressor
+ ****************************************************************************************************/
+TsCompressor::TsCompressor() : buf(NULL), len(0), bit_pos(0), samples(0)
+{
+}
+
+void TsCompressor::begin(uint8_t* buf, int len)
+{
+    this->buf = buf;
+    this->len = len;
+    bit_pos = TSC_HEADER_SIZE * 8;
+    samples = 0;
+    last_ms = 0;
+    last_delta = 0;
+    last_flags = 0;
+    reset_state(state);
+}
+
+// MSB first; every write clears the rest of its byte so a rolled back sample leaves no stray bits
+bool TsCompressor::putBits(uint64_t value, int bits)
+{
+    if (bit_pos + bits > (uint32_t) len * 8)
+        return false;
+    while (bits > 0) {
+        int offset = bit_pos & 7;
+        int n = 8 - offset < bits ? 8 - offset : bits;
+        uint8_t chunk = (value >> (bits - n)) & ((1 << n) - 1);
+        uint8_t& b = buf[bit_pos >> 3];
+        b = (b & ~(0xFF >> offset)) | (chunk << (8 - offset - n));
+        bit_pos += n;
+        bits -= n;
+    }
+    return true;
+}
+
+bool TsCompressor::putVarint(uint32_t value)
+{
+    do {
+        uint32_t group = value & 0x7F;
+        value >>= 7;
+        if (! putBits((group << 1) | (value ? 1 : 0), 8))
+            return false;
+    } while (value);
+    return true;
+}
+
+bool TsCompressor::encode(const SensorSample& sample)
+{
+    const uint8_t* base = (const uint8_t*) &sample;
+    uint64_t ms = sample_ms(sample);
+
+    // timestamp
+    if (samples == 0) {
+        if (! putBits(ms, first_ms_bits))
+            return false;
+    } else {
+        int64_t delta = (int64_t) (ms - last_ms);
+        uint64_t dod = zigzag64(delta - last_delta);
+        bool ok;
+        if (dod == 0)
+            ok = putBits(0, 1);
+        else if (dod < (1 << 7))
+            ok = putBits(0x2, 2) && putBits(dod, 7);
+        else if (dod < (1 << 9))
+            ok = putBits(0x6, 3) && putBits(dod, 9);
+        else if (dod < (1 << 12))
+            ok = putBits(0xE, 4) && putBits(dod, 12);
+        else
+            ok = putBits(0xF, 4) && putBits(dod, 64);
+        if (! ok)
+            return false;
+        last_delta = delta;
+    }
+    last_ms = ms;
+
+    // flags
+    if (samples > 0 && sample.flags == last_flags) {
+        if (! putBits(0, 1))
+            return false;
+    } else if (! putBits(1, 1) || ! putBits(sample.flags, 16)) {
+        return false;
+    }
+    last_flags = sample.flags;
+
+    // channels of the groups read for this sample
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        const TelemetryChannel& ch = telemetry_schema[i];
+        TscChannelState& st = state[i];
+        if (! (sample.flags & ch.group))
+            continue;
+
+        if (ch.raw) {
+            int32_t raw = channel_raw(ch, base);
+            uint32_t delta = (uint32_t) raw - (uint32_t) st.last_raw;
+            st.last_raw = raw;
+            if (delta == 0) {
+                if (! putBits(0, 1))
+                    return false;
+            } else if (! putBits(1, 1) || ! putVarint(zigzag32((int32_t) delta))) {
+                return false;
+            }
+            continue;
+        }
+
+        uint32_t bits;
+        memcpy(&bits, base + ch.offset, sizeof(bits));
+        uint32_t x = bits ^ st.last_bits;
+        st.last_bits = bits;
+        if (x == 0) {
+            if (! putBits(0, 1))
+                return false;
+            continue;
+        }
+        int lead = leading_zeros(x);
+        int trail = trailing_zeros(x);
+        if (st.lead != no_window && lead >= st.lead && trail >= st.trail) {
+            if (! putBits(0x2, 2) || ! putBits(x >> st.trail, 32 - st.lead - st.trail))
+                return false;
+        } else {
+            int n = 32 - lead - trail;
+            if (! putBits(0x3, 2) || ! putBits(lead, 5) || ! putBits(n - 1, 5) || ! putBits(x >> trail, n))
+                return false;
+            st.lead = lead;
+            st.trail = trail;
+        }
+    }
+    return true;
+}
+
+bool TsCompressor::add(const SensorSample& sample)
+{
+    if (! buf || samples == 0xFFFF)
+        return false;
+
+    // encode() updates the predictors as it goes, keep them for a roll back
+    uint32_t saved_pos = bit_pos;
+    uint64_t saved_ms = last_ms;
+    int64_t saved_delta = last_delta;
+    uint16_t saved_flags = last_flags;
+    TscChannelState saved_state[TELEMETRY_CHANNELS];
+    memcpy(saved_state, state, sizeof(state));
+
+    if (! encode(sample)) {
+        bit_pos = saved_pos;
+        last_ms = saved_ms;
+        last_delta = saved_delta;
+        last_flags = saved_flags;
+        memcpy(state, saved_state, sizeof(state));
+        return false;
+    }
+    samples++;
+    return true;
+}
+
+int TsCompressor::finish()
+{
+    if (! buf || len < TSC_HEADER_SIZE)
+        return 0;
+    buf[0] = TSC_MAGIC;
+    buf[1] = TSC_VERSION;
+    buf[2] = samples;
+    buf[3] = samples >> 8;
+    return (bit_pos + 7) / 8;
+}
+
+int TsCompressor::count()
+{
+    return samples;
+}
+
+/****************************************************************************************************
+// TsDecompressor
+ ****************************************************************************************************/
+TsDecompressor::TsDecompressor() : buf(NULL), len(0), bit_pos(0), samples(0), decoded(0)
+{
+}
+
+bool TsDecompressor::begin(const uint8_t* buf, int len)
+{
+    this->buf = buf;
+    this->len = len;
+    bit_pos = TSC_HEADER_SIZE * 8;
+    decoded = 0;
+    samples = 0;
+    last_ms = 0;
+    last_delta = 0;
+    last_flags = 0;
+    reset_state(state);
+
+    if (len < TSC_HEADER_SIZE || buf[0] != TSC_MAGIC || buf[1] != TSC_VERSION)
+        return false;
+    samples = buf[2] | (buf[3] << 8);
+    return true;
+}
+
+bool TsDecompressor::getBits(int bits, uint64_t& value)
+{
+    if (bit_pos + bits > (uint32_t) len * 8)
+        return false;
+    value = 0;
+    while (bits > 0) {
+        int offset = bit_pos & 7;
+        int n = 8 - offset < bits ? 8 - offset : bits;
+        uint8_t chunk = (buf[bit_pos >> 3] >> (8 - offset - n)) & ((1 << n) - 1);
+        value = (value << n) | chunk;
+        bit_pos += n;
+        bits -= n;
+    }
+    return true;
+}
+
+bool TsDecompressor::getVarint(uint32_t& value)
+{
+    uint64_t group;
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (! getBits(8, group))
+            return false;
+        value |= (uint32_t) (group >> 1) << shift;
+        if (! (group & 1))
+            return true;
+    }
+    return false;                   // more than 5 groups: corrupt
+}
+
+bool TsDecompressor::next(SensorSample& sample)
+{
+    uint8_t* base = (uint8_t*) &sample;
+    uint64_t v;
+
+    if (decoded >= samples)
+        return false;
+    memset(&sample, 0, sizeof(sample));
+
+    // timestamp
+    uint64_t ms;
+    if (decoded == 0) {
+        if (! getBits(first_ms_bits, ms))
+            return false;
+    } else {
+        int prefix = 0;
+        while (prefix < 4) {
+            if (! getBits(1, v))
+                return false;
+            if (! v)
+                break;
+            prefix++;
+        }
+        static const int dod_bits[] = { 0, 7, 9, 12, 64 };
+        uint64_t dod = 0;
+        if (prefix && ! getBits(dod_bits[prefix], dod))
+            return false;
+        last_delta += unzigzag64(dod);
+        ms = last_ms + last_delta;
+    }
+    last_ms = ms;
+    sample.timestamp = ms / 1000;
+    sample.millis = ms % 1000;
+
+    // flags
+    if (! getBits(1, v))
+        return false;
+    if (v || decoded == 0) {
+        if (! getBits(16, v))
+            return false;
+        last_flags = v;
+    }
+    sample.flags = last_flags;
+
+    for (int i = 0; i < TELEMETRY_CHANNELS; i++) {
+        const TelemetryChannel& ch = telemetry_schema[i];
+        TscChannelState& st = state[i];
+        if (! (sample.flags & ch.group))
+            continue;
+
+        if (ch.raw) {
+            if (! getBits(1, v))
+                return false;
+            if (v) {
+                uint32_t zz;
+                if (! getVarint(zz))
+                    return false;
+                st.last_raw = (int32_t) ((uint32_t) st.last_raw + (uint32_t) unzigzag32(zz));
+            }
+            if (ch.field == FIELD_INT32) {
+                memcpy(base + ch.offset, &st.last_raw, sizeof(st.last_raw));
+            } else {
+                float value = st.last_raw / ch.scale;
+                memcpy(base + ch.offset, &value, sizeof(value));
+            }
+            continue;
+        }
+
+        if (! getBits(1, v))
+            return false;
+        if (v) {
+            uint64_t control, lead, n, bits;
+            if (! getBits(1, control))
+                return false;
+            if (! control) {
+                if (st.lead == no_window)
+                    return false;
+                n = 32 - st.lead - st.trail;
+            } else {
+                if (! getBits(5, lead) || ! getBits(5, n))
+                    return false;
+                n++;
+                if (lead + n > 32)
+                    return false;
+                st.lead = lead;
+                st.trail = 32 - lead - n;
+            }
+            if (! getBits(n, bits))
+                return false;
+            st.last_bits ^= (uint32_t) bits << st.trail;
+        }
+        memcpy(base + ch.offset, &st.last_bits, sizeof(st.last_bits));
+    }
+    decoded++;
+    return true;
+}
+
+int TsDecompressor::remaining()
+{
+    return samples - decoded;
+}
+
+int TsDecompressor::blockSize()
+{
+    return (bit_pos + 7) / 8;
+}
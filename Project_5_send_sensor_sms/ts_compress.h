@@ -0,0 +1,107 @@
+/****************************************************************************************************
+ * ts_compress.h
+ *
+ * Streaming compressor for batches of SensorSample records ("TSC block").
+ *
+ * Successive samples of the slowly changing shield channels differ very little, so a batch is
+ * stored as a bit stream of differences instead of independent telemetry frames:
+ *
+ *   - timestamps (ms): delta-of-delta, '0' for an unchanged sampling interval, otherwise a
+ *     prefix-coded zigzag value ('10' + 7 bits, '110' + 9 bits, '1110' + 12 bits, '1111' + 64 bits)
+ *   - flags: '0' unchanged, '1' + 16 bits
+ *   - raw register channels (telemetry_schema[i].raw): delta of the raw value, '0' when unchanged,
+ *     otherwise '1' + zigzag varint (7 bit groups, each followed by a continue bit)
+ *   - converted float channels (temperature, UV, lux): Gorilla-style XOR with the previous value,
+ *     '0' when unchanged, '10' + bits inside the previous leading/trailing zero window, or
+ *     '11' + 5 bits leading zeros + 5 bits (length - 1) + the meaningful bits
+ *
+ * Only channels of the sensor groups read for a sample are coded, like telemetry frames.
+ * Block layout: u8 TSC_MAGIC, u8 TSC_VERSION, u16 sample count (little endian), bit stream.
+ * Float channels are lossless; raw channels decode to raw / scale, the same as telemetry_decode().
+ * The first sample of a block is coded against zero and may take more room than its frame, the
+ * savings come from the following ones (see Host_tools/ts_compress_bench.cpp).
+ * Everything works in caller-provided buffers; no mbed dependencies.
+ ****************************************************************************************************/
+#ifndef TS_COMPRESS_H
+#define TS_COMPRESS_H
+
+#include <stdint.h>
+#include "sensor_sample.h"
+#include "telemetry_codec.h"
+
+#define TSC_MAGIC           0xC5
+#define TSC_VERSION         1
+#define TSC_HEADER_SIZE     4
+
+// per-channel predictor state shared by both directions
+struct TscChannelState {
+    int32_t     last_raw;           // raw channels
+    uint32_t    last_bits;          // float channels
+    uint8_t     lead;               // current XOR window
+    uint8_t     trail;
+};
+
+class TsCompressor
+{
+public:
+    TsCompressor();
+
+    // start a new block in buf
+    void begin(uint8_t* buf, int len);
+
+    // append a sample, returns false (and leaves the block unchanged) when it does not fit
+    bool add(const SensorSample& sample);
+
+    // finish the block, returns its size in bytes
+    int finish();
+
+    int count();
+
+private:
+    bool putBits(uint64_t value, int bits);
+    bool putVarint(uint32_t value);
+    bool encode(const SensorSample& sample);
+
+    uint8_t*        buf;
+    int             len;
+    uint32_t        bit_pos;
+    int             samples;
+    uint64_t        last_ms;
+    int64_t         last_delta;
+    uint16_t        last_flags;
+    TscChannelState state[TELEMETRY_CHANNELS];
+};
+
+class TsDecompressor
+{
+public:
+    TsDecompressor();
+
+    // returns false if buf does not start with a TSC block header
+    bool begin(const uint8_t* buf, int len);
+
+    // decode the next sample, returns false at the end of the block or on corrupt data
+    bool next(SensorSample& sample);
+
+    // samples not yet decoded
+    int remaining();
+
+    // size of the block in bytes, valid once all samples were decoded
+    int blockSize();
+
+private:
+    bool getBits(int bits, uint64_t& value);
+    bool getVarint(uint32_t& value);
+
+    const uint8_t*  buf;
+    int             len;
+    uint32_t        bit_pos;
+    int             samples;
+    int             decoded;
+    uint64_t        last_ms;
+    int64_t         last_delta;
+    uint16_t        last_flags;
+    TscChannelState state[TELEMETRY_CHANNELS];
+};
+
+#endif